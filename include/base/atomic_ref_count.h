@@ -0,0 +1,74 @@
+// Copyright (c) 2011 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// This is a low level implementation of atomic semantics for reference
+// counting.
+
+#ifndef BASE_ATOMIC_REF_COUNT_H_
+#define BASE_ATOMIC_REF_COUNT_H_
+
+#include "base/build_config.h"
+
+#if defined(OS_WIN)
+#include <windows.h>
+#endif
+
+namespace base {
+
+#if defined(OS_WIN)
+typedef volatile LONG AtomicRefCount;
+#else
+typedef volatile int AtomicRefCount;
+#endif
+
+// Increment a reference count by "increment", which must exceed 0.
+inline void AtomicRefCountIncN(AtomicRefCount* ptr, int increment) {
+#if defined(OS_WIN)
+  InterlockedExchangeAdd(ptr, increment);
+#else
+  __sync_fetch_and_add(ptr, increment);
+#endif
+}
+
+// Decrement a reference count by "decrement", which must exceed 0,
+// and return whether the result is non-zero.
+// Insert barriers to ensure that state written before the reference count
+// became zero will be visible to a thread that has just made the count zero.
+inline bool AtomicRefCountDecN(AtomicRefCount* ptr, int decrement) {
+#if defined(OS_WIN)
+  return InterlockedExchangeAdd(ptr, -decrement) != decrement;
+#else
+  return __sync_sub_and_fetch(ptr, decrement) != 0;
+#endif
+}
+
+// Increment a reference count by 1.
+inline void AtomicRefCountInc(AtomicRefCount* ptr) {
+  AtomicRefCountIncN(ptr, 1);
+}
+
+// Decrement a reference count by 1 and return whether the result is non-zero.
+// Insert barriers to ensure that state written before the reference count
+// became zero will be visible to a thread that has just made the count zero.
+inline bool AtomicRefCountDec(AtomicRefCount* ptr) {
+  return AtomicRefCountDecN(ptr, 1);
+}
+
+// Return whether the reference count is one.  If the reference count is used
+// in the conventional way, a reference count of 1 implies that the current
+// thread owns the reference and no other thread shares it.  This call performs
+// the test for a reference count of one, and performs the memory barrier
+// needed for the owning thread to act on the object, knowing that it has
+// exclusive access to the object.
+inline bool AtomicRefCountIsOne(AtomicRefCount* ptr) {
+#if defined(OS_WIN)
+  return InterlockedCompareExchange(ptr, 1, 1) == 1;
+#else
+  return __sync_val_compare_and_swap(ptr, 1, 1) == 1;
+#endif
+}
+
+}  // namespace base
+
+#endif  // BASE_ATOMIC_REF_COUNT_H_
@@ -0,0 +1,28 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef BASE_CRC32C_H_
+#define BASE_CRC32C_H_
+
+#include "base/base_export.h"
+#include "base/basictypes.h"
+
+namespace base {
+
+// Returns the CRC32C (Castagnoli polynomial, as used by iSCSI and SCTP) of
+// |length| bytes at |data|, continuing from |crc|, the CRC32C of the data
+// that precedes them, or 0 to start afresh.
+//
+// On x86-64 CPUs with SSE4.2 this uses the crc32 instruction on three
+// interleaved streams and runs at several bytes per cycle; elsewhere it
+// falls back to slicing-by-8 tables.
+BASE_EXPORT uint32 Crc32c(uint32 crc, const void* data, size_t length);
+
+// Exposed for testing: the portable implementation, whatever the CPU.
+BASE_EXPORT uint32 Crc32cPortable(uint32 crc, const void* data,
+                                  size_t length);
+
+}  // namespace base
+
+#endif  // BASE_CRC32C_H_
@@ -0,0 +1,38 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef BASE_LZ_CODEC_H_
+#define BASE_LZ_CODEC_H_
+
+#include "base/base_export.h"
+#include "base/basictypes.h"
+
+namespace base {
+
+// A fast LZ77 compressor for in-memory blocks, writing the LZ4 block format:
+// greedy matching through a hash of 4-byte sequences within a 64 KB window.
+// It trades ratio for speed, which suits repetitive structured data such as
+// serialized messages.  Blocks carry no framing; the caller records the
+// original size and passes it to LzDecompress().
+
+// The largest output LzCompress() can produce for |length| bytes of input.
+BASE_EXPORT size_t LzCompressBound(size_t length);
+
+// Compresses |length| bytes at |data| into |output|, which has room for
+// |capacity| bytes, and returns the compressed size.  Returns 0 if the
+// result does not fit, so passing a |capacity| below |length| asks for
+// compression only if it saves space.
+BASE_EXPORT size_t LzCompress(const char* data, size_t length,
+                              char* output, size_t capacity);
+
+// Decompresses the block of |length| bytes at |data| into |output|, which
+// must be exactly the |output_length| bytes the block expands to.  Returns
+// false if the block is malformed or its size does not match; the input is
+// never trusted, so no read or write goes out of bounds either way.
+BASE_EXPORT bool LzDecompress(const char* data, size_t length,
+                              char* output, size_t output_length);
+
+}  // namespace base
+
+#endif  // BASE_LZ_CODEC_H_
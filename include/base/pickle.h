@@ -6,10 +6,16 @@
 #define BASE_PICKLE_H__
 
 #include <string>
+#include <vector>
 #include <assert.h>
 #include "base/base_export.h"
 #include "base/basictypes.h"
 #include "base/compiler_specific.h"
+#include "base/pickle_allocator.h"
+#include "base/string_piece.h"
+#if defined(OS_POSIX)
+#include <sys/uio.h>
+#endif
 //#include "base/gtest_prod_util.h"
 //#include "base/logging.h"
 //#include "base/strings/string16.h"
@@ -20,7 +26,14 @@ class Pickle;
 // while the PickleIterator object is in use.
 class BASE_EXPORT PickleIterator {
  public:
-  PickleIterator() : payload_(NULL), read_index_(0), end_index_(0) {}
+  PickleIterator()
+      : payload_(NULL),
+        read_index_(0),
+        end_index_(0),
+        compact_(false),
+        bool_byte_(NULL),
+        bool_bits_(0),
+        checked_(true) {}
   explicit PickleIterator(const Pickle& pickle);
 
   // Methods for reading the payload of the Pickle. To read from the start of
@@ -40,6 +53,11 @@ class BASE_EXPORT PickleIterator {
   bool ReadString(std::string* result) WARN_UNUSED_RESULT;
   bool ReadWString(std::wstring* result) WARN_UNUSED_RESULT;
   //bool ReadString16(base::string16* result) WARN_UNUSED_RESULT;
+  // Like ReadString(), but |result| points into the Pickle's payload instead
+  // of holding a copy, so it is only valid as long as the Pickle is unchanged.
+  bool ReadStringPiece(base::StringPiece* result) WARN_UNUSED_RESULT;
+  // ReadData() and ReadBytes() do not copy either; the pointer they return
+  // is valid as long as the Pickle is unchanged.
   bool ReadData(const char** data, int* length) WARN_UNUSED_RESULT;
   bool ReadBytes(const char** data, int length) WARN_UNUSED_RESULT;
 
@@ -55,6 +73,15 @@ class BASE_EXPORT PickleIterator {
     return !!GetReadPointerAndAdvance(num_bytes);
   }
 
+  // With |checked| false, reads and skips are no longer checked against the
+  // end of the payload.  This is only for a payload that has already been
+  // walked with the same sequence of reads from the same position, e.g. by
+  // IPC::ValidateParam(); going beyond what was validated reads out of
+  // bounds.  Checks on the values themselves (negative lengths, compact
+  // integers out of range) still apply.
+  void set_checked(bool checked) { checked_ = checked; }
+  bool checked() const { return checked_; }
+
  private:
   // Aligns 'i' by rounding it up to the next multiple of 'alignment'
   static size_t AlignInt(size_t i, int alignment) {
@@ -65,6 +92,11 @@ class BASE_EXPORT PickleIterator {
   template <typename Type>
   bool ReadBuiltinType(Type* result);
 
+  // Compact encoding, see Pickle::set_compact().
+  bool ReadVarint(uint64* result);
+  bool ReadZigZag(int64* result);
+  bool ReadCompactBool(bool* result);
+
   // Advance read_index_ but do not allow it to exceed end_index_.
   // Keeps read_index_ aligned.
   void Advance(size_t size);
@@ -85,6 +117,10 @@ class BASE_EXPORT PickleIterator {
   const char* payload_;  // Start of our pickle's payload.
   size_t read_index_;  // Offset of the next readable byte in payload.
   size_t end_index_;  // Payload size.
+  bool compact_;  // The payload uses the compact encoding.
+  const char* bool_byte_;  // Byte holding the packed booleans being read.
+  int bool_bits_;  // Bits of |*bool_byte_| consumed; 0 or 8 if none left.
+  bool checked_;  // Reads are checked against |end_index_|.
 
   //FRIEND_TEST_ALL_PREFIXES(PickleTest, GetReadPointerAndAdvance);
 };
@@ -106,8 +142,34 @@ class BASE_EXPORT PickleIterator {
 // space is controlled by the header_size parameter passed to the Pickle
 // constructor.
 //
+// A writable Pickle starts out storing its header and payload in a small
+// buffer embedded in the object itself (see kInlineCapacity), and only moves
+// to the heap once a write no longer fits.  Small messages therefore never
+// allocate.
+//
 class BASE_EXPORT Pickle {
  public:
+  // Disposes of an adopted buffer.  |context| is Buffer::deleter_context.
+  typedef void (*BufferDeleter)(void* data, void* context);
+
+  // A heap block holding a complete pickle, header and payload.  It is what
+  // ReleaseBuffer() hands out and what Pickle(const Buffer&) takes over, so
+  // a message can be passed to a transport, or built from one, without
+  // copying.  Whoever holds a Buffer must dispose of it with FreeBuffer()
+  // or by adopting it into a Pickle.
+  struct BASE_EXPORT Buffer {
+    Buffer();
+
+    char* data;
+    size_t size;      // Bytes of header plus payload starting at |data|.
+    size_t capacity;  // Bytes available at |data|; at least |size|.
+    // If |deleter| is set it disposes of |data|.  Otherwise |data| came from
+    // |allocator|, or from malloc() when |allocator| is NULL.
+    PickleAllocator* allocator;
+    BufferDeleter deleter;
+    void* deleter_context;
+  };
+
   // Initialize a Pickle object using the default header size.
   Pickle();
 
@@ -116,15 +178,38 @@ class BASE_EXPORT Pickle {
   // will be rounded up to ensure that the header size is 32bit-aligned.
   explicit Pickle(int header_size);
 
+  // Like Pickle(int), but once the payload outgrows the inline buffer its
+  // storage comes from |allocator|.  A NULL |allocator| selects the default
+  // allocator (see SetDefaultAllocator()).  |allocator| must outlive the
+  // Pickle.
+  Pickle(int header_size, PickleAllocator* allocator);
+
   // Initializes a Pickle from a const block of data.  The data is not copied;
   // instead the data is merely referenced by this Pickle.  Only const methods
   // should be used on the Pickle when initialized this way.  The header
   // padding size is deduced from the data length.
   Pickle(const char* data, int data_len);
 
-  // Initializes a Pickle as a deep copy of another Pickle.
+  // Takes ownership of |buffer|, which must hold a complete pickle; the
+  // header size is deduced as in Pickle(const char*, int).  The Pickle is
+  // fully writable: appends go into the spare capacity of |buffer| and, once
+  // that runs out, into a new heap buffer, at which point |buffer| is
+  // disposed of.  If the data is not a valid pickle, |buffer| is disposed of
+  // right away and the Pickle is invalid, like Pickle(const char*, int)
+  // would be.
+  explicit Pickle(const Buffer& buffer);
+
+  // Initializes a Pickle as a deep copy of another Pickle.  The copy uses the
+  // default allocator rather than |other|'s, since it may well outlive it.
+  // If |other| is shared (see MakeShared()), the payload is not copied; the
+  // copy takes another reference to it instead.
   Pickle(const Pickle& other);
 
+  // Takes over |other|'s buffer without copying the payload, except for
+  // pickles small enough to live in the inline buffer.  |other| is left empty
+  // with its header zeroed.
+  Pickle(Pickle&& other);
+
   // Note: There are no virtual methods in this class.  This destructor is
   // virtual as an element of defensive coding.  Other classes have derived from
   // this class, and there is a *chance* that they will cast into this base
@@ -132,14 +217,105 @@ class BASE_EXPORT Pickle {
   // destructor, suggesting at least some need to call more derived destructors.
   virtual ~Pickle();
 
-  // Performs a deep copy.
+  // Performs a deep copy, or takes a reference if |other| is shared.  This
+  // Pickle keeps its own allocator.
   Pickle& operator=(const Pickle& other);
 
+  // Releases this Pickle's buffer and takes over |other|'s, as the move
+  // constructor does, including |other|'s allocator.
+  Pickle& operator=(Pickle&& other);
+
+  // Exchanges the contents of two Pickles, without copying heap buffers.
+  void Swap(Pickle* other);
+
+  // Hands the header and payload over to the caller, leaving this Pickle
+  // empty.  A Pickle stored inline or referencing const data gives away a
+  // heap copy instead.  Returns an empty Buffer if the Pickle is invalid.
+  Buffer ReleaseBuffer();
+
+  // Disposes of a Buffer obtained from ReleaseBuffer().
+  static void FreeBuffer(const Buffer& buffer);
+
+  // Turns the contents into an immutable, reference counted payload, so that
+  // copies of this Pickle (and of Messages) share it instead of duplicating
+  // the bytes.  The first modification made through any one copy gives that
+  // copy a private buffer again; the others are unaffected.  A heap buffer
+  // is taken over as is, while inline or read-only data is copied once.
+  //
+  // The references may be dropped on any thread.  The buffer goes back to
+  // its allocator on the thread that drops the last one, so a shared Pickle
+  // must not use an allocator bound to a thread or a batch, such as
+  // PickleArena, if it crosses threads.
+  void MakeShared();
+
+  // True if the payload is shared through MakeShared().
+  bool is_shared() const { return shared_ != NULL; }
+
+  // Scatter-gather mode.  Once enabled, WriteData() calls of at least
+  // |threshold| bytes no longer copy the blob into the buffer; they record a
+  // reference to the caller's memory, which must stay valid and unchanged
+  // until the Pickle has been sent, flattened or destroyed.  Smaller fields
+  // are written as usual.  size() and the header always describe the full
+  // serialized pickle.
+  //
+  // Use GetSegments() or GetIOVecs() to send such a Pickle without copying
+  // the blobs.  Anything that needs the bytes in one piece -- data(),
+  // payload(), a PickleIterator, copying, ReleaseBuffer() or MakeShared() --
+  // first copies the referenced blobs into the buffer (see Flatten()).
+  void EnableScatterGather(size_t threshold);
+
+  // Compact encoding.  Integers, lengths and container sizes are written as
+  // LEB128 varints (zigzag encoded for signed types), booleans are packed
+  // eight to a byte, and nothing is padded to 4-byte alignment.  Floats,
+  // doubles and raw bytes are copied as they are.  Must be selected before
+  // anything is written.  The choice is not part of the data, so a reader
+  // has to be told before it creates its PickleIterator; IPC::Message
+  // carries it in its header flags.
+  void set_compact(bool compact);
+  bool compact() const { return compact_; }
+
+  // True if some of the payload still lives in caller-owned memory.
+  bool has_references() const;
+
+  // Copies every referenced blob into the buffer, making the payload
+  // contiguous again.  Scatter-gather mode stays enabled for later writes.
+  void Flatten();
+
+  // A contiguous piece of the serialized pickle.
+  struct Segment {
+    const char* data;
+    size_t size;
+  };
+
+  // Appends the pieces that make up the serialized pickle, header first, to
+  // |segments|.  Without references that is a single piece.  The pieces
+  // point into this Pickle and into the referenced blobs, so they are valid
+  // until the Pickle is next modified.
+  void GetSegments(std::vector<Segment>* segments) const;
+#if defined(OS_POSIX)
+  // Same as GetSegments(), as iovecs ready for writev() or sendmsg().
+  void GetIOVecs(std::vector<struct iovec>* iovecs) const;
+#endif
+
   // Returns the size of the Pickle's data.
   size_t size() const { return header_size_ + header_->payload_size; }
 
   // Returns the data for this Pickle.
-  const void* data() const { return header_; }
+  const void* data() const {
+    EnsureContiguous();
+    return header_;
+  }
+
+  // Returns the allocator backing the heap buffer, or NULL for malloc().
+  PickleAllocator* allocator() const { return allocator_; }
+
+  // Sets the allocator used by Pickles constructed without one.  NULL, the
+  // initial value, means malloc().  Pickles that already exist keep the
+  // allocator they were constructed with.  This is meant to be called once
+  // during startup, before other threads create Pickles; e.g.
+  //   Pickle::SetDefaultAllocator(PickleBufferPool::GetInstance());
+  static void SetDefaultAllocator(PickleAllocator* allocator);
+  static PickleAllocator* default_allocator();
 
   // For compatibility, these older style read methods pass through to the
   // PickleIterator methods.
@@ -192,6 +368,10 @@ class BASE_EXPORT Pickle {
   //                  base::string16* result) const WARN_UNUSED_RESULT {
   //  return iter->ReadString16(result);
   //}
+  bool ReadStringPiece(PickleIterator* iter,
+                       base::StringPiece* result) const WARN_UNUSED_RESULT {
+    return iter->ReadStringPiece(result);
+  }
   // A pointer to the data will be placed in *data, and the length will be
   // placed in *length. This buffer will be into the message's buffer so will
   // be scoped to the lifetime of the message (or until the message data is
@@ -223,9 +403,13 @@ class BASE_EXPORT Pickle {
   // Pickle, it is important to read them in the order in which they were added
   // to the Pickle.
   bool WriteBool(bool value) {
+    if (compact_)
+      return WriteCompactBool(value);
     return WriteInt(value ? 1 : 0);
   }
   bool WriteInt(int value) {
+    if (compact_)
+      return WriteVarint(ZigZag(value));
     return WritePOD(value);
   }
   // WARNING: DO NOT USE THIS METHOD IF PICKLES ARE PERSISTED IN ANY WAY.
@@ -234,18 +418,28 @@ class BASE_EXPORT Pickle {
   // pickles are still around after upgrading to 64-bit, or if they are copied
   // between dissimilar systems, YOUR PICKLES WILL HAVE GONE BAD.
   bool WriteLongUsingDangerousNonPortableLessPersistableForm(long value) {
+    if (compact_)
+      return WriteVarint(ZigZag(value));
     return WritePOD(value);
   }
   bool WriteUInt16(uint16 value) {
+    if (compact_)
+      return WriteVarint(value);
     return WritePOD(value);
   }
   bool WriteUInt32(uint32 value) {
+    if (compact_)
+      return WriteVarint(value);
     return WritePOD(value);
   }
   bool WriteInt64(int64 value) {
+    if (compact_)
+      return WriteVarint(ZigZag(value));
     return WritePOD(value);
   }
   bool WriteUInt64(uint64 value) {
+    if (compact_)
+      return WriteVarint(value);
     return WritePOD(value);
   }
   bool WriteFloat(float value) {
@@ -270,6 +464,21 @@ class BASE_EXPORT Pickle {
   // Reserve() before calling WriteFoo() multiple times.
   void Reserve(size_t additional_capacity);
 
+  // Like Reserve(), but grows the buffer to exactly |additional_capacity|
+  // more payload bytes (rounded up to the allocation unit) rather than
+  // doubling it.  Meant for writers that know the final size in advance,
+  // see PickleSizer.
+  void ReserveExact(size_t additional_capacity);
+
+  // Appends |length| zeroed bytes, padded like WriteBytes(), and returns a
+  // pointer to them so that the caller can store the data in place.  The
+  // pointer is only valid until the next write.
+  char* ClaimBytes(size_t length);
+
+  // Size in bytes of the buffer embedded in every Pickle.  It holds the
+  // header plus as much payload as fits before the first heap allocation.
+  static const size_t kInlineCapacity = 128;
+
   // Payload follows after allocation of Header (header size is customizable).
   struct Header {
     uint32 payload_size;  // Specifies the size of the payload.
@@ -281,6 +490,8 @@ class BASE_EXPORT Pickle {
   template <class T>
   T* headerT() {
     assert(header_size_ == sizeof(T));
+    if (shared_)
+      Unshare(0);
     return static_cast<T*>(header_);
   }
   template <class T>
@@ -295,6 +506,7 @@ class BASE_EXPORT Pickle {
   }
 
   const char* payload() const {
+    EnsureContiguous();
     return reinterpret_cast<const char*>(header_) + header_size_;
   }
 
@@ -307,6 +519,8 @@ class BASE_EXPORT Pickle {
 
  protected:
   char* mutable_payload() {
+    if (shared_)
+      Unshare(0);
     return reinterpret_cast<char*>(header_) + header_size_;
   }
 
@@ -315,7 +529,8 @@ class BASE_EXPORT Pickle {
   }
 
   // Resize the capacity, note that the input value should not include the size
-  // of the header.
+  // of the header.  The header and payload together are rounded up to a
+  // multiple of kPayloadUnit.
   void Resize(size_t new_capacity);
 
   // Aligns 'i' by rounding it up to the next multiple of 'alignment'
@@ -329,20 +544,107 @@ class BASE_EXPORT Pickle {
                               const char* range_start,
                               const char* range_end);
 
-  // The allocation granularity of the payload.
+  // The allocation granularity of the header and payload together.
   static const int kPayloadUnit;
 
  private:
   friend class PickleIterator;
+  friend class PickleSizer;
+
+  // True if the header and payload currently live in |inline_storage_|.
+  bool uses_inline_storage() const {
+    return header_ == reinterpret_cast<const Header*>(inline_storage_.bytes);
+  }
+
+  // Flattens the payload if it has references.  Reading does not change the
+  // logical contents, hence const.
+  void EnsureContiguous() const {
+    if (segments_)
+      const_cast<Pickle*>(this)->Flatten();
+  }
+
+  // Size of |length| bytes of raw data in the payload, padding included.
+  size_t PaddedSize(size_t length) const {
+    return compact_ ? length : AlignInt(length, sizeof(uint32));
+  }
+
+  // Maps signed values onto unsigned ones so that small magnitudes of
+  // either sign make short varints.
+  static uint64 ZigZag(int64 value) {
+    return (static_cast<uint64>(value) << 1) ^ static_cast<uint64>(value >> 63);
+  }
+
+  // Compact encoding, see set_compact().
+  bool WriteVarint(uint64 value);
+  bool WriteCompactBool(bool value);
+
+  // Records a reference to a blob written in scatter-gather mode.
+  void AppendReference(const char* data, size_t length);
+
+  // Releases the heap buffer, if any, to allocator_ or deleter_.  Leaves
+  // header_ dangling.
+  void FreeStorage();
+
+  // Moves the data written so far into a fresh buffer from allocator_ with
+  // room for |new_capacity| payload bytes, and frees the old one.
+  void MoveToNewBuffer(size_t new_capacity);
+
+  // Moves |other|'s contents into this Pickle, which must not own a buffer
+  // and must already have |other|'s header size and allocator.
+  void TakeStorage(Pickle* other);
+
+  // Drops the current buffer without freeing it and starts over as an empty
+  // writable Pickle with a zeroed header.
+  void ResetToEmpty();
+
+  // The reference counted owner of a shared buffer.
+  struct SharedPayload;
+
+  // Makes this Pickle, which must not own a buffer, another reference to the
+  // shared payload of |other|.
+  void ShareWith(const Pickle& other);
+
+  // Gives a shared Pickle a private buffer with room for at least
+  // |new_capacity| payload bytes.  The last reference takes the shared
+  // buffer back without copying.
+  void Unshare(size_t new_capacity);
+
+  // Drops one reference to |shared| and frees it with the last one.
+  static void ReleaseShared(SharedPayload* shared);
 
   Header* header_;
+  PickleAllocator* allocator_;  // NULL means malloc() and friends.
   size_t header_size_;  // Supports extra data between header and payload.
   // Allocation size of payload (or -1 if allocation is const). Note: this
   // doesn't count the header.
   size_t capacity_after_header_;
   // The offset at which we will write the next field. Note: this doesn't count
-  // the header.
+  // the header.  In scatter-gather mode this covers only the bytes in the
+  // buffer, while header_->payload_size includes the referenced blobs.
   size_t write_offset_;
+  // Set when the buffer was adopted through Pickle(const Buffer&) with a
+  // custom deleter; allocator_ is then only used once the Pickle grows.
+  BufferDeleter deleter_;
+  void* deleter_context_;
+  // Set while the payload is shared; header_ then points into its buffer,
+  // which is read-only, and capacity_after_header_ is 0 so that the next
+  // write reaches Resize() and unshares.
+  SharedPayload* shared_;
+  // Non-NULL in scatter-gather mode.
+  struct Segments;
+  Segments* segments_;
+  // Compact encoding, see set_compact().  Booleans are packed into the byte
+  // at |bool_offset_| (an offset like write_offset_) until |bool_bits_|
+  // reaches 8; 0 means no byte has been started.
+  bool compact_;
+  int bool_bits_;
+  size_t bool_offset_;
+  // Backing store for small pickles.  The uint64 member only forces 8-byte
+  // alignment, matching what malloc() hands back for the heap case.
+  union {
+    char bytes[kInlineCapacity];
+    uint64 align;
+  } inline_storage_;
 
   // Just like WriteBytes, but with a compile-time size, for performance.
   template<size_t length> void BASE_EXPORT WriteBytesStatic(const void* data);
@@ -360,4 +662,52 @@ class BASE_EXPORT Pickle {
   //FRIEND_TEST_ALL_PREFIXES(PickleTest, FindNextOverflow);
 };
 
+// PickleSizer computes the payload size a sequence of Pickle::WriteFoo()
+// calls will produce, padding and the compact encoding included, without
+// writing anything.  Call the AddFoo() method matching each WriteFoo() in
+// the same order, then Pickle::ReserveExact(payload_size()) so that the
+// writes themselves never reallocate.
+//
+// A sizer that was told about a field it cannot size (see SetUnknown())
+// keeps counting but reports known() == false; the total is then only a
+// lower bound.
+class BASE_EXPORT PickleSizer {
+ public:
+  // |compact| must match Pickle::compact() of the Pickle being sized.
+  explicit PickleSizer(bool compact);
+
+  void AddBool(bool value);
+  void AddInt(int value);
+  void AddLongUsingDangerousNonPortableLessPersistableForm(long value);
+  void AddUInt16(uint16 value);
+  void AddUInt32(uint32 value);
+  void AddInt64(int64 value);
+  void AddUInt64(uint64 value);
+  void AddFloat(float value);
+  void AddDouble(double value);
+  void AddString(const std::string& value);
+  void AddWString(const std::wstring& value);
+  void AddData(int length);
+  void AddBytes(int length);
+
+  // Records that some field could not be sized.
+  void SetUnknown() { known_ = false; }
+  bool known() const { return known_; }
+
+  bool compact() const { return compact_; }
+  size_t payload_size() const { return payload_size_; }
+
+ private:
+  void AddPOD(size_t size);
+  void AddVarint(uint64 value);
+
+  bool compact_;
+  bool known_;
+  // Bits used in the last packed boolean byte, as Pickle::bool_bits_.
+  int bool_bits_;
+  size_t payload_size_;
+
+  DISALLOW_COPY_AND_ASSIGN(PickleSizer);
+};
+
 #endif  // BASE_PICKLE_H__
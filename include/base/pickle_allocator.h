@@ -0,0 +1,100 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef BASE_PICKLE_ALLOCATOR_H__
+#define BASE_PICKLE_ALLOCATOR_H__
+
+#include "base/base_export.h"
+#include "base/basictypes.h"
+#include "base/compiler_specific.h"
+
+// PickleAllocator supplies the heap buffer of a Pickle once the pickle has
+// outgrown its inline storage.  A Pickle constructed without an allocator
+// uses malloc(), realloc() and free() directly.
+//
+// The allocator must outlive every Pickle that was constructed with it.
+class BASE_EXPORT PickleAllocator {
+ public:
+  virtual ~PickleAllocator() {}
+
+  // Returns a block of at least |size| bytes, aligned at least as strictly as
+  // malloc() would align it.
+  virtual void* Allocate(size_t size) = 0;
+
+  // Grows a block returned by Allocate() from |old_size| to |new_size| bytes.
+  // The first |old_size| bytes are preserved.  The returned pointer replaces
+  // |ptr|, which must not be used afterwards.
+  virtual void* Reallocate(void* ptr, size_t old_size, size_t new_size) = 0;
+
+  // Returns a block of |size| bytes obtained from this allocator.
+  virtual void Free(void* ptr, size_t size) = 0;
+};
+
+// A bump allocator intended for messages that live no longer than one
+// dispatch batch.  Allocations are carved out of large blocks and individual
+// Free() calls are (almost) free; the memory is reclaimed all at once by
+// Reset().  The typical pattern is:
+//
+//   PickleArena arena;
+//   for (;;) {
+//     ... build and dispatch messages constructed with &arena ...
+//     ... destroy them ...
+//     arena.Reset();
+//   }
+//
+// PickleArena is not thread safe.
+class BASE_EXPORT PickleArena : public PickleAllocator {
+ public:
+  // The default size of each block requested from the system.
+  static const size_t kDefaultBlockSize = 64 * 1024;
+
+  PickleArena();
+  explicit PickleArena(size_t block_size);
+  virtual ~PickleArena();
+
+  // PickleAllocator implementation.
+  virtual void* Allocate(size_t size) OVERRIDE;
+  virtual void* Reallocate(void* ptr, size_t old_size,
+                           size_t new_size) OVERRIDE;
+  virtual void Free(void* ptr, size_t size) OVERRIDE;
+
+  // Makes all memory handed out so far available again.  Every Pickle
+  // allocated from the arena must have been destroyed before this is called.
+  // One block is kept around so that the next batch does not hit malloc.
+  void Reset();
+
+  // Number of bytes currently handed out, including alignment padding.
+  size_t bytes_allocated() const { return bytes_allocated_; }
+
+  // Number of blocks currently obtained from the system.
+  size_t block_count() const { return block_count_; }
+
+ private:
+  struct Block {
+    Block* next;   // Previously filled block, or NULL.
+    size_t size;   // Usable bytes following this header.
+  };
+
+  // Starts a new block able to hold at least |size| bytes.
+  void AddBlock(size_t size);
+
+  char* block_data(Block* block) const {
+    return reinterpret_cast<char*>(block) + kBlockHeaderSize;
+  }
+
+  static const size_t kAlignment = 16;
+  static const size_t kBlockHeaderSize = 16;
+
+  size_t block_size_;
+  Block* current_;         // Block being carved up; older ones hang off next.
+  size_t offset_;          // Bump offset inside |current_|.
+  char* last_allocation_;  // Most recent allocation, may be grown in place.
+  size_t bytes_allocated_;
+  size_t block_count_;
+  int outstanding_;        // Allocations not yet returned through Free().
+
+  DISALLOW_COPY_AND_ASSIGN(PickleArena);
+};
+
+#endif  // BASE_PICKLE_ALLOCATOR_H__
@@ -0,0 +1,94 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef BASE_PICKLE_BUFFER_POOL_H__
+#define BASE_PICKLE_BUFFER_POOL_H__
+
+#include "base/base_export.h"
+#include "base/basictypes.h"
+#include "base/compiler_specific.h"
+#include "base/pickle_allocator.h"
+
+// PickleBufferPool recycles Pickle buffers instead of returning them to the
+// system.  Buffers are grouped into size classes of Pickle::kPayloadUnit
+// bytes.  Pickle::Resize() rounds the whole buffer, header included, to that
+// unit, so a Pickle asks for exactly one class and no space is lost to
+// rounding.  A process that keeps building messages of the same few sizes
+// is served almost entirely from the free lists.
+//
+// The free lists are per thread: Allocate() and Free() only ever touch the
+// calling thread's lists, so no locking is needed.  A buffer may be freed on
+// a different thread than the one that allocated it; it simply joins the
+// freeing thread's lists.  Cached buffers are released when their thread
+// exits.
+//
+// There is a single pool per process.  To route every Pickle through it:
+//
+//   Pickle::SetDefaultAllocator(PickleBufferPool::GetInstance());
+//
+// or pass PickleBufferPool::GetInstance() to individual Pickle / Message
+// constructors.
+class BASE_EXPORT PickleBufferPool : public PickleAllocator {
+ public:
+  // Bounds on what a single thread keeps cached.  Buffers that would exceed
+  // any of them go straight back to free().
+  struct Limits {
+    Limits();
+
+    // Buffers larger than this are never pooled.  Clamped to
+    // kMaxPooledSize.
+    size_t max_buffer_size;
+    // Maximum number of cached buffers in each size class.
+    size_t max_buffers_per_class;
+    // Maximum number of bytes cached by one thread, across all classes.
+    size_t max_cached_bytes;
+  };
+
+  // Counters for the calling thread.
+  struct Stats {
+    Stats();
+
+    uint64 hits;         // Allocations served from a free list.
+    uint64 misses;       // Poolable allocations that fell through to malloc.
+    uint64 unpooled;     // Allocations too large to be pooled.
+    uint64 recycled;     // Frees that put the buffer on a free list.
+    uint64 released;     // Frees that went to free() because of the limits.
+    size_t cached_buffers;
+    size_t cached_bytes;
+  };
+
+  // Hard upper bound for Limits::max_buffer_size.
+  static const size_t kMaxPooledSize = 64 * 1024;
+
+  static PickleBufferPool* GetInstance();
+
+  // Replaces the limits for all threads.  Should be called before messages
+  // start flowing; threads trim their caches lazily as buffers come back.
+  void SetLimits(const Limits& limits);
+  Limits limits() const { return limits_; }
+
+  // Returns the calling thread's counters.
+  void GetStats(Stats* stats) const;
+
+  // Frees every buffer cached by the calling thread.  Counters are kept.
+  void TrimCurrentThread();
+
+  // PickleAllocator implementation.
+  virtual void* Allocate(size_t size) OVERRIDE;
+  virtual void* Reallocate(void* ptr, size_t old_size,
+                           size_t new_size) OVERRIDE;
+  virtual void Free(void* ptr, size_t size) OVERRIDE;
+
+ private:
+  friend struct PickleBufferPoolTraits;
+
+  PickleBufferPool();
+  virtual ~PickleBufferPool();
+
+  Limits limits_;
+
+  DISALLOW_COPY_AND_ASSIGN(PickleBufferPool);
+};
+
+#endif  // BASE_PICKLE_BUFFER_POOL_H__
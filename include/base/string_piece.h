@@ -0,0 +1,123 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// A string-like object that points to a sized piece of memory.
+//
+// Functions or methods may use const StringPiece& parameters to accept either
+// a "const char*" or a "string" value that will be implicitly converted to
+// a StringPiece.
+//
+// A StringPiece does not own the memory it points to, which must outlive
+// it.  PickleIterator::ReadStringPiece() returns pieces of a Pickle's
+// payload, which are valid until the Pickle is modified or destroyed.
+
+#ifndef BASE_STRING_PIECE_H_
+#define BASE_STRING_PIECE_H_
+
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+#include "base/basictypes.h"
+
+namespace base {
+
+class StringPiece {
+ public:
+  typedef size_t size_type;
+  typedef const char* const_iterator;
+
+  StringPiece() : ptr_(NULL), length_(0) {}
+  StringPiece(const char* str)
+      : ptr_(str), length_(str ? strlen(str) : 0) {}
+  StringPiece(const std::string& str)
+      : ptr_(str.data()), length_(str.size()) {}
+  StringPiece(const char* offset, size_type len)
+      : ptr_(offset), length_(len) {}
+
+  // data() may return a pointer to a buffer with embedded NULs, and the
+  // returned buffer may or may not be null terminated.  Therefore it is
+  // typically a mistake to pass data() to a routine that expects a NUL
+  // terminated string.
+  const char* data() const { return ptr_; }
+  size_type size() const { return length_; }
+  size_type length() const { return length_; }
+  bool empty() const { return length_ == 0; }
+
+  void clear() {
+    ptr_ = NULL;
+    length_ = 0;
+  }
+  void set(const char* data, size_type len) {
+    ptr_ = data;
+    length_ = len;
+  }
+
+  char operator[](size_type i) const { return ptr_[i]; }
+
+  const_iterator begin() const { return ptr_; }
+  const_iterator end() const { return ptr_ + length_; }
+
+  int compare(const StringPiece& x) const {
+    size_type min_size = std::min(length_, x.length_);
+    int r = min_size ? memcmp(ptr_, x.ptr_, min_size) : 0;
+    if (r == 0) {
+      if (length_ < x.length_)
+        r = -1;
+      else if (length_ > x.length_)
+        r = +1;
+    }
+    return r;
+  }
+
+  std::string as_string() const {
+    // std::string doesn't like to take a NULL pointer even with a 0 size.
+    return empty() ? std::string() : std::string(ptr_, length_);
+  }
+
+  void CopyToString(std::string* target) const {
+    if (empty())
+      target->clear();
+    else
+      target->assign(ptr_, length_);
+  }
+
+  bool starts_with(const StringPiece& x) const {
+    return length_ >= x.length_ &&
+           (x.length_ == 0 || memcmp(ptr_, x.ptr_, x.length_) == 0);
+  }
+
+ private:
+  const char* ptr_;
+  size_type length_;
+};
+
+inline bool operator==(const StringPiece& x, const StringPiece& y) {
+  return x.size() == y.size() && x.compare(y) == 0;
+}
+
+inline bool operator!=(const StringPiece& x, const StringPiece& y) {
+  return !(x == y);
+}
+
+inline bool operator<(const StringPiece& x, const StringPiece& y) {
+  return x.compare(y) < 0;
+}
+
+inline bool operator>(const StringPiece& x, const StringPiece& y) {
+  return y < x;
+}
+
+inline bool operator<=(const StringPiece& x, const StringPiece& y) {
+  return !(y < x);
+}
+
+inline bool operator>=(const StringPiece& x, const StringPiece& y) {
+  return !(x < y);
+}
+
+}  // namespace base
+
+#endif  // BASE_STRING_PIECE_H_
@@ -0,0 +1,116 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPC_FILE_DESCRIPTOR_SET_POSIX_H_
+#define IPC_FILE_DESCRIPTOR_SET_POSIX_H_
+
+#include "base/build_config.h"
+
+#if defined(OS_POSIX)
+
+#include <vector>
+
+#include "base/atomic_ref_count.h"
+#include "base/basictypes.h"
+#include "base/file_descriptor_posix.h"
+#include "ipc/ipc_export.h"
+
+namespace IPC {
+
+// -----------------------------------------------------------------------------
+// A FileDescriptorSet is an ordered set of POSIX file descriptors. These are
+// associated with IPC messages so that descriptors can be transmitted over a
+// UNIX domain socket.  The message carries the index of each descriptor in
+// the set; the descriptors themselves travel beside the message's bytes, as
+// SCM_RIGHTS control data.
+//
+// A set is shared by the copies of a message, and reference counted.
+// -----------------------------------------------------------------------------
+class IPC_EXPORT FileDescriptorSet {
+ public:
+  FileDescriptorSet();
+
+  // The most descriptors a message can carry.  Linux takes no more than 253
+  // (SCM_MAX_FD) in one sendmsg().
+  static const size_t kMaxDescriptorsPerMessage = 128;
+
+  void AddRef();
+  // Deletes the set once the last reference is gone.
+  void Release();
+
+  // ---------------------------------------------------------------------------
+  // Interfaces for building during message serialisation...
+
+  // Add a descriptor to the end of the set. Returns false iff the set is full.
+  bool Add(int fd);
+  // Add a descriptor to the end of the set and automatically close it after
+  // transmission. Returns false iff the set is full.
+  bool AddAndAutoClose(int fd);
+
+  // ---------------------------------------------------------------------------
+
+
+  // ---------------------------------------------------------------------------
+  // Interfaces for accessing during message deserialisation...
+
+  // Return the number of descriptors
+  size_t size() const { return descriptors_.size(); }
+  // Return true if no unconsumed descriptors remain
+  bool empty() const { return descriptors_.empty(); }
+  // Take the nth descriptor from the beginning of the set, transferring the
+  // ownership of it to the caller.  Descriptors are taken in order, each
+  // once; returns -1 for any other |n|.
+  int GetDescriptorAt(size_t n);
+
+  // ---------------------------------------------------------------------------
+
+
+  // ---------------------------------------------------------------------------
+  // Interfaces for transmission...
+
+  // Fill an array with file descriptors without 'consuming' them. CommitAll
+  // must be called after these descriptors have been transmitted.
+  //   buffer: (output) a buffer of, at least, size() integers.
+  void GetDescriptors(int* buffer) const;
+  // This must be called after transmitting the descriptors returned by
+  // GetDescriptors. It marks all the descriptors as consumed and closes those
+  // which are auto-close.
+  void CommitAll();
+
+  // ---------------------------------------------------------------------------
+
+
+  // ---------------------------------------------------------------------------
+  // Interfaces for receiving...
+
+  // Set the contents of the set from the given buffer. This set must be empty
+  // before calling. The auto-close flag is set on all the descriptors so that
+  // unconsumed descriptors are closed on destruction.
+  void SetDescriptors(const int* buffer, size_t count);
+
+  // ---------------------------------------------------------------------------
+
+ private:
+  // Closes the auto-close descriptors nobody took.
+  ~FileDescriptorSet();
+
+  // A vector of descriptors and closing flags. If this message is sent, then
+  // these descriptors are sent as control data. After sending, any descriptors
+  // with a true flag are closed. If this message has been received, then these
+  // are the descriptors which were received and all close flags are true.
+  std::vector<base::FileDescriptor> descriptors_;
+
+  // The descriptors before this index have been taken by GetDescriptorAt().
+  size_t consumed_descriptor_highwater_;
+
+  base::AtomicRefCount ref_count_;
+
+  DISALLOW_COPY_AND_ASSIGN(FileDescriptorSet);
+};
+
+}  // namespace IPC
+
+#endif  // defined(OS_POSIX)
+
+#endif  // IPC_FILE_DESCRIPTOR_SET_POSIX_H_
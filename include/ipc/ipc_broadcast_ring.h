@@ -0,0 +1,174 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPC_IPC_BROADCAST_RING_H_
+#define IPC_IPC_BROADCAST_RING_H_
+
+#include "base/build_config.h"
+
+#if defined(OS_LINUX)
+
+#include <vector>
+
+#include "base/basictypes.h"
+#include "base/compiler_specific.h"
+#include "ipc/ipc_channel.h"
+#include "ipc/ipc_export.h"
+#include "ipc/ipc_message.h"
+
+namespace IPC {
+
+// A ring in shared memory that one writer publishes messages into and any
+// number of readers, up to a limit fixed at creation, read from.  Each
+// message is serialized and stored once, however many readers there are;
+// each reader keeps its own position in the ring.
+//
+// What happens when a reader falls a whole ring behind is up to the writer:
+// either the writer goes on and the reader loses the messages it missed,
+// and is told how many, or the writer waits for the slowest reader.  In the
+// second case a reader that stops reading, or dies without detaching,
+// stops the writer too.
+//
+// The writer creates the ring and hands fd() to each reader process, which
+// calls Reader::Open().  Neither the writer nor a reader is thread safe.
+class IPC_EXPORT BroadcastRing : public Message::Sender {
+ public:
+  enum OverflowPolicy {
+    // Readers that fall behind lose messages.
+    OVERWRITE_SLOW_READERS,
+    // The writer waits for the slowest reader.
+    BLOCK_ON_SLOW_READERS
+  };
+
+  // A reader of the ring.  Detaches on destruction.
+  class Reader;
+
+  virtual ~BroadcastRing();
+
+  // Creates a ring with room for |capacity| bytes of messages, rounded up
+  // to a power of two, and at most |max_readers| readers at a time.
+  // Returns NULL on failure.
+  static BroadcastRing* Create(size_t capacity, size_t max_readers,
+                               OverflowPolicy policy);
+
+  // The descriptor of the shared memory, to hand to the readers.
+  int fd() const { return fd_; }
+
+  size_t capacity() const { return capacity_; }
+
+  // Message::Sender implementation.  Publishes |message| to every reader
+  // and deletes it.  Returns false if the writer waits for readers and the
+  // slowest one has not left room; see WaitForSpace().
+  virtual bool Send(Message* message) OVERRIDE;
+
+  // Publishes a copy of |message|, as Send().
+  bool WriteMessage(const Message& message);
+
+  // Waits until a message with |payload_size| bytes of payload fits, for
+  // at most |timeout_ms| milliseconds or indefinitely if it is negative.
+  // Returns false on timeout or if it can never fit.  Always true for
+  // messages that fit when slow readers are overwritten.
+  bool WaitForSpace(size_t payload_size, int timeout_ms);
+
+  // The readers attached now.
+  size_t reader_count() const;
+
+ private:
+  friend class Reader;
+  struct Control;
+  struct ReaderSlot;
+
+  BroadcastRing(int fd, char* mapping, size_t mapping_size,
+                size_t capacity, bool overwrite);
+
+  // Finds |size| contiguous bytes at or after the head and returns their
+  // position, or returns false.
+  bool ReserveSlot(size_t size, uint64* position);
+  // The oldest position a reader still needs, or the head if none does.
+  uint64 MinReaderTail() const;
+
+  int fd_;
+  char* mapping_;
+  size_t mapping_size_;
+  Control* control_;
+  char* ring_;
+  size_t capacity_;
+  bool overwrite_;
+
+  uint64 head_;
+  uint64 cached_min_tail_;
+  uint64 sequence_;
+  uint32 version_;
+
+  DISALLOW_COPY_AND_ASSIGN(BroadcastRing);
+};
+
+class IPC_EXPORT BroadcastRing::Reader {
+ public:
+  class IPC_EXPORT Listener : public Channel::Listener {
+   public:
+    // Called before the next message when |count| messages were
+    // overwritten before this reader got to them.
+    virtual void OnMessagesLost(uint64 count) {}
+  };
+
+  ~Reader();
+
+  // Attaches to the ring |fd| refers to, taking ownership of |fd|.  The
+  // reader sees the messages published from now on.  Returns NULL if |fd|
+  // does not hold a ring or the ring has as many readers as it allows.
+  static Reader* Open(int fd);
+
+  // Waits for a message, for at most |timeout_ms| milliseconds or
+  // indefinitely if it is negative.  Returns false on timeout.
+  bool WaitForMessage(int timeout_ms);
+
+  // Hands up to |max_messages| waiting messages to |listener| and
+  // returns the number handed over.  When the writer waits for readers
+  // the messages are read in place; otherwise each is copied out first,
+  // since the writer may overwrite it at any moment.  A message that
+  // fails to decompress breaks the reader.
+  size_t DispatchMessages(Listener* listener, size_t max_messages);
+
+  // Messages overwritten before this reader read them, so far.
+  uint64 messages_lost() const { return messages_lost_; }
+
+  // True once the reader has found something that is not a valid message.
+  bool is_broken() const { return broken_; }
+
+ private:
+  Reader(int fd, char* mapping, size_t mapping_size, size_t index);
+
+  // Points |*data| at the oldest unread message, copied out of the ring
+  // if the writer does not wait, and its sequence number, or returns
+  // false.  Skips what was overwritten.
+  bool NextMessage(const char** data, int* size, uint64* sequence);
+  // Moves past the message NextMessage() returned.
+  void AdvanceTail();
+
+  int fd_;
+  char* mapping_;
+  size_t mapping_size_;
+  BroadcastRing::Control* control_;
+  BroadcastRing::ReaderSlot* slot_;
+  char* ring_;
+  size_t capacity_;
+  bool overwrite_;
+
+  uint64 tail_;
+  uint64 cached_head_;
+  size_t slot_size_;
+  std::vector<char> copy_;
+  uint64 next_sequence_;
+  uint64 messages_lost_;
+  bool broken_;
+
+  DISALLOW_COPY_AND_ASSIGN(Reader);
+};
+
+}  // namespace IPC
+
+#endif  // defined(OS_LINUX)
+
+#endif  // IPC_IPC_BROADCAST_RING_H_
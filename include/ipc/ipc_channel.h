@@ -0,0 +1,255 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPC_IPC_CHANNEL_H_
+#define IPC_IPC_CHANNEL_H_
+
+#include "base/build_config.h"
+
+#if defined(OS_LINUX)
+
+#include <string>
+#include <vector>
+
+#include "base/basictypes.h"
+#include "base/compiler_specific.h"
+#include "ipc/ipc_export.h"
+#include "ipc/ipc_io_loop.h"
+#include "ipc/ipc_message.h"
+#include "ipc/ipc_message_queue.h"
+#include "ipc/ipc_message_reader.h"
+
+namespace IPC {
+
+// A connection to another process over a Unix domain stream socket, driven
+// by an IOLoop.  Send() queues the message and writes as much as the socket
+// takes without blocking; the rest goes out as the socket drains.  Incoming
+// bytes are cut into messages by a MessageReader and handed to the
+// Listener, so a class with an IPC_BEGIN_MESSAGE_MAP in its
+// OnMessageReceived() and a Send() that forwards to the channel can answer
+// synchronous messages as it is.
+//
+// The outgoing queue is a MessageQueue: higher priorities go first, and
+// asynchronous messages whose deadline passes while queued are dropped.
+// Each write takes as many queued messages as it can, gathered into one
+// sendmsg().  By default a message is written as soon as it is sent; the
+// FlushPolicy can hold small messages back so that a burst of them leaves
+// in one write.
+//
+// File descriptors written to a message (see Message::WriteFileDescriptor())
+// travel with it as SCM_RIGHTS control data, so a memfd or a pipe can take
+// bulk data past the socket.  Received ones are attached to their message,
+// and closed with it unless the listener reads them.
+//
+// On an IOLoop that runs on io_uring, the loop does the socket I/O itself
+// (see IOLoop::StartReceiving()): messages leave the queue in batches that
+// are written by one chain of linked sends, and messages are read in place
+// out of the buffers the loop receives into.
+//
+// A channel is used on the thread that runs its IOLoop.
+class IPC_EXPORT Channel : public Message::Sender,
+                           public IOLoop::Watcher,
+                           public IOLoop::StreamHandler {
+ public:
+  // Implemented by the consumer of a channel.
+  class IPC_EXPORT Listener {
+   public:
+    virtual ~Listener() {}
+
+    // Called for each incoming message.  Compressed messages have been
+    // decompressed and checksums checked.  Returns true if the message was
+    // handled.
+    virtual bool OnMessageReceived(const Message& message) = 0;
+
+    // Called once the channel is connected, with the pid of the peer.
+    virtual void OnChannelConnected(int32 peer_pid) {}
+
+    // Called once if the channel breaks: the peer went away, or sent
+    // something that is not a valid message.  The channel is closed.
+    virtual void OnChannelError() {}
+  };
+
+  enum Mode {
+    // Listens at the path and takes the first connection.
+    MODE_SERVER,
+    // Connects to a server listening at the path.
+    MODE_CLIENT
+  };
+
+  // A channel over the socket at |path|.  Connect() creates it.
+  Channel(const std::string& path, Mode mode, Listener* listener,
+          IOLoop* loop);
+
+  // When queued messages are written.  Until one of the limits is reached,
+  // sent messages wait in the queue for more to join them; 0 means no
+  // limit.  PRIORITY_HIGH messages, synchronous messages and replies are
+  // written at once, along with whatever waits.  So is a SendBatch().
+  // Messages sent while the socket is full go out as it drains, whatever
+  // the policy.
+  struct IPC_EXPORT FlushPolicy {
+    // Writes every message as soon as it is sent.
+    FlushPolicy();
+
+    // Written once this many bytes of messages wait...
+    size_t max_bytes;
+    // ... or this many messages...
+    size_t max_messages;
+    // ... or the first of them has waited this many microseconds.
+    int64 max_delay_us;
+  };
+
+  // A channel over |fd|, one end of an already connected stream socket
+  // pair (see SocketPair()).  The channel takes ownership of |fd|.
+  Channel(int fd, Listener* listener, IOLoop* loop);
+
+  virtual ~Channel();
+
+  // Creates a connected pair of sockets for Channel(int, ...).
+  static bool SocketPair(int* fd0, int* fd1);
+
+  // Starts listening, connecting, or reading, depending on how the channel
+  // was created.  Returns false if that fails.
+  bool Connect() WARN_UNUSED_RESULT;
+
+  // Closes the socket and drops the messages not yet written.  Safe to call
+  // from the listener, which gets no further calls.
+  void Close();
+
+  // Message::Sender.  Takes ownership of |message|.  Messages sent before
+  // the channel is connected wait in the queue.  Returns false if the
+  // channel has been closed.
+  virtual bool Send(Message* message) OVERRIDE;
+
+  // Message::Sender.  Queues |messages| as Send() does, and writes them
+  // without waiting for the flush policy.
+  virtual bool SendBatch(std::vector<Message*>* messages) OVERRIDE;
+
+  // Writes the messages the flush policy holds back.  Returns false if the
+  // channel has been closed.
+  bool Flush();
+
+  void set_flush_policy(const FlushPolicy& policy) {
+    flush_policy_ = policy;
+  }
+  const FlushPolicy& flush_policy() const { return flush_policy_; }
+
+  // Outgoing messages of at least |threshold| bytes are compressed (see
+  // Message::Compress()).  0, the default, turns compression off.
+  void set_compression_threshold(size_t threshold) {
+    compression_threshold_ = threshold;
+  }
+
+  // Outgoing messages get a checksum (see Message::AddChecksum()).  Off by
+  // default; incoming checksums are always checked.
+  void set_add_checksums(bool add_checksums) {
+    add_checksums_ = add_checksums;
+  }
+
+  bool is_connected() const { return fd_ >= 0 && !connecting_; }
+
+  int32 peer_pid() const { return peer_pid_; }
+
+  // Messages queued and not yet completely written.
+  size_t pending_messages() const {
+    return output_queue_.size() + writing_.size() + messages_in_loop_;
+  }
+
+  const MessageQueue& output_queue() const { return output_queue_; }
+
+  // IOLoop::Watcher.
+  virtual void OnFileCanReadWithoutBlocking(int fd) OVERRIDE;
+  virtual void OnFileCanWriteWithoutBlocking(int fd) OVERRIDE;
+
+  // IOLoop::StreamHandler.
+  virtual void OnStreamReceived(int fd, const char* data,
+                                ssize_t size) OVERRIDE;
+  virtual void OnStreamDescriptorsReceived(int fd, const int* fds,
+                                           size_t count) OVERRIDE;
+  virtual void OnStreamCanSend(int fd) OVERRIDE;
+  virtual void OnStreamSent(int fd, size_t count, int error) OVERRIDE;
+
+ private:
+  bool CreateServerSocket();
+  bool ConnectToServer();
+  bool AcceptConnection();
+
+  // Starts reading from |fd_| and tells the listener.
+  bool FinishConnecting();
+
+  // Compresses |message| and adds a checksum as configured, and queues it.
+  // A message that already has a checksum is sent uncompressed.
+  // Returns true if it must not wait for the flush policy.
+  bool QueueMessage(Message* message);
+  // Starts writing what is queued if |urgent| or the flush policy says so,
+  // or else makes sure the flush timer runs.  Returns false if the channel
+  // broke.
+  bool OnMessagesQueued(bool urgent);
+  // Starts writing everything queued.  Returns false if the channel broke.
+  bool StartWriting();
+  // Starts the timer for FlushPolicy::max_delay_us.
+  bool StartFlushTimer();
+
+  // Reads until the socket runs dry and dispatches what arrived.  Returns
+  // false if the channel is broken.
+  bool ProcessIncomingMessages();
+  bool DispatchMessages();
+  // Hands |message| the descriptors its header counts, from |input_fds_|.
+  // Returns false if they have not all arrived.
+  bool AttachDescriptors(Message* message);
+
+  // Writes queued messages, several at a time, until the socket is full.
+  // Returns false if the channel is broken.
+  bool ProcessOutgoingMessages();
+
+  // Closes the channel and tells the listener.
+  void OnError();
+
+  std::string path_;
+  Mode mode_;
+  Listener* listener_;
+  IOLoop* loop_;
+
+  // The connected socket, or -1.
+  int fd_;
+  // The listening socket of a server that has not accepted yet, or -1.
+  int server_fd_;
+  bool connecting_;
+  bool closed_;
+  int32 peer_pid_;
+
+  MessageReader reader_;
+  // Descriptors received and not yet attached to a message, in order.
+  std::vector<int> input_fds_;
+  MessageQueue output_queue_;
+  // The messages being written, and how much of the first has been.
+  std::vector<Message*> writing_;
+  size_t write_offset_;
+  // True while the loop watches |fd_| for writing.
+  bool waiting_to_write_;
+
+  // True if the loop does the socket I/O.
+  bool streaming_;
+  // Messages handed to the loop and not yet written.
+  size_t messages_in_loop_;
+
+  size_t compression_threshold_;
+  bool add_checksums_;
+
+  FlushPolicy flush_policy_;
+  // The messages, and bytes, queued since writing last started.
+  size_t held_messages_;
+  size_t held_bytes_;
+  // A timerfd for FlushPolicy::max_delay_us, or -1; and whether it runs
+  // for the messages held now.
+  int flush_timer_fd_;
+  bool flush_timer_running_;
+
+  DISALLOW_COPY_AND_ASSIGN(Channel);
+};
+
+}  // namespace IPC
+
+#endif  // defined(OS_LINUX)
+
+#endif  // IPC_IPC_CHANNEL_H_
@@ -0,0 +1,162 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPC_IPC_CHUNKED_STREAM_H_
+#define IPC_IPC_CHUNKED_STREAM_H_
+
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "base/basictypes.h"
+#include "ipc/ipc_export.h"
+#include "ipc/ipc_message.h"
+
+namespace IPC {
+
+// Streams of bytes too large to be one message, or too large to build in
+// memory first.  ChunkedStreamWriter cuts the stream into messages of type
+// IPC_CHUNK_ID carrying at most chunk_size() bytes each, and sends every
+// chunk as soon as it is full, so the sender holds at most one chunk.  On
+// the other end ChunkedStreamReader hands the bytes over as they arrive, or
+// reassembles the whole stream first.  Streams are only limited by a 64-bit
+// offset, not by the 32-bit payload size of a message.
+//
+// Each chunk carries the stream id, the type of the logical message, the
+// offset of its bytes in the stream and whether it is the last one.  Chunks
+// travel with the routing id of the logical message, so streams to
+// different routes, or with different ids, can be interleaved on one
+// channel; the chunks of one stream must arrive in order, which a channel
+// guarantees.
+//
+//   IPC::ChunkedStreamWriter writer(channel, route, FooMsg_Snapshot::ID, id);
+//   while (...)
+//     writer.Write(data, size);
+//   writer.Close();
+//
+// and on the receiving side, for messages of type IPC_CHUNK_ID:
+//
+//   if (!stream_reader_.OnMessageReceived(message))
+//     ...  // A broken stream; it has been dropped.
+class IPC_EXPORT ChunkedStreamWriter {
+ public:
+  // The default limit on the bytes carried by one chunk.
+  static const size_t kDefaultChunkSize = 256 * 1024;
+
+  // Sends the chunks of stream |stream_id| to |sender|, with |routing_id|
+  // and |type| identifying the logical message.  |chunk_size| may not
+  // exceed kint32max.
+  ChunkedStreamWriter(Message::Sender* sender, int32 routing_id,
+                      uint16 type, uint32 stream_id,
+                      size_t chunk_size = kDefaultChunkSize);
+  ~ChunkedStreamWriter();
+
+  // The priority of the chunks sent from now on.
+  void set_priority(Message::PriorityValue priority) { priority_ = priority; }
+
+  // Appends |size| bytes to the stream, sending every chunk that fills up.
+  // Writes of a chunk or more go out without being copied into the pending
+  // chunk first.  Returns false if sending failed, after which the writer
+  // only fails.
+  bool Write(const void* data, size_t size);
+
+  // Sends what is pending as the last chunk.  Must be called once, after the
+  // last Write(); a stream without a last chunk stays open at the reader.
+  bool Close();
+
+  // Bytes handed to Write() so far.
+  uint64 bytes_written() const { return sent_ + pending_.size(); }
+
+  size_t chunk_size() const { return chunk_size_; }
+
+ private:
+  bool SendChunk(const char* data, size_t size, bool last);
+
+  Message::Sender* sender_;
+  int32 routing_id_;
+  uint16 type_;
+  uint32 stream_id_;
+  size_t chunk_size_;
+  Message::PriorityValue priority_;
+  // Bytes of the chunk being filled.
+  std::vector<char> pending_;
+  // Bytes sent in complete chunks.
+  uint64 sent_;
+  bool closed_;
+  bool failed_;
+
+  DISALLOW_COPY_AND_ASSIGN(ChunkedStreamWriter);
+};
+
+class IPC_EXPORT ChunkedStreamReader {
+ public:
+  class IPC_EXPORT Delegate {
+   public:
+    virtual ~Delegate() {}
+
+    // Receives the next |size| bytes of stream |stream_id|, which was sent
+    // to |routing_id| as a message of type |type|.  Only called by a reader
+    // that does not reassemble streams.
+    virtual void OnStreamData(int32 routing_id, uint16 type,
+                              uint32 stream_id, const char* data,
+                              size_t size) = 0;
+
+    // Called when the last chunk of a stream has arrived.  If the reader
+    // reassembles streams, |data| holds the whole stream and may be swapped
+    // out; otherwise it is NULL.
+    virtual void OnStreamEnd(int32 routing_id, uint16 type,
+                             uint32 stream_id, std::vector<char>* data) = 0;
+  };
+
+  // The default limit on the streams that are open at once.
+  static const size_t kDefaultMaxOpenStreams = 64;
+
+  // With a |max_reassembly_size| of 0 the bytes go to the delegate as they
+  // arrive.  Otherwise each stream is collected until its last chunk, and
+  // a stream that grows larger than |max_reassembly_size| is dropped.
+  // At most |max_open_streams| streams are open at once, so a reader that
+  // reassembles holds at most |max_open_streams| * |max_reassembly_size|
+  // bytes however many streams the peer starts.
+  explicit ChunkedStreamReader(
+      Delegate* delegate,
+      size_t max_reassembly_size = 0,
+      size_t max_open_streams = kDefaultMaxOpenStreams);
+  ~ChunkedStreamReader();
+
+  // Handles a message of type IPC_CHUNK_ID.  Returns false, and drops the
+  // stream, if the chunk is malformed, does not continue its stream where
+  // the previous one ended, makes the stream too large to reassemble, or
+  // would open a stream beyond max_open_streams.  A stream that is ended by
+  // its first chunk never counts as open.
+  bool OnMessageReceived(const Message& message);
+
+  // Streams that have started but not ended.
+  size_t open_streams() const { return streams_.size(); }
+
+ private:
+  struct Stream {
+    Stream();
+
+    uint16 type;
+    // Bytes received so far.
+    uint64 offset;
+    // The reassembled bytes, if the reader reassembles.
+    std::vector<char> data;
+  };
+
+  // Streams are told apart by routing id and stream id.
+  typedef std::pair<int32, uint32> StreamKey;
+  typedef std::map<StreamKey, Stream> StreamMap;
+
+  Delegate* delegate_;
+  size_t max_reassembly_size_;
+  size_t max_open_streams_;
+  StreamMap streams_;
+
+  DISALLOW_COPY_AND_ASSIGN(ChunkedStreamReader);
+};
+
+}  // namespace IPC
+
+#endif  // IPC_IPC_CHUNKED_STREAM_H_
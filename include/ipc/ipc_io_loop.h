@@ -0,0 +1,210 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPC_IPC_IO_LOOP_H_
+#define IPC_IPC_IO_LOOP_H_
+
+#include "base/build_config.h"
+
+#if defined(OS_LINUX)
+
+#include <sys/types.h>
+
+#include <map>
+#include <vector>
+
+#include "base/basictypes.h"
+#include "ipc/ipc_export.h"
+
+namespace IPC {
+
+class Message;
+
+// A single threaded event loop that waits for file descriptors to become
+// readable or writable and tells their watchers.  Channels run on one; any
+// number of channels can share a loop.  Apart from Quit(), its methods must
+// be called on the thread that runs it, Init() included.
+//
+// The loop runs on io_uring where the kernel has what it needs (Linux 6.0),
+// and on epoll otherwise.  On io_uring it also does stream I/O itself, for
+// the descriptors handed to StartReceiving(): it keeps a multishot
+// recvmsg() going on each, into buffers it provides, and writes the
+// messages given to SendMessages() as chains of linked sendmsg()s that
+// gather several messages each.  File descriptors attached to the messages
+// go both ways, as SCM_RIGHTS control data.  Everything queued while the
+// loop runs goes to the kernel with the one io_uring_enter() it waits in,
+// and one such call can bring back any number of completions.
+class IPC_EXPORT IOLoop {
+ public:
+  enum Backend {
+    BACKEND_EPOLL,
+    BACKEND_IO_URING
+  };
+
+  class Watcher {
+   public:
+    virtual ~Watcher() {}
+
+    // Called when |fd| is readable, or has hung up or failed; a read then
+    // reports what happened.
+    virtual void OnFileCanReadWithoutBlocking(int fd) = 0;
+
+    // Called when |fd| is writable.
+    virtual void OnFileCanWriteWithoutBlocking(int fd) = 0;
+  };
+
+  // Handles the stream I/O the loop does on io_uring.
+  class StreamHandler {
+   public:
+    virtual ~StreamHandler() {}
+
+    // Called with the next |size| bytes received on |fd|, in a buffer of
+    // the loop's that is only valid during the call.  |size| is 0 once the
+    // peer has closed its end, or -errno on failure; nothing more is
+    // received after either.
+    virtual void OnStreamReceived(int fd, const char* data, ssize_t size) = 0;
+
+    // Called with |count| descriptors received on |fd|, before the bytes
+    // they came with.  The handler owns them from then on.
+    virtual void OnStreamDescriptorsReceived(int fd, const int* fds,
+                                             size_t count) = 0;
+
+    // Called, after RequestSend(), when the loop is ready to take more
+    // messages for |fd|: nothing it was given before is being written.
+    virtual void OnStreamCanSend(int fd) = 0;
+
+    // Called when |count| more of the messages given to SendMessages() have
+    // been written in full, and deleted.  |error| is 0, or the errno that
+    // writing failed with; nothing more is written after that.
+    virtual void OnStreamSent(int fd, size_t count, int error) = 0;
+  };
+
+  enum Mode {
+    WATCH_READ = 1 << 0,
+    WATCH_WRITE = 1 << 1,
+    WATCH_READ_WRITE = WATCH_READ | WATCH_WRITE
+  };
+
+  IOLoop();
+  ~IOLoop();
+
+  // Sets the loop up on |backend|, or on epoll if that is io_uring and
+  // io_uring is not available.  Returns false if that fails.
+  bool Init(Backend backend = BACKEND_IO_URING);
+
+  Backend backend() const { return backend_; }
+
+  // Starts watching |fd| for |mode|, or changes the mode and watcher if |fd|
+  // is already watched.  Watching is level triggered: the watcher is called
+  // on every iteration for as long as the condition holds.
+  bool WatchFileDescriptor(int fd, int mode, Watcher* watcher);
+
+  // Stops watching |fd|, and ends the stream I/O on it: the operations in
+  // flight are cancelled and the messages not yet written deleted, without
+  // any further calls to the handler.  Must be called before |fd| is
+  // closed.  Safe to call from a watcher or handler, for any descriptor.
+  void StopWatchingFileDescriptor(int fd);
+
+  // The stream I/O, on BACKEND_IO_URING only.  |fd| must be a connected
+  // stream socket, in blocking mode, and not otherwise watched.
+
+  // Starts receiving from |fd| and handing what arrives to |handler|.
+  bool StartReceiving(int fd, StreamHandler* handler);
+
+  // Asks for a call to OnStreamCanSend() for |fd| before the loop next
+  // waits, or once what it is writing now is written.
+  void RequestSend(int fd);
+
+  // Writes |messages| to |fd|, in order, after what the loop was given
+  // before, and clears |messages|.  Takes ownership of the messages.  The
+  // descriptors of a message reach the peer no later than its first byte,
+  // and are committed once sent (see FileDescriptorSet::CommitAll()).
+  void SendMessages(int fd, std::vector<Message*>* messages);
+
+  // Waits up to |timeout_ms| milliseconds, or indefinitely if it is
+  // negative, for at least one event and dispatches what is ready.  Returns
+  // false on error or once Quit() has been called.
+  bool RunOnce(int timeout_ms);
+
+  // Runs until Quit() is called.
+  void Run();
+
+  // Makes Run() return, and RunOnce() return false until the next Run(),
+  // soon.  May be called from any thread.
+  void Quit();
+
+ private:
+  // The io_uring instance and the requests in flight on it.
+  struct Uring;
+  struct Request;
+  struct SendBatch;
+
+  struct Watch {
+    Watcher* watcher;
+    int mode;
+    // The poll request for it, with io_uring.
+    Request* poll;
+  };
+  typedef std::map<int, Watch> WatchMap;
+
+  struct Stream {
+    StreamHandler* handler;
+    Request* receive;
+    bool send_requested;
+    // Given to SendMessages() and not yet submitted; the first may have
+    // been written in part, up to |unsent_offset|.
+    std::vector<Message*> unsent;
+    size_t unsent_offset;
+    // The batch being written, or NULL.
+    SendBatch* sending;
+  };
+  typedef std::map<int, Stream> StreamMap;
+
+  bool InitUring();
+  bool RunOnceEpoll(int timeout_ms);
+  bool RunOnceUring(int timeout_ms);
+
+  // io_uring: queues |request| to poll |fd| for |events|.
+  void SubmitPoll(Request* request, int fd, uint32 events);
+  // io_uring: queues the multishot receive of |request|.
+  void SubmitReceive(Request* request);
+  // io_uring: queues what |fd| has to write as one linked batch.
+  void SubmitSends(int fd, Stream* stream);
+  // io_uring: queues the cancellation of everything in flight on |fd|.
+  void SubmitCancel(int fd);
+  // io_uring: hands the streams that asked for it to their handlers and
+  // queues what they have to write.
+  void FlushSends();
+
+  // io_uring: requests are counted, so the loop can wait for them all to
+  // complete before it goes away.
+  Request* NewRequest(int type, int fd);
+  void DeleteRequest(Request* request);
+
+  void OnPollCompleted(Request* request, int result);
+  void OnReceiveCompleted(Request* request, int result, uint32 flags);
+  void OnSendCompleted(Request* request, int result);
+  // Calls the watcher of |fd| for what is ready.
+  void DispatchPoll(int fd, bool readable, bool writable);
+
+  Backend backend_;
+  int epoll_fd_;
+  // An eventfd that Quit() makes readable.
+  int wakeup_fd_;
+  bool quit_;
+  WatchMap watches_;
+
+  Uring* uring_;
+  StreamMap streams_;
+  // The streams that may have something to write.
+  std::vector<int> ready_to_send_;
+
+  DISALLOW_COPY_AND_ASSIGN(IOLoop);
+};
+
+}  // namespace IPC
+
+#endif  // defined(OS_LINUX)
+
+#endif  // IPC_IPC_IO_LOOP_H_
@@ -6,10 +6,17 @@
 #define CHROME_COMMON_IPC_MESSAGE_H__
 
 #include <string>
+#include <vector>
 #include "base/basictypes.h"
 #include "base/pickle.h"
 #include "ipc/ipc_export.h"
 
+#if defined(OS_POSIX)
+namespace base {
+struct FileDescriptor;
+}
+#endif
+
 #ifndef NDEBUG
 #define IPC_MESSAGE_LOG_ENABLED
 #endif
@@ -19,6 +26,10 @@ namespace IPC {
 
 //------------------------------------------------------------------------------
 
+#if defined(OS_POSIX)
+class FileDescriptorSet;
+#endif
+
 struct LogData;
 
 class IPC_EXPORT Message : public Pickle {
@@ -33,6 +44,12 @@ class IPC_EXPORT Message : public Pickle {
     // is done to make this method easier to use.  Returns true on success and
     // false otherwise.
     virtual bool Send(Message* msg) = 0;
+
+    // Sends |messages|, in order, and clears the vector.  Takes ownership
+    // of every message, as Send() does.  A sender that writes to a stream
+    // can write the whole batch at once; by default each message goes to
+    // Send() in turn.  Returns true if every message was sent.
+    virtual bool SendBatch(std::vector<Message*>* messages);
   };
 
   enum PriorityValue {
@@ -49,18 +66,40 @@ class IPC_EXPORT Message : public Pickle {
   // destination WebView ID.
   Message(int32 routing_id, uint16 type, PriorityValue priority);
 
+  // Same as above, but the payload storage comes from |allocator| once it
+  // outgrows the inline buffer.  See PickleAllocator and PickleArena.
+  Message(int32 routing_id, uint16 type, PriorityValue priority,
+          PickleAllocator* allocator);
+
   // Initializes a message from a const block of data.  The data is not copied;
   // instead the data is merely referenced by this message.  Only const methods
-  // should be used on the message when initialized this way.
+  // should be used on the message when initialized this way.  To keep the
+  // message beyond the lifetime of |data|, or to hand it to several
+  // receivers, call MakeShared(): copies then share one payload.
   Message(const char* data, int data_len);
 
   Message(const Message& other);
   Message& operator=(const Message& other);
 
+  // Takes over the buffer of |other|, which is left as an empty message.
+  Message(Message&& other);
+  Message& operator=(Message&& other);
+
+  // Adopts a buffer holding a complete message, either one released by
+  // Pickle::ReleaseBuffer() or one owned by a transport that set
+  // Buffer::deleter.  The message is writable; see Pickle(const Buffer&).
+  explicit Message(const Buffer& buffer);
+
   PriorityValue priority() const {
     return static_cast<PriorityValue>(header()->flags & PRIORITY_MASK);
   }
 
+  // Messages declared with the IPC_MESSAGE macros start out as
+  // PRIORITY_NORMAL.  See MessageQueue.
+  void set_priority(PriorityValue priority) {
+    header()->flags = (header()->flags & ~PRIORITY_MASK) | priority;
+  }
+
   void set_sync() {
       header()->flags |= SYNC_BIT;
   }
@@ -110,6 +149,99 @@ class IPC_EXPORT Message : public Pickle {
     return (header()->flags & PUMPING_MSGS_BIT) != 0;
   }
 
+  // Switches the message to the compact encoding, see Pickle::set_compact().
+  // Must be called before anything is written.  The receiver picks the
+  // encoding up from the header.
+  void set_compact() {
+    header()->flags |= COMPACT_BIT;
+    Pickle::set_compact(true);
+  }
+
+  bool is_compact() const {
+    return (header()->flags & COMPACT_BIT) != 0;
+  }
+
+  // Marks the message as useless after |deadline|, in microseconds on the
+  // DeadlineClockNow() clock.  Dispatch() drops an expired message, or for a
+  // synchronous one sends a reply with set_reply_error(), without reading
+  // its parameters.  Like set_sent_time(), this appends to the payload, so it
+  // must be called after the parameters are written, at most once, and
+  // before set_sent_time().
+  void set_deadline(int64 deadline);
+
+  bool has_deadline() const {
+    return (header()->flags & HAS_DEADLINE_BIT) != 0;
+  }
+
+  // Returns 0 if the message has no deadline.
+  int64 deadline() const;
+
+  // True if the message has a deadline no later than |now|.
+  bool IsExpired(int64 now) const {
+    return has_deadline() && deadline() <= now;
+  }
+  bool IsExpired() const {
+    return has_deadline() && IsExpired(DeadlineClockNow());
+  }
+
+  // Microseconds on a monotonic clock shared by all the processes on the
+  // machine.
+  static int64 DeadlineClockNow();
+
+  // Appends a CRC32C of the header and payload, which MessageReader and
+  // MessageBatch::Reader check on the receiving side.  It covers everything
+  // written so far, so it must be the last change made to the message
+  // before it is sent; set_deadline(), set_sent_time() and Compress() come
+  // before it.
+  void AddChecksum();
+
+  bool has_checksum() const {
+    return (header()->flags & HAS_CHECKSUM_BIT) != 0;
+  }
+
+  // True if the message has no checksum or a matching one.
+  bool VerifyChecksum() const;
+
+  // Same for the serialized message at |data|, |size| bytes long as
+  // FindNext() delimits it.  |data| must be 4-byte aligned.
+  static bool VerifyChecksum(const char* data, size_t size);
+
+  // True if the payload of the serialized message at |data| is large enough
+  // for the deadline, sent time and checksum that its flags announce.  The
+  // accessors of those trust the flags, so whatever frames messages from
+  // the wire must check this before handing a message out.
+  static bool VerifyTrailers(const char* data, size_t size);
+
+  // Payloads smaller than this are not worth compressing.
+  static const size_t kDefaultCompressionThreshold = 16 * 1024;
+
+  // Compresses the parameters with base::LzCompress() if they take at least
+  // |threshold| bytes and shrink by at least an eighth, and marks the
+  // message as compressed.  Returns true if it did.  The header and the
+  // deadline and sent time stay readable; the parameters are not until
+  // Decompress() is called.  A message that already has a checksum is left
+  // alone.  Senders that want compression on by default call this on every
+  // outgoing message.
+  bool Compress(size_t threshold = kDefaultCompressionThreshold);
+
+  bool is_compressed() const {
+    return (header()->flags & COMPRESSED_BIT) != 0;
+  }
+
+  // Restores the payload of a compressed message, decoding it straight into
+  // a new buffer that the message then owns, and drops the checksum, which
+  // covered the compressed form; check it first.  Works on a message that
+  // refers to const data too.  Returns false, leaving the message as it
+  // was, if the compressed payload is malformed.  Does nothing for a message
+  // that is not compressed.
+  bool Decompress();
+
+  // Makes every message constructed from a routing id and type, including
+  // the ones declared with the IPC_MESSAGE macros, use the compact encoding.
+  // Meant to be called once during startup, like
+  // Pickle::SetDefaultAllocator().
+  static void SetCompactByDefault(bool compact);
+
   uint16 type() const {
     return header()->type;
   }
@@ -167,17 +299,28 @@ class IPC_EXPORT Message : public Pickle {
     return Pickle::FindNext(sizeof(Header), range_start, range_end);
   }
 
-//#if defined(OS_POSIX)
-//  // On POSIX, a message supports reading / writing FileDescriptor objects.
-//  // This is used to pass a file descriptor to the peer of an IPC channel.
-//
-//  // Add a descriptor to the end of the set. Returns false iff the set is full.
-//  bool WriteFileDescriptor(const base::FileDescriptor& descriptor);
-//  // Get a file descriptor from the message. Returns false on error.
-//  //   iter: a Pickle iterator to the current location in the message.
-//  bool ReadFileDescriptor(void** iter, base::FileDescriptor* descriptor) const;
-//#endif
-//
+#if defined(OS_POSIX)
+  // On POSIX, a message supports reading / writing FileDescriptor objects.
+  // This is used to pass a file descriptor to the peer of an IPC channel.
+  // Only a Channel carries the descriptors; the other transports send the
+  // bytes of the message alone.
+
+  // Add a descriptor to the end of the set. Returns false iff the set is full.
+  bool WriteFileDescriptor(const base::FileDescriptor& descriptor);
+  // True if WriteFileDescriptor() would find room for another descriptor.
+  bool CanWriteFileDescriptor() const;
+  // Get a file descriptor from the message. Returns false on error.
+  //   iter: a Pickle iterator to the current location in the message.
+  // The descriptor is handed over with auto_close set: the caller owns it,
+  // and each descriptor can be read once.  Those nobody reads are closed
+  // with the message.
+  bool ReadFileDescriptor(PickleIterator* iter,
+                          base::FileDescriptor* descriptor) const;
+
+  // Returns true if descriptors were written to this message.
+  bool HasFileDescriptors() const;
+#endif
+
 #ifdef IPC_MESSAGE_LOG_ENABLED
   // Adds the outgoing time from Time::Now() at the end of the message and sets
   // a bit to indicate that it's been added.
@@ -199,8 +342,12 @@ class IPC_EXPORT Message : public Pickle {
 #endif
 
  protected:
+  friend class BroadcastRing;
   friend class Channel;
+  friend class IOLoop;
+  friend class MessageReader;
   friend class MessageReplyDeserializer;
+  friend class SharedRing;
   friend class SyncMessage;
 
 
@@ -214,6 +361,10 @@ class IPC_EXPORT Message : public Pickle {
     UNBLOCK_BIT     = 0x0020,
     PUMPING_MSGS_BIT= 0x0040,
     HAS_SENT_TIME_BIT = 0x0080,
+    COMPACT_BIT     = 0x0100,
+    HAS_DEADLINE_BIT = 0x0200,
+    HAS_CHECKSUM_BIT = 0x0400,
+    COMPRESSED_BIT  = 0x0800,
   };
 
 #pragma pack(push, 2)
@@ -236,6 +387,37 @@ class IPC_EXPORT Message : public Pickle {
 
   void InitLoggingVariables();
 
+  // The end of the payload before the checksum trailer, if any.
+  const char* end_of_trailers() const;
+
+  // Bytes taken by the deadline and sent time trailers.
+  size_t trailers_size() const;
+
+  // Replaces the contents with the complete message in |buffer|.
+  void AdoptBuffer(const Buffer& buffer);
+
+  // Selects the Pickle encoding named by the header of received data.
+  void InitCompactFromHeader();
+
+#if defined(OS_POSIX)
+  // The set of file descriptors associated with this message, shared with
+  // its copies.  NULL until a descriptor is written or attached.
+  FileDescriptorSet* file_descriptor_set_;
+
+  // Ensure that a FileDescriptorSet is allocated
+  void EnsureFileDescriptorSet();
+
+  FileDescriptorSet* file_descriptor_set() {
+    EnsureFileDescriptorSet();
+    return file_descriptor_set_;
+  }
+  const FileDescriptorSet* file_descriptor_set() const {
+    return file_descriptor_set_;
+  }
+
+  // Makes this message share |set|, or none if it is NULL.
+  void SetFileDescriptorSet(FileDescriptorSet* set);
+#endif
 
 #ifdef IPC_MESSAGE_LOG_ENABLED
   // Used for logging.
@@ -260,5 +442,7 @@ enum SpecialRoutingIDs {
 
 #define IPC_REPLY_ID 0xFFF0  // Special message id for replies
 #define IPC_LOGGING_ID 0xFFF1  // Special message id for logging
+#define IPC_BATCH_ID 0xFFF2  // Special message id for MessageBatch
+#define IPC_CHUNK_ID 0xFFF3  // Special message id for ChunkedStreamWriter
 
 #endif  // CHROME_COMMON_IPC_MESSAGE_H__
@@ -0,0 +1,102 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPC_IPC_MESSAGE_BATCH_H_
+#define IPC_IPC_MESSAGE_BATCH_H_
+
+#include <vector>
+
+#include "base/basictypes.h"
+#include "ipc/ipc_export.h"
+#include "ipc/ipc_message.h"
+
+namespace IPC {
+
+// A message that carries many other messages, so that a burst of small
+// messages costs one frame, and one write, instead of one each.
+//
+// The payload holds the inner messages exactly as Message::data() lays them
+// out, each starting on a 4-byte boundary, followed by a table with the
+// offset of each one and finally the number of messages:
+//
+//   | message 0 | message 1 | ... | offset 0 | offset 1 | ... | count |
+//
+// so the receiver can find any inner message in constant time and read it
+// in place.  Unlike ParamTraits<Message>, which rebuilds the nested message
+// from a few header fields, the inner headers are stored verbatim, so both
+// ends must agree on the Message header layout.
+//
+//   IPC::MessageBatch batch;
+//   batch.AddMessage(FooMsg_Update(1, 2));
+//   batch.AddMessage(FooMsg_Update(3, 4));
+//   batch.Finish();
+//   sender->Send(new IPC::MessageBatch(batch));
+//
+// and on the receiving side, for a message of type IPC_BATCH_ID:
+//
+//   IPC::MessageBatch::Reader reader;
+//   if (!reader.Init(message))
+//     return false;
+//   for (size_t i = 0; i < reader.size(); ++i) {
+//     const char* data;
+//     int size;
+//     if (!reader.GetMessageData(i, &data, &size))
+//       return false;
+//     IPC::Message inner(data, size);
+//     OnMessageReceived(inner);
+//   }
+class IPC_EXPORT MessageBatch : public Message {
+ public:
+  enum { ID = IPC_BATCH_ID };
+
+  // Reads the inner messages of a received batch.
+  class IPC_EXPORT Reader {
+   public:
+    Reader();
+
+    // Checks the layout of the offset table of |batch|, which must outlive
+    // the Reader.  Returns false if it is malformed.
+    bool Init(const Message& batch);
+
+    // The number of inner messages.
+    size_t size() const { return count_; }
+
+    // Points |*data| at the |*size| bytes of inner message |index|, header
+    // included, inside the batch's buffer.  Wrap them in
+    // Message(const char*, int) to read the message without copying.
+    // Returns false if |index| is out of range, the message is malformed or
+    // its checksum does not match.
+    bool GetMessageData(size_t index, const char** data, int* size) const;
+
+   private:
+    const char* payload_;
+    // The offset table starts here, relative to |payload_|.
+    size_t table_offset_;
+    size_t count_;
+  };
+
+  explicit MessageBatch(int32 routing_id = MSG_ROUTING_CONTROL,
+                        PriorityValue priority = PRIORITY_NORMAL);
+  virtual ~MessageBatch();
+
+  // Appends a copy of |message|, which may itself be compact.  Must not be
+  // called after Finish().
+  void AddMessage(const Message& message);
+
+  // The number of messages added so far.
+  size_t message_count() const { return offsets_.size(); }
+
+  // Writes the offset table.  Must be called once, after the last
+  // AddMessage() and before the batch is sent.
+  void Finish();
+
+ private:
+  // The payload offset of each inner message.
+  std::vector<uint32> offsets_;
+  bool finished_;
+};
+
+}  // namespace IPC
+
+#endif  // IPC_IPC_MESSAGE_BATCH_H_
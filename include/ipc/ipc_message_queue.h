@@ -0,0 +1,95 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPC_IPC_MESSAGE_QUEUE_H_
+#define IPC_IPC_MESSAGE_QUEUE_H_
+
+#include <queue>
+
+#include "base/basictypes.h"
+#include "ipc/ipc_export.h"
+#include "ipc/ipc_message.h"
+
+namespace IPC {
+
+// A queue of messages that honors Message::priority(), for messages waiting
+// to be written to a channel as well as for messages waiting to be
+// dispatched.  Pop() returns the oldest message of the highest priority,
+// except that a lower priority that has been passed over max_skips() times
+// in a row is served next, so bulk traffic can delay control messages but
+// control messages cannot starve bulk traffic.
+//
+// Asynchronous messages whose deadline has passed (see
+// Message::set_deadline()) are dropped by Pop() instead of being returned.
+// Synchronous ones are still returned, so that the dispatcher can answer
+// them with an error rather than leave the sender waiting.
+//
+// The queue owns the messages in it.  It is not thread safe.
+class IPC_EXPORT MessageQueue {
+ public:
+  // Counters kept for each priority.
+  struct Stats {
+    Stats();
+
+    size_t depth;      // Messages queued now.
+    size_t max_depth;  // The largest |depth| seen.
+    uint64 pushed;     // Messages queued in total.
+    uint64 popped;     // Messages returned by Pop().
+    uint64 expired;    // Messages dropped because of their deadline.
+    uint64 promoted;   // Pops served ahead of a higher priority because of
+                       // max_skips().
+  };
+
+  // The default starvation bound.
+  static const int kDefaultMaxSkips = 16;
+
+  explicit MessageQueue(int max_skips = kDefaultMaxSkips);
+  ~MessageQueue();
+
+  // Queues |message| and takes ownership of it.  Messages without a valid
+  // priority count as PRIORITY_NORMAL.
+  void Push(Message* message);
+
+  // Removes the next message and returns it, with ownership, or returns NULL
+  // if the queue is empty.
+  Message* Pop();
+
+  // Deletes every queued message.  The counters are kept.
+  void Clear();
+
+  bool empty() const { return size() == 0; }
+  size_t size() const;
+
+  const Stats& stats(Message::PriorityValue priority) const {
+    return levels_[LevelOf(priority)].stats;
+  }
+
+  int max_skips() const { return max_skips_; }
+
+ private:
+  enum { kNumLevels = Message::PRIORITY_HIGH };
+
+  struct Level {
+    Level();
+
+    std::queue<Message*> messages;
+    // Pops that went to a higher priority while this one was waiting.
+    int skips;
+    Stats stats;
+  };
+
+  static int LevelOf(int priority);
+
+  // Returns the level Pop() should take from next, or -1 if all are empty.
+  int NextLevel() const;
+
+  Level levels_[kNumLevels];
+  int max_skips_;
+
+  DISALLOW_COPY_AND_ASSIGN(MessageQueue);
+};
+
+}  // namespace IPC
+
+#endif  // IPC_IPC_MESSAGE_QUEUE_H_
@@ -0,0 +1,169 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPC_IPC_MESSAGE_READER_H_
+#define IPC_IPC_MESSAGE_READER_H_
+
+#include <vector>
+
+#include "base/basictypes.h"
+#include "ipc/ipc_export.h"
+
+namespace IPC {
+
+// MessageReader turns a byte stream into messages.  A transport reads into
+// the buffer returned by GetWriteBuffer() and reports how much it got with
+// DidWrite(); the reader then hands out each complete message as a pointer
+// into that buffer, framed the way Message::FindNext() frames them:
+//
+//   size_t size;
+//   char* buffer = reader.GetWriteBuffer(&size);
+//   ssize_t bytes_read = read(fd, buffer, size);
+//   if (bytes_read <= 0) ...
+//   reader.DidWrite(bytes_read);
+//
+//   const char* data;
+//   int data_size;
+//   while (reader.ReadMessage(&data, &data_size) ==
+//          IPC::MessageReader::MESSAGE_READY) {
+//     IPC::Message message(data, data_size);
+//     listener->OnMessageReceived(message);
+//   }
+//
+// Reads may end anywhere, including in the middle of a header.  Once the
+// size of a partially received message is known, GetWriteBuffer() makes
+// room for all of it, so a large message is read straight into place rather
+// than assembled from pieces.  The bytes left over after the last complete
+// message are only moved to the front of the buffer when more room is
+// needed, and are then at most one partial message.  A buffer that grew
+// for a large message shrinks back once that message has been read.
+//
+// Messages are handed out 4-byte aligned, as Message expects.  Compact
+// messages can have any length, so the message after one may start
+// unaligned; such a message alone is copied into a scratch buffer of the
+// reader's, and all other messages are read in place.  Nothing is moved
+// while messages that were handed out may still point at it.
+//
+// Compressed messages (see Message::Compress()) are handed out as they
+// arrived, after their checksum has been checked; Message::Decompress()
+// then decodes them into a buffer of their own.
+//
+// A transport that receives into buffers of its own, such as ones it lent
+// the kernel, hands them over with Borrow() instead: the messages that lie
+// wholly inside such a buffer are handed out from it, and only a message
+// that continues into the next buffer is copied.
+class IPC_EXPORT MessageReader {
+ public:
+  enum Status {
+    // |*data| and |*size| describe the next message.
+    MESSAGE_READY,
+    // No complete message is buffered.
+    NEED_MORE_DATA,
+    // The next message would be larger than max_message_size().  The
+    // stream cannot be resynchronized, so the reader keeps returning this.
+    MESSAGE_TOO_LARGE,
+    // The next message carries a checksum (see Message::AddChecksum()) that
+    // does not match its contents.  The message is skipped; whether the
+    // stream can still be trusted is up to the caller.
+    CHECKSUM_MISMATCH,
+    // The header of the next message announces trailers that its payload
+    // is too small to hold (see Message::VerifyTrailers()).  The message is
+    // skipped, as for CHECKSUM_MISMATCH.
+    MALFORMED_MESSAGE
+  };
+
+  // The default limit on the size of a message, header included.
+  static const size_t kDefaultMaxMessageSize = 128 * 1024 * 1024;
+
+  // The free space GetWriteBuffer() offers at the least.
+  static const size_t kReadBufferSize = 4 * 1024;
+
+  // |max_message_size| may not exceed kint32max.
+  explicit MessageReader(size_t max_message_size = kDefaultMaxMessageSize);
+  ~MessageReader();
+
+  // Returns the free space at the end of the buffer and its size, which is
+  // at least kReadBufferSize.  Invalidates the messages handed out so far.
+  char* GetWriteBuffer(size_t* size);
+
+  // Records that |bytes| were stored at the start of the space returned by
+  // the last GetWriteBuffer().
+  void DidWrite(size_t bytes);
+
+  // Copies |size| bytes into the buffer.  For transports that do not read
+  // into a buffer of their choosing.  Invalidates the messages handed out so
+  // far.
+  void Append(const char* data, size_t size);
+
+  // Adds |size| bytes at |data| to the stream without copying what it can
+  // avoid to.  Must only be called once ReadMessage() has returned
+  // NEED_MORE_DATA, and ReadMessage() must then be called until it does so
+  // again before |data| goes away; the bytes of a message that |data| ends
+  // in the middle of are copied by then.
+  void Borrow(const char* data, size_t size);
+
+  // Takes the next complete message out of the buffer.  On MESSAGE_READY,
+  // |*data| points at |*size| bytes holding the message, header included,
+  // which stay valid until the next call to a non-const method other than
+  // ReadMessage() itself.  Wrap them in Message(const char*, int) to read
+  // them without copying, or copy the Message to keep it longer.
+  Status ReadMessage(const char** data, int* size);
+
+  // Bytes received but not yet handed out as messages.
+  size_t pending_bytes() const { return end_ - begin_ + borrowed_size_; }
+
+  size_t max_message_size() const { return max_message_size_; }
+
+ private:
+  // The pending bytes that are in the buffer.
+  size_t buffered_bytes() const { return end_ - begin_; }
+
+  // Sets |*size| to the size of the message at |begin_|, if enough of its
+  // header has arrived to tell.
+  bool GetPendingMessageSize(size_t* size) const;
+
+  // Moves the pending bytes to the start of the buffer.
+  void MoveToFront();
+
+  // Copies the |size| bytes at |data| to a 4-byte aligned place in the
+  // scratch buffer that stays put until ReleaseHandedOut().
+  const char* CopyToScratch(const char* data, size_t size);
+
+  // Adds |size| bytes to the buffer from within ReadMessage(), where the
+  // messages handed out so far must stay where they are.
+  void AppendWithoutMoving(const char* data, size_t size);
+
+  // Frees the memory that only messages handed out so far may still use.
+  // Called on entry to the methods that invalidate those messages.
+  void ReleaseHandedOut();
+
+  // Takes the next message out of the bytes passed to Borrow(), or copies
+  // them into the buffer if they do not hold one that can be handed out in
+  // place.
+  Status ReadBorrowedMessage(const char** data, int* size);
+
+  char* buffer_;
+  size_t capacity_;
+  // The pending bytes are [begin_, end_).
+  size_t begin_;
+  size_t end_;
+  size_t max_message_size_;
+  bool too_large_;
+  // What is left of the bytes passed to Borrow().  Only used while the
+  // buffer holds nothing pending.
+  const char* borrowed_;
+  size_t borrowed_size_;
+  // Unaligned messages are copied to [scratch_, scratch_ + scratch_used_).
+  char* scratch_;
+  size_t scratch_capacity_;
+  size_t scratch_used_;
+  // Buffers replaced while messages in them were still handed out.
+  std::vector<char*> retired_;
+
+  DISALLOW_COPY_AND_ASSIGN(MessageReader);
+};
+
+}  // namespace IPC
+
+#endif  // IPC_IPC_MESSAGE_READER_H_
@@ -5,6 +5,7 @@
 #ifndef IPC_IPC_MESSAGE_UTILS_H_
 #define IPC_IPC_MESSAGE_UTILS_H_
 
+#include <string.h>
 #include <algorithm>
 #include <map>
 #include <set>
@@ -72,7 +73,9 @@ class ListValue;
 //class Time;
 //class TimeDelta;
 //class TimeTicks;
-//struct FileDescriptor;
+#if defined(OS_POSIX)
+struct FileDescriptor;
+#endif
 }
 
 namespace IPC {
@@ -133,6 +136,92 @@ static inline void LogParam(const P& p, std::string* l) {
   ParamTraits<Type>::Log(static_cast<const Type& >(p), l);
 }
 
+// ParamTraits may also provide
+//
+//   static void GetSize(PickleSizer* sizer, const param_type& p);
+//
+// which feeds |sizer| the same sequence of fields Write() would write, so
+// that a message can be allocated at its final size before it is filled in.
+// All the traits in this file do.  Traits without GetSize() still work;
+// they only make the sizer report known() == false.
+template <class Traits>
+struct HasGetSize {
+  typedef char Yes;
+  struct No { char c[2]; };
+  template <class U> static Yes Test(char (*)[sizeof(&U::GetSize)]);
+  template <class U> static No Test(...);
+  static const bool value = sizeof(Test<Traits>(0)) == sizeof(Yes);
+};
+
+template <class P, bool = HasGetSize<ParamTraits<P> >::value>
+struct ParamSizer {
+  static void GetSize(PickleSizer* sizer, const P& p) {
+    ParamTraits<P>::GetSize(sizer, p);
+  }
+};
+
+template <class P>
+struct ParamSizer<P, false> {
+  static void GetSize(PickleSizer* sizer, const P& p) {
+    sizer->SetUnknown();
+  }
+};
+
+template <class P>
+static inline void GetParamSize(PickleSizer* sizer, const P& p) {
+  typedef typename SimilarTypeTraits<P>::Type Type;
+  ParamSizer<Type>::GetSize(sizer, static_cast<const Type& >(p));
+}
+
+// Grows |m| once to fit |p|, ahead of WriteParam(m, p).
+template <class P>
+static inline void ReserveParam(Message* m, const P& p) {
+  PickleSizer sizer(m->compact());
+  GetParamSize(&sizer, p);
+  m->ReserveExact(sizer.payload_size());
+}
+
+// ParamTraits may also provide
+//
+//   static bool Validate(const Message* m, PickleIterator* iter);
+//
+// which advances |iter| past one serialized param_type, failing wherever
+// Read() would fail, but without building the value; e.g. strings are
+// skipped rather than copied.  A message that validated can then be read
+// with an iterator that skips the bounds checks, see
+// PickleIterator::set_checked().  Traits without Validate() are validated
+// by reading into a temporary.
+template <class Traits>
+struct HasValidate {
+  typedef char Yes;
+  struct No { char c[2]; };
+  template <class U> static Yes Test(char (*)[sizeof(&U::Validate)]);
+  template <class U> static No Test(...);
+  static const bool value = sizeof(Test<Traits>(0)) == sizeof(Yes);
+};
+
+template <class P, bool = HasValidate<ParamTraits<P> >::value>
+struct ParamValidator {
+  static bool Validate(const Message* m, PickleIterator* iter) {
+    return ParamTraits<P>::Validate(m, iter);
+  }
+};
+
+template <class P>
+struct ParamValidator<P, false> {
+  static bool Validate(const Message* m, PickleIterator* iter) {
+    P p;
+    return ParamTraits<P>::Read(m, iter, &p);
+  }
+};
+
+template <class P>
+static inline bool WARN_UNUSED_RESULT ValidateParam(const Message* m,
+                                                    PickleIterator* iter) {
+  typedef typename SimilarTypeTraits<P>::Type Type;
+  return ParamValidator<Type>::Validate(m, iter);
+}
+
 // Primitive ParamTraits -------------------------------------------------------
 
 template <>
@@ -141,6 +230,9 @@ struct ParamTraits<bool> {
   static void Write(Message* m, const param_type& p) {
     m->WriteBool(p);
   }
+  static void GetSize(PickleSizer* sizer, const param_type& p) {
+    sizer->AddBool(p);
+  }
   static bool Read(const Message* m, PickleIterator* iter, param_type* r) {
     return m->ReadBool(iter, r);
   }
@@ -151,6 +243,7 @@ template <>
 struct IPC_EXPORT ParamTraits<unsigned char> {
   typedef unsigned char param_type;
   static void Write(Message* m, const param_type& p);
+  static void GetSize(PickleSizer* sizer, const param_type& p);
   static bool Read(const Message* m, PickleIterator* iter, param_type* r);
   static void Log(const param_type& p, std::string* l);
 };
@@ -159,6 +252,7 @@ template <>
 struct IPC_EXPORT ParamTraits<unsigned short> {
   typedef unsigned short param_type;
   static void Write(Message* m, const param_type& p);
+  static void GetSize(PickleSizer* sizer, const param_type& p);
   static bool Read(const Message* m, PickleIterator* iter, param_type* r);
   static void Log(const param_type& p, std::string* l);
 };
@@ -169,6 +263,9 @@ struct ParamTraits<int> {
   static void Write(Message* m, const param_type& p) {
     m->WriteInt(p);
   }
+  static void GetSize(PickleSizer* sizer, const param_type& p) {
+    sizer->AddInt(p);
+  }
   static bool Read(const Message* m, PickleIterator* iter, param_type* r) {
     return m->ReadInt(iter, r);
   }
@@ -181,6 +278,9 @@ struct ParamTraits<unsigned int> {
   static void Write(Message* m, const param_type& p) {
     m->WriteInt(p);
   }
+  static void GetSize(PickleSizer* sizer, const param_type& p) {
+    sizer->AddInt(p);
+  }
   static bool Read(const Message* m, PickleIterator* iter, param_type* r) {
     return m->ReadInt(iter, reinterpret_cast<int*>(r));
   }
@@ -193,6 +293,9 @@ struct ParamTraits<long> {
   static void Write(Message* m, const param_type& p) {
     m->WriteLongUsingDangerousNonPortableLessPersistableForm(p);
   }
+  static void GetSize(PickleSizer* sizer, const param_type& p) {
+    sizer->AddLongUsingDangerousNonPortableLessPersistableForm(p);
+  }
   static bool Read(const Message* m, PickleIterator* iter, param_type* r) {
     return m->ReadLong(iter, r);
   }
@@ -205,6 +308,9 @@ struct ParamTraits<unsigned long> {
   static void Write(Message* m, const param_type& p) {
     m->WriteLongUsingDangerousNonPortableLessPersistableForm(p);
   }
+  static void GetSize(PickleSizer* sizer, const param_type& p) {
+    sizer->AddLongUsingDangerousNonPortableLessPersistableForm(p);
+  }
   static bool Read(const Message* m, PickleIterator* iter, param_type* r) {
     return m->ReadLong(iter, reinterpret_cast<long*>(r));
   }
@@ -217,6 +323,9 @@ struct ParamTraits<long long> {
   static void Write(Message* m, const param_type& p) {
     m->WriteInt64(static_cast<int64>(p));
   }
+  static void GetSize(PickleSizer* sizer, const param_type& p) {
+    sizer->AddInt64(static_cast<int64>(p));
+  }
   static bool Read(const Message* m, PickleIterator* iter,
                    param_type* r) {
     return m->ReadInt64(iter, reinterpret_cast<int64*>(r));
@@ -230,6 +339,9 @@ struct ParamTraits<unsigned long long> {
   static void Write(Message* m, const param_type& p) {
     m->WriteInt64(p);
   }
+  static void GetSize(PickleSizer* sizer, const param_type& p) {
+    sizer->AddInt64(p);
+  }
   static bool Read(const Message* m, PickleIterator* iter,
                    param_type* r) {
     return m->ReadInt64(iter, reinterpret_cast<int64*>(r));
@@ -246,6 +358,9 @@ struct IPC_EXPORT ParamTraits<float> {
   static void Write(Message* m, const param_type& p) {
     m->WriteFloat(p);
   }
+  static void GetSize(PickleSizer* sizer, const param_type& p) {
+    sizer->AddFloat(p);
+  }
   static bool Read(const Message* m, PickleIterator* iter, param_type* r) {
     return m->ReadFloat(iter, r);
   }
@@ -256,6 +371,7 @@ template <>
 struct IPC_EXPORT ParamTraits<double> {
   typedef double param_type;
   static void Write(Message* m, const param_type& p);
+  static void GetSize(PickleSizer* sizer, const param_type& p);
   static bool Read(const Message* m, PickleIterator* iter, param_type* r);
   static void Log(const param_type& p, std::string* l);
 };
@@ -268,10 +384,17 @@ struct ParamTraits<std::string> {
   static void Write(Message* m, const param_type& p) {
     m->WriteString(p);
   }
+  static void GetSize(PickleSizer* sizer, const param_type& p) {
+    sizer->AddString(p);
+  }
   static bool Read(const Message* m, PickleIterator* iter,
                    param_type* r) {
     return m->ReadString(iter, r);
   }
+  static bool Validate(const Message* m, PickleIterator* iter) {
+    int length;
+    return m->ReadInt(iter, &length) && iter->SkipBytes(length);
+  }
   IPC_EXPORT static void Log(const param_type& p, std::string* l);
 };
 
@@ -281,35 +404,73 @@ struct ParamTraits<std::wstring> {
   static void Write(Message* m, const param_type& p) {
     m->WriteWString(p);
   }
+  static void GetSize(PickleSizer* sizer, const param_type& p) {
+    sizer->AddWString(p);
+  }
   static bool Read(const Message* m, PickleIterator* iter,
                    param_type* r) {
     return m->ReadWString(iter, r);
   }
+  static bool Validate(const Message* m, PickleIterator* iter) {
+    int length;
+    return m->ReadInt(iter, &length) && length >= 0 &&
+           static_cast<size_t>(length) <= INT_MAX / sizeof(wchar_t) &&
+           iter->SkipBytes(static_cast<int>(length * sizeof(wchar_t)));
+  }
   IPC_EXPORT static void Log(const param_type& p, std::string* l);
 };
 
-// If WCHAR_T_IS_UTF16 is defined, then string16 is a std::wstring so we don't
-// need this trait.
-#if !defined(WCHAR_T_IS_UTF16)
+// Serialized exactly like std::string, so either side may use either type.
+// A StringPiece that was read points into the message, which must outlive
+// it; a handler taking one borrows the string for the length of the
+// dispatch instead of receiving a copy.
 template <>
-struct ParamTraits<base::string16> {
-  typedef base::string16 param_type;
+struct ParamTraits<base::StringPiece> {
+  typedef base::StringPiece param_type;
   static void Write(Message* m, const param_type& p) {
-    m->WriteString16(p);
+    m->WriteInt(static_cast<int>(p.size()));
+    m->WriteBytes(p.data(), static_cast<int>(p.size()));
+  }
+  static void GetSize(PickleSizer* sizer, const param_type& p) {
+    sizer->AddInt(static_cast<int>(p.size()));
+    sizer->AddBytes(static_cast<int>(p.size()));
   }
   static bool Read(const Message* m, PickleIterator* iter,
                    param_type* r) {
-    return m->ReadString16(iter, r);
+    return m->ReadStringPiece(iter, r);
+  }
+  static bool Validate(const Message* m, PickleIterator* iter) {
+    return ParamTraits<std::string>::Validate(m, iter);
+  }
+  static void Log(const param_type& p, std::string* l) {
+    l->append(p.data(), p.size());
   }
-  IPC_EXPORT static void Log(const param_type& p, std::string* l);
 };
-#endif
+
+// If WCHAR_T_IS_UTF16 is defined, then string16 is a std::wstring so we don't
+// need this trait.
+//#if !defined(WCHAR_T_IS_UTF16)
+//template <>
+//struct ParamTraits<base::string16> {
+//  typedef base::string16 param_type;
+//  static void Write(Message* m, const param_type& p) {
+//    m->WriteString16(p);
+//  }
+//  static bool Read(const Message* m, PickleIterator* iter,
+//                   param_type* r) {
+//    return m->ReadString16(iter, r);
+//  }
+//  IPC_EXPORT static void Log(const param_type& p, std::string* l);
+//};
+//#endif
 
 template <>
 struct IPC_EXPORT ParamTraits<std::vector<char> > {
   typedef std::vector<char> param_type;
   static void Write(Message* m, const param_type& p);
+  static void GetSize(PickleSizer* sizer, const param_type& p);
   static bool Read(const Message*, PickleIterator* iter, param_type* r);
+  static bool Validate(const Message* m, PickleIterator* iter);
   static void Log(const param_type& p, std::string* l);
 };
 
@@ -317,7 +478,9 @@ template <>
 struct IPC_EXPORT ParamTraits<std::vector<unsigned char> > {
   typedef std::vector<unsigned char> param_type;
   static void Write(Message* m, const param_type& p);
+  static void GetSize(PickleSizer* sizer, const param_type& p);
   static bool Read(const Message* m, PickleIterator* iter, param_type* r);
+  static bool Validate(const Message* m, PickleIterator* iter);
   static void Log(const param_type& p, std::string* l);
 };
 
@@ -325,17 +488,228 @@ template <>
 struct IPC_EXPORT ParamTraits<std::vector<bool> > {
   typedef std::vector<bool> param_type;
   static void Write(Message* m, const param_type& p);
+  static void GetSize(PickleSizer* sizer, const param_type& p);
   static bool Read(const Message* m, PickleIterator* iter, param_type* r);
   static void Log(const param_type& p, std::string* l);
 };
 
+// How arrays of an element type are serialized.  ARRAY_BLOCK writes the
+// element count followed by the elements' bytes, padded once at the end.
+// Outside compact mode that is exactly what writing them one at a time
+// produces for 4- and 8-byte types; for char and unsigned char it is what
+// the std::vector traits' WriteData() produces, so ArrayView<char> serves
+// as a byte span.  Types that ParamTraits writes as varints in compact mode
+// are ARRAY_BLOCK_UNLESS_COMPACT.
+enum ArrayEncoding {
+  ARRAY_ELEMENTWISE,
+  ARRAY_BLOCK,
+  ARRAY_BLOCK_UNLESS_COMPACT
+};
+
+template <class P>
+struct ArrayElementTraits {
+  static const ArrayEncoding kEncoding = ARRAY_ELEMENTWISE;
+};
+
+#define IPC_ARRAY_ELEMENT_TYPE(type, encoding)        \
+  template <>                                         \
+  struct ArrayElementTraits<type> {                   \
+    static const ArrayEncoding kEncoding = encoding;  \
+  };
+
+IPC_ARRAY_ELEMENT_TYPE(char, ARRAY_BLOCK)
+IPC_ARRAY_ELEMENT_TYPE(unsigned char, ARRAY_BLOCK)
+IPC_ARRAY_ELEMENT_TYPE(unsigned short, ARRAY_BLOCK)
+IPC_ARRAY_ELEMENT_TYPE(int, ARRAY_BLOCK_UNLESS_COMPACT)
+IPC_ARRAY_ELEMENT_TYPE(unsigned int, ARRAY_BLOCK_UNLESS_COMPACT)
+IPC_ARRAY_ELEMENT_TYPE(long, ARRAY_BLOCK_UNLESS_COMPACT)
+IPC_ARRAY_ELEMENT_TYPE(unsigned long, ARRAY_BLOCK_UNLESS_COMPACT)
+IPC_ARRAY_ELEMENT_TYPE(long long, ARRAY_BLOCK_UNLESS_COMPACT)
+IPC_ARRAY_ELEMENT_TYPE(unsigned long long, ARRAY_BLOCK_UNLESS_COMPACT)
+IPC_ARRAY_ELEMENT_TYPE(float, ARRAY_BLOCK)
+IPC_ARRAY_ELEMENT_TYPE(double, ARRAY_BLOCK)
+
+#undef IPC_ARRAY_ELEMENT_TYPE
+
+template <class P, ArrayEncoding> struct ArrayParamTraits;
+
+// A read-only array of P, serialized exactly like std::vector<P>.
+//
+// On the sending side it wraps the caller's memory, so the elements need
+// not be copied into a vector first.  Read from a message, it points
+// straight into the message's buffer when the elements are stored as one
+// block that happens to be aligned for P, and otherwise holds a copy of
+// its own.  Either way it must not outlive the message it was read from.
+template <class P>
+class ArrayView {
+ public:
+  ArrayView() : data_(NULL), size_(0) {}
+  ArrayView(const P* data, size_t size) : data_(data), size_(size) {}
+  explicit ArrayView(const std::vector<P>& v)
+      : data_(v.empty() ? NULL : &v.front()), size_(v.size()) {}
+  ArrayView(const ArrayView& other) { *this = other; }
+
+  ArrayView& operator=(const ArrayView& other) {
+    if (other.owns_data()) {
+      copy_ = other.copy_;
+      data_ = &copy_.front();
+    } else {
+      copy_.clear();
+      data_ = other.data_;
+    }
+    size_ = other.size_;
+    return *this;
+  }
+
+  const P* data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  const P* begin() const { return data_; }
+  const P* end() const { return data_ + size_; }
+  const P& operator[](size_t i) const { return data_[i]; }
+
+  // True if the elements live in this object rather than in the caller's
+  // memory or a message.
+  bool owns_data() const { return !copy_.empty(); }
+
+ private:
+  template <class, ArrayEncoding> friend struct ArrayParamTraits;
+
+  const P* data_;
+  size_t size_;
+  std::vector<P> copy_;
+};
+
+// Reads and writes arrays of |size| elements of type P for the std::vector
+// and ArrayView traits.  The generic version goes through ParamTraits<P>
+// element by element.
+template <class P, ArrayEncoding = ArrayElementTraits<P>::kEncoding>
+struct ArrayParamTraits {
+  static void Write(Message* m, const P* p, size_t size) {
+    WriteParam(m, static_cast<int>(size));
+    for (size_t i = 0; i < size; i++)
+      WriteParam(m, p[i]);
+  }
+  static void GetSize(PickleSizer* sizer, const P* p, size_t size) {
+    sizer->AddInt(static_cast<int>(size));
+    for (size_t i = 0; i < size; i++)
+      GetParamSize(sizer, p[i]);
+  }
+  // Reads the elements following the count into |r|.
+  static bool ReadElements(const Message* m, PickleIterator* iter, int size,
+                           std::vector<P>* r) {
+    r->resize(size);
+    for (int i = 0; i < size; i++) {
+      if (!ReadParam(m, iter, &(*r)[i]))
+        return false;
+    }
+    return true;
+  }
+  static bool ReadView(const Message* m, PickleIterator* iter, int size,
+                       ArrayView<P>* r) {
+    if (!ReadElements(m, iter, size, &r->copy_))
+      return false;
+    r->data_ = size ? &r->copy_.front() : NULL;
+    r->size_ = size;
+    return true;
+  }
+  static bool Validate(const Message* m, PickleIterator* iter, int size) {
+    for (int i = 0; i < size; i++) {
+      if (!ValidateParam<P>(m, iter))
+        return false;
+    }
+    return true;
+  }
+};
+
+template <class P>
+struct ArrayParamTraits<P, ARRAY_BLOCK> {
+  static void Write(Message* m, const P* p, size_t size) {
+    m->WriteInt(static_cast<int>(size));
+    m->WriteBytes(p, static_cast<int>(size * sizeof(P)));
+  }
+  static void GetSize(PickleSizer* sizer, const P* p, size_t size) {
+    sizer->AddInt(static_cast<int>(size));
+    sizer->AddBytes(static_cast<int>(size * sizeof(P)));
+  }
+  // The block is checked against the end of the message once.
+  static bool ReadElements(const Message* m, PickleIterator* iter, int size,
+                           std::vector<P>* r) {
+    const char* data;
+    if (!m->ReadBytes(iter, &data, static_cast<int>(size * sizeof(P))))
+      return false;
+    r->resize(size);
+    if (size)
+      memcpy(&r->front(), data, size * sizeof(P));
+    return true;
+  }
+  static bool ReadView(const Message* m, PickleIterator* iter, int size,
+                       ArrayView<P>* r) {
+    const char* data;
+    if (!m->ReadBytes(iter, &data, static_cast<int>(size * sizeof(P))))
+      return false;
+    r->size_ = size;
+    if (size == 0 || reinterpret_cast<uintptr_t>(data) % ALIGNOF(P) == 0) {
+      r->copy_.clear();
+      r->data_ = size ? reinterpret_cast<const P*>(data) : NULL;
+      return true;
+    }
+    // Only 8-byte types can be misaligned, or any type in compact mode.
+    r->copy_.resize(size);
+    memcpy(&r->copy_.front(), data, size * sizeof(P));
+    r->data_ = &r->copy_.front();
+    return true;
+  }
+  static bool Validate(const Message* m, PickleIterator* iter, int size) {
+    return iter->SkipBytes(static_cast<int>(size * sizeof(P)));
+  }
+};
+
+template <class P>
+struct ArrayParamTraits<P, ARRAY_BLOCK_UNLESS_COMPACT> {
+  typedef ArrayParamTraits<P, ARRAY_BLOCK> Block;
+  typedef ArrayParamTraits<P, ARRAY_ELEMENTWISE> Elementwise;
+
+  static void Write(Message* m, const P* p, size_t size) {
+    if (m->compact())
+      Elementwise::Write(m, p, size);
+    else
+      Block::Write(m, p, size);
+  }
+  static void GetSize(PickleSizer* sizer, const P* p, size_t size) {
+    if (sizer->compact())
+      Elementwise::GetSize(sizer, p, size);
+    else
+      Block::GetSize(sizer, p, size);
+  }
+  static bool ReadElements(const Message* m, PickleIterator* iter, int size,
+                           std::vector<P>* r) {
+    if (m->compact())
+      return Elementwise::ReadElements(m, iter, size, r);
+    return Block::ReadElements(m, iter, size, r);
+  }
+  static bool ReadView(const Message* m, PickleIterator* iter, int size,
+                       ArrayView<P>* r) {
+    if (m->compact())
+      return Elementwise::ReadView(m, iter, size, r);
+    return Block::ReadView(m, iter, size, r);
+  }
+  static bool Validate(const Message* m, PickleIterator* iter, int size) {
+    if (m->compact())
+      return Elementwise::Validate(m, iter, size);
+    return Block::Validate(m, iter, size);
+  }
+};
+
 template <class P>
 struct ParamTraits<std::vector<P> > {
   typedef std::vector<P> param_type;
   static void Write(Message* m, const param_type& p) {
-    WriteParam(m, static_cast<int>(p.size()));
-    for (size_t i = 0; i < p.size(); i++)
-      WriteParam(m, p[i]);
+    ArrayParamTraits<P>::Write(m, p.empty() ? NULL : &p.front(), p.size());
+  }
+  static void GetSize(PickleSizer* sizer, const param_type& p) {
+    ArrayParamTraits<P>::GetSize(sizer, p.empty() ? NULL : &p.front(),
+                                 p.size());
   }
   static bool Read(const Message* m, PickleIterator* iter,
                    param_type* r) {
@@ -346,12 +720,15 @@ struct ParamTraits<std::vector<P> > {
     // Resizing beforehand is not safe, see BUG 1006367 for details.
     if (INT_MAX / sizeof(P) <= static_cast<size_t>(size))
       return false;
-    r->resize(size);
-    for (int i = 0; i < size; i++) {
-      if (!ReadParam(m, iter, &(*r)[i]))
-        return false;
-    }
-    return true;
+    return ArrayParamTraits<P>::ReadElements(m, iter, size, r);
+  }
+  static bool Validate(const Message* m, PickleIterator* iter) {
+    int size;
+    if (!m->ReadLength(iter, &size))
+      return false;
+    if (INT_MAX / sizeof(P) <= static_cast<size_t>(size))
+      return false;
+    return ArrayParamTraits<P>::Validate(m, iter, size);
   }
   static void Log(const param_type& p, std::string* l) {
     for (size_t i = 0; i < p.size(); ++i) {
@@ -362,6 +739,36 @@ struct ParamTraits<std::vector<P> > {
   }
 };
 
+template <class P>
+struct ParamTraits<ArrayView<P> > {
+  typedef ArrayView<P> param_type;
+  static void Write(Message* m, const param_type& p) {
+    ArrayParamTraits<P>::Write(m, p.data(), p.size());
+  }
+  static void GetSize(PickleSizer* sizer, const param_type& p) {
+    ArrayParamTraits<P>::GetSize(sizer, p.data(), p.size());
+  }
+  static bool Read(const Message* m, PickleIterator* iter,
+                   param_type* r) {
+    int size;
+    if (!m->ReadLength(iter, &size))
+      return false;
+    if (INT_MAX / sizeof(P) <= static_cast<size_t>(size))
+      return false;
+    return ArrayParamTraits<P>::ReadView(m, iter, size, r);
+  }
+  static bool Validate(const Message* m, PickleIterator* iter) {
+    return ParamTraits<std::vector<P> >::Validate(m, iter);
+  }
+  static void Log(const param_type& p, std::string* l) {
+    for (size_t i = 0; i < p.size(); ++i) {
+      if (i != 0)
+        l->append(" ");
+      LogParam(p[i], l);
+    }
+  }
+};
+
 template <class P>
 struct ParamTraits<std::set<P> > {
   typedef std::set<P> param_type;
@@ -371,6 +778,12 @@ struct ParamTraits<std::set<P> > {
     for (iter = p.begin(); iter != p.end(); ++iter)
       WriteParam(m, *iter);
   }
+  static void GetSize(PickleSizer* sizer, const param_type& p) {
+    sizer->AddInt(static_cast<int>(p.size()));
+    typename param_type::const_iterator iter;
+    for (iter = p.begin(); iter != p.end(); ++iter)
+      GetParamSize(sizer, *iter);
+  }
   static bool Read(const Message* m, PickleIterator* iter,
                    param_type* r) {
     int size;
@@ -384,6 +797,16 @@ struct ParamTraits<std::set<P> > {
     }
     return true;
   }
+  static bool Validate(const Message* m, PickleIterator* iter) {
+    int size;
+    if (!m->ReadLength(iter, &size))
+      return false;
+    for (int i = 0; i < size; ++i) {
+      if (!ValidateParam<P>(m, iter))
+        return false;
+    }
+    return true;
+  }
   static void Log(const param_type& p, std::string* l) {
     l->append("<std::set>");
   }
@@ -400,6 +823,14 @@ struct ParamTraits<std::map<K, V> > {
       WriteParam(m, iter->second);
     }
   }
+  static void GetSize(PickleSizer* sizer, const param_type& p) {
+    sizer->AddInt(static_cast<int>(p.size()));
+    typename param_type::const_iterator iter;
+    for (iter = p.begin(); iter != p.end(); ++iter) {
+      GetParamSize(sizer, iter->first);
+      GetParamSize(sizer, iter->second);
+    }
+  }
   static bool Read(const Message* m, PickleIterator* iter,
                    param_type* r) {
     int size;
@@ -415,6 +846,16 @@ struct ParamTraits<std::map<K, V> > {
     }
     return true;
   }
+  static bool Validate(const Message* m, PickleIterator* iter) {
+    int size;
+    if (!ReadParam(m, iter, &size) || size < 0)
+      return false;
+    for (int i = 0; i < size; ++i) {
+      if (!ValidateParam<K>(m, iter) || !ValidateParam<V>(m, iter))
+        return false;
+    }
+    return true;
+  }
   static void Log(const param_type& p, std::string* l) {
     l->append("<std::map>");
   }
@@ -427,10 +868,17 @@ struct ParamTraits<std::pair<A, B> > {
     WriteParam(m, p.first);
     WriteParam(m, p.second);
   }
+  static void GetSize(PickleSizer* sizer, const param_type& p) {
+    GetParamSize(sizer, p.first);
+    GetParamSize(sizer, p.second);
+  }
   static bool Read(const Message* m, PickleIterator* iter,
                    param_type* r) {
     return ReadParam(m, iter, &r->first) && ReadParam(m, iter, &r->second);
   }
+  static bool Validate(const Message* m, PickleIterator* iter) {
+    return ValidateParam<A>(m, iter) && ValidateParam<B>(m, iter);
+  }
   static void Log(const param_type& p, std::string* l) {
     l->append("(");
     LogParam(p.first, l);
@@ -446,6 +894,7 @@ template <>
 struct IPC_EXPORT ParamTraits<base::DictionaryValue> {
   typedef base::DictionaryValue param_type;
   static void Write(Message* m, const param_type& p);
+  static void GetSize(PickleSizer* sizer, const param_type& p);
   static bool Read(const Message* m, PickleIterator* iter, param_type* r);
   static void Log(const param_type& p, std::string* l);
 };
@@ -466,13 +915,22 @@ struct IPC_EXPORT ParamTraits<base::DictionaryValue> {
 // of transmission. Since transmission is not synchronous, one should consider
 // dup()ing any file descriptors to be transmitted and setting the |auto_close|
 // flag, which causes the file descriptor to be closed after writing.
-//template<>
-//struct IPC_EXPORT ParamTraits<base::FileDescriptor> {
-//  typedef base::FileDescriptor param_type;
-//  static void Write(Message* m, const param_type& p);
-//  static bool Read(const Message* m, PickleIterator* iter, param_type* r);
-//  static void Log(const param_type& p, std::string* l);
-//};
+//
+// A message carries at most FileDescriptorSet::kMaxDescriptorsPerMessage
+// descriptors.  Any beyond that are written as invalid, and closed if
+// |auto_close| is set, so the receiver sees -1 for them.
+//
+// Validate() checks the index a descriptor is written as without taking the
+// descriptor, which a descriptor can only be once.
+template<>
+struct IPC_EXPORT ParamTraits<base::FileDescriptor> {
+  typedef base::FileDescriptor param_type;
+  static void Write(Message* m, const param_type& p);
+  static void GetSize(PickleSizer* sizer, const param_type& p);
+  static bool Read(const Message* m, PickleIterator* iter, param_type* r);
+  static bool Validate(const Message* m, PickleIterator* iter);
+  static void Log(const param_type& p, std::string* l);
+};
 #endif  // defined(OS_POSIX)
 
 //template <>
@@ -487,6 +945,7 @@ template <>
 struct IPC_EXPORT ParamTraits<base::ListValue> {
   typedef base::ListValue param_type;
   static void Write(Message* m, const param_type& p);
+  static void GetSize(PickleSizer* sizer, const param_type& p);
   static bool Read(const Message* m, PickleIterator* iter, param_type* r);
   static void Log(const param_type& p, std::string* l);
 };
@@ -544,14 +1003,221 @@ struct IPC_EXPORT ParamTraits<base::ListValue> {
 //  static void Log(const param_type& p, std::string* l);
 //};
 //
+
+// Fixed-layout tuples ---------------------------------------------------------
+//
+// Outside compact mode, ParamTraits of the arithmetic types below always
+// write sizeof(P) bytes padded to 4, so a tuple of nothing but those has a
+// layout known at compile time.  Such tuples are written with a single
+// Pickle::ClaimBytes() followed by direct stores, and read with a single
+// bounds check followed by direct loads; the bytes on the wire are the same
+// as writing the fields one at a time.  In compact mode the fields are
+// varints and the tuple traits fall back to the per-field path.
+template <class P>
+struct FixedLayoutTraits {
+  static const bool kFixed = false;
+  static const size_t kSize = 0;
+};
+
+template <class P>
+struct FixedLayoutTraits<const P> : FixedLayoutTraits<P> {};
+
+template <class P>
+struct FixedLayoutTraits<P&> : FixedLayoutTraits<P> {};
+
+#define IPC_FIXED_LAYOUT_TYPE(type)                          \
+  template <>                                                \
+  struct FixedLayoutTraits<type> {                           \
+    static const bool kFixed = true;                         \
+    static const size_t kSize = (sizeof(type) + 3) & ~3;     \
+    static void Store(char* dst, const type& p) {            \
+      memcpy(dst, &p, sizeof(type));                         \
+    }                                                        \
+    static void Load(const char* src, type* r) {             \
+      memcpy(r, src, sizeof(type));                          \
+    }                                                        \
+  };
+
+IPC_FIXED_LAYOUT_TYPE(unsigned char)
+IPC_FIXED_LAYOUT_TYPE(unsigned short)
+IPC_FIXED_LAYOUT_TYPE(int)
+IPC_FIXED_LAYOUT_TYPE(unsigned int)
+IPC_FIXED_LAYOUT_TYPE(long)
+IPC_FIXED_LAYOUT_TYPE(unsigned long)
+IPC_FIXED_LAYOUT_TYPE(long long)
+IPC_FIXED_LAYOUT_TYPE(unsigned long long)
+IPC_FIXED_LAYOUT_TYPE(float)
+IPC_FIXED_LAYOUT_TYPE(double)
+
+#undef IPC_FIXED_LAYOUT_TYPE
+
+// Pickle::WriteBool() writes an int.
+template <>
+struct FixedLayoutTraits<bool> {
+  static const bool kFixed = true;
+  static const size_t kSize = sizeof(int);
+  static void Store(char* dst, const bool& p) {
+    int value = p ? 1 : 0;
+    memcpy(dst, &value, sizeof(value));
+  }
+  static void Load(const char* src, bool* r) {
+    int value;
+    memcpy(&value, src, sizeof(value));
+    *r = value != 0;
+  }
+};
+
+template <class A>
+struct FixedLayoutTraits< Tuple1<A> > {
+  typedef FixedLayoutTraits<A> TA;
+  static const bool kFixed = TA::kFixed;
+  static const size_t kSize = TA::kSize;
+  static void Store(char* dst, const Tuple1<A>& p) {
+    TA::Store(dst, p.a);
+  }
+  static void Load(const char* src, Tuple1<A>* r) {
+    TA::Load(src, &r->a);
+  }
+};
+
+template <class A, class B>
+struct FixedLayoutTraits< Tuple2<A, B> > {
+  typedef FixedLayoutTraits<A> TA;
+  typedef FixedLayoutTraits<B> TB;
+  static const bool kFixed = TA::kFixed && TB::kFixed;
+  static const size_t kSize = TA::kSize + TB::kSize;
+  static void Store(char* dst, const Tuple2<A, B>& p) {
+    TA::Store(dst, p.a);
+    TB::Store(dst + TA::kSize, p.b);
+  }
+  static void Load(const char* src, Tuple2<A, B>* r) {
+    TA::Load(src, &r->a);
+    TB::Load(src + TA::kSize, &r->b);
+  }
+};
+
+template <class A, class B, class C>
+struct FixedLayoutTraits< Tuple3<A, B, C> > {
+  typedef FixedLayoutTraits<A> TA;
+  typedef FixedLayoutTraits<B> TB;
+  typedef FixedLayoutTraits<C> TC;
+  static const bool kFixed = TA::kFixed && TB::kFixed && TC::kFixed;
+  static const size_t kSize = TA::kSize + TB::kSize + TC::kSize;
+  static void Store(char* dst, const Tuple3<A, B, C>& p) {
+    TA::Store(dst, p.a);
+    TB::Store(dst += TA::kSize, p.b);
+    TC::Store(dst += TB::kSize, p.c);
+  }
+  static void Load(const char* src, Tuple3<A, B, C>* r) {
+    TA::Load(src, &r->a);
+    TB::Load(src += TA::kSize, &r->b);
+    TC::Load(src += TB::kSize, &r->c);
+  }
+};
+
+template <class A, class B, class C, class D>
+struct FixedLayoutTraits< Tuple4<A, B, C, D> > {
+  typedef FixedLayoutTraits<A> TA;
+  typedef FixedLayoutTraits<B> TB;
+  typedef FixedLayoutTraits<C> TC;
+  typedef FixedLayoutTraits<D> TD;
+  static const bool kFixed =
+      TA::kFixed && TB::kFixed && TC::kFixed && TD::kFixed;
+  static const size_t kSize = TA::kSize + TB::kSize + TC::kSize + TD::kSize;
+  static void Store(char* dst, const Tuple4<A, B, C, D>& p) {
+    TA::Store(dst, p.a);
+    TB::Store(dst += TA::kSize, p.b);
+    TC::Store(dst += TB::kSize, p.c);
+    TD::Store(dst += TC::kSize, p.d);
+  }
+  static void Load(const char* src, Tuple4<A, B, C, D>* r) {
+    TA::Load(src, &r->a);
+    TB::Load(src += TA::kSize, &r->b);
+    TC::Load(src += TB::kSize, &r->c);
+    TD::Load(src += TC::kSize, &r->d);
+  }
+};
+
+template <class A, class B, class C, class D, class E>
+struct FixedLayoutTraits< Tuple5<A, B, C, D, E> > {
+  typedef FixedLayoutTraits<A> TA;
+  typedef FixedLayoutTraits<B> TB;
+  typedef FixedLayoutTraits<C> TC;
+  typedef FixedLayoutTraits<D> TD;
+  typedef FixedLayoutTraits<E> TE;
+  static const bool kFixed =
+      TA::kFixed && TB::kFixed && TC::kFixed && TD::kFixed && TE::kFixed;
+  static const size_t kSize =
+      TA::kSize + TB::kSize + TC::kSize + TD::kSize + TE::kSize;
+  static void Store(char* dst, const Tuple5<A, B, C, D, E>& p) {
+    TA::Store(dst, p.a);
+    TB::Store(dst += TA::kSize, p.b);
+    TC::Store(dst += TB::kSize, p.c);
+    TD::Store(dst += TC::kSize, p.d);
+    TE::Store(dst += TD::kSize, p.e);
+  }
+  static void Load(const char* src, Tuple5<A, B, C, D, E>* r) {
+    TA::Load(src, &r->a);
+    TB::Load(src += TA::kSize, &r->b);
+    TC::Load(src += TB::kSize, &r->c);
+    TD::Load(src += TC::kSize, &r->d);
+    TE::Load(src += TD::kSize, &r->e);
+  }
+};
+
+// Used by the tuple ParamTraits: Applies() tells whether |m| can take the
+// fixed-layout path, and the other methods must only be called if it can.
+template <class P, bool = FixedLayoutTraits<P>::kFixed>
+struct FixedLayoutParam {
+  typedef FixedLayoutTraits<P> Traits;
+
+  static bool Applies(bool compact) { return !compact; }
+  static void Write(Message* m, const P& p) {
+    Traits::Store(m->ClaimBytes(Traits::kSize), p);
+  }
+  static void GetSize(PickleSizer* sizer) {
+    sizer->AddBytes(static_cast<int>(Traits::kSize));
+  }
+  static bool Read(const Message* m, PickleIterator* iter, P* r) {
+    const char* data;
+    if (!m->ReadBytes(iter, &data, static_cast<int>(Traits::kSize)))
+      return false;
+    Traits::Load(data, r);
+    return true;
+  }
+  static bool Validate(const Message* m, PickleIterator* iter) {
+    return iter->SkipBytes(static_cast<int>(Traits::kSize));
+  }
+};
+
+template <class P>
+struct FixedLayoutParam<P, false> {
+  static bool Applies(bool compact) { return false; }
+  static void Write(Message* m, const P& p) {}
+  static void GetSize(PickleSizer* sizer) {}
+  static bool Read(const Message* m, PickleIterator* iter, P* r) {
+    return false;
+  }
+  static bool Validate(const Message* m, PickleIterator* iter) {
+    return false;
+  }
+};
+
+// Tuple ParamTraits -----------------------------------------------------------
+
 template <>
 struct ParamTraits<Tuple0> {
   typedef Tuple0 param_type;
   static void Write(Message* m, const param_type& p) {
   }
+  static void GetSize(PickleSizer* sizer, const param_type& p) {
+  }
   static bool Read(const Message* m, PickleIterator* iter, param_type* r) {
     return true;
   }
+  static bool Validate(const Message* m, PickleIterator* iter) {
+    return true;
+  }
   static void Log(const param_type& p, std::string* l) {
   }
 };
@@ -559,12 +1225,31 @@ struct ParamTraits<Tuple0> {
 template <class A>
 struct ParamTraits< Tuple1<A> > {
   typedef Tuple1<A> param_type;
+  typedef FixedLayoutParam<param_type> Fixed;
   static void Write(Message* m, const param_type& p) {
+    if (Fixed::Applies(m->compact())) {
+      Fixed::Write(m, p);
+      return;
+    }
     WriteParam(m, p.a);
   }
+  static void GetSize(PickleSizer* sizer, const param_type& p) {
+    if (Fixed::Applies(sizer->compact())) {
+      Fixed::GetSize(sizer);
+      return;
+    }
+    GetParamSize(sizer, p.a);
+  }
   static bool Read(const Message* m, PickleIterator* iter, param_type* r) {
+    if (Fixed::Applies(m->compact()))
+      return Fixed::Read(m, iter, r);
     return ReadParam(m, iter, &r->a);
   }
+  static bool Validate(const Message* m, PickleIterator* iter) {
+    if (Fixed::Applies(m->compact()))
+      return Fixed::Validate(m, iter);
+    return ValidateParam<A>(m, iter);
+  }
   static void Log(const param_type& p, std::string* l) {
     LogParam(p.a, l);
   }
@@ -573,14 +1258,35 @@ struct ParamTraits< Tuple1<A> > {
 template <class A, class B>
 struct ParamTraits< Tuple2<A, B> > {
   typedef Tuple2<A, B> param_type;
+  typedef FixedLayoutParam<param_type> Fixed;
   static void Write(Message* m, const param_type& p) {
+    if (Fixed::Applies(m->compact())) {
+      Fixed::Write(m, p);
+      return;
+    }
     WriteParam(m, p.a);
     WriteParam(m, p.b);
   }
+  static void GetSize(PickleSizer* sizer, const param_type& p) {
+    if (Fixed::Applies(sizer->compact())) {
+      Fixed::GetSize(sizer);
+      return;
+    }
+    GetParamSize(sizer, p.a);
+    GetParamSize(sizer, p.b);
+  }
   static bool Read(const Message* m, PickleIterator* iter, param_type* r) {
+    if (Fixed::Applies(m->compact()))
+      return Fixed::Read(m, iter, r);
     return (ReadParam(m, iter, &r->a) &&
             ReadParam(m, iter, &r->b));
   }
+  static bool Validate(const Message* m, PickleIterator* iter) {
+    if (Fixed::Applies(m->compact()))
+      return Fixed::Validate(m, iter);
+    return (ValidateParam<A>(m, iter) &&
+            ValidateParam<B>(m, iter));
+  }
   static void Log(const param_type& p, std::string* l) {
     LogParam(p.a, l);
     l->append(", ");
@@ -591,16 +1297,39 @@ struct ParamTraits< Tuple2<A, B> > {
 template <class A, class B, class C>
 struct ParamTraits< Tuple3<A, B, C> > {
   typedef Tuple3<A, B, C> param_type;
+  typedef FixedLayoutParam<param_type> Fixed;
   static void Write(Message* m, const param_type& p) {
+    if (Fixed::Applies(m->compact())) {
+      Fixed::Write(m, p);
+      return;
+    }
     WriteParam(m, p.a);
     WriteParam(m, p.b);
     WriteParam(m, p.c);
   }
+  static void GetSize(PickleSizer* sizer, const param_type& p) {
+    if (Fixed::Applies(sizer->compact())) {
+      Fixed::GetSize(sizer);
+      return;
+    }
+    GetParamSize(sizer, p.a);
+    GetParamSize(sizer, p.b);
+    GetParamSize(sizer, p.c);
+  }
   static bool Read(const Message* m, PickleIterator* iter, param_type* r) {
+    if (Fixed::Applies(m->compact()))
+      return Fixed::Read(m, iter, r);
     return (ReadParam(m, iter, &r->a) &&
             ReadParam(m, iter, &r->b) &&
             ReadParam(m, iter, &r->c));
   }
+  static bool Validate(const Message* m, PickleIterator* iter) {
+    if (Fixed::Applies(m->compact()))
+      return Fixed::Validate(m, iter);
+    return (ValidateParam<A>(m, iter) &&
+            ValidateParam<B>(m, iter) &&
+            ValidateParam<C>(m, iter));
+  }
   static void Log(const param_type& p, std::string* l) {
     LogParam(p.a, l);
     l->append(", ");
@@ -613,18 +1342,43 @@ struct ParamTraits< Tuple3<A, B, C> > {
 template <class A, class B, class C, class D>
 struct ParamTraits< Tuple4<A, B, C, D> > {
   typedef Tuple4<A, B, C, D> param_type;
+  typedef FixedLayoutParam<param_type> Fixed;
   static void Write(Message* m, const param_type& p) {
+    if (Fixed::Applies(m->compact())) {
+      Fixed::Write(m, p);
+      return;
+    }
     WriteParam(m, p.a);
     WriteParam(m, p.b);
     WriteParam(m, p.c);
     WriteParam(m, p.d);
   }
+  static void GetSize(PickleSizer* sizer, const param_type& p) {
+    if (Fixed::Applies(sizer->compact())) {
+      Fixed::GetSize(sizer);
+      return;
+    }
+    GetParamSize(sizer, p.a);
+    GetParamSize(sizer, p.b);
+    GetParamSize(sizer, p.c);
+    GetParamSize(sizer, p.d);
+  }
   static bool Read(const Message* m, PickleIterator* iter, param_type* r) {
+    if (Fixed::Applies(m->compact()))
+      return Fixed::Read(m, iter, r);
     return (ReadParam(m, iter, &r->a) &&
             ReadParam(m, iter, &r->b) &&
             ReadParam(m, iter, &r->c) &&
             ReadParam(m, iter, &r->d));
   }
+  static bool Validate(const Message* m, PickleIterator* iter) {
+    if (Fixed::Applies(m->compact()))
+      return Fixed::Validate(m, iter);
+    return (ValidateParam<A>(m, iter) &&
+            ValidateParam<B>(m, iter) &&
+            ValidateParam<C>(m, iter) &&
+            ValidateParam<D>(m, iter));
+  }
   static void Log(const param_type& p, std::string* l) {
     LogParam(p.a, l);
     l->append(", ");
@@ -639,20 +1393,47 @@ struct ParamTraits< Tuple4<A, B, C, D> > {
 template <class A, class B, class C, class D, class E>
 struct ParamTraits< Tuple5<A, B, C, D, E> > {
   typedef Tuple5<A, B, C, D, E> param_type;
+  typedef FixedLayoutParam<param_type> Fixed;
   static void Write(Message* m, const param_type& p) {
+    if (Fixed::Applies(m->compact())) {
+      Fixed::Write(m, p);
+      return;
+    }
     WriteParam(m, p.a);
     WriteParam(m, p.b);
     WriteParam(m, p.c);
     WriteParam(m, p.d);
     WriteParam(m, p.e);
   }
+  static void GetSize(PickleSizer* sizer, const param_type& p) {
+    if (Fixed::Applies(sizer->compact())) {
+      Fixed::GetSize(sizer);
+      return;
+    }
+    GetParamSize(sizer, p.a);
+    GetParamSize(sizer, p.b);
+    GetParamSize(sizer, p.c);
+    GetParamSize(sizer, p.d);
+    GetParamSize(sizer, p.e);
+  }
   static bool Read(const Message* m, PickleIterator* iter, param_type* r) {
+    if (Fixed::Applies(m->compact()))
+      return Fixed::Read(m, iter, r);
     return (ReadParam(m, iter, &r->a) &&
             ReadParam(m, iter, &r->b) &&
             ReadParam(m, iter, &r->c) &&
             ReadParam(m, iter, &r->d) &&
             ReadParam(m, iter, &r->e));
   }
+  static bool Validate(const Message* m, PickleIterator* iter) {
+    if (Fixed::Applies(m->compact()))
+      return Fixed::Validate(m, iter);
+    return (ValidateParam<A>(m, iter) &&
+            ValidateParam<B>(m, iter) &&
+            ValidateParam<C>(m, iter) &&
+            ValidateParam<D>(m, iter) &&
+            ValidateParam<E>(m, iter));
+  }
   static void Log(const param_type& p, std::string* l) {
     LogParam(p.a, l);
     l->append(", ");
@@ -783,6 +1564,7 @@ template <>
 struct IPC_EXPORT ParamTraits<LogData> {
   typedef LogData param_type;
   static void Write(Message* m, const param_type& p);
+  static void GetSize(PickleSizer* sizer, const param_type& p);
   static bool Read(const Message* m, PickleIterator* iter, param_type* r);
   static void Log(const param_type& p, std::string* l);
 };
@@ -790,6 +1572,7 @@ struct IPC_EXPORT ParamTraits<LogData> {
 template <>
 struct IPC_EXPORT ParamTraits<Message> {
   static void Write(Message* m, const Message& p);
+  static void GetSize(PickleSizer* sizer, const Message& p);
   static bool Read(const Message* m, PickleIterator* iter, Message* r);
   static void Log(const Message& p, std::string* l);
 };
@@ -835,19 +1618,37 @@ public:
 
     MessageWithTuple(int32 routing_id, uint16 type, const RefParam& p)
         : Message(routing_id, type, PRIORITY_NORMAL) {
+        ReserveParam(this, p);
         WriteParam(this, p);
     }
 
     static bool Read(const Message* msg, Param* p) {
-        void* iter = NULL;
-        bool rv = ReadParam(msg, &iter, p);
-        DCHECK(rv) << "Error deserializing message " << msg->type();
-        return rv;
+        PickleIterator iter(*msg);
+        return ReadParam(msg, &iter, p);
+    }
+
+    // Walks |msg| once, checking that it holds a complete Param, without
+    // decoding it.  A message that passed can then be decoded by
+    // ReadValidated() or DispatchValidated(), which skip the bounds checks.
+    static bool Validate(const Message* msg) {
+        PickleIterator iter(*msg);
+        return ValidateParam<Param>(msg, &iter);
     }
 
-    // Generic dispatcher.  Should cover most cases.
+    // Like Read(), for a message that Validate() accepted.
+    static bool ReadValidated(const Message* msg, Param* p) {
+        PickleIterator iter(*msg);
+        iter.set_checked(false);
+        return ReadParam(msg, &iter, p);
+    }
+
+    // Generic dispatcher.  Should cover most cases.  Like all the
+    // dispatchers, it drops a message past its deadline unread and reports
+    // success.
     template<class T, class Method>
     static bool Dispatch(const Message* msg, T* obj, Method func) {
+        if (msg->IsExpired())
+            return true;
         Param p;
         if (Read(msg, &p)) {
             DispatchToMethod(obj, func, p);
@@ -856,12 +1657,27 @@ public:
         return false;
     }
 
+    // Like Dispatch(), for a message that Validate() accepted.
+    template<class T, class Method>
+    static bool DispatchValidated(const Message* msg, T* obj, Method func) {
+        if (msg->IsExpired())
+            return true;
+        Param p;
+        if (ReadValidated(msg, &p)) {
+            DispatchToMethod(obj, func, p);
+            return true;
+        }
+        return false;
+    }
+
     // The following dispatchers exist for the case where the callback function
     // needs the message as well.  They assume that "Param" is a type of Tuple
     // (except the one arg case, as there is no Tuple1).
     template<class T, typename TA>
     static bool Dispatch(const Message* msg, T* obj,
         void (T::*func)(const Message&, TA)) {
+        if (msg->IsExpired())
+            return true;
         Param p;
         if (Read(msg, &p)) {
             (obj->*func)(*msg, p.a);
@@ -873,6 +1689,8 @@ public:
     template<class T, typename TA, typename TB>
     static bool Dispatch(const Message* msg, T* obj,
         void (T::*func)(const Message&, TA, TB)) {
+        if (msg->IsExpired())
+            return true;
         Param p;
         if (Read(msg, &p)) {
             (obj->*func)(*msg, p.a, p.b);
@@ -884,6 +1702,8 @@ public:
     template<class T, typename TA, typename TB, typename TC>
     static bool Dispatch(const Message* msg, T* obj,
         void (T::*func)(const Message&, TA, TB, TC)) {
+        if (msg->IsExpired())
+            return true;
         Param p;
         if (Read(msg, &p)) {
             (obj->*func)(*msg, p.a, p.b, p.c);
@@ -895,6 +1715,8 @@ public:
     template<class T, typename TA, typename TB, typename TC, typename TD>
     static bool Dispatch(const Message* msg, T* obj,
         void (T::*func)(const Message&, TA, TB, TC, TD)) {
+        if (msg->IsExpired())
+            return true;
         Param p;
         if (Read(msg, &p)) {
             (obj->*func)(*msg, p.a, p.b, p.c, p.d);
@@ -907,6 +1729,8 @@ public:
         typename TE>
         static bool Dispatch(const Message* msg, T* obj,
         void (T::*func)(const Message&, TA, TB, TC, TD, TE)) {
+            if (msg->IsExpired())
+                return true;
             Param p;
             if (Read(msg, &p)) {
                 (obj->*func)(*msg, p.a, p.b, p.c, p.d, p.e);
@@ -996,6 +1820,7 @@ public:
         const RefSendParam& send, const ReplyParam& reply)
         : SyncMessage(routing_id, type, PRIORITY_NORMAL,
         new ParamDeserializer<ReplyParam>(reply)) {
+        ReserveParam(this, send);
         WriteParam(this, send);
     }
 
@@ -1024,15 +1849,49 @@ public:
         }
     }
 
+    // Walks |msg| once, checking that it holds a complete SendParam,
+    // without decoding it.  A message that passed can then be dispatched by
+    // DispatchValidated(), which skips the bounds checks.
+    static bool Validate(const Message* msg) {
+        PickleIterator iter = GetDataIterator(msg);
+        return ValidateParam<SendParam>(msg, &iter);
+    }
+
     template<class T, class Method>
     static bool Dispatch(const Message* msg, T* obj, Method func) {
-        SendParam send_params;
+        return DispatchFrom(msg, GetDataIterator(msg), obj, func);
+    }
+
+    // Like Dispatch(), for a message that Validate() accepted.
+    template<class T, class Method>
+    static bool DispatchValidated(const Message* msg, T* obj, Method func) {
         PickleIterator iter = GetDataIterator(msg);
+        iter.set_checked(false);
+        return DispatchFrom(msg, iter, obj, func);
+    }
+
+    // Answers a message past its deadline with an error, without reading
+    // its parameters.  The message itself was fine, hence true.
+    template<class T>
+    static bool SendExpiredReply(const Message* msg, T* obj) {
+        Message* reply = GenerateReply(msg);
+        reply->set_reply_error();
+        obj->Send(reply);
+        return true;
+    }
+
+    template<class T, class Method>
+    static bool DispatchFrom(const Message* msg, PickleIterator iter, T* obj,
+                             Method func) {
+        if (msg->IsExpired())
+            return SendExpiredReply(msg, obj);
+        SendParam send_params;
         Message* reply = GenerateReply(msg);//
         bool error;
         if (ReadParam(msg, &iter, &send_params)) {//ȡtuple
             typename ReplyParam::ValueTuple reply_params;
             DispatchToMethod(obj, func, send_params, &reply_params);//ģػ
+            ReserveParam(reply, reply_params);
             WriteParam(reply, reply_params);//tupleдmsg
             error = false;
 #ifdef IPC_MESSAGE_LOG_ENABLED
@@ -1055,6 +1914,8 @@ public:
 
     template<class T, class Method>
     static bool DispatchDelayReply(const Message* msg, T* obj, Method func) {
+        if (msg->IsExpired())
+            return SendExpiredReply(msg, obj);
         SendParam send_params;
         PickleIterator iter = GetDataIterator(msg);
         Message* reply = GenerateReply(msg);
@@ -0,0 +1,48 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPC_IPC_SHARED_MEMORY_H_
+#define IPC_IPC_SHARED_MEMORY_H_
+
+#include "base/build_config.h"
+
+#if defined(OS_LINUX)
+
+#include "base/basictypes.h"
+#include "ipc/ipc_export.h"
+
+namespace IPC {
+
+// Helpers for the transports that live in memory shared between processes,
+// SharedRing and BroadcastRing.
+namespace internal {
+
+// Maps |size| bytes of new, zeroed, anonymous shared memory and returns the
+// mapping, with the descriptor another process needs to map it in |*fd|.
+// Returns NULL on failure.
+IPC_EXPORT char* CreateSharedMemory(const char* name, size_t size, int* fd);
+
+// Maps all of the shared memory |fd| refers to, and returns the mapping and
+// its size in |*size|, or NULL.  Leaves |fd| open either way.
+IPC_EXPORT char* MapSharedMemory(int fd, size_t* size);
+
+// Sleeps while |*word| is |value|, for at most |timeout_ms| milliseconds or
+// indefinitely if it is negative.  May return early.
+IPC_EXPORT void FutexWait(uint32* word, uint32 value, int timeout_ms);
+
+// Changes |*word| and wakes up to |count| threads sleeping on it.
+IPC_EXPORT void FutexWake(uint32* word, int count);
+
+// The milliseconds left until |deadline|, a Message::DeadlineClockNow()
+// time, or -1 if |deadline| is negative, meaning there is none.  Never
+// returns 0 for a deadline that has not passed.
+IPC_EXPORT int RemainingMs(int64 deadline);
+
+}  // namespace internal
+
+}  // namespace IPC
+
+#endif  // defined(OS_LINUX)
+
+#endif  // IPC_IPC_SHARED_MEMORY_H_
@@ -0,0 +1,145 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPC_IPC_SHARED_RING_H_
+#define IPC_IPC_SHARED_RING_H_
+
+#include "base/build_config.h"
+
+#if defined(OS_LINUX)
+
+#include "base/basictypes.h"
+#include "base/compiler_specific.h"
+#include "ipc/ipc_channel.h"
+#include "ipc/ipc_export.h"
+#include "ipc/ipc_message.h"
+
+namespace IPC {
+
+// A single producer, single consumer ring of messages in shared memory, for
+// processes on the same machine.  Messages sit in the ring exactly as
+// Message::data() lays them out, header first, so the producer can build a
+// message in place (BeginMessage()) and the consumer reads it where it is
+// (PeekMessage(), DispatchMessages()); neither side copies, and nothing
+// goes through the kernel while both keep up with each other.  A side only
+// makes a futex call when it has to wait, because the ring is empty or
+// full, or when the other side is waiting.
+//
+// One process creates the ring and passes fd() to the other, which calls
+// Open().  Each side then uses only its half of the methods; neither half
+// is thread safe, but the two halves may run on different threads.  The
+// consumer checks every message it reads against the ring, so a broken
+// producer cannot make it read out of bounds.
+class IPC_EXPORT SharedRing {
+ public:
+  // Messages start on multiples of this many bytes.
+  static const size_t kSlotAlignment = 8;
+
+  ~SharedRing();
+
+  // Creates a ring with room for |capacity| bytes of messages, rounded up
+  // to a power of two, in new anonymous shared memory.  Returns NULL on
+  // failure.
+  static SharedRing* Create(size_t capacity);
+
+  // Maps the ring another process created, given a descriptor for it.
+  // Takes ownership of |fd|.  Returns NULL if |fd| does not hold a ring.
+  static SharedRing* Open(int fd);
+
+  // The descriptor of the shared memory, to hand to the other process.
+  int fd() const { return fd_; }
+
+  size_t capacity() const { return capacity_; }
+
+  // Producer --------------------------------------------------------------
+
+  // Starts a message with room for |max_payload_size| bytes of payload
+  // directly in the ring, and returns it for the parameters to be written
+  // into.  Returns NULL if the ring does not have that much room right now;
+  // see WaitForSpace().  The message belongs to the ring and is only valid
+  // until CommitMessage().  It is a plain Message: messages declared with
+  // the IPC_MESSAGE macros build themselves and go through WriteMessage().
+  Message* BeginMessage(int32 routing_id, uint16 type,
+                        Message::PriorityValue priority,
+                        size_t max_payload_size);
+
+  // Makes the message started by BeginMessage() visible to the consumer,
+  // taking only the space it used.  If it outgrew |max_payload_size| it
+  // has moved to the heap; it is then copied into the ring if there is
+  // room, and lost, with false returned, if there is not.
+  bool CommitMessage();
+
+  // Copies |message| into the ring.  Returns false if there is no room.
+  bool WriteMessage(const Message& message);
+
+  // Waits until a message with |payload_size| bytes of payload fits, for at
+  // most |timeout_ms| milliseconds or indefinitely if it is negative.
+  // Returns false on timeout or if it can never fit.
+  bool WaitForSpace(size_t payload_size, int timeout_ms);
+
+  // Consumer --------------------------------------------------------------
+
+  // Points |*data| at the |*size| bytes of the oldest message, in the ring,
+  // without removing it.  They stay valid until PopMessage().  Returns false
+  // if the ring is empty or the producer wrote something that is not a
+  // message; is_broken() tells the two apart.
+  bool PeekMessage(const char** data, int* size);
+
+  // Removes the message returned by the last PeekMessage().
+  void PopMessage();
+
+  // Waits for a message, for at most |timeout_ms| milliseconds or
+  // indefinitely if it is negative.  Returns false on timeout.
+  bool WaitForMessage(int timeout_ms);
+
+  // Hands up to |max_messages| waiting messages to |listener|, in place,
+  // and removes them.  Returns the number dispatched.  Compressed messages
+  // are decompressed first; a message that fails to decompress breaks the
+  // ring.
+  size_t DispatchMessages(Channel::Listener* listener, size_t max_messages);
+
+  // True once the consumer has found something that is not a valid message.
+  bool is_broken() const { return broken_; }
+
+ private:
+  struct Control;
+
+  SharedRing(int fd, char* mapping, size_t capacity);
+
+  // Producer: finds |size| contiguous bytes at or after the head, and
+  // returns their position, or returns false.
+  bool ReserveSlot(size_t size, uint64* position);
+  // Producer: publishes everything up to |new_head|.
+  void PublishHead(uint64 new_head);
+
+  int fd_;
+  char* mapping_;
+  Control* control_;
+  // The message bytes, |capacity_| of them.
+  char* ring_;
+  size_t capacity_;
+
+  // Producer state: the head as far as this side has published it, the
+  // tail as last seen, and the message being built.
+  uint64 head_;
+  uint64 cached_tail_;
+  Message message_;
+  uint64 message_position_;
+  bool building_;
+
+  // Consumer state: the tail as far as this side has published it, the
+  // head as last seen, and the size of the slot PeekMessage() returned.
+  uint64 tail_;
+  uint64 cached_head_;
+  size_t peeked_size_;
+  bool broken_;
+
+  DISALLOW_COPY_AND_ASSIGN(SharedRing);
+};
+
+}  // namespace IPC
+
+#endif  // defined(OS_LINUX)
+
+#endif  // IPC_IPC_SHARED_RING_H_
@@ -27,6 +27,10 @@ class IPC_EXPORT SyncMessage : public Message {
               MessageReplyDeserializer* deserializer);
   virtual ~SyncMessage();
 
+  // Takes over the buffer and the reply deserializer of |other|.
+  SyncMessage(SyncMessage&& other);
+  SyncMessage& operator=(SyncMessage&& other);
+
   // Call this to get a deserializer for the output parameters.
   // Note that this can only be called once, and the caller is responsible
   // for deleting the deserializer when they're done.
@@ -68,6 +72,12 @@ class IPC_EXPORT SyncMessage : public Message {
   // Generates a reply message to the given message.
   static Message* GenerateReply(const Message* msg);
 
+  // Same as above, but the reply's payload is allocated from |allocator|.
+  // Use this with a PickleArena when replies are sent within the batch in
+  // which they were generated.
+  static Message* GenerateReply(const Message* msg,
+                                PickleAllocator* allocator);
+
  private:
   struct SyncHeader {
     // unique ID (unique per sender)
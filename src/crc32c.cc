@@ -0,0 +1,274 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// The hardware path follows Mark Adler's crc32c.c: three crc32 instruction
+// streams run side by side to hide the instruction's latency, and their
+// results are combined with tables that shift a CRC over a fixed run of
+// zero bytes.
+
+#include "base/crc32c.h"
+
+#include <string.h>
+
+#if defined(ARCH_CPU_X86_64) && (defined(COMPILER_GCC) || defined(COMPILER_MSVC))
+#define CRC32C_HAS_HARDWARE 1
+#include <nmmintrin.h>
+#if defined(COMPILER_MSVC)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(OS_WIN)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+namespace base {
+
+namespace {
+
+// The Castagnoli polynomial, bit reversed.
+const uint32 kPolynomial = 0x82f63b78;
+
+// Block sizes for the three-stream hardware path.
+const size_t kLongBlock = 8192;
+const size_t kShortBlock = 256;
+
+struct Tables {
+  // Slicing-by-8 tables for the portable path.
+  uint32 bytes[8][256];
+  // Shift a CRC over kLongBlock and kShortBlock zero bytes.
+  uint32 long_shift[4][256];
+  uint32 short_shift[4][256];
+  bool use_hardware;
+};
+
+Tables g_tables;
+
+// Multiplies the 32x32 GF(2) matrix |mat| by |vec|.
+uint32 MatrixTimes(const uint32* mat, uint32 vec) {
+  uint32 sum = 0;
+  for (; vec; vec >>= 1, ++mat) {
+    if (vec & 1)
+      sum ^= *mat;
+  }
+  return sum;
+}
+
+void MatrixSquare(uint32* square, const uint32* mat) {
+  for (int n = 0; n < 32; ++n)
+    square[n] = MatrixTimes(mat, mat[n]);
+}
+
+// Fills |op| with the operator that appends |length| zero bytes to a CRC.
+// |length| must be a power of two.
+void ZerosOperator(uint32* op, size_t length) {
+  uint32 odd[32];
+  odd[0] = kPolynomial;  // One zero bit.
+  uint32 row = 1;
+  for (int n = 1; n < 32; ++n) {
+    odd[n] = row;
+    row <<= 1;
+  }
+  MatrixSquare(op, odd);   // Two zero bits.
+  MatrixSquare(odd, op);   // Four zero bits.
+  // Each square doubles the count, starting at one zero byte.
+  for (;;) {
+    MatrixSquare(op, odd);
+    length >>= 1;
+    if (length == 0)
+      return;
+    MatrixSquare(odd, op);
+    length >>= 1;
+    if (length == 0)
+      break;
+  }
+  memcpy(op, odd, sizeof(odd));
+}
+
+void FillShiftTable(uint32 table[4][256], size_t length) {
+  uint32 op[32];
+  ZerosOperator(op, length);
+  for (uint32 n = 0; n < 256; ++n) {
+    table[0][n] = MatrixTimes(op, n);
+    table[1][n] = MatrixTimes(op, n << 8);
+    table[2][n] = MatrixTimes(op, n << 16);
+    table[3][n] = MatrixTimes(op, n << 24);
+  }
+}
+
+bool CpuHasSse42() {
+#if defined(CRC32C_HAS_HARDWARE) && defined(COMPILER_MSVC)
+  int info[4];
+  __cpuid(info, 1);
+  return (info[2] & (1 << 20)) != 0;
+#elif defined(CRC32C_HAS_HARDWARE)
+  return __builtin_cpu_supports("sse4.2");
+#else
+  return false;
+#endif
+}
+
+void InitializeTables() {
+  for (uint32 n = 0; n < 256; ++n) {
+    uint32 crc = n;
+    for (int k = 0; k < 8; ++k)
+      crc = crc & 1 ? (crc >> 1) ^ kPolynomial : crc >> 1;
+    g_tables.bytes[0][n] = crc;
+  }
+  for (uint32 n = 0; n < 256; ++n) {
+    uint32 crc = g_tables.bytes[0][n];
+    for (int k = 1; k < 8; ++k) {
+      crc = g_tables.bytes[0][crc & 0xff] ^ (crc >> 8);
+      g_tables.bytes[k][n] = crc;
+    }
+  }
+  FillShiftTable(g_tables.long_shift, kLongBlock);
+  FillShiftTable(g_tables.short_shift, kShortBlock);
+  g_tables.use_hardware = CpuHasSse42();
+}
+
+#if defined(OS_WIN)
+
+INIT_ONCE g_init_once = INIT_ONCE_STATIC_INIT;
+
+BOOL CALLBACK InitializeOnce(PINIT_ONCE, PVOID, PVOID*) {
+  InitializeTables();
+  return TRUE;
+}
+
+const Tables& GetTables() {
+  InitOnceExecuteOnce(&g_init_once, &InitializeOnce, NULL, NULL);
+  return g_tables;
+}
+
+#else  // defined(OS_WIN)
+
+pthread_once_t g_init_once = PTHREAD_ONCE_INIT;
+
+const Tables& GetTables() {
+  pthread_once(&g_init_once, &InitializeTables);
+  return g_tables;
+}
+
+#endif  // defined(OS_WIN)
+
+uint64 LoadUInt64(const unsigned char* p) {
+  uint64 value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+uint32 Crc32cSoftware(const Tables& tables, uint32 crc,
+                      const unsigned char* next, size_t length) {
+  crc = ~crc;
+  while (length && (reinterpret_cast<uintptr_t>(next) & 7) != 0) {
+    crc = tables.bytes[0][(crc ^ *next++) & 0xff] ^ (crc >> 8);
+    --length;
+  }
+#if defined(ARCH_CPU_LITTLE_ENDIAN)
+  for (; length >= 8; length -= 8, next += 8) {
+    uint64 word = crc ^ LoadUInt64(next);
+    crc = tables.bytes[7][word & 0xff] ^
+          tables.bytes[6][(word >> 8) & 0xff] ^
+          tables.bytes[5][(word >> 16) & 0xff] ^
+          tables.bytes[4][(word >> 24) & 0xff] ^
+          tables.bytes[3][(word >> 32) & 0xff] ^
+          tables.bytes[2][(word >> 40) & 0xff] ^
+          tables.bytes[1][(word >> 48) & 0xff] ^
+          tables.bytes[0][word >> 56];
+  }
+#endif
+  while (length) {
+    crc = tables.bytes[0][(crc ^ *next++) & 0xff] ^ (crc >> 8);
+    --length;
+  }
+  return ~crc;
+}
+
+#if defined(CRC32C_HAS_HARDWARE)
+
+#if defined(COMPILER_GCC)
+#define CRC32C_TARGET_SSE42 __attribute__((target("sse4.2")))
+#else
+#define CRC32C_TARGET_SSE42
+#endif
+
+uint32 Shift(const uint32 table[4][256], uint32 crc) {
+  return table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff] ^
+         table[2][(crc >> 16) & 0xff] ^ table[3][crc >> 24];
+}
+
+CRC32C_TARGET_SSE42
+uint32 Crc32cHardware(const Tables& tables, uint32 crc,
+                      const unsigned char* next, size_t length) {
+  uint64 crc0 = ~crc;
+  while (length && (reinterpret_cast<uintptr_t>(next) & 7) != 0) {
+    crc0 = _mm_crc32_u8(static_cast<uint32>(crc0), *next++);
+    --length;
+  }
+
+  // Three independent streams over consecutive blocks, then the first two
+  // results are shifted over the blocks that follow them and folded in.
+  while (length >= kLongBlock * 3) {
+    uint64 crc1 = 0;
+    uint64 crc2 = 0;
+    const unsigned char* end = next + kLongBlock;
+    do {
+      crc0 = _mm_crc32_u64(crc0, LoadUInt64(next));
+      crc1 = _mm_crc32_u64(crc1, LoadUInt64(next + kLongBlock));
+      crc2 = _mm_crc32_u64(crc2, LoadUInt64(next + 2 * kLongBlock));
+      next += 8;
+    } while (next < end);
+    crc0 = Shift(tables.long_shift, static_cast<uint32>(crc0)) ^ crc1;
+    crc0 = Shift(tables.long_shift, static_cast<uint32>(crc0)) ^ crc2;
+    next += 2 * kLongBlock;
+    length -= 3 * kLongBlock;
+  }
+  while (length >= kShortBlock * 3) {
+    uint64 crc1 = 0;
+    uint64 crc2 = 0;
+    const unsigned char* end = next + kShortBlock;
+    do {
+      crc0 = _mm_crc32_u64(crc0, LoadUInt64(next));
+      crc1 = _mm_crc32_u64(crc1, LoadUInt64(next + kShortBlock));
+      crc2 = _mm_crc32_u64(crc2, LoadUInt64(next + 2 * kShortBlock));
+      next += 8;
+    } while (next < end);
+    crc0 = Shift(tables.short_shift, static_cast<uint32>(crc0)) ^ crc1;
+    crc0 = Shift(tables.short_shift, static_cast<uint32>(crc0)) ^ crc2;
+    next += 2 * kShortBlock;
+    length -= 3 * kShortBlock;
+  }
+
+  for (; length >= 8; length -= 8, next += 8)
+    crc0 = _mm_crc32_u64(crc0, LoadUInt64(next));
+  while (length) {
+    crc0 = _mm_crc32_u8(static_cast<uint32>(crc0), *next++);
+    --length;
+  }
+  return ~static_cast<uint32>(crc0);
+}
+
+#endif  // defined(CRC32C_HAS_HARDWARE)
+
+}  // namespace
+
+uint32 Crc32c(uint32 crc, const void* data, size_t length) {
+  const Tables& tables = GetTables();
+  const unsigned char* next = static_cast<const unsigned char*>(data);
+#if defined(CRC32C_HAS_HARDWARE)
+  if (tables.use_hardware)
+    return Crc32cHardware(tables, crc, next, length);
+#endif
+  return Crc32cSoftware(tables, crc, next, length);
+}
+
+uint32 Crc32cPortable(uint32 crc, const void* data, size_t length) {
+  return Crc32cSoftware(GetTables(), crc,
+                        static_cast<const unsigned char*>(data), length);
+}
+
+}  // namespace base
@@ -0,0 +1,103 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipc/file_descriptor_set_posix.h"
+
+#if defined(OS_POSIX)
+
+#include <unistd.h>
+
+#include "base/compiler_specific.h"
+
+namespace IPC {
+
+namespace {
+
+void CloseDescriptor(int fd) {
+  // Linux closes the descriptor even when close() is interrupted, so it
+  // must not be retried.
+  close(fd);
+}
+
+}  // namespace
+
+// static
+STATIC_CONST_MEMBER_DEFINITION const size_t
+    FileDescriptorSet::kMaxDescriptorsPerMessage;
+
+FileDescriptorSet::FileDescriptorSet()
+    : consumed_descriptor_highwater_(0),
+      ref_count_(1) {
+}
+
+FileDescriptorSet::~FileDescriptorSet() {
+  // Descriptors handed out belong to whoever took them; of the rest, the
+  // set owns those that close automatically.  A message with descriptors
+  // that is dropped unread, or never sent, ends up here.
+  for (size_t i = consumed_descriptor_highwater_; i < descriptors_.size();
+       ++i) {
+    if (descriptors_[i].auto_close)
+      CloseDescriptor(descriptors_[i].fd);
+  }
+}
+
+void FileDescriptorSet::AddRef() {
+  base::AtomicRefCountInc(&ref_count_);
+}
+
+void FileDescriptorSet::Release() {
+  if (!base::AtomicRefCountDec(&ref_count_))
+    delete this;
+}
+
+bool FileDescriptorSet::Add(int fd) {
+  if (descriptors_.size() == kMaxDescriptorsPerMessage)
+    return false;
+  descriptors_.push_back(base::FileDescriptor(fd, false));
+  return true;
+}
+
+bool FileDescriptorSet::AddAndAutoClose(int fd) {
+  if (descriptors_.size() == kMaxDescriptorsPerMessage)
+    return false;
+  descriptors_.push_back(base::FileDescriptor(fd, true));
+  return true;
+}
+
+int FileDescriptorSet::GetDescriptorAt(size_t n) {
+  // Taking them in order means that the descriptors nobody took are
+  // exactly those from the highwater on, which the destructor closes.
+  if (n >= descriptors_.size() || n != consumed_descriptor_highwater_)
+    return -1;
+  consumed_descriptor_highwater_ = n + 1;
+  return descriptors_[n].fd;
+}
+
+void FileDescriptorSet::GetDescriptors(int* buffer) const {
+  //DCHECK_EQ(consumed_descriptor_highwater_, 0u);
+  for (size_t i = 0; i < descriptors_.size(); ++i)
+    buffer[i] = descriptors_[i].fd;
+}
+
+void FileDescriptorSet::CommitAll() {
+  for (size_t i = 0; i < descriptors_.size(); ++i) {
+    if (descriptors_[i].auto_close)
+      CloseDescriptor(descriptors_[i].fd);
+  }
+  descriptors_.clear();
+  consumed_descriptor_highwater_ = 0;
+}
+
+void FileDescriptorSet::SetDescriptors(const int* buffer, size_t count) {
+  //DCHECK_LE(count, kMaxDescriptorsPerMessage);
+  //DCHECK_EQ(descriptors_.size(), 0u);
+  //DCHECK_EQ(consumed_descriptor_highwater_, 0u);
+  descriptors_.reserve(count);
+  for (size_t i = 0; i < count; ++i)
+    descriptors_.push_back(base::FileDescriptor(buffer[i], true));
+}
+
+}  // namespace IPC
+
+#endif  // defined(OS_POSIX)
@@ -0,0 +1,505 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipc/ipc_broadcast_ring.h"
+
+#if defined(OS_LINUX)
+
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "ipc/ipc_shared_memory.h"
+
+namespace IPC {
+
+namespace {
+
+const uint32 kMagic = 0x42435049;  // "IPCB"
+
+const size_t kMinCapacity = 4096;
+const size_t kMaxCapacity = 1u << 30;
+const size_t kMaxReaders = 1024;
+
+const size_t kCacheLineSize = 64;
+const size_t kPageSize = 4096;
+
+// Reader slot states.  A reader only counts once it is attached, when its
+// tail is where it will start reading.
+const uint32 kReaderFree = 0;
+const uint32 kReaderAttaching = 1;
+const uint32 kReaderAttached = 2;
+
+// Stands in for a message size where the writer skipped the rest of the
+// ring because the next message did not fit before the end.
+const uint32 kWrapMarker = 0xffffffff;
+
+// Precedes each message in the ring.
+struct SlotHeader {
+  uint32 size;      // Of the message, header included, or kWrapMarker.
+  uint32 reserved;
+  uint64 sequence;  // Counts the messages the writer published.
+};
+
+const size_t kSlotAlignment = 8;
+
+// The bytes a message of |size| bytes takes in the ring.
+size_t SlotSize(size_t size) {
+  return (sizeof(SlotHeader) + size + kSlotAlignment - 1) &
+         ~(kSlotAlignment - 1);
+}
+
+uint64 LoadAcquire(const uint64* p) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+void StoreRelease(uint64* p, uint64 value) {
+  __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+int64 DeadlineAfter(int timeout_ms) {
+  return timeout_ms < 0 ?
+      -1 : Message::DeadlineClockNow() + timeout_ms * 1000LL;
+}
+
+}  // namespace
+
+// The start of the shared memory, followed by one ReaderSlot per reader
+// and, from the next page on, the messages.
+struct BroadcastRing::Control {
+  uint32 magic;
+  uint32 capacity;
+  uint32 max_readers;
+  uint32 overwrite;
+  char padding0[kCacheLineSize - 4 * sizeof(uint32)];
+
+  // Written by the writer.
+  uint64 head;              // Bytes ever published.
+  uint64 claim;             // Bytes ever claimed for writing; when slow
+                            // readers are overwritten, they are lapped
+                            // once it is more than a ring ahead of them.
+  uint64 published;         // Messages ever published.
+  uint32 version;           // Odd while head and published disagree.
+  uint32 data_sequence;     // Futex readers wait on when they are done.
+  uint32 readers_waiting;   // Readers waiting on it.
+  char padding1[kCacheLineSize - 3 * sizeof(uint64) - 3 * sizeof(uint32)];
+
+  // Written by the readers.
+  uint32 space_sequence;    // Futex the writer waits on for readers.
+  uint32 writer_waiting;    // Set while the writer waits.
+  char padding2[kCacheLineSize - 2 * sizeof(uint32)];
+};
+
+// Each reader's position, on a cache line of its own.
+struct BroadcastRing::ReaderSlot {
+  uint64 tail;              // Bytes this reader is done with.
+  uint32 state;
+  char padding[kCacheLineSize - sizeof(uint64) - sizeof(uint32)];
+};
+
+namespace {
+
+size_t RingOffset(size_t control_size, size_t max_readers,
+                  size_t reader_size) {
+  size_t size = control_size + max_readers * reader_size;
+  return (size + kPageSize - 1) & ~(kPageSize - 1);
+}
+
+}  // namespace
+
+BroadcastRing::BroadcastRing(int fd, char* mapping, size_t mapping_size,
+                             size_t capacity, bool overwrite)
+    : fd_(fd),
+      mapping_(mapping),
+      mapping_size_(mapping_size),
+      control_(reinterpret_cast<Control*>(mapping)),
+      ring_(mapping + mapping_size - capacity),
+      capacity_(capacity),
+      overwrite_(overwrite),
+      head_(0),
+      cached_min_tail_(0),
+      sequence_(0),
+      version_(0) {
+}
+
+BroadcastRing::~BroadcastRing() {
+  munmap(mapping_, mapping_size_);
+  close(fd_);
+}
+
+// static
+BroadcastRing* BroadcastRing::Create(size_t capacity, size_t max_readers,
+                                     OverflowPolicy policy) {
+  size_t rounded = kMinCapacity;
+  while (rounded < capacity && rounded < kMaxCapacity)
+    rounded <<= 1;
+  if (rounded < capacity || max_readers == 0 || max_readers > kMaxReaders)
+    return NULL;
+
+  size_t size = RingOffset(sizeof(Control), max_readers,
+                           sizeof(ReaderSlot)) + rounded;
+  int fd;
+  char* mapping = internal::CreateSharedMemory("ipc_broadcast_ring", size,
+                                               &fd);
+  if (!mapping)
+    return NULL;
+
+  // The new memory is zeroed: no readers, nothing published.
+  Control* control = reinterpret_cast<Control*>(mapping);
+  control->capacity = static_cast<uint32>(rounded);
+  control->max_readers = static_cast<uint32>(max_readers);
+  control->overwrite = policy == OVERWRITE_SLOW_READERS;
+  __atomic_store_n(&control->magic, kMagic, __ATOMIC_RELEASE);
+  return new BroadcastRing(fd, mapping, size, rounded,
+                           policy == OVERWRITE_SLOW_READERS);
+}
+
+bool BroadcastRing::Send(Message* message) {
+  bool written = WriteMessage(*message);
+  delete message;
+  return written;
+}
+
+bool BroadcastRing::WriteMessage(const Message& message) {
+  size_t size = message.size();
+  uint64 position;
+  if (size > capacity_ || !ReserveSlot(SlotSize(size), &position))
+    return false;
+
+  char* slot = ring_ + (position & (capacity_ - 1));
+  SlotHeader header;
+  header.size = static_cast<uint32>(size);
+  header.reserved = 0;
+  header.sequence = sequence_++;
+  memcpy(slot, &header, sizeof(header));
+  memcpy(slot + sizeof(header), message.data(), size);
+
+  // A reader attaching reads the head and the count together, under the
+  // version.
+  head_ = position + SlotSize(size);
+  __atomic_store_n(&control_->version, ++version_, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  StoreRelease(&control_->head, head_);
+  __atomic_store_n(&control_->published, sequence_, __ATOMIC_RELAXED);
+  __atomic_store_n(&control_->version, ++version_, __ATOMIC_RELEASE);
+  // Pairs with the fence in Reader::WaitForMessage(): either the reader
+  // sees the new head, or this sees it waiting.
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&control_->readers_waiting, __ATOMIC_RELAXED))
+    internal::FutexWake(&control_->data_sequence, INT_MAX);
+  return true;
+}
+
+bool BroadcastRing::WaitForSpace(size_t payload_size, int timeout_ms) {
+  if (payload_size > capacity_)
+    return false;
+  size_t size = SlotSize(sizeof(Message::Header) + payload_size);
+  if (size > capacity_)
+    return false;
+  if (overwrite_)
+    return true;
+
+  int64 deadline = DeadlineAfter(timeout_ms);
+  uint64 position;
+  for (;;) {
+    if (ReserveSlot(size, &position))
+      return true;
+
+    uint32 sequence = __atomic_load_n(&control_->space_sequence,
+                                      __ATOMIC_SEQ_CST);
+    __atomic_store_n(&control_->writer_waiting, 1, __ATOMIC_SEQ_CST);
+    if (ReserveSlot(size, &position)) {
+      __atomic_store_n(&control_->writer_waiting, 0, __ATOMIC_SEQ_CST);
+      return true;
+    }
+    int remaining = internal::RemainingMs(deadline);
+    if (remaining == 0) {
+      __atomic_store_n(&control_->writer_waiting, 0, __ATOMIC_SEQ_CST);
+      return false;
+    }
+    internal::FutexWait(&control_->space_sequence, sequence, remaining);
+    __atomic_store_n(&control_->writer_waiting, 0, __ATOMIC_SEQ_CST);
+  }
+}
+
+size_t BroadcastRing::reader_count() const {
+  const ReaderSlot* readers = reinterpret_cast<const ReaderSlot*>(
+      mapping_ + sizeof(Control));
+  size_t count = 0;
+  for (size_t i = 0; i < control_->max_readers; ++i) {
+    if (__atomic_load_n(&readers[i].state, __ATOMIC_ACQUIRE) ==
+        kReaderAttached)
+      ++count;
+  }
+  return count;
+}
+
+bool BroadcastRing::ReserveSlot(size_t size, uint64* position) {
+  size_t offset = head_ & (capacity_ - 1);
+  // A message never wraps around the end; the writer skips to the start
+  // instead.
+  size_t skip = offset + size > capacity_ ? capacity_ - offset : 0;
+  if (skip + size > capacity_)
+    return false;
+  uint64 end = head_ + skip + size;
+
+  if (overwrite_) {
+    // Readers check the claim after they read, and throw away what they
+    // read if it had been claimed by then.
+    __atomic_store_n(&control_->claim, end, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+  } else if (end - cached_min_tail_ > capacity_) {
+    cached_min_tail_ = MinReaderTail();
+    if (end - cached_min_tail_ > capacity_)
+      return false;
+  }
+
+  if (skip) {
+    // Unpublished until the message after it is.
+    SlotHeader marker;
+    memset(&marker, 0, sizeof(marker));
+    marker.size = kWrapMarker;
+    memcpy(ring_ + offset, &marker, sizeof(marker));
+  }
+  *position = head_ + skip;
+  return true;
+}
+
+uint64 BroadcastRing::MinReaderTail() const {
+  const ReaderSlot* readers = reinterpret_cast<const ReaderSlot*>(
+      mapping_ + sizeof(Control));
+  uint64 min_tail = head_;
+  for (size_t i = 0; i < control_->max_readers; ++i) {
+    if (__atomic_load_n(&readers[i].state, __ATOMIC_ACQUIRE) !=
+        kReaderAttached)
+      continue;
+    uint64 tail = LoadAcquire(&readers[i].tail);
+    if (head_ - tail > head_ - min_tail)
+      min_tail = tail;
+  }
+  return min_tail;
+}
+
+BroadcastRing::Reader::Reader(int fd, char* mapping, size_t mapping_size,
+                              size_t index)
+    : fd_(fd),
+      mapping_(mapping),
+      mapping_size_(mapping_size),
+      control_(reinterpret_cast<BroadcastRing::Control*>(mapping)),
+      slot_(reinterpret_cast<BroadcastRing::ReaderSlot*>(
+          mapping + sizeof(BroadcastRing::Control)) + index),
+      ring_(mapping + mapping_size - control_->capacity),
+      capacity_(control_->capacity),
+      overwrite_(control_->overwrite != 0),
+      tail_(0),
+      cached_head_(0),
+      slot_size_(0),
+      next_sequence_(0),
+      messages_lost_(0),
+      broken_(false) {
+  // A writer that scanned the readers before this one attached may still
+  // go a ring past the head it saw then, so the tail is set again, from a
+  // head read after attaching.
+  slot_->tail = __atomic_load_n(&control_->head, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&slot_->state, kReaderAttached, __ATOMIC_SEQ_CST);
+  for (;;) {
+    uint32 version = __atomic_load_n(&control_->version, __ATOMIC_SEQ_CST);
+    tail_ = __atomic_load_n(&control_->head, __ATOMIC_RELAXED);
+    next_sequence_ = __atomic_load_n(&control_->published, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (!(version & 1) &&
+        __atomic_load_n(&control_->version, __ATOMIC_RELAXED) == version)
+      break;
+  }
+  StoreRelease(&slot_->tail, tail_);
+  cached_head_ = tail_;
+}
+
+BroadcastRing::Reader::~Reader() {
+  __atomic_store_n(&slot_->state, kReaderFree, __ATOMIC_SEQ_CST);
+  // A waiting writer may have been waiting for this reader.
+  if (__atomic_load_n(&control_->writer_waiting, __ATOMIC_SEQ_CST))
+    internal::FutexWake(&control_->space_sequence, 1);
+  munmap(mapping_, mapping_size_);
+  close(fd_);
+}
+
+// static
+BroadcastRing::Reader* BroadcastRing::Reader::Open(int fd) {
+  size_t size;
+  char* mapping = internal::MapSharedMemory(fd, &size);
+  if (!mapping) {
+    close(fd);
+    return NULL;
+  }
+
+  BroadcastRing::Control* control =
+      reinterpret_cast<BroadcastRing::Control*>(mapping);
+  size_t capacity = 0;
+  size_t max_readers = 0;
+  if (size >= sizeof(BroadcastRing::Control) &&
+      __atomic_load_n(&control->magic, __ATOMIC_ACQUIRE) == kMagic) {
+    capacity = control->capacity;
+    max_readers = control->max_readers;
+  }
+  if (capacity < kMinCapacity || (capacity & (capacity - 1)) != 0 ||
+      max_readers == 0 || max_readers > kMaxReaders ||
+      RingOffset(sizeof(BroadcastRing::Control), max_readers,
+                 sizeof(BroadcastRing::ReaderSlot)) + capacity != size) {
+    munmap(mapping, size);
+    close(fd);
+    return NULL;
+  }
+
+  BroadcastRing::ReaderSlot* readers =
+      reinterpret_cast<BroadcastRing::ReaderSlot*>(
+          mapping + sizeof(BroadcastRing::Control));
+  for (size_t i = 0; i < max_readers; ++i) {
+    uint32 expected = kReaderFree;
+    if (__atomic_compare_exchange_n(&readers[i].state, &expected,
+                                    kReaderAttaching, false,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+      return new Reader(fd, mapping, size, i);
+  }
+
+  munmap(mapping, size);
+  close(fd);
+  return NULL;
+}
+
+bool BroadcastRing::Reader::WaitForMessage(int timeout_ms) {
+  int64 deadline = DeadlineAfter(timeout_ms);
+  for (;;) {
+    if (tail_ != cached_head_ ||
+        (cached_head_ = LoadAcquire(&control_->head)) != tail_)
+      return true;
+
+    uint32 sequence = __atomic_load_n(&control_->data_sequence,
+                                      __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&control_->readers_waiting, 1, __ATOMIC_SEQ_CST);
+    if ((cached_head_ = LoadAcquire(&control_->head)) != tail_) {
+      __atomic_sub_fetch(&control_->readers_waiting, 1, __ATOMIC_SEQ_CST);
+      return true;
+    }
+    int remaining = internal::RemainingMs(deadline);
+    if (remaining != 0)
+      internal::FutexWait(&control_->data_sequence, sequence, remaining);
+    __atomic_sub_fetch(&control_->readers_waiting, 1, __ATOMIC_SEQ_CST);
+    if (remaining == 0)
+      return false;
+  }
+}
+
+size_t BroadcastRing::Reader::DispatchMessages(Listener* listener,
+                                               size_t max_messages) {
+  size_t dispatched = 0;
+  const char* data;
+  int size;
+  uint64 sequence;
+  while (dispatched < max_messages && NextMessage(&data, &size, &sequence)) {
+    if (sequence != next_sequence_) {
+      uint64 lost = sequence - next_sequence_;
+      messages_lost_ += lost;
+      listener->OnMessagesLost(lost);
+    }
+    next_sequence_ = sequence + 1;
+
+    Message message(data, size);
+    if (!message.Decompress()) {
+      broken_ = true;
+      break;
+    }
+    listener->OnMessageReceived(message);
+    AdvanceTail();
+    ++dispatched;
+  }
+  return dispatched;
+}
+
+bool BroadcastRing::Reader::NextMessage(const char** data, int* size,
+                                        uint64* sequence) {
+  if (broken_)
+    return false;
+
+  for (;;) {
+    if (tail_ == cached_head_) {
+      cached_head_ = LoadAcquire(&control_->head);
+      if (tail_ == cached_head_)
+        return false;
+    }
+
+    size_t offset = tail_ & (capacity_ - 1);
+    size_t available = cached_head_ - tail_;
+    SlotHeader header;
+    memcpy(&header, ring_ + offset, sizeof(header));
+    // Lapped: what was read may be from a later message.  The head is
+    // always where a message starts, so the reader starts over there.
+    if (overwrite_) {
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if (__atomic_load_n(&control_->claim, __ATOMIC_RELAXED) - tail_ >
+          capacity_) {
+        tail_ = cached_head_ = LoadAcquire(&control_->head);
+        continue;
+      }
+    }
+
+    if (header.size == kWrapMarker) {
+      if (capacity_ - offset > available) {
+        broken_ = true;
+        return false;
+      }
+      tail_ += capacity_ - offset;
+      continue;
+    }
+
+    // The writer is not trusted to stay within what it published.
+    size_t slot_size = SlotSize(header.size);
+    if (header.size == 0 || header.size > capacity_ ||
+        slot_size > available ||
+        offset + slot_size > capacity_) {
+      broken_ = true;
+      return false;
+    }
+
+    const char* message = ring_ + offset + sizeof(header);
+    if (overwrite_) {
+      copy_.assign(message, message + header.size);
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if (__atomic_load_n(&control_->claim, __ATOMIC_RELAXED) - tail_ >
+          capacity_) {
+        tail_ = cached_head_ = LoadAcquire(&control_->head);
+        continue;
+      }
+      message = &copy_[0];
+    }
+    if (Message::FindNext(message, message + header.size) !=
+        message + header.size) {
+      broken_ = true;
+      return false;
+    }
+
+    *data = message;
+    *size = static_cast<int>(header.size);
+    *sequence = header.sequence;
+    slot_size_ = slot_size;
+    return true;
+  }
+}
+
+void BroadcastRing::Reader::AdvanceTail() {
+  tail_ += slot_size_;
+  slot_size_ = 0;
+  // Only a writer that waits for readers looks at where they are.
+  if (overwrite_)
+    return;
+  StoreRelease(&slot_->tail, tail_);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&control_->writer_waiting, __ATOMIC_RELAXED))
+    internal::FutexWake(&control_->space_sequence, 1);
+}
+
+}  // namespace IPC
+
+#endif  // defined(OS_LINUX)
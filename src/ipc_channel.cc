@@ -0,0 +1,579 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipc/ipc_channel.h"
+
+#if defined(OS_LINUX)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "ipc/file_descriptor_set_posix.h"
+
+namespace IPC {
+
+namespace {
+
+// Messages written at a time: by one sendmsg(), or on io_uring by one chain
+// of linked sends.
+const size_t kMaxSendBatch = 64;
+
+// Room for the control data of the most descriptors a message can carry.
+const size_t kControlBufferSize =
+    CMSG_SPACE(sizeof(int) * FileDescriptorSet::kMaxDescriptorsPerMessage);
+
+bool SetNonBlocking(int fd, bool non_blocking) {
+  int flags = fcntl(fd, F_GETFL);
+  if (flags < 0)
+    return false;
+  flags = non_blocking ? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+  return fcntl(fd, F_SETFL, flags) == 0;
+}
+
+// Fills in |address| for |path|.  Returns false if |path| does not fit.
+bool MakeAddress(const std::string& path, struct sockaddr_un* address) {
+  memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(address->sun_path))
+    return false;
+  memcpy(address->sun_path, path.data(), path.size());
+  return true;
+}
+
+}  // namespace
+
+Channel::Channel(const std::string& path, Mode mode, Listener* listener,
+                 IOLoop* loop)
+    : path_(path),
+      mode_(mode),
+      listener_(listener),
+      loop_(loop),
+      fd_(-1),
+      server_fd_(-1),
+      connecting_(true),
+      closed_(false),
+      peer_pid_(-1),
+      write_offset_(0),
+      waiting_to_write_(false),
+      streaming_(false),
+      messages_in_loop_(0),
+      compression_threshold_(0),
+      add_checksums_(false),
+      held_messages_(0),
+      held_bytes_(0),
+      flush_timer_fd_(-1),
+      flush_timer_running_(false) {
+}
+
+Channel::Channel(int fd, Listener* listener, IOLoop* loop)
+    : mode_(MODE_CLIENT),
+      listener_(listener),
+      loop_(loop),
+      fd_(fd),
+      server_fd_(-1),
+      connecting_(true),
+      closed_(false),
+      peer_pid_(-1),
+      write_offset_(0),
+      waiting_to_write_(false),
+      streaming_(false),
+      messages_in_loop_(0),
+      compression_threshold_(0),
+      add_checksums_(false),
+      held_messages_(0),
+      held_bytes_(0),
+      flush_timer_fd_(-1),
+      flush_timer_running_(false) {
+}
+
+Channel::FlushPolicy::FlushPolicy()
+    : max_bytes(0),
+      max_messages(1),
+      max_delay_us(0) {
+}
+
+Channel::~Channel() {
+  Close();
+}
+
+// static
+bool Channel::SocketPair(int* fd0, int* fd1) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0)
+    return false;
+  *fd0 = fds[0];
+  *fd1 = fds[1];
+  return true;
+}
+
+bool Channel::Connect() {
+  if (closed_)
+    return false;
+  if (fd_ >= 0)
+    return FinishConnecting();
+  if (mode_ == MODE_SERVER)
+    return CreateServerSocket();
+  return ConnectToServer() && FinishConnecting();
+}
+
+void Channel::Close() {
+  closed_ = true;
+  if (server_fd_ >= 0) {
+    loop_->StopWatchingFileDescriptor(server_fd_);
+    close(server_fd_);
+    server_fd_ = -1;
+    unlink(path_.c_str());
+  }
+  if (fd_ >= 0) {
+    loop_->StopWatchingFileDescriptor(fd_);
+    close(fd_);
+    fd_ = -1;
+  }
+  if (flush_timer_fd_ >= 0) {
+    loop_->StopWatchingFileDescriptor(flush_timer_fd_);
+    close(flush_timer_fd_);
+    flush_timer_fd_ = -1;
+  }
+  for (size_t i = 0; i < input_fds_.size(); ++i)
+    close(input_fds_[i]);
+  input_fds_.clear();
+  for (size_t i = 0; i < writing_.size(); ++i)
+    delete writing_[i];
+  writing_.clear();
+  messages_in_loop_ = 0;
+  output_queue_.Clear();
+}
+
+bool Channel::Send(Message* message) {
+  if (closed_) {
+    delete message;
+    return false;
+  }
+  return OnMessagesQueued(QueueMessage(message));
+}
+
+bool Channel::SendBatch(std::vector<Message*>* messages) {
+  if (closed_) {
+    for (size_t i = 0; i < messages->size(); ++i)
+      delete (*messages)[i];
+    messages->clear();
+    return false;
+  }
+  for (size_t i = 0; i < messages->size(); ++i)
+    QueueMessage((*messages)[i]);
+  messages->clear();
+  return OnMessagesQueued(true);
+}
+
+bool Channel::Flush() {
+  if (closed_)
+    return false;
+  return OnMessagesQueued(true);
+}
+
+void Channel::OnFileCanReadWithoutBlocking(int fd) {
+  if (fd == flush_timer_fd_) {
+    uint64 expirations;
+    if (read(flush_timer_fd_, &expirations, sizeof(expirations)) < 0)
+      return;
+    flush_timer_running_ = false;
+    if (held_messages_ && !StartWriting())
+      OnError();
+    return;
+  }
+  bool ok = fd == server_fd_ ? AcceptConnection() : ProcessIncomingMessages();
+  if (!ok)
+    OnError();
+}
+
+void Channel::OnFileCanWriteWithoutBlocking(int fd) {
+  if (!ProcessOutgoingMessages())
+    OnError();
+}
+
+void Channel::OnStreamReceived(int fd, const char* data, ssize_t size) {
+  // The peer closed its end, or the socket failed.
+  if (size <= 0) {
+    OnError();
+    return;
+  }
+  reader_.Borrow(data, size);
+  if (!DispatchMessages())
+    OnError();
+}
+
+void Channel::OnStreamDescriptorsReceived(int fd, const int* fds,
+                                          size_t count) {
+  input_fds_.insert(input_fds_.end(), fds, fds + count);
+}
+
+void Channel::OnStreamCanSend(int fd) {
+  // The queue orders what has not left it yet; a batch handed over is
+  // written as it is.
+  held_messages_ = 0;
+  held_bytes_ = 0;
+  std::vector<Message*> messages;
+  while (messages.size() < kMaxSendBatch) {
+    Message* message = output_queue_.Pop();
+    if (!message)
+      break;
+    messages.push_back(message);
+  }
+  messages_in_loop_ += messages.size();
+  loop_->SendMessages(fd, &messages);
+}
+
+void Channel::OnStreamSent(int fd, size_t count, int error) {
+  messages_in_loop_ -= count;
+  if (error) {
+    OnError();
+    return;
+  }
+  if (!output_queue_.empty())
+    loop_->RequestSend(fd);
+}
+
+bool Channel::QueueMessage(Message* message) {
+  // A checksum the sender added already covers the uncompressed payload.
+  if (compression_threshold_ && !message->has_checksum())
+    message->Compress(compression_threshold_);
+  if (add_checksums_ && !message->has_checksum())
+    message->AddChecksum();
+  // Somebody waits on these.
+  bool urgent = message->priority() == Message::PRIORITY_HIGH ||
+                message->is_sync() || message->is_reply();
+  ++held_messages_;
+  held_bytes_ += message->size();
+  output_queue_.Push(message);
+  return urgent;
+}
+
+bool Channel::OnMessagesQueued(bool urgent) {
+  // Connecting writes what was queued before.
+  if (!is_connected())
+    return true;
+
+  const FlushPolicy& policy = flush_policy_;
+  if (!urgent && held_messages_ &&
+      (!policy.max_messages || held_messages_ < policy.max_messages) &&
+      (!policy.max_bytes || held_bytes_ < policy.max_bytes)) {
+    if (!policy.max_delay_us || flush_timer_running_ || StartFlushTimer())
+      return true;
+  }
+  if (!StartWriting()) {
+    OnError();
+    return false;
+  }
+  return true;
+}
+
+bool Channel::StartWriting() {
+  if (streaming_) {
+    loop_->RequestSend(fd_);
+    return true;
+  }
+  if (waiting_to_write_)
+    return true;
+  return ProcessOutgoingMessages();
+}
+
+bool Channel::StartFlushTimer() {
+  if (flush_timer_fd_ < 0) {
+    flush_timer_fd_ = timerfd_create(CLOCK_MONOTONIC,
+                                     TFD_NONBLOCK | TFD_CLOEXEC);
+    if (flush_timer_fd_ < 0)
+      return false;
+    if (!loop_->WatchFileDescriptor(flush_timer_fd_, IOLoop::WATCH_READ,
+                                    this)) {
+      close(flush_timer_fd_);
+      flush_timer_fd_ = -1;
+      return false;
+    }
+  }
+  // Setting the timer again discards an expiry not yet read.
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  spec.it_value.tv_sec = flush_policy_.max_delay_us / 1000000;
+  spec.it_value.tv_nsec = (flush_policy_.max_delay_us % 1000000) * 1000;
+  if (timerfd_settime(flush_timer_fd_, 0, &spec, NULL) != 0)
+    return false;
+  flush_timer_running_ = true;
+  return true;
+}
+
+bool Channel::CreateServerSocket() {
+  struct sockaddr_un address;
+  if (!MakeAddress(path_, &address))
+    return false;
+  server_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (server_fd_ < 0)
+    return false;
+
+  // A socket file left behind by an earlier server would make bind() fail.
+  unlink(path_.c_str());
+  if (bind(server_fd_, reinterpret_cast<struct sockaddr*>(&address),
+           sizeof(address)) != 0 ||
+      listen(server_fd_, 1) != 0 ||
+      !loop_->WatchFileDescriptor(server_fd_, IOLoop::WATCH_READ, this)) {
+    close(server_fd_);
+    server_fd_ = -1;
+    return false;
+  }
+  return true;
+}
+
+bool Channel::ConnectToServer() {
+  struct sockaddr_un address;
+  if (!MakeAddress(path_, &address))
+    return false;
+  fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd_ < 0)
+    return false;
+
+  // Connecting to a local socket does not wait for the server to accept.
+  if (connect(fd_, reinterpret_cast<struct sockaddr*>(&address),
+              sizeof(address)) != 0) {
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  return true;
+}
+
+bool Channel::AcceptConnection() {
+  int fd = accept4(server_fd_, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (fd < 0)
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+  // The path only serves to meet; nobody else may connect.
+  loop_->StopWatchingFileDescriptor(server_fd_);
+  close(server_fd_);
+  server_fd_ = -1;
+  unlink(path_.c_str());
+
+  fd_ = fd;
+  return FinishConnecting();
+}
+
+bool Channel::FinishConnecting() {
+  // The loop's sends and receives wait for the socket in the kernel, which
+  // they only do on a blocking socket.
+  streaming_ = loop_->backend() == IOLoop::BACKEND_IO_URING;
+  if (streaming_) {
+    if (!SetNonBlocking(fd_, false) || !loop_->StartReceiving(fd_, this))
+      return false;
+  } else if (!SetNonBlocking(fd_, true) ||
+             !loop_->WatchFileDescriptor(fd_, IOLoop::WATCH_READ, this)) {
+    return false;
+  }
+
+  struct ucred credentials;
+  socklen_t length = sizeof(credentials);
+  if (getsockopt(fd_, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0)
+    peer_pid_ = credentials.pid;
+
+  connecting_ = false;
+  listener_->OnChannelConnected(peer_pid_);
+  if (closed_)
+    return true;
+  if (streaming_) {
+    if (!output_queue_.empty())
+      loop_->RequestSend(fd_);
+    return true;
+  }
+  return ProcessOutgoingMessages();
+}
+
+bool Channel::ProcessIncomingMessages() {
+  for (;;) {
+    size_t size;
+    char* buffer = reader_.GetWriteBuffer(&size);
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = size;
+    union {
+      struct cmsghdr align;
+      char buffer[kControlBufferSize];
+    } control;
+    struct msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_iov = &iov;
+    header.msg_iovlen = 1;
+    header.msg_control = control.buffer;
+    header.msg_controllen = sizeof(control);
+    ssize_t bytes_read = recvmsg(fd_, &header,
+                                 MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if (bytes_read < 0) {
+      if (errno == EINTR)
+        continue;
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    // The peer closed its end.
+    if (bytes_read == 0)
+      return false;
+
+    // Descriptors come ahead of, or with, the first byte of their message.
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&header); cmsg;
+         cmsg = CMSG_NXTHDR(&header, cmsg)) {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        const int* fds = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        input_fds_.insert(input_fds_.end(), fds, fds + count);
+      }
+    }
+    // More than a message can carry: the peer is broken.
+    if (header.msg_flags & MSG_CTRUNC)
+      return false;
+
+    reader_.DidWrite(bytes_read);
+    if (!DispatchMessages())
+      return false;
+    // A short read means the socket is empty, or that what follows came
+    // with descriptors; the loop calls again while anything is left.
+    if (closed_ || static_cast<size_t>(bytes_read) < size)
+      return true;
+  }
+}
+
+bool Channel::DispatchMessages() {
+  for (;;) {
+    const char* data;
+    int size;
+    MessageReader::Status status = reader_.ReadMessage(&data, &size);
+    if (status == MessageReader::NEED_MORE_DATA)
+      return true;
+    if (status != MessageReader::MESSAGE_READY)
+      return false;
+
+    Message message(data, size);
+    if (!AttachDescriptors(&message) || !message.Decompress())
+      return false;
+    listener_->OnMessageReceived(message);
+    if (closed_)
+      return true;
+  }
+}
+
+bool Channel::AttachDescriptors(Message* message) {
+  size_t count = message->header()->num_fds;
+  if (!count)
+    return true;
+  // The peer sent a message without its descriptors.
+  if (count > FileDescriptorSet::kMaxDescriptorsPerMessage ||
+      count > input_fds_.size())
+    return false;
+  message->file_descriptor_set()->SetDescriptors(&input_fds_[0], count);
+  input_fds_.erase(input_fds_.begin(), input_fds_.begin() + count);
+  return true;
+}
+
+bool Channel::ProcessOutgoingMessages() {
+  // Everything queued goes now, whatever the flush policy held back.
+  held_messages_ = 0;
+  held_bytes_ = 0;
+  for (;;) {
+    while (writing_.size() < kMaxSendBatch) {
+      Message* message = output_queue_.Pop();
+      if (!message)
+        break;
+      writing_.push_back(message);
+    }
+    if (writing_.empty())
+      break;
+
+    // A write carries the descriptors of one message at most, and stops
+    // short of the next message that has any.  They reach the peer with
+    // the first byte written, which is at or ahead of their message's.
+    size_t count = writing_.size();
+    Message* carrier = NULL;
+    for (size_t i = 0; i < count; ++i) {
+      if (!writing_[i]->HasFileDescriptors())
+        continue;
+      if (carrier) {
+        count = i;
+        break;
+      }
+      carrier = writing_[i];
+    }
+
+    // The first message goes on from where the last write stopped.
+    struct iovec iov[kMaxSendBatch];
+    for (size_t i = 0; i < count; ++i) {
+      size_t offset = i == 0 ? write_offset_ : 0;
+      iov[i].iov_base = const_cast<char*>(
+          static_cast<const char*>(writing_[i]->data()) + offset);
+      iov[i].iov_len = writing_[i]->size() - offset;
+    }
+    struct msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_iov = iov;
+    header.msg_iovlen = count;
+    union {
+      struct cmsghdr align;
+      char buffer[kControlBufferSize];
+    } control;
+    if (carrier) {
+      FileDescriptorSet* set = carrier->file_descriptor_set();
+      header.msg_control = control.buffer;
+      header.msg_controllen = CMSG_SPACE(sizeof(int) * set->size());
+      struct cmsghdr* cmsg = CMSG_FIRSTHDR(&header);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int) * set->size());
+      set->GetDescriptors(reinterpret_cast<int*>(CMSG_DATA(cmsg)));
+    }
+    ssize_t bytes_written = sendmsg(fd_, &header,
+                                    MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (bytes_written < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        return false;
+      if (!waiting_to_write_) {
+        if (!loop_->WatchFileDescriptor(fd_, IOLoop::WATCH_READ_WRITE, this))
+          return false;
+        waiting_to_write_ = true;
+      }
+      return true;
+    }
+
+    if (carrier)
+      carrier->file_descriptor_set()->CommitAll();
+    size_t written = 0;
+    write_offset_ += bytes_written;
+    while (written < writing_.size() &&
+           write_offset_ >= writing_[written]->size()) {
+      write_offset_ -= writing_[written]->size();
+      delete writing_[written];
+      ++written;
+    }
+    writing_.erase(writing_.begin(), writing_.begin() + written);
+  }
+
+  if (waiting_to_write_) {
+    if (!loop_->WatchFileDescriptor(fd_, IOLoop::WATCH_READ, this))
+      return false;
+    waiting_to_write_ = false;
+  }
+  return true;
+}
+
+void Channel::OnError() {
+  if (closed_)
+    return;
+  Close();
+  listener_->OnChannelError();
+}
+
+}  // namespace IPC
+
+#endif  // defined(OS_LINUX)
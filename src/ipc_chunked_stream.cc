@@ -0,0 +1,159 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipc/ipc_chunked_stream.h"
+
+#include <algorithm>  // for min()
+
+#include "base/compiler_specific.h"
+
+namespace IPC {
+
+// static
+STATIC_CONST_MEMBER_DEFINITION const size_t
+    ChunkedStreamWriter::kDefaultChunkSize;
+STATIC_CONST_MEMBER_DEFINITION const size_t
+    ChunkedStreamReader::kDefaultMaxOpenStreams;
+
+namespace {
+
+// Room for the fields in front of the bytes of a chunk.
+const size_t kChunkOverhead = 32;
+
+}  // namespace
+
+ChunkedStreamWriter::ChunkedStreamWriter(Message::Sender* sender,
+                                         int32 routing_id,
+                                         uint16 type,
+                                         uint32 stream_id,
+                                         size_t chunk_size)
+    : sender_(sender),
+      routing_id_(routing_id),
+      type_(type),
+      stream_id_(stream_id),
+      chunk_size_(std::max<size_t>(std::min<size_t>(chunk_size, kint32max),
+                                   1)),
+      priority_(Message::PRIORITY_NORMAL),
+      sent_(0),
+      closed_(false),
+      failed_(false) {
+}
+
+ChunkedStreamWriter::~ChunkedStreamWriter() {
+}
+
+bool ChunkedStreamWriter::Write(const void* data, size_t size) {
+  assert(!closed_);
+  const char* bytes = static_cast<const char*>(data);
+  while (size > 0 && !failed_) {
+    if (pending_.empty() && size >= chunk_size_) {
+      if (!SendChunk(bytes, chunk_size_, false))
+        break;
+      bytes += chunk_size_;
+      size -= chunk_size_;
+      continue;
+    }
+
+    size_t bytes_to_copy = std::min(size, chunk_size_ - pending_.size());
+    pending_.insert(pending_.end(), bytes, bytes + bytes_to_copy);
+    bytes += bytes_to_copy;
+    size -= bytes_to_copy;
+    if (pending_.size() == chunk_size_) {
+      SendChunk(&pending_[0], pending_.size(), false);
+      pending_.clear();
+    }
+  }
+  return !failed_;
+}
+
+bool ChunkedStreamWriter::Close() {
+  assert(!closed_);
+  closed_ = true;
+  if (!failed_)
+    SendChunk(pending_.empty() ? "" : &pending_[0], pending_.size(), true);
+  std::vector<char>().swap(pending_);
+  return !failed_;
+}
+
+bool ChunkedStreamWriter::SendChunk(const char* data, size_t size,
+                                    bool last) {
+  Message* chunk = new Message(routing_id_, IPC_CHUNK_ID, priority_);
+  chunk->Reserve(kChunkOverhead + size);
+  chunk->WriteUInt32(stream_id_);
+  chunk->WriteUInt16(type_);
+  chunk->WriteUInt64(sent_);
+  chunk->WriteBool(last);
+  chunk->WriteData(data, static_cast<int>(size));
+  if (!sender_->Send(chunk)) {
+    failed_ = true;
+    return false;
+  }
+  sent_ += size;
+  return true;
+}
+
+ChunkedStreamReader::Stream::Stream() : type(0), offset(0) {
+}
+
+ChunkedStreamReader::ChunkedStreamReader(Delegate* delegate,
+                                         size_t max_reassembly_size,
+                                         size_t max_open_streams)
+    : delegate_(delegate),
+      max_reassembly_size_(max_reassembly_size),
+      max_open_streams_(max_open_streams) {
+}
+
+ChunkedStreamReader::~ChunkedStreamReader() {
+}
+
+bool ChunkedStreamReader::OnMessageReceived(const Message& message) {
+  //DCHECK_EQ(IPC_CHUNK_ID, message.type());
+  PickleIterator iter(message);
+  uint32 stream_id;
+  uint16 type;
+  uint64 offset;
+  bool last;
+  const char* data;
+  int size;
+  if (!message.ReadUInt32(&iter, &stream_id) ||
+      !message.ReadUInt16(&iter, &type) ||
+      !message.ReadUInt64(&iter, &offset) ||
+      !message.ReadBool(&iter, &last) ||
+      !message.ReadData(&iter, &data, &size))
+    return false;
+
+  StreamKey key(message.routing_id(), stream_id);
+  StreamMap::iterator it = streams_.find(key);
+  if (it == streams_.end()) {
+    if (offset != 0 || (!last && streams_.size() >= max_open_streams_))
+      return false;
+    it = streams_.insert(std::make_pair(key, Stream())).first;
+    it->second.type = type;
+  }
+
+  Stream& stream = it->second;
+  if (offset != stream.offset || type != stream.type ||
+      (max_reassembly_size_ &&
+       static_cast<size_t>(size) > max_reassembly_size_ - stream.data.size())) {
+    streams_.erase(it);
+    return false;
+  }
+  stream.offset += size;
+
+  if (max_reassembly_size_) {
+    stream.data.insert(stream.data.end(), data, data + size);
+  } else if (size > 0) {
+    delegate_->OnStreamData(key.first, type, stream_id, data, size);
+  }
+
+  if (last) {
+    // The delegate may swap the data out, so it is only dropped afterwards.
+    delegate_->OnStreamEnd(key.first, type, stream_id,
+                           max_reassembly_size_ ? &stream.data : NULL);
+    streams_.erase(key);
+  }
+  return true;
+}
+
+}  // namespace IPC
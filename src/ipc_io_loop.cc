@@ -0,0 +1,924 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipc/ipc_io_loop.h"
+
+#if defined(OS_LINUX)
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "ipc/file_descriptor_set_posix.h"
+#include "ipc/ipc_message.h"
+
+namespace IPC {
+
+namespace {
+
+// Events handled per epoll_wait().
+const int kMaxEvents = 64;
+
+// Submission queue entries; the completion queue has twice as many.
+const unsigned kUringEntries = 256;
+
+// The buffers multishot receives land in, shared by all streams.  A power
+// of two.
+const unsigned kReceiveBufferCount = 16;
+const size_t kReceiveBufferSize = 128 * 1024;
+const uint16 kReceiveBufferGroup = 0;
+
+// Messages written by one chain of linked sends at most, and by each send
+// in it, which gathers them with sendmsg().
+const size_t kMaxSendBatch = 64;
+const size_t kMessagesPerSend = 16;
+
+// Room for the control data of the most descriptors a message can carry.
+const size_t kControlBufferSize =
+    CMSG_SPACE(sizeof(int) * FileDescriptorSet::kMaxDescriptorsPerMessage);
+
+uint32 EpollEvents(int mode) {
+  uint32 events = 0;
+  if (mode & IOLoop::WATCH_READ)
+    events |= EPOLLIN;
+  if (mode & IOLoop::WATCH_WRITE)
+    events |= EPOLLOUT;
+  return events;
+}
+
+uint32 PollEvents(int mode) {
+  uint32 events = 0;
+  if (mode & IOLoop::WATCH_READ)
+    events |= POLLIN;
+  if (mode & IOLoop::WATCH_WRITE)
+    events |= POLLOUT;
+  return events;
+}
+
+int UringSetup(unsigned entries, struct io_uring_params* params) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int UringEnter(int fd, unsigned to_submit, unsigned min_complete,
+               unsigned flags, const void* arg, size_t arg_size) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit,
+                                  min_complete, flags, arg, arg_size));
+}
+
+int UringRegister(int fd, unsigned opcode, const void* arg, unsigned count) {
+  return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg,
+                                  count));
+}
+
+}  // namespace
+
+struct IOLoop::Request {
+  enum Type {
+    // Polls a watched descriptor.
+    POLL,
+    // Polls |wakeup_fd_|.
+    WAKEUP,
+    // The multishot receive of a stream.
+    RECEIVE,
+    // Send |index| of |batch|.
+    SEND
+  };
+
+  Request(Type type, int fd)
+      : type(type), fd(fd), batch(NULL), index(0) {}
+
+  Type type;
+  int fd;
+  SendBatch* batch;
+  size_t index;
+};
+
+// Messages written by one chain of linked sends.  Send k writes messages
+// ends[k - 1] up to ends[k].
+struct IOLoop::SendBatch {
+  int fd;
+  std::vector<Message*> messages;
+  // Where writing starts in the first message.
+  size_t offset;
+  // Where each send ends, and the message whose descriptors it carries, or
+  // -1.
+  std::vector<size_t> ends;
+  std::vector<int> carriers;
+  // One for each message, and one header for each send.
+  std::vector<struct iovec> iovecs;
+  std::vector<struct msghdr> headers;
+  // The control data of the sends that carry descriptors.
+  std::vector<char> control;
+  // What each send completed with.
+  std::vector<int> results;
+  // Sends not completed yet.
+  size_t pending;
+};
+
+// The rings shared with the kernel.
+struct IOLoop::Uring {
+  Uring()
+      : fd(-1),
+        ring(MAP_FAILED),
+        ring_size(0),
+        sqes(static_cast<struct io_uring_sqe*>(MAP_FAILED)),
+        sqes_size(0),
+        sq_local_tail(0),
+        buffer_ring(static_cast<struct io_uring_buf*>(MAP_FAILED)),
+        buffer_ring_size(0),
+        buffers(static_cast<char*>(MAP_FAILED)),
+        buffer_tail(0),
+        requests(0) {
+  }
+
+  ~Uring() {
+    if (fd >= 0)
+      close(fd);
+    if (ring != MAP_FAILED)
+      munmap(ring, ring_size);
+    if (sqes != MAP_FAILED)
+      munmap(sqes, sqes_size);
+    if (buffer_ring != MAP_FAILED)
+      munmap(buffer_ring, buffer_ring_size);
+    if (buffers != MAP_FAILED)
+      munmap(buffers, kReceiveBufferCount * kReceiveBufferSize);
+  }
+
+  // Queues nothing, but makes sure |count| entries can be queued in a row
+  // without a submission in between, which would break a chain of links.
+  void Reserve(unsigned count) {
+    if (sq_entries - (sq_local_tail - __atomic_load_n(sq_head,
+                                                      __ATOMIC_ACQUIRE)) <
+        count)
+      Enter(0, 0, NULL, 0);
+  }
+
+  // Returns a cleared submission queue entry to fill in.
+  struct io_uring_sqe* GetSqe() {
+    Reserve(1);
+    struct io_uring_sqe* sqe = &sqes[sq_local_tail & sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ++sq_local_tail;
+    return sqe;
+  }
+
+  // Submits what is queued and, if |min_complete| is not 0, waits for
+  // completions.
+  int Enter(unsigned min_complete, unsigned flags, const void* arg,
+            size_t arg_size) {
+    __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+    unsigned to_submit =
+        sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if (min_complete)
+      flags |= IORING_ENTER_GETEVENTS;
+    return UringEnter(fd, to_submit, min_complete, flags, arg, arg_size);
+  }
+
+  // Hands buffer |id| back to the kernel.
+  void ProvideBuffer(uint16 id) {
+    struct io_uring_buf* buffer =
+        &buffer_ring[buffer_tail & (kReceiveBufferCount - 1)];
+    buffer->addr = reinterpret_cast<uint64>(buffers + id * kReceiveBufferSize);
+    buffer->len = kReceiveBufferSize;
+    buffer->bid = id;
+    ++buffer_tail;
+    // The tail shares the first entry, as its otherwise unused last field.
+    __atomic_store_n(&buffer_ring[0].resv, buffer_tail, __ATOMIC_RELEASE);
+  }
+
+  int fd;
+  void* ring;
+  size_t ring_size;
+  struct io_uring_sqe* sqes;
+  size_t sqes_size;
+
+  unsigned* sq_head;
+  unsigned* sq_tail;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  // Entries queued, including those not yet made visible to the kernel.
+  unsigned sq_local_tail;
+
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe* cqes;
+
+  // What multishot receives ask for besides the payload: room for the
+  // control data of one message's descriptors, and no address.
+  struct msghdr receive_header;
+
+  // The ring of provided buffers, as struct io_uring_buf_ring lays it out
+  // in C; in C++ its flexible array member comes out misplaced.
+  struct io_uring_buf* buffer_ring;
+  size_t buffer_ring_size;
+  char* buffers;
+  uint16 buffer_tail;
+
+  // Requests that have not completed for good.
+  size_t requests;
+};
+
+IOLoop::IOLoop()
+    : backend_(BACKEND_EPOLL),
+      epoll_fd_(-1),
+      wakeup_fd_(-1),
+      quit_(false),
+      uring_(NULL) {
+}
+
+IOLoop::~IOLoop() {
+  //DCHECK(watches_.empty());
+  //DCHECK(streams_.empty());
+  if (uring_) {
+    // The kernel may still be reading from messages, or writing into the
+    // receive buffers, until the requests complete.
+    watches_.clear();
+    for (StreamMap::iterator it = streams_.begin(); it != streams_.end();
+         ++it) {
+      for (size_t i = 0; i < it->second.unsent.size(); ++i)
+        delete it->second.unsent[i];
+    }
+    streams_.clear();
+    struct io_uring_sqe* sqe = uring_->GetSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    for (int i = 0; i < 1000 && uring_->requests > 0; ++i) {
+      quit_ = false;
+      RunOnceUring(10);
+    }
+    delete uring_;
+  }
+  if (wakeup_fd_ >= 0)
+    close(wakeup_fd_);
+  if (epoll_fd_ >= 0)
+    close(epoll_fd_);
+}
+
+bool IOLoop::Init(Backend backend) {
+  wakeup_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wakeup_fd_ < 0)
+    return false;
+
+  if (backend == BACKEND_IO_URING) {
+    if (InitUring()) {
+      backend_ = BACKEND_IO_URING;
+      Request* request = NewRequest(Request::WAKEUP, wakeup_fd_);
+      SubmitPoll(request, wakeup_fd_, POLLIN);
+      return true;
+    }
+    delete uring_;
+    uring_ = NULL;
+  }
+
+  backend_ = BACKEND_EPOLL;
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0)
+    return false;
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = wakeup_fd_;
+  return epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wakeup_fd_, &event) == 0;
+}
+
+bool IOLoop::InitUring() {
+  uring_ = new Uring;
+  // A single issuer is new in 6.0, as are multishot receives; the other
+  // features needed are older.
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN |
+                 IORING_SETUP_SUBMIT_ALL;
+  uring_->fd = UringSetup(kUringEntries, &params);
+  if (uring_->fd < 0)
+    return false;
+  const uint32 kFeatures = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP |
+                           IORING_FEAT_EXT_ARG;
+  if ((params.features & kFeatures) != kFeatures)
+    return false;
+
+  uring_->ring_size = std::max<size_t>(
+      params.sq_off.array + params.sq_entries * sizeof(unsigned),
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+  uring_->ring = mmap(NULL, uring_->ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, uring_->fd,
+                      IORING_OFF_SQ_RING);
+  if (uring_->ring == MAP_FAILED)
+    return false;
+  uring_->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  uring_->sqes = static_cast<struct io_uring_sqe*>(
+      mmap(NULL, uring_->sqes_size, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, uring_->fd, IORING_OFF_SQES));
+  if (uring_->sqes == MAP_FAILED)
+    return false;
+
+  char* ring = static_cast<char*>(uring_->ring);
+  uring_->sq_head = reinterpret_cast<unsigned*>(ring + params.sq_off.head);
+  uring_->sq_tail = reinterpret_cast<unsigned*>(ring + params.sq_off.tail);
+  uring_->sq_mask = *reinterpret_cast<unsigned*>(
+      ring + params.sq_off.ring_mask);
+  uring_->sq_entries = *reinterpret_cast<unsigned*>(
+      ring + params.sq_off.ring_entries);
+  uring_->sq_local_tail = *uring_->sq_tail;
+  unsigned* array = reinterpret_cast<unsigned*>(ring + params.sq_off.array);
+  for (unsigned i = 0; i < uring_->sq_entries; ++i)
+    array[i] = i;
+  uring_->cq_head = reinterpret_cast<unsigned*>(ring + params.cq_off.head);
+  uring_->cq_tail = reinterpret_cast<unsigned*>(ring + params.cq_off.tail);
+  uring_->cq_mask = *reinterpret_cast<unsigned*>(
+      ring + params.cq_off.ring_mask);
+  uring_->cqes = reinterpret_cast<struct io_uring_cqe*>(
+      ring + params.cq_off.cqes);
+
+  memset(&uring_->receive_header, 0, sizeof(uring_->receive_header));
+  uring_->receive_header.msg_controllen = kControlBufferSize;
+
+  // The receive buffers, handed to the kernel through a ring of their own.
+  uring_->buffer_ring_size =
+      kReceiveBufferCount * sizeof(struct io_uring_buf);
+  uring_->buffer_ring = static_cast<struct io_uring_buf*>(
+      mmap(NULL, uring_->buffer_ring_size, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  uring_->buffers = static_cast<char*>(
+      mmap(NULL, kReceiveBufferCount * kReceiveBufferSize,
+           PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  if (uring_->buffer_ring == MAP_FAILED || uring_->buffers == MAP_FAILED)
+    return false;
+  struct io_uring_buf_reg registration;
+  memset(&registration, 0, sizeof(registration));
+  registration.ring_addr = reinterpret_cast<uint64>(uring_->buffer_ring);
+  registration.ring_entries = kReceiveBufferCount;
+  registration.bgid = kReceiveBufferGroup;
+  if (UringRegister(uring_->fd, IORING_REGISTER_PBUF_RING, &registration,
+                    1) != 0)
+    return false;
+  for (unsigned i = 0; i < kReceiveBufferCount; ++i)
+    uring_->ProvideBuffer(static_cast<uint16>(i));
+  return true;
+}
+
+bool IOLoop::WatchFileDescriptor(int fd, int mode, Watcher* watcher) {
+  //DCHECK_NE(fd, wakeup_fd_);
+  if (backend_ == BACKEND_IO_URING) {
+    WatchMap::iterator it = watches_.find(fd);
+    if (it == watches_.end()) {
+      Watch watch = { NULL, 0, NULL };
+      it = watches_.insert(std::make_pair(fd, watch)).first;
+    } else if (it->second.mode != mode && it->second.poll) {
+      // Left to complete on its own; it no longer counts.
+      struct io_uring_sqe* sqe = uring_->GetSqe();
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->addr = reinterpret_cast<uint64>(it->second.poll);
+      sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+      it->second.poll = NULL;
+    }
+    it->second.watcher = watcher;
+    it->second.mode = mode;
+    if (!it->second.poll) {
+      it->second.poll = NewRequest(Request::POLL, fd);
+      SubmitPoll(it->second.poll, fd, PollEvents(mode));
+    }
+    return true;
+  }
+
+  struct epoll_event event = {};
+  event.events = EpollEvents(mode);
+  event.data.fd = fd;
+
+  WatchMap::iterator it = watches_.find(fd);
+  if (it == watches_.end()) {
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) != 0)
+      return false;
+    it = watches_.insert(std::make_pair(fd, Watch())).first;
+  } else if (it->second.mode != mode &&
+             epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event) != 0) {
+    return false;
+  }
+  it->second.watcher = watcher;
+  it->second.mode = mode;
+  it->second.poll = NULL;
+  return true;
+}
+
+void IOLoop::StopWatchingFileDescriptor(int fd) {
+  if (backend_ == BACKEND_IO_URING) {
+    bool watched = false;
+    WatchMap::iterator it = watches_.find(fd);
+    if (it != watches_.end()) {
+      watches_.erase(it);
+      watched = true;
+    }
+    StreamMap::iterator stream = streams_.find(fd);
+    if (stream != streams_.end()) {
+      for (size_t i = 0; i < stream->second.unsent.size(); ++i)
+        delete stream->second.unsent[i];
+      streams_.erase(stream);
+      watched = true;
+    }
+    // The requests complete on their own, and are then found not to count.
+    // The cancellation goes in now, while |fd| still refers to the file.
+    if (watched) {
+      SubmitCancel(fd);
+      uring_->Enter(0, 0, NULL, 0);
+    }
+    return;
+  }
+
+  WatchMap::iterator it = watches_.find(fd);
+  if (it == watches_.end())
+    return;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, NULL);
+  watches_.erase(it);
+}
+
+bool IOLoop::StartReceiving(int fd, StreamHandler* handler) {
+  if (backend_ != BACKEND_IO_URING || streams_.count(fd) ||
+      watches_.count(fd))
+    return false;
+  Stream& stream = streams_[fd];
+  stream.handler = handler;
+  stream.receive = NewRequest(Request::RECEIVE, fd);
+  stream.send_requested = false;
+  stream.unsent_offset = 0;
+  stream.sending = NULL;
+  SubmitReceive(stream.receive);
+  return true;
+}
+
+void IOLoop::RequestSend(int fd) {
+  StreamMap::iterator it = streams_.find(fd);
+  if (it == streams_.end() || it->second.send_requested)
+    return;
+  it->second.send_requested = true;
+  ready_to_send_.push_back(fd);
+}
+
+void IOLoop::SendMessages(int fd, std::vector<Message*>* messages) {
+  StreamMap::iterator it = streams_.find(fd);
+  if (it == streams_.end()) {
+    for (size_t i = 0; i < messages->size(); ++i)
+      delete (*messages)[i];
+  } else {
+    it->second.unsent.insert(it->second.unsent.end(), messages->begin(),
+                             messages->end());
+    ready_to_send_.push_back(fd);
+  }
+  messages->clear();
+}
+
+bool IOLoop::RunOnce(int timeout_ms) {
+  if (quit_)
+    return false;
+  if (backend_ == BACKEND_IO_URING)
+    return RunOnceUring(timeout_ms);
+  return RunOnceEpoll(timeout_ms);
+}
+
+bool IOLoop::RunOnceEpoll(int timeout_ms) {
+  struct epoll_event events[kMaxEvents];
+  int count = epoll_wait(epoll_fd_, events, kMaxEvents, timeout_ms);
+  if (count < 0)
+    return errno == EINTR;
+
+  for (int i = 0; i < count && !quit_; ++i) {
+    int fd = events[i].data.fd;
+    if (fd == wakeup_fd_) {
+      uint64 value;
+      if (read(wakeup_fd_, &value, sizeof(value)) > 0)
+        quit_ = true;
+      continue;
+    }
+
+    uint32 ready = events[i].events;
+    DispatchPoll(fd, (ready & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0,
+                 (ready & (EPOLLOUT | EPOLLERR)) != 0);
+  }
+  return !quit_;
+}
+
+bool IOLoop::RunOnceUring(int timeout_ms) {
+  FlushSends();
+
+  // Completions may be left from the last time round, if it quit.
+  unsigned head = *uring_->cq_head;
+  bool waiting = timeout_ms != 0 &&
+      head == __atomic_load_n(uring_->cq_tail, __ATOMIC_ACQUIRE);
+  struct __kernel_timespec timeout;
+  struct io_uring_getevents_arg arg;
+  memset(&arg, 0, sizeof(arg));
+  const void* enter_arg = NULL;
+  size_t enter_arg_size = 0;
+  unsigned flags = IORING_ENTER_GETEVENTS;
+  if (waiting && timeout_ms > 0) {
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+    arg.ts = reinterpret_cast<uint64>(&timeout);
+    enter_arg = &arg;
+    enter_arg_size = sizeof(arg);
+    flags |= IORING_ENTER_EXT_ARG;
+  }
+  if (uring_->Enter(waiting ? 1 : 0, flags, enter_arg, enter_arg_size) < 0 &&
+      errno != EINTR && errno != ETIME && errno != EBUSY && errno != EAGAIN)
+    return false;
+
+  // The completion is copied out and its slot freed before it is handled,
+  // so handlers can queue more requests.
+  while (!quit_) {
+    if (head == __atomic_load_n(uring_->cq_tail, __ATOMIC_ACQUIRE))
+      break;
+    struct io_uring_cqe cqe = uring_->cqes[head & uring_->cq_mask];
+    ++head;
+    __atomic_store_n(uring_->cq_head, head, __ATOMIC_RELEASE);
+
+    Request* request = reinterpret_cast<Request*>(cqe.user_data);
+    if (!request)
+      continue;
+    switch (request->type) {
+      case Request::POLL:
+      case Request::WAKEUP:
+        OnPollCompleted(request, cqe.res);
+        break;
+      case Request::RECEIVE:
+        OnReceiveCompleted(request, cqe.res, cqe.flags);
+        break;
+      case Request::SEND:
+        OnSendCompleted(request, cqe.res);
+        break;
+    }
+  }
+  return !quit_;
+}
+
+void IOLoop::Run() {
+  quit_ = false;
+  while (RunOnce(-1)) {
+  }
+}
+
+void IOLoop::Quit() {
+  uint64 value = 1;
+  ssize_t result = write(wakeup_fd_, &value, sizeof(value));
+  (void)result;
+}
+
+IOLoop::Request* IOLoop::NewRequest(int type, int fd) {
+  ++uring_->requests;
+  return new Request(static_cast<Request::Type>(type), fd);
+}
+
+void IOLoop::DeleteRequest(Request* request) {
+  --uring_->requests;
+  delete request;
+}
+
+void IOLoop::SubmitPoll(Request* request, int fd, uint32 events) {
+  struct io_uring_sqe* sqe = uring_->GetSqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = events;
+  sqe->user_data = reinterpret_cast<uint64>(request);
+}
+
+void IOLoop::SubmitReceive(Request* request) {
+  struct io_uring_sqe* sqe = uring_->GetSqe();
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = request->fd;
+  sqe->addr = reinterpret_cast<uint64>(&uring_->receive_header);
+  sqe->len = 1;
+  sqe->msg_flags = MSG_CMSG_CLOEXEC;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = kReceiveBufferGroup;
+  sqe->user_data = reinterpret_cast<uint64>(request);
+}
+
+void IOLoop::SubmitSends(int fd, Stream* stream) {
+  size_t count = std::min(stream->unsent.size(), kMaxSendBatch);
+  SendBatch* batch = new SendBatch;
+  batch->fd = fd;
+  batch->messages.assign(stream->unsent.begin(),
+                         stream->unsent.begin() + count);
+  stream->unsent.erase(stream->unsent.begin(),
+                       stream->unsent.begin() + count);
+  batch->offset = stream->unsent_offset;
+  stream->unsent_offset = 0;
+
+  // Each send gathers kMessagesPerSend messages at most, and carries the
+  // descriptors of one of them at most: it stops short of the next
+  // message that has any.  They reach the peer with its first byte, which
+  // is at or ahead of their message's.
+  size_t control_size = 0;
+  for (size_t first = 0; first < count;) {
+    size_t end = first;
+    int carrier = -1;
+    for (; end < count && end - first < kMessagesPerSend; ++end) {
+      Message* message = batch->messages[end];
+      if (!message->HasFileDescriptors())
+        continue;
+      if (carrier >= 0)
+        break;
+      carrier = static_cast<int>(end);
+      control_size +=
+          CMSG_SPACE(sizeof(int) * message->file_descriptor_set()->size());
+    }
+    batch->ends.push_back(end);
+    batch->carriers.push_back(carrier);
+    first = end;
+  }
+  size_t sends = batch->ends.size();
+  batch->iovecs.resize(count);
+  batch->headers.resize(sends);
+  batch->control.resize(control_size);
+  batch->results.resize(sends, -ECANCELED);
+  batch->pending = sends;
+  stream->sending = batch;
+  for (size_t i = 0; i < count; ++i) {
+    size_t offset = i == 0 ? batch->offset : 0;
+    const Message* message = batch->messages[i];
+    batch->iovecs[i].iov_base = const_cast<char*>(
+        static_cast<const char*>(message->data()) + offset);
+    batch->iovecs[i].iov_len = message->size() - offset;
+  }
+
+  // Each send only starts once the one before it has written everything;
+  // one that falls short cancels the rest.
+  uring_->Reserve(static_cast<unsigned>(sends));
+  size_t control_offset = 0;
+  for (size_t i = 0; i < sends; ++i) {
+    size_t first = i == 0 ? 0 : batch->ends[i - 1];
+    struct msghdr* header = &batch->headers[i];
+    memset(header, 0, sizeof(*header));
+    header->msg_iov = &batch->iovecs[first];
+    header->msg_iovlen = batch->ends[i] - first;
+    if (batch->carriers[i] >= 0) {
+      FileDescriptorSet* set =
+          batch->messages[batch->carriers[i]]->file_descriptor_set();
+      header->msg_control = &batch->control[control_offset];
+      header->msg_controllen = CMSG_SPACE(sizeof(int) * set->size());
+      control_offset += header->msg_controllen;
+      struct cmsghdr* cmsg = CMSG_FIRSTHDR(header);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int) * set->size());
+      set->GetDescriptors(reinterpret_cast<int*>(CMSG_DATA(cmsg)));
+    }
+
+    Request* request = NewRequest(Request::SEND, fd);
+    request->batch = batch;
+    request->index = i;
+    struct io_uring_sqe* sqe = uring_->GetSqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64>(header);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    if (i + 1 < sends)
+      sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = reinterpret_cast<uint64>(request);
+  }
+}
+
+void IOLoop::SubmitCancel(int fd) {
+  struct io_uring_sqe* sqe = uring_->GetSqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = fd;
+  sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+  sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+}
+
+void IOLoop::FlushSends() {
+  std::vector<int> ready;
+  ready.swap(ready_to_send_);
+  for (size_t i = 0; i < ready.size(); ++i) {
+    int fd = ready[i];
+    StreamMap::iterator it = streams_.find(fd);
+    if (it == streams_.end() || it->second.sending)
+      continue;
+    if (it->second.send_requested) {
+      it->second.send_requested = false;
+      it->second.handler->OnStreamCanSend(fd);
+      it = streams_.find(fd);
+      if (it == streams_.end() || it->second.sending)
+        continue;
+    }
+    if (!it->second.unsent.empty())
+      SubmitSends(fd, &it->second);
+  }
+}
+
+void IOLoop::OnPollCompleted(Request* request, int result) {
+  int fd = request->fd;
+  if (request->type == Request::WAKEUP) {
+    if (result < 0) {
+      DeleteRequest(request);
+      return;
+    }
+    uint64 value;
+    if (read(wakeup_fd_, &value, sizeof(value)) > 0)
+      quit_ = true;
+    SubmitPoll(request, wakeup_fd_, POLLIN);
+    return;
+  }
+
+  WatchMap::iterator it = watches_.find(fd);
+  if (it == watches_.end() || it->second.poll != request) {
+    DeleteRequest(request);
+    return;
+  }
+  // Polls are one-shot: the descriptor is polled again after the watcher
+  // has run, which keeps watching level triggered.
+  it->second.poll = NULL;
+  bool failed = result < 0;
+  DispatchPoll(fd, failed || (result & (POLLIN | POLLHUP | POLLERR)),
+               failed || (result & (POLLOUT | POLLERR)));
+
+  it = watches_.find(fd);
+  if (it != watches_.end() && !it->second.poll) {
+    it->second.poll = request;
+    SubmitPoll(request, fd, PollEvents(it->second.mode));
+  } else {
+    DeleteRequest(request);
+  }
+}
+
+void IOLoop::OnReceiveCompleted(Request* request, int result, uint32 flags) {
+  int fd = request->fd;
+  int buffer = -1;
+  if (flags & IORING_CQE_F_BUFFER)
+    buffer = flags >> IORING_CQE_BUFFER_SHIFT;
+
+  // The buffer holds a struct io_uring_recvmsg_out, the control data in
+  // the room |receive_header| asks for, and the payload.  A receive without
+  // payload means the peer closed its end.
+  ssize_t received = result;
+  if (result > 0 && buffer >= 0) {
+    char* data = uring_->buffers + buffer * kReceiveBufferSize;
+    const struct io_uring_recvmsg_out* out =
+        reinterpret_cast<const struct io_uring_recvmsg_out*>(data);
+    struct msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_control =
+        data + sizeof(*out) + uring_->receive_header.msg_namelen;
+    header.msg_controllen = out->controllen;
+    std::vector<int> fds;
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&header); cmsg;
+         cmsg = CMSG_NXTHDR(&header, cmsg)) {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        const int* first = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+        fds.insert(fds.end(), first,
+                   first + (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+      }
+    }
+    received = out->payloadlen;
+    // More descriptors than a message can carry: the peer is broken.
+    if (out->flags & MSG_CTRUNC)
+      received = -EMSGSIZE;
+
+    StreamMap::iterator it = streams_.find(fd);
+    if (!fds.empty() && it != streams_.end() &&
+        it->second.receive == request) {
+      it->second.handler->OnStreamDescriptorsReceived(fd, &fds[0],
+                                                      fds.size());
+      fds.clear();
+      it = streams_.find(fd);
+    }
+    for (size_t i = 0; i < fds.size(); ++i)
+      close(fds[i]);
+    if (it != streams_.end() && it->second.receive == request &&
+        received > 0) {
+      it->second.handler->OnStreamReceived(
+          fd, static_cast<const char*>(header.msg_control) +
+                  uring_->receive_header.msg_controllen,
+          received);
+    }
+  }
+  if (buffer >= 0)
+    uring_->ProvideBuffer(static_cast<uint16>(buffer));
+
+  StreamMap::iterator it = streams_.find(fd);
+  bool current = it != streams_.end() && it->second.receive == request;
+  if (flags & IORING_CQE_F_MORE) {
+    if (!current || received > 0)
+      return;
+    // The receive goes on, but the stream is done with it; it no longer
+    // counts once it completes.
+    struct io_uring_sqe* sqe = uring_->GetSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = reinterpret_cast<uint64>(request);
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    it->second.receive = NULL;
+    it->second.handler->OnStreamReceived(fd, NULL, received);
+    return;
+  }
+
+  // The receive has ended.  It goes on after running out of buffers, which
+  // are back now, or after anything else that ends it while data flows.
+  if (!current) {
+    DeleteRequest(request);
+    return;
+  }
+  if (received > 0 || received == -ENOBUFS) {
+    SubmitReceive(request);
+    return;
+  }
+  it->second.receive = NULL;
+  DeleteRequest(request);
+  it->second.handler->OnStreamReceived(fd, NULL, received);
+}
+
+void IOLoop::OnSendCompleted(Request* request, int result) {
+  SendBatch* batch = request->batch;
+  batch->results[request->index] = result;
+  DeleteRequest(request);
+  if (--batch->pending > 0)
+    return;
+
+  // The messages written in full are done with.  Writing resumes where
+  // the first send that fell short stopped, unless it failed.
+  size_t written = 0;
+  size_t offset = batch->offset;
+  int error = 0;
+  for (size_t i = 0; i < batch->results.size(); ++i) {
+    int result = batch->results[i];
+    if (result < 0) {
+      if (result != -ECANCELED)
+        error = -result;
+      break;
+    }
+    // Descriptors go with the first byte a send writes.
+    if (result > 0 && batch->carriers[i] >= 0)
+      batch->messages[batch->carriers[i]]->file_descriptor_set()->CommitAll();
+    size_t bytes = result;
+    size_t end = batch->ends[i];
+    for (; written < end; ++written) {
+      size_t left = batch->messages[written]->size() - offset;
+      if (bytes < left)
+        break;
+      bytes -= left;
+      offset = 0;
+      delete batch->messages[written];
+    }
+    if (written < end) {
+      offset += bytes;
+      break;
+    }
+  }
+  batch->messages.erase(batch->messages.begin(),
+                        batch->messages.begin() + written);
+
+  int fd = batch->fd;
+  StreamMap::iterator it = streams_.find(fd);
+  if (it == streams_.end() || it->second.sending != batch || error) {
+    for (size_t i = 0; i < batch->messages.size(); ++i)
+      delete batch->messages[i];
+    batch->messages.clear();
+  } else if (!batch->messages.empty()) {
+    it->second.unsent.insert(it->second.unsent.begin(),
+                             batch->messages.begin(),
+                             batch->messages.end());
+    it->second.unsent_offset = offset;
+  }
+  bool current = it != streams_.end() && it->second.sending == batch;
+  delete batch;
+  if (!current)
+    return;
+
+  it->second.sending = NULL;
+  if (error) {
+    for (size_t i = 0; i < it->second.unsent.size(); ++i)
+      delete it->second.unsent[i];
+    it->second.unsent.clear();
+    it->second.send_requested = false;
+  } else if (it->second.send_requested || !it->second.unsent.empty()) {
+    ready_to_send_.push_back(fd);
+  }
+  if (written || error)
+    it->second.handler->OnStreamSent(fd, written, error);
+}
+
+void IOLoop::DispatchPoll(int fd, bool readable, bool writable) {
+  // Look the descriptor up again before each call: an earlier watcher
+  // may have stopped watching it.
+  WatchMap::iterator it = watches_.find(fd);
+  if (readable && it != watches_.end() && (it->second.mode & WATCH_READ))
+    it->second.watcher->OnFileCanReadWithoutBlocking(fd);
+  it = watches_.find(fd);
+  if (writable && it != watches_.end() && (it->second.mode & WATCH_WRITE))
+    it->second.watcher->OnFileCanWriteWithoutBlocking(fd);
+}
+
+}  // namespace IPC
+
+#endif  // defined(OS_LINUX)
@@ -4,15 +4,64 @@
 
 #include "ipc/ipc_message.h"
 
+#include <stdlib.h>
+#include <string.h>
+
+#include <utility>  // for move()
+
+#include "base/compiler_specific.h"
+#include "base/crc32c.h"
+#include "base/lz_codec.h"
+
+#if defined(OS_POSIX)
+#include "base/file_descriptor_posix.h"
+#include "ipc/file_descriptor_set_posix.h"
+#endif
+
+#if defined(OS_WIN)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
 //#include "base/logging.h"
 //#include "build/build_config.h"
 
 
 namespace IPC {
 
+static bool g_compact_by_default = false;
+
+namespace {
+
+// A compressed payload starts with the sizes before and after compression.
+struct CompressedPrefix {
+  uint32 raw_size;
+  uint32 compressed_size;
+};
+
+}  // namespace
+
+// static
+STATIC_CONST_MEMBER_DEFINITION const size_t
+    Message::kDefaultCompressionThreshold;
+
 //------------------------------------------------------------------------------
 
+bool Message::Sender::SendBatch(std::vector<Message*>* messages) {
+  bool sent = true;
+  for (size_t i = 0; i < messages->size(); ++i) {
+    if (!Send((*messages)[i]))
+      sent = false;
+  }
+  messages->clear();
+  return sent;
+}
+
 Message::~Message() {
+#if defined(OS_POSIX)
+  SetFileDescriptorSet(NULL);
+#endif
 }
 
 Message::Message()
@@ -20,6 +69,7 @@ Message::Message()
   header()->routing = header()->type = header()->flags = 0;
 #if defined(OS_POSIX)
   header()->num_fds = 0;
+  file_descriptor_set_ = NULL;
 #endif
   InitLoggingVariables();
 }
@@ -31,21 +81,70 @@ Message::Message(int32 routing_id, uint16 type, PriorityValue priority)
   header()->flags = priority;
 #if defined(OS_POSIX)
   header()->num_fds = 0;
+  file_descriptor_set_ = NULL;
+#endif
+  InitLoggingVariables();
+  if (g_compact_by_default)
+    set_compact();
+}
+
+Message::Message(int32 routing_id, uint16 type, PriorityValue priority,
+                 PickleAllocator* allocator)
+    : Pickle(sizeof(Header), allocator) {
+  header()->routing = routing_id;
+  header()->type = type;
+  header()->flags = priority;
+#if defined(OS_POSIX)
+  header()->num_fds = 0;
+  file_descriptor_set_ = NULL;
 #endif
   InitLoggingVariables();
+  if (g_compact_by_default)
+    set_compact();
 }
 
 Message::Message(const char* data, int data_len) : Pickle(data, data_len) {
+#if defined(OS_POSIX)
+  file_descriptor_set_ = NULL;
+#endif
   InitLoggingVariables();
+  InitCompactFromHeader();
 }
 
 Message::Message(const Message& other) : Pickle(other) {
   InitLoggingVariables();
+#if defined(OS_POSIX)
+  file_descriptor_set_ = NULL;
+  SetFileDescriptorSet(other.file_descriptor_set_);
+#endif
+}
+
+Message::Message(Message&& other) : Pickle(std::move(other)) {
+  InitLoggingVariables();
 #if defined(OS_POSIX)
   file_descriptor_set_ = other.file_descriptor_set_;
+  other.file_descriptor_set_ = NULL;
 #endif
 }
 
+Message::Message(const Buffer& buffer) : Pickle(buffer) {
+#if defined(OS_POSIX)
+  file_descriptor_set_ = NULL;
+#endif
+  InitLoggingVariables();
+  InitCompactFromHeader();
+}
+
+// static
+void Message::SetCompactByDefault(bool compact) {
+  g_compact_by_default = compact;
+}
+
+void Message::InitCompactFromHeader() {
+  if (data() && (flags() & COMPACT_BIT))
+    Pickle::set_compact(true);
+}
+
 void Message::InitLoggingVariables() {
 #ifdef IPC_MESSAGE_LOG_ENABLED
   received_time_ = 0;
@@ -56,6 +155,21 @@ void Message::InitLoggingVariables() {
 
 Message& Message::operator=(const Message& other) {
   *static_cast<Pickle*>(this) = other;
+#if defined(OS_POSIX)
+  SetFileDescriptorSet(other.file_descriptor_set_);
+#endif
+  return *this;
+}
+
+Message& Message::operator=(Message&& other) {
+  *static_cast<Pickle*>(this) = std::move(other);
+#if defined(OS_POSIX)
+  if (this != &other) {
+    SetFileDescriptorSet(NULL);
+    file_descriptor_set_ = other.file_descriptor_set_;
+    other.file_descriptor_set_ = NULL;
+  }
+#endif
   return *this;
 }
 
@@ -66,22 +180,271 @@ void Message::SetHeaderValues(int32 routing, uint32 type, uint32 flags) {
     header()->routing = routing;
     header()->type = type;
     header()->flags = flags;
+    Pickle::set_compact((flags & COMPACT_BIT) != 0);
+}
+
+void Message::set_deadline(int64 deadline) {
+  assert(!has_deadline());
+  assert(!has_checksum());
+  assert((header()->flags & HAS_SENT_TIME_BIT) == 0);
+  header()->flags |= HAS_DEADLINE_BIT;
+  // Raw bytes rather than WriteInt64(), which is a varint in compact mode,
+  // so that the trailer can be found from the end of the payload.
+  WriteBytes(&deadline, sizeof(deadline));
+}
+
+int64 Message::deadline() const {
+  if (!has_deadline())
+    return 0;
+
+  const char* data = end_of_trailers() - sizeof(int64);
+  if (header()->flags & HAS_SENT_TIME_BIT)
+    data -= sizeof(int64);
+  int64 deadline;
+  memcpy(&deadline, data, sizeof(deadline));
+  return deadline;
+}
+
+// static
+int64 Message::DeadlineClockNow() {
+#if defined(OS_WIN)
+  return static_cast<int64>(GetTickCount64()) * 1000;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+void Message::AddChecksum() {
+  assert(!has_checksum());
+  header()->flags |= HAS_CHECKSUM_BIT;
+  uint32 crc = 0;
+  WriteBytes(&crc, sizeof(crc));
+
+  // data() flattens a scatter-gather message.
+  const char* start = static_cast<const char*>(data());
+  crc = base::Crc32c(0, start, size() - sizeof(crc));
+  memcpy(mutable_payload() + payload_size() - sizeof(crc), &crc,
+         sizeof(crc));
+}
+
+bool Message::VerifyChecksum() const {
+  if (!has_checksum())
+    return true;
+  return VerifyChecksum(static_cast<const char*>(data()), size());
 }
 
+// static
+bool Message::VerifyTrailers(const char* data, size_t size) {
+  if (size < sizeof(Header))
+    return false;
+  const Header* header = reinterpret_cast<const Header*>(data);
+  size_t trailers = 0;
+  if (header->flags & HAS_DEADLINE_BIT)
+    trailers += sizeof(int64);
+  if (header->flags & HAS_SENT_TIME_BIT)
+    trailers += sizeof(int64);
+  if (header->flags & HAS_CHECKSUM_BIT)
+    trailers += sizeof(uint32);
+  return header->payload_size >= trailers;
+}
+
+// static
+bool Message::VerifyChecksum(const char* data, size_t size) {
+  if (size < sizeof(Header))
+    return false;
+  const Header* header = reinterpret_cast<const Header*>(data);
+  if ((header->flags & HAS_CHECKSUM_BIT) == 0)
+    return true;
+
+  uint32 crc;
+  if (header->payload_size < sizeof(crc))
+    return false;
+  size -= sizeof(crc);
+  memcpy(&crc, data + size, sizeof(crc));
+  return base::Crc32c(0, data, size) == crc;
+}
+
+bool Message::Compress(size_t threshold) {
+  if (is_compressed() || has_checksum())
+    return false;
+  size_t trailers = trailers_size();
+  size_t raw_size = payload_size() - trailers;
+  if (raw_size < threshold)
+    return false;
+
+  // payload() flattens a scatter-gather message.
+  const char* raw = payload();
+  size_t header_size = size() - payload_size();
+  size_t limit = raw_size - raw_size / 8;
+  Buffer buffer;
+  buffer.capacity = header_size + sizeof(CompressedPrefix) +
+                    AlignInt(limit, sizeof(uint32)) + trailers;
+  buffer.data = static_cast<char*>(malloc(buffer.capacity));
+  //CHECK(buffer.data);
+  char* compressed = buffer.data + header_size + sizeof(CompressedPrefix);
+  size_t compressed_size = base::LzCompress(raw, raw_size, compressed, limit);
+  if (!compressed_size) {
+    free(buffer.data);
+    return false;
+  }
+
+  CompressedPrefix prefix;
+  prefix.raw_size = static_cast<uint32>(raw_size);
+  prefix.compressed_size = static_cast<uint32>(compressed_size);
+  memcpy(compressed - sizeof(prefix), &prefix, sizeof(prefix));
+  size_t padded_size = is_compact() ? compressed_size :
+      AlignInt(compressed_size, sizeof(uint32));
+  memset(compressed + compressed_size, 0, padded_size - compressed_size);
+  memcpy(compressed + padded_size, raw + raw_size, trailers);
+
+  memcpy(buffer.data, data(), header_size);
+  Header* new_header = reinterpret_cast<Header*>(buffer.data);
+  new_header->flags |= COMPRESSED_BIT;
+  new_header->payload_size = static_cast<uint32>(
+      sizeof(prefix) + padded_size + trailers);
+  buffer.size = header_size + new_header->payload_size;
+  AdoptBuffer(buffer);
+  return true;
+}
+
+bool Message::Decompress() {
+  if (!is_compressed())
+    return true;
+
+  const char* payload_start = payload();
+  size_t trailers = trailers_size();
+  size_t available = end_of_trailers() - payload_start;
+  CompressedPrefix prefix;
+  if (available < sizeof(prefix) + trailers)
+    return false;
+  memcpy(&prefix, payload_start, sizeof(prefix));
+  available -= sizeof(prefix) + trailers;
+  size_t padded_size = is_compact() ? prefix.compressed_size :
+      AlignInt(prefix.compressed_size, sizeof(uint32));
+  // Each compressed byte expands to at most 255; anything beyond that is
+  // corrupt and must not drive the allocation.
+  if (padded_size != available || prefix.raw_size > static_cast<uint32>(kint32max) ||
+      prefix.raw_size / 255 > prefix.compressed_size)
+    return false;
+
+  size_t header_size = size() - payload_size();
+  Buffer buffer;
+  buffer.size = buffer.capacity = header_size + prefix.raw_size + trailers;
+  buffer.data = static_cast<char*>(malloc(buffer.capacity));
+  //CHECK(buffer.data);
+  const char* compressed = payload_start + sizeof(prefix);
+  if (!base::LzDecompress(compressed, prefix.compressed_size,
+                          buffer.data + header_size, prefix.raw_size)) {
+    free(buffer.data);
+    return false;
+  }
+  memcpy(buffer.data + header_size + prefix.raw_size,
+         compressed + padded_size, trailers);
+
+  memcpy(buffer.data, data(), header_size);
+  Header* new_header = reinterpret_cast<Header*>(buffer.data);
+  new_header->flags &= ~(COMPRESSED_BIT | HAS_CHECKSUM_BIT);
+  new_header->payload_size = static_cast<uint32>(prefix.raw_size + trailers);
+  AdoptBuffer(buffer);
+  return true;
+}
+
+size_t Message::trailers_size() const {
+  size_t size = 0;
+  if (has_deadline())
+    size += sizeof(int64);
+  if (header()->flags & HAS_SENT_TIME_BIT)
+    size += sizeof(int64);
+  return size;
+}
+
+void Message::AdoptBuffer(const Buffer& buffer) {
+  *static_cast<Pickle*>(this) = Pickle(buffer);
+  InitCompactFromHeader();
+}
+
+const char* Message::end_of_trailers() const {
+  const char* end = end_of_payload();
+  if (has_checksum())
+    end -= sizeof(uint32);
+  return end;
+}
+
+#if defined(OS_POSIX)
+bool Message::WriteFileDescriptor(const base::FileDescriptor& descriptor) {
+  // The header counts the descriptors, and the checksum covers the header.
+  assert(!has_checksum());
+  FileDescriptorSet* set = file_descriptor_set();
+  // We write the index of the descriptor so that we don't have to
+  // keep the current descriptor as extra decoding state when deserialising.
+  size_t index = set->size();
+  bool added = descriptor.auto_close ? set->AddAndAutoClose(descriptor.fd) :
+                                       set->Add(descriptor.fd);
+  if (!added)
+    return false;
+  header()->num_fds = static_cast<uint32>(set->size());
+  return WriteInt(static_cast<int>(index));
+}
+
+bool Message::CanWriteFileDescriptor() const {
+  return !file_descriptor_set_ ||
+         file_descriptor_set_->size() <
+             FileDescriptorSet::kMaxDescriptorsPerMessage;
+}
+
+bool Message::ReadFileDescriptor(PickleIterator* iter,
+                                 base::FileDescriptor* descriptor) const {
+  int descriptor_index;
+  if (!ReadInt(iter, &descriptor_index) || descriptor_index < 0)
+    return false;
+
+  FileDescriptorSet* file_descriptor_set = file_descriptor_set_;
+  if (!file_descriptor_set)
+    return false;
+
+  descriptor->fd = file_descriptor_set->GetDescriptorAt(descriptor_index);
+  descriptor->auto_close = true;
+
+  return descriptor->fd >= 0;
+}
+
+bool Message::HasFileDescriptors() const {
+  return file_descriptor_set_ && !file_descriptor_set_->empty();
+}
+
+void Message::EnsureFileDescriptorSet() {
+  if (file_descriptor_set_ == NULL)
+    file_descriptor_set_ = new FileDescriptorSet;
+}
+
+void Message::SetFileDescriptorSet(FileDescriptorSet* set) {
+  if (set)
+    set->AddRef();
+  if (file_descriptor_set_)
+    file_descriptor_set_->Release();
+  file_descriptor_set_ = set;
+}
+#endif
+
 #ifdef IPC_MESSAGE_LOG_ENABLED
 void Message::set_sent_time(int64 time) {
   assert((header()->flags & HAS_SENT_TIME_BIT) == 0);
+  assert(!has_checksum());
   header()->flags |= HAS_SENT_TIME_BIT;
-  WriteInt64(time);
+  WriteBytes(&time, sizeof(time));
 }
 
 int64 Message::sent_time() const {
   if ((header()->flags & HAS_SENT_TIME_BIT) == 0)
     return 0;
 
-  const char* data = end_of_payload();
+  const char* data = end_of_trailers();
   data -= sizeof(int64);
-  return *(reinterpret_cast<const int64*>(data));
+  int64 time;
+  memcpy(&time, data, sizeof(time));
+  return time;
 }
 
 void Message::set_received_time(int64 time) const {
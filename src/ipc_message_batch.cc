@@ -0,0 +1,100 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipc/ipc_message_batch.h"
+
+#include <assert.h>
+#include <string.h>
+
+namespace IPC {
+
+MessageBatch::Reader::Reader()
+    : payload_(NULL),
+      table_offset_(0),
+      count_(0) {
+}
+
+bool MessageBatch::Reader::Init(const Message& batch) {
+  payload_ = NULL;
+  table_offset_ = 0;
+  count_ = 0;
+
+  size_t payload_size = batch.payload_size();
+  if (batch.is_compact() || payload_size < sizeof(uint32) ||
+      payload_size % sizeof(uint32) != 0)
+    return false;
+
+  const char* payload = batch.payload();
+  uint32 count;
+  memcpy(&count, payload + payload_size - sizeof(count), sizeof(count));
+  size_t table_size = payload_size / sizeof(uint32) - 1;
+  if (count > table_size)
+    return false;
+
+  payload_ = payload;
+  table_offset_ = payload_size - (count + 1) * sizeof(uint32);
+  count_ = count;
+  return true;
+}
+
+bool MessageBatch::Reader::GetMessageData(size_t index,
+                                          const char** data,
+                                          int* size) const {
+  if (index >= count_)
+    return false;
+
+  const uint32* table = reinterpret_cast<const uint32*>(payload_ +
+                                                        table_offset_);
+  size_t begin = table[index];
+  size_t end = index + 1 < count_ ? table[index + 1] : table_offset_;
+  if (begin % sizeof(uint32) != 0 || begin > end || end > table_offset_)
+    return false;
+
+  // An inner message may be followed by up to 3 bytes of padding.
+  const char* message_end = Message::FindNext(payload_ + begin,
+                                              payload_ + end);
+  if (!message_end || payload_ + end - message_end >=
+                          static_cast<int>(sizeof(uint32)))
+    return false;
+  if (!Message::VerifyTrailers(payload_ + begin,
+                               message_end - (payload_ + begin)) ||
+      !Message::VerifyChecksum(payload_ + begin,
+                               message_end - (payload_ + begin)))
+    return false;
+
+  *data = payload_ + begin;
+  *size = static_cast<int>(message_end - *data);
+  return true;
+}
+
+MessageBatch::MessageBatch(int32 routing_id, PriorityValue priority)
+    : Message(routing_id, IPC_BATCH_ID, priority),
+      finished_(false) {
+  // The offsets rely on every inner message being padded to 4 bytes.
+  if (is_compact())
+    SetHeaderValues(routing_id, IPC_BATCH_ID, flags() & ~COMPACT_BIT);
+}
+
+MessageBatch::~MessageBatch() {
+}
+
+void MessageBatch::AddMessage(const Message& message) {
+  assert(!finished_);
+  offsets_.push_back(static_cast<uint32>(payload_size()));
+  WriteBytes(message.data(), static_cast<int>(message.size()));
+}
+
+void MessageBatch::Finish() {
+  assert(!finished_);
+  finished_ = true;
+
+  size_t table_size = offsets_.size() * sizeof(uint32);
+  char* table = ClaimBytes(table_size + sizeof(uint32));
+  if (!offsets_.empty())
+    memcpy(table, &offsets_[0], table_size);
+  uint32 count = static_cast<uint32>(offsets_.size());
+  memcpy(table + table_size, &count, sizeof(count));
+}
+
+}  // namespace IPC
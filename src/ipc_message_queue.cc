@@ -0,0 +1,128 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipc/ipc_message_queue.h"
+
+#include <algorithm>  // for max()
+
+#include "base/compiler_specific.h"
+
+namespace IPC {
+
+// static
+STATIC_CONST_MEMBER_DEFINITION const int MessageQueue::kDefaultMaxSkips;
+
+MessageQueue::Stats::Stats()
+    : depth(0),
+      max_depth(0),
+      pushed(0),
+      popped(0),
+      expired(0),
+      promoted(0) {
+}
+
+MessageQueue::Level::Level() : skips(0) {
+}
+
+MessageQueue::MessageQueue(int max_skips)
+    : max_skips_(std::max(max_skips, 1)) {
+}
+
+MessageQueue::~MessageQueue() {
+  Clear();
+}
+
+void MessageQueue::Push(Message* message) {
+  Level& level = levels_[LevelOf(message->priority())];
+  level.messages.push(message);
+  Stats& stats = level.stats;
+  ++stats.pushed;
+  ++stats.depth;
+  stats.max_depth = std::max(stats.max_depth, stats.depth);
+}
+
+Message* MessageQueue::Pop() {
+  // Read lazily; most messages have no deadline.
+  bool have_now = false;
+  int64 now = 0;
+  for (;;) {
+    int index = NextLevel();
+    if (index < 0)
+      return NULL;
+
+    Level& level = levels_[index];
+    Message* message = level.messages.front();
+    level.messages.pop();
+    --level.stats.depth;
+
+    if (message->has_deadline() && !message->is_sync()) {
+      if (!have_now) {
+        now = Message::DeadlineClockNow();
+        have_now = true;
+      }
+      if (message->IsExpired(now)) {
+        ++level.stats.expired;
+        delete message;
+        continue;
+      }
+    }
+
+    // Only returned messages count against starvation.
+    bool promoted = false;
+    for (int i = 0; i < kNumLevels; ++i) {
+      if (i == index)
+        continue;
+      if (i > index && !levels_[i].messages.empty())
+        promoted = true;
+      if (i < index && !levels_[i].messages.empty())
+        ++levels_[i].skips;
+    }
+    level.skips = 0;
+    ++level.stats.popped;
+    if (promoted)
+      ++level.stats.promoted;
+    return message;
+  }
+}
+
+void MessageQueue::Clear() {
+  for (int i = 0; i < kNumLevels; ++i) {
+    Level& level = levels_[i];
+    while (!level.messages.empty()) {
+      delete level.messages.front();
+      level.messages.pop();
+    }
+    level.skips = 0;
+    level.stats.depth = 0;
+  }
+}
+
+size_t MessageQueue::size() const {
+  size_t size = 0;
+  for (int i = 0; i < kNumLevels; ++i)
+    size += levels_[i].messages.size();
+  return size;
+}
+
+// static
+int MessageQueue::LevelOf(int priority) {
+  if (priority < Message::PRIORITY_LOW || priority > Message::PRIORITY_HIGH)
+    priority = Message::PRIORITY_NORMAL;
+  return priority - Message::PRIORITY_LOW;
+}
+
+int MessageQueue::NextLevel() const {
+  // A starved level goes first, the lowest one if there are several.
+  for (int i = 0; i < kNumLevels; ++i) {
+    if (!levels_[i].messages.empty() && levels_[i].skips >= max_skips_)
+      return i;
+  }
+  for (int i = kNumLevels - 1; i >= 0; --i) {
+    if (!levels_[i].messages.empty())
+      return i;
+  }
+  return -1;
+}
+
+}  // namespace IPC
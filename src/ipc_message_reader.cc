@@ -0,0 +1,262 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipc/ipc_message_reader.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>  // for min() and max()
+
+#include "base/compiler_specific.h"
+#include "ipc/ipc_message.h"
+
+namespace IPC {
+
+// static
+STATIC_CONST_MEMBER_DEFINITION const size_t
+    MessageReader::kDefaultMaxMessageSize;
+STATIC_CONST_MEMBER_DEFINITION const size_t MessageReader::kReadBufferSize;
+
+namespace {
+
+// An empty buffer larger than this is released rather than kept for the
+// next message.
+const size_t kMaxRetainedCapacity = 64 * 1024;
+
+}  // namespace
+
+MessageReader::MessageReader(size_t max_message_size)
+    : buffer_(NULL),
+      capacity_(0),
+      begin_(0),
+      end_(0),
+      max_message_size_(std::min<size_t>(max_message_size, kint32max)),
+      too_large_(false),
+      borrowed_(NULL),
+      borrowed_size_(0),
+      scratch_(NULL),
+      scratch_capacity_(0),
+      scratch_used_(0) {
+}
+
+MessageReader::~MessageReader() {
+  ReleaseHandedOut();
+  free(scratch_);
+  free(buffer_);
+}
+
+char* MessageReader::GetWriteBuffer(size_t* size) {
+  ReleaseHandedOut();
+  if (begin_ == end_) {
+    begin_ = end_ = 0;
+    if (capacity_ > kMaxRetainedCapacity) {
+      free(buffer_);
+      buffer_ = NULL;
+      capacity_ = 0;
+    }
+  }
+
+  size_t wanted = kReadBufferSize;
+  size_t message_size;
+  if (GetPendingMessageSize(&message_size) &&
+      message_size <= max_message_size_ && message_size > buffered_bytes())
+    wanted = std::max(wanted, message_size - buffered_bytes());
+
+  if (capacity_ - end_ < wanted) {
+    // Reclaim the space in front of the pending bytes before growing.
+    if (begin_ > 0 && capacity_ - buffered_bytes() >= wanted) {
+      MoveToFront();
+    } else {
+      size_t new_capacity = std::max(capacity_ * 2, end_ + wanted);
+      buffer_ = static_cast<char*>(realloc(buffer_, new_capacity));
+      //CHECK(buffer_);
+      capacity_ = new_capacity;
+    }
+  }
+
+  *size = capacity_ - end_;
+  return buffer_ + end_;
+}
+
+void MessageReader::DidWrite(size_t bytes) {
+  //DCHECK_LE(bytes, capacity_ - end_);
+  end_ += bytes;
+}
+
+void MessageReader::Append(const char* data, size_t size) {
+  while (size > 0) {
+    size_t buffer_size;
+    char* buffer = GetWriteBuffer(&buffer_size);
+    size_t bytes = std::min(size, buffer_size);
+    memcpy(buffer, data, bytes);
+    DidWrite(bytes);
+    data += bytes;
+    size -= bytes;
+  }
+}
+
+void MessageReader::Borrow(const char* data, size_t size) {
+  //DCHECK(!borrowed_size_);
+  ReleaseHandedOut();
+  // A partial message in the buffer is completed there first; only what
+  // follows it can be handed out of |data|.
+  if (buffered_bytes() > 0 && buffered_bytes() < sizeof(uint32)) {
+    size_t bytes = std::min(size, sizeof(uint32) - buffered_bytes());
+    Append(data, bytes);
+    data += bytes;
+    size -= bytes;
+  }
+  size_t message_size;
+  if (buffered_bytes() > 0 && GetPendingMessageSize(&message_size) &&
+      message_size <= max_message_size_ &&
+      message_size > buffered_bytes()) {
+    size_t bytes = std::min(size, message_size - buffered_bytes());
+    Append(data, bytes);
+    data += bytes;
+    size -= bytes;
+  }
+
+  borrowed_ = size ? data : NULL;
+  borrowed_size_ = size;
+}
+
+MessageReader::Status MessageReader::ReadMessage(const char** data,
+                                                 int* size) {
+  if (too_large_)
+    return MESSAGE_TOO_LARGE;
+  if (begin_ == end_ && borrowed_size_)
+    return ReadBorrowedMessage(data, size);
+
+  size_t message_size;
+  if (!GetPendingMessageSize(&message_size))
+    return NEED_MORE_DATA;
+  if (message_size > max_message_size_) {
+    too_large_ = true;
+    return MESSAGE_TOO_LARGE;
+  }
+  if (buffered_bytes() < message_size)
+    return NEED_MORE_DATA;
+
+  // Only possible after a compact message.  Moving the pending bytes
+  // instead would pull them out from under the messages handed out so far.
+  const char* message = buffer_ + begin_;
+  if (begin_ % sizeof(uint32) != 0)
+    message = CopyToScratch(message, message_size);
+  begin_ += message_size;
+  if (!Message::VerifyTrailers(message, message_size))
+    return MALFORMED_MESSAGE;
+  if (!Message::VerifyChecksum(message, message_size))
+    return CHECKSUM_MISMATCH;
+
+  *data = message;
+  *size = static_cast<int>(message_size);
+  return MESSAGE_READY;
+}
+
+MessageReader::Status MessageReader::ReadBorrowedMessage(const char** data,
+                                                         int* size) {
+  size_t message_size = 0;
+  if (borrowed_size_ >= sizeof(uint32)) {
+    uint32 payload_size;
+    memcpy(&payload_size, borrowed_, sizeof(payload_size));
+    message_size = sizeof(Message::Header) + payload_size;
+    if (message_size > max_message_size_) {
+      too_large_ = true;
+      return MESSAGE_TOO_LARGE;
+    }
+  }
+
+  // Messages are handed out whole; the rest waits in the buffer.
+  if (!message_size || borrowed_size_ < message_size) {
+    const char* rest = borrowed_;
+    size_t rest_size = borrowed_size_;
+    borrowed_ = NULL;
+    borrowed_size_ = 0;
+    AppendWithoutMoving(rest, rest_size);
+    return NEED_MORE_DATA;
+  }
+
+  // ... and aligned.
+  const char* message = borrowed_;
+  if (reinterpret_cast<uintptr_t>(message) % sizeof(uint32) != 0)
+    message = CopyToScratch(message, message_size);
+  borrowed_ += message_size;
+  borrowed_size_ -= message_size;
+  if (!borrowed_size_)
+    borrowed_ = NULL;
+  if (!Message::VerifyTrailers(message, message_size))
+    return MALFORMED_MESSAGE;
+  if (!Message::VerifyChecksum(message, message_size))
+    return CHECKSUM_MISMATCH;
+
+  *data = message;
+  *size = static_cast<int>(message_size);
+  return MESSAGE_READY;
+}
+
+bool MessageReader::GetPendingMessageSize(size_t* size) const {
+  // Message::FindNext() reads the payload size through a Header*, which
+  // needs the alignment that the pending bytes may not have yet.
+  uint32 payload_size;
+  if (buffered_bytes() < sizeof(payload_size))
+    return false;
+  memcpy(&payload_size, buffer_ + begin_, sizeof(payload_size));
+  *size = sizeof(Message::Header) + payload_size;
+  return true;
+}
+
+void MessageReader::MoveToFront() {
+  memmove(buffer_, buffer_ + begin_, buffered_bytes());
+  end_ -= begin_;
+  begin_ = 0;
+}
+
+const char* MessageReader::CopyToScratch(const char* data, size_t size) {
+  size_t offset = (scratch_used_ + sizeof(uint32) - 1) &
+                  ~(sizeof(uint32) - 1);
+  if (!scratch_ || scratch_capacity_ - offset < size) {
+    // The copies made so far stay where they are until ReleaseHandedOut().
+    if (scratch_)
+      retired_.push_back(scratch_);
+    scratch_capacity_ = std::max(std::max(scratch_capacity_ * 2, size),
+                                 kReadBufferSize);
+    scratch_ = static_cast<char*>(malloc(scratch_capacity_));
+    //CHECK(scratch_);
+    offset = 0;
+  }
+  memcpy(scratch_ + offset, data, size);
+  scratch_used_ = offset + size;
+  return scratch_ + offset;
+}
+
+void MessageReader::AppendWithoutMoving(const char* data, size_t size) {
+  if (capacity_ - end_ < size) {
+    // Only called once the buffer holds nothing pending, so a fresh buffer
+    // can take over; the old one may still hold handed out messages.
+    //DCHECK_EQ(begin_, end_);
+    if (buffer_)
+      retired_.push_back(buffer_);
+    capacity_ = std::max(size, kReadBufferSize);
+    buffer_ = static_cast<char*>(malloc(capacity_));
+    //CHECK(buffer_);
+    begin_ = end_ = 0;
+  }
+  memcpy(buffer_ + end_, data, size);
+  end_ += size;
+}
+
+void MessageReader::ReleaseHandedOut() {
+  for (size_t i = 0; i < retired_.size(); ++i)
+    free(retired_[i]);
+  retired_.clear();
+  scratch_used_ = 0;
+  if (scratch_capacity_ > kMaxRetainedCapacity) {
+    free(scratch_);
+    scratch_ = NULL;
+    scratch_capacity_ = 0;
+  }
+}
+
+}  // namespace IPC
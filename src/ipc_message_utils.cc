@@ -18,6 +18,9 @@
 //#include "ipc/ipc_channel_handle.h"
 
 #if defined(OS_POSIX)
+#include <unistd.h>
+
+#include "base/file_descriptor_posix.h"
 #include "ipc/file_descriptor_set_posix.h"
 #elif defined(OS_WIN)
 #include <tchar.h>
@@ -66,6 +69,77 @@ void LogBytes(const std::vector<CharType>& data, std::string* out)
 bool ReadValue(const Message* m, PickleIterator* iter, base::Value** value,
                int recursion);
 
+// Sizes what WriteValue() writes for |value|.
+void GetValueSize(PickleSizer* sizer, const base::Value* value, int recursion)
+{
+    bool result;
+    if (recursion > kMaxRecursionDepth)
+        return;
+
+    sizer->AddInt(value->GetType());
+
+    switch (value->GetType()) {
+    case base::Value::TYPE_NULL:
+        break;
+    case base::Value::TYPE_BOOLEAN: {
+        bool val;
+        result = value->GetAsBoolean(&val);
+        DCHECK(result);
+        GetParamSize(sizer, val);
+        break;
+    }
+    case base::Value::TYPE_INTEGER: {
+        int val;
+        result = value->GetAsInteger(&val);
+        DCHECK(result);
+        GetParamSize(sizer, val);
+        break;
+    }
+    case base::Value::TYPE_DOUBLE: {
+        double val;
+        result = value->GetAsDouble(&val);
+        DCHECK(result);
+        GetParamSize(sizer, val);
+        break;
+    }
+    case base::Value::TYPE_STRING: {
+        std::string val;
+        result = value->GetAsString(&val);
+        DCHECK(result);
+        GetParamSize(sizer, val);
+        break;
+    }
+    case base::Value::TYPE_BINARY: {
+        const base::BinaryValue* binary =
+            static_cast<const base::BinaryValue*>(value);
+        sizer->AddData(static_cast<int>(binary->GetSize()));
+        break;
+    }
+    case base::Value::TYPE_DICTIONARY: {
+        const base::DictionaryValue* dict =
+            static_cast<const base::DictionaryValue*>(value);
+
+        GetParamSize(sizer, static_cast<int>(dict->size()));
+
+        for (base::DictionaryValue::Iterator it(*dict); !it.IsAtEnd();
+             it.Advance()) {
+            GetParamSize(sizer, it.key());
+            GetValueSize(sizer, &it.value(), recursion + 1);
+        }
+        break;
+    }
+    case base::Value::TYPE_LIST: {
+        const base::ListValue* list = static_cast<const base::ListValue*>(value);
+        GetParamSize(sizer, static_cast<int>(list->GetSize()));
+        for (base::ListValue::const_iterator it = list->begin();
+             it != list->end(); ++it) {
+            GetValueSize(sizer, *it, recursion + 1);
+        }
+        break;
+    }
+    }
+}
+
 void WriteValue(Message* m, const base::Value* value, int recursion)
 {
     bool result;
@@ -284,6 +358,12 @@ void ParamTraits<unsigned char>::Write(Message* m, const param_type& p)
     m->WriteBytes(&p, sizeof(param_type));
 }
 
+void ParamTraits<unsigned char>::GetSize(PickleSizer* sizer,
+                                         const param_type& p)
+{
+    sizer->AddBytes(sizeof(param_type));
+}
+
 bool ParamTraits<unsigned char>::Read(const Message* m, PickleIterator* iter,
                                       param_type* r)
 {
@@ -313,6 +393,12 @@ void ParamTraits<unsigned short>::Write(Message* m, const param_type& p)
     m->WriteBytes(&p, sizeof(param_type));
 }
 
+void ParamTraits<unsigned short>::GetSize(PickleSizer* sizer,
+                                          const param_type& p)
+{
+    sizer->AddBytes(sizeof(param_type));
+}
+
 bool ParamTraits<unsigned short>::Read(const Message* m, PickleIterator* iter,
                                        param_type* r)
 {
@@ -381,6 +467,11 @@ void ParamTraits<double>::Write(Message* m, const param_type& p)
     m->WriteBytes(reinterpret_cast<const char*>(&p), sizeof(param_type));
 }
 
+void ParamTraits<double>::GetSize(PickleSizer* sizer, const param_type& p)
+{
+    sizer->AddBytes(sizeof(param_type));
+}
+
 bool ParamTraits<double>::Read(const Message* m, PickleIterator* iter,
                                param_type* r)
 {
@@ -426,6 +517,12 @@ void ParamTraits<std::vector<char> >::Write(Message* m, const param_type& p)
     }
 }
 
+void ParamTraits<std::vector<char> >::GetSize(PickleSizer* sizer,
+        const param_type& p)
+{
+    sizer->AddData(static_cast<int>(p.size()));
+}
+
 bool ParamTraits<std::vector<char> >::Read(const Message* m,
         PickleIterator* iter,
         param_type* r)
@@ -440,6 +537,13 @@ bool ParamTraits<std::vector<char> >::Read(const Message* m,
     return true;
 }
 
+bool ParamTraits<std::vector<char> >::Validate(const Message* m,
+        PickleIterator* iter)
+{
+    int data_size;
+    return m->ReadInt(iter, &data_size) && iter->SkipBytes(data_size);
+}
+
 void ParamTraits<std::vector<char> >::Log(const param_type& p, std::string* l)
 {
     LogBytes(p, l);
@@ -456,6 +560,12 @@ void ParamTraits<std::vector<unsigned char> >::Write(Message* m,
     }
 }
 
+void ParamTraits<std::vector<unsigned char> >::GetSize(PickleSizer* sizer,
+        const param_type& p)
+{
+    sizer->AddData(static_cast<int>(p.size()));
+}
+
 bool ParamTraits<std::vector<unsigned char> >::Read(const Message* m,
         PickleIterator* iter,
         param_type* r)
@@ -470,6 +580,13 @@ bool ParamTraits<std::vector<unsigned char> >::Read(const Message* m,
     return true;
 }
 
+bool ParamTraits<std::vector<unsigned char> >::Validate(const Message* m,
+        PickleIterator* iter)
+{
+    int data_size;
+    return m->ReadInt(iter, &data_size) && iter->SkipBytes(data_size);
+}
+
 void ParamTraits<std::vector<unsigned char> >::Log(const param_type& p,
         std::string* l)
 {
@@ -486,6 +603,14 @@ void ParamTraits<std::vector<bool> >::Write(Message* m, const param_type& p)
         WriteParam(m, static_cast<bool>(p[i]));
 }
 
+void ParamTraits<std::vector<bool> >::GetSize(PickleSizer* sizer,
+        const param_type& p)
+{
+    GetParamSize(sizer, static_cast<int>(p.size()));
+    for (size_t i = 0; i < p.size(); i++)
+        GetParamSize(sizer, static_cast<bool>(p[i]));
+}
+
 bool ParamTraits<std::vector<bool> >::Read(const Message* m,
         PickleIterator* iter,
         param_type* r)
@@ -519,6 +644,12 @@ void ParamTraits<base::DictionaryValue>::Write(Message* m,
     WriteValue(m, &p, 0);
 }
 
+void ParamTraits<base::DictionaryValue>::GetSize(PickleSizer* sizer,
+        const param_type& p)
+{
+    GetValueSize(sizer, &p, 0);
+}
+
 bool ParamTraits<base::DictionaryValue>::Read(
     const Message* m, PickleIterator* iter, param_type* r)
 {
@@ -540,13 +671,26 @@ void ParamTraits<base::DictionaryValue>::Log(const param_type& p,
 #if defined(OS_POSIX)
 void ParamTraits<base::FileDescriptor>::Write(Message* m, const param_type& p)
 {
-    const bool valid = p.fd >= 0;
+    // A descriptor that does not fit in the message's set goes out as an
+    // invalid one, so that |valid| never announces an index that is missing.
+    const bool valid = p.fd >= 0 && m->CanWriteFileDescriptor();
     WriteParam(m, valid);
 
-    if (valid) {
-        if (!m->WriteFileDescriptor(p))
-            NOTREACHED();
-    }
+    if (valid)
+        m->WriteFileDescriptor(p);
+    else if (p.fd >= 0 && p.auto_close)
+        close(p.fd);
+}
+
+void ParamTraits<base::FileDescriptor>::GetSize(PickleSizer* sizer,
+        const param_type& p)
+{
+    const bool valid = p.fd >= 0;
+    sizer->AddBool(valid);
+    // The index is only known once written; size for the largest.
+    if (valid)
+        sizer->AddInt(
+            static_cast<int>(FileDescriptorSet::kMaxDescriptorsPerMessage - 1));
 }
 
 bool ParamTraits<base::FileDescriptor>::Read(const Message* m,
@@ -566,14 +710,33 @@ bool ParamTraits<base::FileDescriptor>::Read(const Message* m,
     return m->ReadFileDescriptor(iter, r);
 }
 
+bool ParamTraits<base::FileDescriptor>::Validate(const Message* m,
+        PickleIterator* iter)
+{
+    bool valid;
+    if (!ReadParam(m, iter, &valid))
+        return false;
+    if (!valid)
+        return true;
+
+    int index;
+    return ReadParam(m, iter, &index) && index >= 0 &&
+           static_cast<size_t>(index) <
+               FileDescriptorSet::kMaxDescriptorsPerMessage;
+}
+
 void ParamTraits<base::FileDescriptor>::Log(const param_type& p,
         std::string* l)
 {
+    char buf[32];
     if (p.auto_close) {
-        l->append(base::StringPrintf("FD(%d auto-close)", p.fd));
+        snprintf(buf, sizeof(buf), "FD(%d auto-close)", p.fd);
+        //l->append(base::StringPrintf("FD(%d auto-close)", p.fd));
     } else {
-        l->append(base::StringPrintf("FD(%d)", p.fd));
+        snprintf(buf, sizeof(buf), "FD(%d)", p.fd);
+        //l->append(base::StringPrintf("FD(%d)", p.fd));
     }
+    l->append(buf);
 }
 #endif  // defined(OS_POSIX)
 
@@ -599,6 +762,12 @@ void ParamTraits<base::ListValue>::Write(Message* m, const param_type& p)
     WriteValue(m, &p, 0);
 }
 
+void ParamTraits<base::ListValue>::GetSize(PickleSizer* sizer,
+        const param_type& p)
+{
+    GetValueSize(sizer, &p, 0);
+}
+
 bool ParamTraits<base::ListValue>::Read(
     const Message* m, PickleIterator* iter, param_type* r)
 {
@@ -805,6 +974,19 @@ void ParamTraits<LogData>::Write(Message* m, const param_type& p)
     WriteParam(m, p.params);
 }
 
+void ParamTraits<LogData>::GetSize(PickleSizer* sizer, const param_type& p)
+{
+    GetParamSize(sizer, p.channel);
+    GetParamSize(sizer, p.routing_id);
+    GetParamSize(sizer, p.type);
+    GetParamSize(sizer, p.flags);
+    GetParamSize(sizer, p.sent);
+    GetParamSize(sizer, p.receive);
+    GetParamSize(sizer, p.dispatch);
+    GetParamSize(sizer, p.message_name);
+    GetParamSize(sizer, p.params);
+}
+
 bool ParamTraits<LogData>::Read(const Message* m,
                                 PickleIterator* iter,
                                 param_type* r)
@@ -850,6 +1032,14 @@ void ParamTraits<Message>::Write(Message* m, const Message& p)
     m->WriteData(p.payload(), static_cast<uint32>(p.payload_size()));
 }
 
+void ParamTraits<Message>::GetSize(PickleSizer* sizer, const Message& p)
+{
+    sizer->AddUInt32(static_cast<uint32>(p.routing_id()));
+    sizer->AddUInt32(p.type());
+    sizer->AddUInt32(p.flags());
+    sizer->AddData(static_cast<int>(p.payload_size()));
+}
+
 bool ParamTraits<Message>::Read(const Message* m, PickleIterator* iter,
                                 Message* r)
 {
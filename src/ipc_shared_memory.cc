@@ -0,0 +1,77 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipc/ipc_shared_memory.h"
+
+#if defined(OS_LINUX)
+
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ipc/ipc_message.h"
+
+namespace IPC {
+
+namespace internal {
+
+char* CreateSharedMemory(const char* name, size_t size, int* fd) {
+  *fd = memfd_create(name, MFD_CLOEXEC);
+  if (*fd < 0)
+    return NULL;
+  void* mapping = MAP_FAILED;
+  if (ftruncate(*fd, size) == 0)
+    mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+  if (mapping == MAP_FAILED) {
+    close(*fd);
+    *fd = -1;
+    return NULL;
+  }
+  return static_cast<char*>(mapping);
+}
+
+char* MapSharedMemory(int fd, size_t* size) {
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size <= 0)
+    return NULL;
+  void* mapping = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED)
+    return NULL;
+  *size = info.st_size;
+  return static_cast<char*>(mapping);
+}
+
+// The word is in memory shared between processes, so the futex is not a
+// private one.
+void FutexWait(uint32* word, uint32 value, int timeout_ms) {
+  struct timespec timeout;
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+  syscall(SYS_futex, word, FUTEX_WAIT, value,
+          timeout_ms < 0 ? NULL : &timeout, NULL, 0);
+}
+
+void FutexWake(uint32* word, int count) {
+  __atomic_add_fetch(word, 1, __ATOMIC_SEQ_CST);
+  syscall(SYS_futex, word, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+int RemainingMs(int64 deadline) {
+  if (deadline < 0)
+    return -1;
+  int64 remaining = deadline - Message::DeadlineClockNow();
+  if (remaining <= 0)
+    return 0;
+  return static_cast<int>((remaining + 999) / 1000);
+}
+
+}  // namespace internal
+
+}  // namespace IPC
+
+#endif  // defined(OS_LINUX)
@@ -0,0 +1,362 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipc/ipc_shared_ring.h"
+
+#if defined(OS_LINUX)
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "ipc/ipc_shared_memory.h"
+
+namespace IPC {
+
+// static
+STATIC_CONST_MEMBER_DEFINITION const size_t SharedRing::kSlotAlignment;
+
+namespace {
+
+const uint32 kMagic = 0x52435049;  // "IPCR"
+
+// Stands in for a payload size where the producer skipped the rest of the
+// ring because the next message did not fit before the end.
+const uint32 kWrapMarker = 0xffffffff;
+
+const size_t kMinCapacity = 4096;
+const size_t kMaxCapacity = 1u << 30;
+
+const size_t kCacheLineSize = 64;
+
+uint64 LoadAcquire(const uint64* p) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+void StoreRelease(uint64* p, uint64 value) {
+  __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+// The bytes a message of |size| bytes takes in the ring.
+size_t SlotSize(size_t size) {
+  return (size + SharedRing::kSlotAlignment - 1) &
+         ~(SharedRing::kSlotAlignment - 1);
+}
+
+void LeaveInRing(void* data, void* context) {
+}
+
+}  // namespace
+
+// The start of the shared memory.  Each side's counters sit on a cache line
+// of their own, so that the two sides only share a line when one of them
+// looks at the other's position.
+struct SharedRing::Control {
+  uint32 magic;
+  uint32 capacity;
+  char padding0[kCacheLineSize - 2 * sizeof(uint32)];
+
+  // Written by the producer.
+  uint64 head;             // Bytes ever published.
+  uint32 data_sequence;    // Futex the consumer waits on when empty.
+  uint32 producer_waiting; // Set while the producer waits for space.
+  char padding1[kCacheLineSize - sizeof(uint64) - 2 * sizeof(uint32)];
+
+  // Written by the consumer.
+  uint64 tail;             // Bytes ever consumed.
+  uint32 space_sequence;   // Futex the producer waits on when full.
+  uint32 consumer_waiting; // Set while the consumer waits for data.
+  char padding2[kCacheLineSize - sizeof(uint64) - 2 * sizeof(uint32)];
+};
+
+namespace {
+
+// The messages start on a page of their own.
+const size_t kRingOffset = 4096;
+
+}  // namespace
+
+SharedRing::SharedRing(int fd, char* mapping, size_t capacity)
+    : fd_(fd),
+      mapping_(mapping),
+      control_(reinterpret_cast<Control*>(mapping)),
+      ring_(mapping + kRingOffset),
+      capacity_(capacity),
+      head_(LoadAcquire(&control_->head)),
+      cached_tail_(LoadAcquire(&control_->tail)),
+      message_position_(0),
+      building_(false),
+      tail_(cached_tail_),
+      cached_head_(head_),
+      peeked_size_(0),
+      broken_(false) {
+}
+
+SharedRing::~SharedRing() {
+  // |message_| may point into the ring.
+  message_ = Message();
+  munmap(mapping_, kRingOffset + capacity_);
+  close(fd_);
+}
+
+// static
+SharedRing* SharedRing::Create(size_t capacity) {
+  size_t rounded = kMinCapacity;
+  while (rounded < capacity && rounded < kMaxCapacity)
+    rounded <<= 1;
+  if (rounded < capacity)
+    return NULL;
+
+  int fd;
+  char* mapping = internal::CreateSharedMemory("ipc_shared_ring",
+                                               kRingOffset + rounded, &fd);
+  if (!mapping)
+    return NULL;
+
+  // The new memory is zeroed, so only the identification is left to fill.
+  Control* control = reinterpret_cast<Control*>(mapping);
+  control->capacity = static_cast<uint32>(rounded);
+  __atomic_store_n(&control->magic, kMagic, __ATOMIC_RELEASE);
+  return new SharedRing(fd, mapping, rounded);
+}
+
+// static
+SharedRing* SharedRing::Open(int fd) {
+  size_t size;
+  char* mapping = internal::MapSharedMemory(fd, &size);
+  if (!mapping || size < kRingOffset + kMinCapacity) {
+    if (mapping)
+      munmap(mapping, size);
+    close(fd);
+    return NULL;
+  }
+
+  Control* control = reinterpret_cast<Control*>(mapping);
+  size_t capacity = control->capacity;
+  if (__atomic_load_n(&control->magic, __ATOMIC_ACQUIRE) != kMagic ||
+      capacity < kMinCapacity || (capacity & (capacity - 1)) != 0 ||
+      kRingOffset + capacity != size) {
+    munmap(mapping, size);
+    close(fd);
+    return NULL;
+  }
+  return new SharedRing(fd, mapping, capacity);
+}
+
+Message* SharedRing::BeginMessage(int32 routing_id, uint16 type,
+                                  Message::PriorityValue priority,
+                                  size_t max_payload_size) {
+  //DCHECK(!building_);
+  size_t reserved = SlotSize(sizeof(Message::Header) + max_payload_size);
+  uint64 position;
+  if (max_payload_size > capacity_ || !ReserveSlot(reserved, &position))
+    return NULL;
+
+  char* slot = ring_ + (position & (capacity_ - 1));
+  memset(slot, 0, sizeof(Message::Header));
+  Message::Header* header = reinterpret_cast<Message::Header*>(slot);
+  header->routing = routing_id;
+  header->type = type;
+  header->flags = priority;
+
+  // The message writes straight into the slot, and falls back to the heap
+  // if it outgrows it.
+  Pickle::Buffer buffer;
+  buffer.data = slot;
+  buffer.size = sizeof(Message::Header);
+  buffer.capacity = reserved;
+  buffer.deleter = &LeaveInRing;
+  message_ = Message(buffer);
+
+  message_position_ = position;
+  building_ = true;
+  return &message_;
+}
+
+bool SharedRing::CommitMessage() {
+  //DCHECK(building_);
+  building_ = false;
+  char* slot = ring_ + (message_position_ & (capacity_ - 1));
+  if (message_.data() != slot) {
+    // Outgrown.  Nothing was published, so the slot is simply not used.
+    bool written = WriteMessage(message_);
+    message_ = Message();
+    return written;
+  }
+
+  PublishHead(message_position_ + SlotSize(message_.size()));
+  return true;
+}
+
+bool SharedRing::WriteMessage(const Message& message) {
+  const char* data = static_cast<const char*>(message.data());
+  size_t size = message.size();
+  uint64 position;
+  if (!ReserveSlot(SlotSize(size), &position))
+    return false;
+  memcpy(ring_ + (position & (capacity_ - 1)), data, size);
+  PublishHead(position + SlotSize(size));
+  return true;
+}
+
+bool SharedRing::WaitForSpace(size_t payload_size, int timeout_ms) {
+  if (payload_size > capacity_)
+    return false;
+  size_t size = SlotSize(sizeof(Message::Header) + payload_size);
+  if (size > capacity_)
+    return false;
+
+  int64 deadline = timeout_ms < 0 ?
+      -1 : Message::DeadlineClockNow() + timeout_ms * 1000LL;
+  uint64 position;
+  for (;;) {
+    if (ReserveSlot(size, &position))
+      return true;
+
+    uint32 sequence = __atomic_load_n(&control_->space_sequence,
+                                      __ATOMIC_SEQ_CST);
+    __atomic_store_n(&control_->producer_waiting, 1, __ATOMIC_SEQ_CST);
+    if (ReserveSlot(size, &position)) {
+      __atomic_store_n(&control_->producer_waiting, 0, __ATOMIC_SEQ_CST);
+      return true;
+    }
+    int remaining = internal::RemainingMs(deadline);
+    if (remaining == 0) {
+      __atomic_store_n(&control_->producer_waiting, 0, __ATOMIC_SEQ_CST);
+      return false;
+    }
+    internal::FutexWait(&control_->space_sequence, sequence, remaining);
+    __atomic_store_n(&control_->producer_waiting, 0, __ATOMIC_SEQ_CST);
+  }
+}
+
+bool SharedRing::ReserveSlot(size_t size, uint64* position) {
+  size_t offset = head_ & (capacity_ - 1);
+  // A message never wraps around the end; the producer skips to the start
+  // instead.
+  size_t skip = offset + size > capacity_ ? capacity_ - offset : 0;
+  if (skip + size > capacity_)
+    return false;
+
+  if (head_ + skip + size - cached_tail_ > capacity_) {
+    cached_tail_ = LoadAcquire(&control_->tail);
+    if (head_ + skip + size - cached_tail_ > capacity_)
+      return false;
+  }
+
+  if (skip) {
+    // Unpublished until the message after it is.
+    uint32 marker = kWrapMarker;
+    memcpy(ring_ + offset, &marker, sizeof(marker));
+  }
+  *position = head_ + skip;
+  return true;
+}
+
+void SharedRing::PublishHead(uint64 new_head) {
+  head_ = new_head;
+  StoreRelease(&control_->head, new_head);
+  // Pairs with the fence in WaitForMessage(): either the consumer sees the
+  // new head, or this sees it waiting.
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&control_->consumer_waiting, __ATOMIC_RELAXED))
+    internal::FutexWake(&control_->data_sequence, 1);
+}
+
+bool SharedRing::PeekMessage(const char** data, int* size) {
+  if (broken_)
+    return false;
+
+  for (;;) {
+    if (tail_ == cached_head_) {
+      cached_head_ = LoadAcquire(&control_->head);
+      if (tail_ == cached_head_)
+        return false;
+    }
+
+    size_t offset = tail_ & (capacity_ - 1);
+    size_t available = cached_head_ - tail_;
+    uint32 payload_size;
+    memcpy(&payload_size, ring_ + offset, sizeof(payload_size));
+    if (payload_size == kWrapMarker) {
+      if (capacity_ - offset > available) {
+        broken_ = true;
+        return false;
+      }
+      tail_ += capacity_ - offset;
+      continue;
+    }
+
+    // The producer is not trusted to stay within what it published.
+    size_t message_size = sizeof(Message::Header) + payload_size;
+    size_t slot_size = SlotSize(message_size);
+    if (payload_size > capacity_ || slot_size > available ||
+        offset + slot_size > capacity_) {
+      broken_ = true;
+      return false;
+    }
+
+    *data = ring_ + offset;
+    *size = static_cast<int>(message_size);
+    peeked_size_ = slot_size;
+    return true;
+  }
+}
+
+void SharedRing::PopMessage() {
+  //DCHECK(peeked_size_);
+  tail_ += peeked_size_;
+  peeked_size_ = 0;
+  StoreRelease(&control_->tail, tail_);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&control_->producer_waiting, __ATOMIC_RELAXED))
+    internal::FutexWake(&control_->space_sequence, 1);
+}
+
+bool SharedRing::WaitForMessage(int timeout_ms) {
+  int64 deadline = timeout_ms < 0 ?
+      -1 : Message::DeadlineClockNow() + timeout_ms * 1000LL;
+  for (;;) {
+    if (tail_ != cached_head_ ||
+        (cached_head_ = LoadAcquire(&control_->head)) != tail_)
+      return true;
+
+    uint32 sequence = __atomic_load_n(&control_->data_sequence,
+                                      __ATOMIC_SEQ_CST);
+    __atomic_store_n(&control_->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+    if ((cached_head_ = LoadAcquire(&control_->head)) != tail_) {
+      __atomic_store_n(&control_->consumer_waiting, 0, __ATOMIC_SEQ_CST);
+      return true;
+    }
+    int remaining = internal::RemainingMs(deadline);
+    if (remaining == 0) {
+      __atomic_store_n(&control_->consumer_waiting, 0, __ATOMIC_SEQ_CST);
+      return false;
+    }
+    internal::FutexWait(&control_->data_sequence, sequence, remaining);
+    __atomic_store_n(&control_->consumer_waiting, 0, __ATOMIC_SEQ_CST);
+  }
+}
+
+size_t SharedRing::DispatchMessages(Channel::Listener* listener,
+                                    size_t max_messages) {
+  size_t dispatched = 0;
+  const char* data;
+  int size;
+  while (dispatched < max_messages && PeekMessage(&data, &size)) {
+    Message message(data, size);
+    if (!message.Decompress()) {
+      broken_ = true;
+      break;
+    }
+    listener->OnMessageReceived(message);
+    PopMessage();
+    ++dispatched;
+  }
+  return dispatched;
+}
+
+}  // namespace IPC
+
+#endif  // defined(OS_LINUX)
@@ -10,6 +10,7 @@
 #include <assert.h>
 #define DCHECK assert
 #include <stack>
+#include <utility>  // for move()
 
 //#include "base/atomic_sequence_num.h"
 //#include "base/lazy_instance.h"
@@ -44,6 +45,25 @@ SyncMessage::SyncMessage(
 SyncMessage::~SyncMessage() {
 }
 
+SyncMessage::SyncMessage(SyncMessage&& other)
+    : Message(std::move(other)),
+      deserializer_(other.deserializer_),
+      pump_messages_event_(other.pump_messages_event_) {
+  other.deserializer_ = NULL;
+  other.pump_messages_event_ = NULL;
+}
+
+SyncMessage& SyncMessage::operator=(SyncMessage&& other) {
+  if (this == &other)
+    return *this;
+  *static_cast<Message*>(this) = std::move(other);
+  deserializer_ = other.deserializer_;
+  pump_messages_event_ = other.pump_messages_event_;
+  other.deserializer_ = NULL;
+  other.pump_messages_event_ = NULL;
+  return *this;
+}
+
 MessageReplyDeserializer* SyncMessage::GetReplyDeserializer() {
   DCHECK(deserializer_);
   MessageReplyDeserializer* rv = deserializer_;
@@ -64,8 +84,10 @@ bool SyncMessage::IsMessageReplyTo(const Message& msg, int request_id) {
 }
 
 PickleIterator SyncMessage::GetDataIterator(const Message* msg) {
+  // The header is a single int, whose size depends on the encoding.
   PickleIterator iter(*msg);
-  if (!iter.SkipBytes(kSyncMessageHeaderSize))
+  int message_id;
+  if (!iter.ReadInt(&message_id))
     return PickleIterator();
   else
     return iter;
@@ -83,11 +105,18 @@ int SyncMessage::GetMessageId(const Message& msg) {
 }
 
 Message* SyncMessage::GenerateReply(const Message* msg) {
+  return GenerateReply(msg, NULL);
+}
+
+Message* SyncMessage::GenerateReply(const Message* msg,
+                                    PickleAllocator* allocator) {
   DCHECK(msg->is_sync());
 
   Message* reply = new Message(msg->routing_id(), IPC_REPLY_ID,
-                               msg->priority());
+                               msg->priority(), allocator);
   reply->set_reply();
+  if (msg->is_compact())
+    reply->set_compact();
 
   SyncHeader header;
 
@@ -121,7 +150,8 @@ bool SyncMessage::WriteSyncHeader(Message* msg, const SyncHeader& header) {
   }
 
   // Note: if you add anything here, you need to update kSyncMessageHeaderSize.
-  DCHECK(kSyncMessageHeaderSize == msg->payload_size());
+  DCHECK(msg->is_compact() ||
+         kSyncMessageHeaderSize == msg->payload_size());
 
   return true;
 }
@@ -0,0 +1,202 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "base/lz_codec.h"
+
+#include <string.h>
+
+namespace base {
+
+namespace {
+
+// Matches are at least this long.
+const size_t kMinMatch = 4;
+// The block format requires the last match to start at least this far
+// from the end of the input ...
+const size_t kMatchStartLimit = 12;
+// ... and to be followed by at least this many literals.
+const size_t kLastLiterals = 5;
+// Offsets are stored in 16 bits.
+const size_t kMaxOffset = 65535;
+
+const int kHashBits = 13;
+const int kHashSize = 1 << kHashBits;
+// After this many misses in a row the search takes bigger steps, so
+// incompressible data goes by quickly.
+const int kSkipTrigger = 6;
+
+uint32 Load32(const char* p) {
+  uint32 value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+uint32 Hash(uint32 sequence) {
+  return (sequence * 2654435761U) >> (32 - kHashBits);
+}
+
+// Writes the extra bytes of a length that did not fit in its token nibble.
+char* WriteLength(char* op, size_t length) {
+  for (; length >= 255; length -= 255)
+    *op++ = static_cast<char>(255);
+  *op++ = static_cast<char>(length);
+  return op;
+}
+
+// Writes a sequence: |literals| bytes at |literal_start|, then a match of
+// |match_length| bytes |offset| back, or no match if |match_length| is 0.
+// Returns NULL if the sequence does not fit before |output_end|.
+char* WriteSequence(const char* literal_start, size_t literals,
+                    size_t offset, size_t match_length,
+                    char* op, char* output_end) {
+  size_t needed = 1 + literals / 255 + 1 + literals;
+  if (match_length)
+    needed += 2 + match_length / 255 + 1;
+  if (needed > static_cast<size_t>(output_end - op))
+    return NULL;
+
+  char* token = op++;
+  int token_value = literals < 15 ? static_cast<int>(literals) << 4 : 0xf0;
+  if (literals >= 15)
+    op = WriteLength(op, literals - 15);
+  memcpy(op, literal_start, literals);
+  op += literals;
+
+  if (match_length) {
+    *op++ = static_cast<char>(offset & 0xff);
+    *op++ = static_cast<char>(offset >> 8);
+    size_t length = match_length - kMinMatch;
+    token_value |= length < 15 ? static_cast<int>(length) : 0x0f;
+    if (length >= 15)
+      op = WriteLength(op, length - 15);
+  }
+  *token = static_cast<char>(token_value);
+  return op;
+}
+
+// Reads the extra bytes of a length whose token nibble was 15.
+bool ReadLength(const unsigned char** ip, const unsigned char* input_end,
+                size_t* length) {
+  unsigned char byte;
+  do {
+    if (*ip == input_end)
+      return false;
+    byte = *(*ip)++;
+    *length += byte;
+    // Only a corrupt block comes anywhere near overflowing.
+    if (*length > static_cast<size_t>(-1) / 2)
+      return false;
+  } while (byte == 255);
+  return true;
+}
+
+}  // namespace
+
+size_t LzCompressBound(size_t length) {
+  return length + length / 255 + 16;
+}
+
+size_t LzCompress(const char* data, size_t length,
+                  char* output, size_t capacity) {
+  char* op = output;
+  char* output_end = output + capacity;
+  size_t anchor = 0;
+
+  if (length > kMatchStartLimit) {
+    uint32 table[kHashSize];
+    memset(table, 0, sizeof(table));
+
+    size_t match_start_limit = length - kMatchStartLimit;
+    size_t match_end_limit = length - kLastLiterals;
+    size_t ip = 1;
+    int misses = 0;
+    while (ip < match_start_limit) {
+      uint32 sequence = Load32(data + ip);
+      uint32* slot = &table[Hash(sequence)];
+      size_t ref = *slot;
+      *slot = static_cast<uint32>(ip);
+      if (ip - ref > kMaxOffset || Load32(data + ref) != sequence) {
+        ip += 1 + (misses++ >> kSkipTrigger);
+        continue;
+      }
+      misses = 0;
+
+      while (ip > anchor && ref > 0 && data[ip - 1] == data[ref - 1]) {
+        --ip;
+        --ref;
+      }
+      size_t match_length = kMinMatch;
+      while (ip + match_length < match_end_limit &&
+             data[ip + match_length] == data[ref + match_length])
+        ++match_length;
+
+      op = WriteSequence(data + anchor, ip - anchor, ip - ref, match_length,
+                         op, output_end);
+      if (!op)
+        return 0;
+      ip += match_length;
+      anchor = ip;
+      if (ip < match_start_limit)
+        table[Hash(Load32(data + ip - 2))] = static_cast<uint32>(ip - 2);
+    }
+  }
+
+  op = WriteSequence(data + anchor, length - anchor, 0, 0, op, output_end);
+  return op ? op - output : 0;
+}
+
+bool LzDecompress(const char* data, size_t length,
+                  char* output, size_t output_length) {
+  const unsigned char* ip = reinterpret_cast<const unsigned char*>(data);
+  const unsigned char* input_end = ip + length;
+  char* op = output;
+  char* output_end = output + output_length;
+
+  for (;;) {
+    if (ip == input_end)
+      return false;
+    unsigned token = *ip++;
+
+    size_t literals = token >> 4;
+    if (literals == 15 && !ReadLength(&ip, input_end, &literals))
+      return false;
+    if (literals > static_cast<size_t>(input_end - ip) ||
+        literals > static_cast<size_t>(output_end - op))
+      return false;
+    memcpy(op, ip, literals);
+    ip += literals;
+    op += literals;
+
+    // The last sequence has no match.
+    if (ip == input_end)
+      break;
+
+    if (input_end - ip < 2)
+      return false;
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > static_cast<size_t>(op - output))
+      return false;
+
+    size_t match_length = token & 0x0f;
+    if (match_length == 15 && !ReadLength(&ip, input_end, &match_length))
+      return false;
+    match_length += kMinMatch;
+    if (match_length > static_cast<size_t>(output_end - op))
+      return false;
+
+    const char* match = op - offset;
+    if (offset >= match_length) {
+      memcpy(op, match, match_length);
+      op += match_length;
+    } else {
+      // Overlapping copies repeat the last |offset| bytes.
+      for (size_t i = 0; i < match_length; ++i)
+        *op++ = *match++;
+    }
+  }
+  return op == output_end;
+}
+
+}  // namespace base
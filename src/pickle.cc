@@ -7,6 +7,9 @@
 #include <stdlib.h>
 
 #include <algorithm>  // for max()
+#include <utility>    // for move()
+
+#include "base/atomic_ref_count.h"
 
 //------------------------------------------------------------------------------
 
@@ -16,12 +19,42 @@
 // static
 const int Pickle::kPayloadUnit = 64;
 
+// static
+STATIC_CONST_MEMBER_DEFINITION const size_t Pickle::kInlineCapacity;
+
 static const size_t kCapacityReadOnly = static_cast<size_t>(-1);
 
+static PickleAllocator* g_default_allocator = NULL;
+
+struct Pickle::SharedPayload {
+  base::AtomicRefCount ref_count;
+  Buffer buffer;
+};
+
+struct Pickle::Segments {
+  // A blob that belongs between the buffer bytes before and after |offset|.
+  struct Reference {
+    size_t offset;
+    const char* data;
+    size_t length;
+  };
+
+  size_t threshold;
+  size_t referenced_size;  // Sum of the aligned reference lengths.
+  std::vector<Reference> references;
+};
+
+// Source of the padding that follows a referenced blob.
+static const char kZeroPadding[sizeof(uint32)] = { 0 };
+
 PickleIterator::PickleIterator(const Pickle& pickle)
     : payload_(pickle.payload()),
       read_index_(0),
-      end_index_(pickle.payload_size()) {
+      end_index_(pickle.payload_size()),
+      compact_(pickle.compact()),
+      bool_byte_(NULL),
+      bool_bits_(0),
+      checked_(true) {
 }
 
 template <typename Type>
@@ -37,7 +70,7 @@ inline bool PickleIterator::ReadBuiltinType(Type* result) {
 }
 
 inline void PickleIterator::Advance(size_t size) {
-  size_t aligned_size = AlignInt(size, sizeof(uint32_t));
+  size_t aligned_size = compact_ ? size : AlignInt(size, sizeof(uint32_t));
   if (end_index_ - read_index_ < aligned_size) {
     read_index_ = end_index_;
   } else {
@@ -47,6 +80,12 @@ inline void PickleIterator::Advance(size_t size) {
 
 template<typename Type>
 inline const char* PickleIterator::GetReadPointerAndAdvance() {
+  if (!checked_) {
+    const char* current_read_ptr = payload_ + read_index_;
+    read_index_ += compact_ ? sizeof(Type) : AlignInt(sizeof(Type),
+                                                      sizeof(uint32_t));
+    return current_read_ptr;
+  }
   if (sizeof(Type) > end_index_ - read_index_) {
     read_index_ = end_index_;
     return NULL;
@@ -57,6 +96,11 @@ inline const char* PickleIterator::GetReadPointerAndAdvance() {
 }
 
 const char* PickleIterator::GetReadPointerAndAdvance(int num_bytes) {
+  if (!checked_ && num_bytes >= 0) {
+    const char* current_read_ptr = payload_ + read_index_;
+    read_index_ += compact_ ? num_bytes : AlignInt(num_bytes, sizeof(uint32_t));
+    return current_read_ptr;
+  }
   if (num_bytes < 0 ||
       end_index_ - read_index_ < static_cast<size_t>(num_bytes)) {
     read_index_ = end_index_;
@@ -78,31 +122,100 @@ inline const char* PickleIterator::GetReadPointerAndAdvance(
   return GetReadPointerAndAdvance(num_bytes32);
 }
 
+bool PickleIterator::ReadVarint(uint64* result) {
+  uint64 value = 0;
+  for (int shift = 0; shift < 64 && read_index_ < end_index_; shift += 7) {
+    uint8 byte = static_cast<uint8>(payload_[read_index_++]);
+    value |= static_cast<uint64>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      *result = value;
+      return true;
+    }
+  }
+  read_index_ = end_index_;
+  return false;
+}
+
+bool PickleIterator::ReadZigZag(int64* result) {
+  uint64 value;
+  if (!ReadVarint(&value))
+    return false;
+  *result = static_cast<int64>(value >> 1) ^ -static_cast<int64>(value & 1);
+  return true;
+}
+
+bool PickleIterator::ReadCompactBool(bool* result) {
+  if (bool_bits_ == 0 || bool_bits_ == 8) {
+    bool_byte_ = GetReadPointerAndAdvance(1);
+    if (!bool_byte_)
+      return false;
+    bool_bits_ = 0;
+  }
+  *result = ((*bool_byte_ >> bool_bits_) & 1) != 0;
+  ++bool_bits_;
+  return true;
+}
+
 bool PickleIterator::ReadBool(bool* result) {
+  if (compact_)
+    return ReadCompactBool(result);
   return ReadBuiltinType(result);
 }
 
 bool PickleIterator::ReadInt(int* result) {
+  if (compact_) {
+    int64 value;
+    if (!ReadZigZag(&value) || value < kint32min || value > kint32max)
+      return false;
+    *result = static_cast<int>(value);
+    return true;
+  }
   return ReadBuiltinType(result);
 }
 
 bool PickleIterator::ReadLong(long* result) {
+  if (compact_) {
+    int64 value;
+    if (!ReadZigZag(&value) || static_cast<int64>(static_cast<long>(value)) !=
+                                   value)
+      return false;
+    *result = static_cast<long>(value);
+    return true;
+  }
   return ReadBuiltinType(result);
 }
 
 bool PickleIterator::ReadUInt16(uint16* result) {
+  if (compact_) {
+    uint64 value;
+    if (!ReadVarint(&value) || value > kuint16max)
+      return false;
+    *result = static_cast<uint16>(value);
+    return true;
+  }
   return ReadBuiltinType(result);
 }
 
 bool PickleIterator::ReadUInt32(uint32* result) {
+  if (compact_) {
+    uint64 value;
+    if (!ReadVarint(&value) || value > kuint32max)
+      return false;
+    *result = static_cast<uint32>(value);
+    return true;
+  }
   return ReadBuiltinType(result);
 }
 
 bool PickleIterator::ReadInt64(int64* result) {
+  if (compact_)
+    return ReadZigZag(result);
   return ReadBuiltinType(result);
 }
 
 bool PickleIterator::ReadUInt64(uint64* result) {
+  if (compact_)
+    return ReadVarint(result);
   return ReadBuiltinType(result);
 }
 
@@ -142,6 +255,18 @@ bool PickleIterator::ReadString(std::string* result) {
   return true;
 }
 
+bool PickleIterator::ReadStringPiece(base::StringPiece* result) {
+  int len;
+  if (!ReadInt(&len))
+    return false;
+  const char* read_from = GetReadPointerAndAdvance(len);
+  if (!read_from)
+    return false;
+
+  result->set(read_from, len);
+  return true;
+}
+
 bool PickleIterator::ReadWString(std::wstring* result) {
   int len;
   if (!ReadInt(&len))
@@ -150,6 +275,13 @@ bool PickleIterator::ReadWString(std::wstring* result) {
   if (!read_from)
     return false;
 
+  if (compact_) {
+    // Compact data is not aligned for wchar_t.
+    result->resize(len);
+    if (len)
+      memcpy(&(*result)[0], read_from, len * sizeof(wchar_t));
+    return true;
+  }
   result->assign(reinterpret_cast<const wchar_t*>(read_from), len);
   return true;
 }
@@ -184,33 +316,150 @@ bool PickleIterator::ReadBytes(const char** data, int length) {
   return true;
 }
 
+void Pickle::MakeShared() {
+  if (shared_ || !header_)
+    return;
+
+  // ReleaseBuffer() forgets the encoding along with the buffer, but the
+  // contents stay the same.
+  bool compact = compact_;
+  int bool_bits = bool_bits_;
+  size_t bool_offset = bool_offset_;
+
+  SharedPayload* shared = new SharedPayload;
+  shared->ref_count = 1;
+  shared->buffer = ReleaseBuffer();
+  // ReleaseBuffer() left behind an empty buffer of our own.
+  FreeStorage();
+
+  header_ = reinterpret_cast<Header*>(shared->buffer.data);
+  capacity_after_header_ = 0;
+  write_offset_ = header_->payload_size;
+  shared_ = shared;
+  compact_ = compact;
+  bool_bits_ = bool_bits;
+  bool_offset_ = bool_offset;
+}
+
+void Pickle::ShareWith(const Pickle& other) {
+  base::AtomicRefCountInc(&other.shared_->ref_count);
+  header_ = other.header_;
+  capacity_after_header_ = 0;
+  write_offset_ = other.write_offset_;
+  shared_ = other.shared_;
+}
+
+void Pickle::Unshare(size_t new_capacity) {
+  SharedPayload* shared = shared_;
+  const Header* old_header = header_;
+  shared_ = NULL;
+
+  if (base::AtomicRefCountIsOne(&shared->ref_count)) {
+    // Nobody else is looking, so the buffer can become ours again.
+    header_ = reinterpret_cast<Header*>(shared->buffer.data);
+    allocator_ = shared->buffer.allocator;
+    deleter_ = shared->buffer.deleter;
+    deleter_context_ = shared->buffer.deleter_context;
+    capacity_after_header_ = shared->buffer.capacity - header_size_;
+    delete shared;
+    if (new_capacity > capacity_after_header_)
+      Resize(new_capacity);
+    return;
+  }
+
+  header_ = NULL;
+  capacity_after_header_ = 0;
+  Resize(std::max(new_capacity, write_offset_));
+  memcpy(header_, old_header, header_size_ + write_offset_);
+  ReleaseShared(shared);
+}
+
+// static
+void Pickle::ReleaseShared(SharedPayload* shared) {
+  if (!base::AtomicRefCountDec(&shared->ref_count)) {
+    FreeBuffer(shared->buffer);
+    delete shared;
+  }
+}
+
+Pickle::Buffer::Buffer()
+    : data(NULL),
+      size(0),
+      capacity(0),
+      allocator(NULL),
+      deleter(NULL),
+      deleter_context(NULL) {
+}
+
 // Payload is uint32 aligned.
 
 Pickle::Pickle()
     : header_(NULL),
+      allocator_(g_default_allocator),
       header_size_(sizeof(Header)),
       capacity_after_header_(0),
-      write_offset_(0) {
+      write_offset_(0),
+      deleter_(NULL),
+      deleter_context_(NULL),
+      shared_(NULL),
+      segments_(NULL),
+      compact_(false),
+      bool_bits_(0),
+      bool_offset_(0) {
   Resize(kPayloadUnit);
   header_->payload_size = 0;
 }
 
 Pickle::Pickle(int header_size)
     : header_(NULL),
+      allocator_(g_default_allocator),
       header_size_(AlignInt(header_size, sizeof(uint32))),
       capacity_after_header_(0),
-      write_offset_(0) {
+      write_offset_(0),
+      deleter_(NULL),
+      deleter_context_(NULL),
+      shared_(NULL),
+      segments_(NULL),
+      compact_(false),
+      bool_bits_(0),
+      bool_offset_(0) {
   //DCHECK_GE(static_cast<size_t>(header_size), sizeof(Header));
   //DCHECK_LE(header_size, kPayloadUnit);
   Resize(kPayloadUnit);
   header_->payload_size = 0;
 }
 
+Pickle::Pickle(int header_size, PickleAllocator* allocator)
+    : header_(NULL),
+      allocator_(allocator ? allocator : g_default_allocator),
+      header_size_(AlignInt(header_size, sizeof(uint32))),
+      capacity_after_header_(0),
+      write_offset_(0),
+      deleter_(NULL),
+      deleter_context_(NULL),
+      shared_(NULL),
+      segments_(NULL),
+      compact_(false),
+      bool_bits_(0),
+      bool_offset_(0) {
+  //DCHECK_GE(static_cast<size_t>(header_size), sizeof(Header));
+  Resize(kPayloadUnit);
+  header_->payload_size = 0;
+}
+
 Pickle::Pickle(const char* data, int data_len)
     : header_(reinterpret_cast<Header*>(const_cast<char*>(data))),
+      allocator_(NULL),
       header_size_(0),
       capacity_after_header_(kCapacityReadOnly),
-      write_offset_(0) {
+      write_offset_(0),
+      deleter_(NULL),
+      deleter_context_(NULL),
+      shared_(NULL),
+      segments_(NULL),
+      compact_(false),
+      bool_bits_(0),
+      bool_offset_(0) {
   if (data_len >= static_cast<int>(sizeof(Header)))
     header_size_ = data_len - header_->payload_size;
 
@@ -227,17 +476,83 @@ Pickle::Pickle(const char* data, int data_len)
 
 Pickle::Pickle(const Pickle& other)
     : header_(NULL),
+      allocator_(g_default_allocator),
       header_size_(other.header_size_),
       capacity_after_header_(0),
-      write_offset_(other.write_offset_) {
+      write_offset_(0),
+      deleter_(NULL),
+      deleter_context_(NULL),
+      shared_(NULL),
+      segments_(NULL),
+      compact_(false),
+      bool_bits_(0),
+      bool_offset_(0) {
+  other.EnsureContiguous();
+  write_offset_ = other.write_offset_;
+  compact_ = other.compact_;
+  bool_bits_ = other.bool_bits_;
+  bool_offset_ = other.bool_offset_;
+  if (other.shared_) {
+    ShareWith(other);
+    return;
+  }
   size_t payload_size = header_size_ + other.header_->payload_size;
   Resize(payload_size);
   memcpy(header_, other.header_, payload_size);
 }
 
+Pickle::Pickle(const Buffer& buffer)
+    : header_(reinterpret_cast<Header*>(buffer.data)),
+      allocator_(buffer.allocator),
+      header_size_(0),
+      capacity_after_header_(0),
+      write_offset_(0),
+      deleter_(buffer.deleter),
+      deleter_context_(buffer.deleter_context),
+      shared_(NULL),
+      segments_(NULL),
+      compact_(false),
+      bool_bits_(0),
+      bool_offset_(0) {
+  if (header_ && buffer.size >= sizeof(Header) &&
+      buffer.size - sizeof(Header) >= header_->payload_size &&
+      buffer.capacity >= buffer.size)
+    header_size_ = buffer.size - header_->payload_size;
+
+  if (header_size_ != AlignInt(header_size_, sizeof(uint32)))
+    header_size_ = 0;
+
+  // If there is anything wrong with the data, we're not going to use it.
+  if (!header_size_) {
+    FreeBuffer(buffer);
+    header_ = NULL;
+    deleter_ = NULL;
+    return;
+  }
+
+  capacity_after_header_ = buffer.capacity - header_size_;
+  write_offset_ = header_->payload_size;
+}
+
+Pickle::Pickle(Pickle&& other)
+    : header_(NULL),
+      allocator_(other.allocator_),
+      header_size_(other.header_size_),
+      capacity_after_header_(0),
+      write_offset_(0),
+      deleter_(NULL),
+      deleter_context_(NULL),
+      shared_(NULL),
+      segments_(NULL),
+      compact_(false),
+      bool_bits_(0),
+      bool_offset_(0) {
+  TakeStorage(&other);
+}
+
 Pickle::~Pickle() {
-  if (capacity_after_header_ != kCapacityReadOnly)
-    free(header_);
+  FreeStorage();
+  delete segments_;
 }
 
 Pickle& Pickle::operator=(const Pickle& other) {
@@ -245,12 +560,35 @@ Pickle& Pickle::operator=(const Pickle& other) {
     //NOTREACHED();
     return *this;
   }
+  other.EnsureContiguous();
+  compact_ = other.compact_;
+  bool_bits_ = other.bool_bits_;
+  bool_offset_ = other.bool_offset_;
+  if (segments_) {
+    // The references belonged to the old contents.
+    segments_->references.clear();
+    segments_->referenced_size = 0;
+  }
+  if (other.shared_ || shared_) {
+    // Neither buffer can be reused in place.
+    FreeStorage();
+    header_ = NULL;
+    capacity_after_header_ = 0;
+    deleter_ = NULL;
+    deleter_context_ = NULL;
+    shared_ = NULL;
+    if (other.shared_) {
+      header_size_ = other.header_size_;
+      ShareWith(other);
+      return *this;
+    }
+  }
   if (capacity_after_header_ == kCapacityReadOnly) {
     header_ = NULL;
     capacity_after_header_ = 0;
   }
   if (header_size_ != other.header_size_) {
-    free(header_);
+    FreeStorage();
     header_ = NULL;
     header_size_ = other.header_size_;
   }
@@ -261,6 +599,117 @@ Pickle& Pickle::operator=(const Pickle& other) {
   return *this;
 }
 
+Pickle& Pickle::operator=(Pickle&& other) {
+  if (this == &other)
+    return *this;
+  FreeStorage();
+  header_ = NULL;
+  deleter_ = NULL;
+  deleter_context_ = NULL;
+  shared_ = NULL;
+  delete segments_;
+  segments_ = NULL;
+  allocator_ = other.allocator_;
+  header_size_ = other.header_size_;
+  TakeStorage(&other);
+  return *this;
+}
+
+void Pickle::Swap(Pickle* other) {
+  Pickle temp(std::move(*other));
+  *other = std::move(*this);
+  *this = std::move(temp);
+}
+
+Pickle::Buffer Pickle::ReleaseBuffer() {
+  Buffer buffer;
+  if (!header_)
+    return buffer;
+
+  Flatten();
+  buffer.size = size();
+  buffer.allocator = allocator_;
+  if (capacity_after_header_ == kCapacityReadOnly || uses_inline_storage() ||
+      shared_) {
+    // The bytes are not ours to give away, so hand out a heap copy.
+    buffer.capacity = AlignInt(buffer.size, kPayloadUnit);
+    void* p = allocator_ ? allocator_->Allocate(buffer.capacity)
+                         : malloc(buffer.capacity);
+    //CHECK(p);
+    memcpy(p, header_, buffer.size);
+    buffer.data = static_cast<char*>(p);
+    FreeStorage();
+  } else {
+    buffer.data = reinterpret_cast<char*>(header_);
+    buffer.capacity = header_size_ + capacity_after_header_;
+    buffer.deleter = deleter_;
+    buffer.deleter_context = deleter_context_;
+  }
+
+  ResetToEmpty();
+  return buffer;
+}
+
+// static
+void Pickle::FreeBuffer(const Buffer& buffer) {
+  if (!buffer.data)
+    return;
+  if (buffer.deleter)
+    buffer.deleter(buffer.data, buffer.deleter_context);
+  else if (buffer.allocator)
+    buffer.allocator->Free(buffer.data, buffer.capacity);
+  else
+    free(buffer.data);
+}
+
+void Pickle::TakeStorage(Pickle* other) {
+  if (other->uses_inline_storage()) {
+    header_ = reinterpret_cast<Header*>(inline_storage_.bytes);
+    capacity_after_header_ = kInlineCapacity - header_size_;
+    memcpy(header_, other->header_, header_size_ + other->write_offset_);
+  } else {
+    header_ = other->header_;
+    capacity_after_header_ = other->capacity_after_header_;
+    deleter_ = other->deleter_;
+    deleter_context_ = other->deleter_context_;
+    shared_ = other->shared_;
+  }
+  write_offset_ = other->write_offset_;
+  compact_ = other->compact_;
+  bool_bits_ = other->bool_bits_;
+  bool_offset_ = other->bool_offset_;
+  segments_ = other->segments_;
+  other->segments_ = NULL;
+  other->ResetToEmpty();
+}
+
+void Pickle::ResetToEmpty() {
+  header_ = NULL;
+  capacity_after_header_ = 0;
+  write_offset_ = 0;
+  deleter_ = NULL;
+  deleter_context_ = NULL;
+  shared_ = NULL;
+  compact_ = false;
+  bool_bits_ = 0;
+  bool_offset_ = 0;
+  // An invalid read-only Pickle has no header size to go back to.
+  if (!header_size_)
+    header_size_ = sizeof(Header);
+  Resize(kPayloadUnit);
+  memset(header_, 0, header_size_);
+}
+
+// static
+void Pickle::SetDefaultAllocator(PickleAllocator* allocator) {
+  g_default_allocator = allocator;
+}
+
+// static
+PickleAllocator* Pickle::default_allocator() {
+  return g_default_allocator;
+}
+
 bool Pickle::WriteString(const std::string& value) {
   if (!WriteInt(static_cast<int>(value.size())))
     return false;
@@ -286,7 +735,14 @@ bool Pickle::WriteWString(const std::wstring& value) {
 //
 
 bool Pickle::WriteData(const char* data, int length) {
-  return length >= 0 && WriteInt(length) && WriteBytes(data, length);
+  if (length < 0 || !WriteInt(length))
+    return false;
+  if (segments_ && length > 0 &&
+      static_cast<size_t>(length) >= segments_->threshold) {
+    AppendReference(data, length);
+    return true;
+  }
+  return WriteBytes(data, length);
 }
 
 bool Pickle::WriteBytes(const void* data, int length) {
@@ -306,16 +762,220 @@ void Pickle::Reserve(size_t length) {
     Resize(capacity_after_header_ * 2 + new_size);
 }
 
+void Pickle::ReserveExact(size_t length) {
+  size_t new_size = write_offset_ + PaddedSize(length);
+  if (new_size > capacity_after_header_)
+    Resize(new_size);
+}
+
 void Pickle::Resize(size_t new_capacity) {
-  new_capacity = AlignInt(new_capacity, kPayloadUnit);
+  // Round the whole buffer, header included, so that heap buffers are an
+  // exact number of units; see PickleBufferPool.
+  new_capacity = AlignInt(header_size_ + new_capacity, kPayloadUnit) -
+                 header_size_;
 
   //CHECK_NE(capacity_after_header_, kCapacityReadOnly);
-  void* p = realloc(header_, header_size_ + new_capacity);
+  if (shared_) {
+    Unshare(new_capacity);
+    return;
+  }
+
+  if (!header_ || uses_inline_storage()) {
+    if (header_size_ + new_capacity <= kInlineCapacity) {
+      header_ = reinterpret_cast<Header*>(inline_storage_.bytes);
+      capacity_after_header_ = kInlineCapacity - header_size_;
+      return;
+    }
+    // Spill to the heap.
+    MoveToNewBuffer(new_capacity);
+    return;
+  }
+
+  if (deleter_) {
+    // An adopted buffer is used for as long as it is big enough, after which
+    // the data moves to memory of our own.
+    if (new_capacity > capacity_after_header_)
+      MoveToNewBuffer(new_capacity);
+    return;
+  }
+
+  void* p;
+  if (allocator_) {
+    p = allocator_->Reallocate(header_,
+                               header_size_ + capacity_after_header_,
+                               header_size_ + new_capacity);
+  } else {
+    p = realloc(header_, header_size_ + new_capacity);
+  }
+  //CHECK(p);
+  header_ = reinterpret_cast<Header*>(p);
+  capacity_after_header_ = new_capacity;
+}
+
+void Pickle::MoveToNewBuffer(size_t new_capacity) {
+  size_t size = header_size_ + new_capacity;
+  void* p = allocator_ ? allocator_->Allocate(size) : malloc(size);
   //CHECK(p);
+  if (header_) {
+    // Carry over whatever has been written so far.
+    memcpy(p, header_, header_size_ + write_offset_);
+    FreeStorage();
+  }
   header_ = reinterpret_cast<Header*>(p);
   capacity_after_header_ = new_capacity;
+  deleter_ = NULL;
+  deleter_context_ = NULL;
+}
+
+void Pickle::FreeStorage() {
+  if (shared_) {
+    ReleaseShared(shared_);
+    return;
+  }
+  if (!header_ || capacity_after_header_ == kCapacityReadOnly ||
+      uses_inline_storage())
+    return;
+  if (deleter_)
+    deleter_(header_, deleter_context_);
+  else if (allocator_)
+    allocator_->Free(header_, header_size_ + capacity_after_header_);
+  else
+    free(header_);
+}
+
+void Pickle::set_compact(bool compact) {
+  //DCHECK_EQ(0u, payload_size());
+  compact_ = compact;
+  bool_bits_ = 0;
+}
+
+bool Pickle::WriteVarint(uint64 value) {
+  char bytes[10];
+  size_t length = 0;
+  while (value >= 0x80) {
+    bytes[length++] = static_cast<char>(value | 0x80);
+    value >>= 7;
+  }
+  bytes[length++] = static_cast<char>(value);
+  WriteBytesCommon(bytes, length);
+  return true;
+}
+
+bool Pickle::WriteCompactBool(bool value) {
+  if (bool_bits_ == 0 || bool_bits_ == 8) {
+    bool_offset_ = write_offset_;
+    char byte = value ? 1 : 0;
+    WriteBytesCommon(&byte, 1);
+    bool_bits_ = 1;
+    return true;
+  }
+  if (value)
+    mutable_payload()[bool_offset_] |= static_cast<char>(1 << bool_bits_);
+  ++bool_bits_;
+  return true;
+}
+
+void Pickle::EnableScatterGather(size_t threshold) {
+  if (!segments_) {
+    segments_ = new Segments;
+    segments_->referenced_size = 0;
+  }
+  segments_->threshold = threshold;
+}
+
+bool Pickle::has_references() const {
+  return segments_ && !segments_->references.empty();
+}
+
+void Pickle::AppendReference(const char* data, size_t length) {
+  Segments::Reference reference = { write_offset_, data, length };
+  segments_->references.push_back(reference);
+  size_t data_len = PaddedSize(length);
+  segments_->referenced_size += data_len;
+  header_->payload_size += static_cast<uint32>(data_len);
+}
+
+void Pickle::Flatten() {
+  if (!has_references())
+    return;
+
+  size_t payload_size = header_->payload_size;
+  if (payload_size > capacity_after_header_)
+    Resize(payload_size);
+
+  // Work from the back, moving each run of buffer bytes to its final place
+  // before copying in the blob that precedes it.
+  char* payload = mutable_payload();
+  const std::vector<Segments::Reference>& references = segments_->references;
+  size_t shift = segments_->referenced_size;
+  size_t end = write_offset_;
+  for (size_t i = references.size(); i-- > 0;) {
+    const Segments::Reference& reference = references[i];
+    memmove(payload + reference.offset + shift, payload + reference.offset,
+            end - reference.offset);
+    size_t data_len = PaddedSize(reference.length);
+    shift -= data_len;
+    char* write = payload + reference.offset + shift;
+    memcpy(write, reference.data, reference.length);
+    memset(write + reference.length, 0, data_len - reference.length);
+    end = reference.offset;
+  }
+
+  // An open byte of packed booleans has moved along with its run.
+  if (bool_bits_) {
+    size_t offset = bool_offset_;
+    for (size_t i = 0; i < references.size(); ++i) {
+      if (references[i].offset <= offset)
+        bool_offset_ += PaddedSize(references[i].length);
+    }
+  }
+
+  write_offset_ = payload_size;
+  segments_->references.clear();
+  segments_->referenced_size = 0;
+}
+
+void Pickle::GetSegments(std::vector<Segment>* segments) const {
+  const char* buffer = reinterpret_cast<const char*>(header_);
+  size_t begin = 0;
+  if (segments_) {
+    for (size_t i = 0; i < segments_->references.size(); ++i) {
+      const Segments::Reference& reference = segments_->references[i];
+      size_t end = header_size_ + reference.offset;
+      if (end > begin) {
+        Segment local = { buffer + begin, end - begin };
+        segments->push_back(local);
+      }
+      Segment blob = { reference.data, reference.length };
+      segments->push_back(blob);
+      size_t padding = PaddedSize(reference.length) - reference.length;
+      if (padding) {
+        Segment zeros = { kZeroPadding, padding };
+        segments->push_back(zeros);
+      }
+      begin = end;
+    }
+  }
+  size_t end = header_size_ + write_offset_;
+  if (end > begin) {
+    Segment local = { buffer + begin, end - begin };
+    segments->push_back(local);
+  }
 }
 
+#if defined(OS_POSIX)
+void Pickle::GetIOVecs(std::vector<struct iovec>* iovecs) const {
+  std::vector<Segment> segments;
+  GetSegments(&segments);
+  for (size_t i = 0; i < segments.size(); ++i) {
+    struct iovec iov;
+    iov.iov_base = const_cast<char*>(segments[i].data);
+    iov.iov_len = segments[i].size;
+    iovecs->push_back(iov);
+  }
+}
+#endif
+
 // static
 const char* Pickle::FindNext(size_t header_size,
                              const char* start,
@@ -341,10 +1001,23 @@ template void Pickle::WriteBytesStatic<2>(const void* data);
 template void Pickle::WriteBytesStatic<4>(const void* data);
 template void Pickle::WriteBytesStatic<8>(const void* data);
 
+char* Pickle::ClaimBytes(size_t length) {
+  size_t data_len = PaddedSize(length);
+  size_t new_size = write_offset_ + data_len;
+  if (new_size > capacity_after_header_)
+    Resize(std::max(capacity_after_header_ * 2, new_size));
+
+  char* write = mutable_payload() + write_offset_;
+  memset(write, 0, data_len);
+  header_->payload_size += static_cast<uint32>(data_len);
+  write_offset_ = new_size;
+  return write;
+}
+
 inline void Pickle::WriteBytesCommon(const void* data, size_t length) {
   //DCHECK_NE(kCapacityReadOnly, capacity_after_header_)
       //<< "oops: pickle is readonly";
-  size_t data_len = AlignInt(length, sizeof(uint32));
+  size_t data_len = PaddedSize(length);
   //DCHECK_GE(data_len, length);
 //#ifdef ARCH_CPU_64_BITS
 //  DCHECK_LE(data_len, kuint32max);
@@ -358,6 +1031,111 @@ inline void Pickle::WriteBytesCommon(const void* data, size_t length) {
   char* write = mutable_payload() + write_offset_;
   memcpy(write, data, length);
   memset(write + length, 0, data_len - length);
-  header_->payload_size = static_cast<uint32>(new_size);
+  // Not simply new_size: the payload may include referenced blobs.
+  header_->payload_size += static_cast<uint32>(data_len);
   write_offset_ = new_size;
 }
+
+PickleSizer::PickleSizer(bool compact)
+    : compact_(compact),
+      known_(true),
+      bool_bits_(0),
+      payload_size_(0) {
+}
+
+void PickleSizer::AddBool(bool value) {
+  if (!compact_) {
+    AddPOD(sizeof(int));
+    return;
+  }
+  // Mirrors Pickle::WriteCompactBool(): only the first of every eight
+  // booleans takes a byte.
+  if (bool_bits_ == 0 || bool_bits_ == 8) {
+    payload_size_ += 1;
+    bool_bits_ = 0;
+  }
+  ++bool_bits_;
+}
+
+void PickleSizer::AddInt(int value) {
+  if (compact_)
+    AddVarint(Pickle::ZigZag(value));
+  else
+    AddPOD(sizeof(value));
+}
+
+void PickleSizer::AddLongUsingDangerousNonPortableLessPersistableForm(
+    long value) {
+  if (compact_)
+    AddVarint(Pickle::ZigZag(value));
+  else
+    AddPOD(sizeof(value));
+}
+
+void PickleSizer::AddUInt16(uint16 value) {
+  if (compact_)
+    AddVarint(value);
+  else
+    AddPOD(sizeof(value));
+}
+
+void PickleSizer::AddUInt32(uint32 value) {
+  if (compact_)
+    AddVarint(value);
+  else
+    AddPOD(sizeof(value));
+}
+
+void PickleSizer::AddInt64(int64 value) {
+  if (compact_)
+    AddVarint(Pickle::ZigZag(value));
+  else
+    AddPOD(sizeof(value));
+}
+
+void PickleSizer::AddUInt64(uint64 value) {
+  if (compact_)
+    AddVarint(value);
+  else
+    AddPOD(sizeof(value));
+}
+
+void PickleSizer::AddFloat(float value) {
+  AddPOD(sizeof(value));
+}
+
+void PickleSizer::AddDouble(double value) {
+  AddPOD(sizeof(value));
+}
+
+void PickleSizer::AddString(const std::string& value) {
+  AddInt(static_cast<int>(value.size()));
+  AddBytes(static_cast<int>(value.size()));
+}
+
+void PickleSizer::AddWString(const std::wstring& value) {
+  AddInt(static_cast<int>(value.size()));
+  AddBytes(static_cast<int>(value.size() * sizeof(wchar_t)));
+}
+
+void PickleSizer::AddData(int length) {
+  AddInt(length);
+  AddBytes(length);
+}
+
+void PickleSizer::AddBytes(int length) {
+  AddPOD(length);
+}
+
+void PickleSizer::AddPOD(size_t size) {
+  payload_size_ += compact_ ? size : Pickle::AlignInt(size, sizeof(uint32));
+}
+
+void PickleSizer::AddVarint(uint64 value) {
+  size_t length = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    ++length;
+  }
+  payload_size_ += length;
+}
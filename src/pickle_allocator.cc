@@ -0,0 +1,132 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "base/pickle_allocator.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>  // for max()
+
+// static
+STATIC_CONST_MEMBER_DEFINITION const size_t PickleArena::kDefaultBlockSize;
+STATIC_CONST_MEMBER_DEFINITION const size_t PickleArena::kAlignment;
+STATIC_CONST_MEMBER_DEFINITION const size_t PickleArena::kBlockHeaderSize;
+
+namespace {
+
+size_t AlignSize(size_t size, size_t alignment) {
+  return (size + alignment - 1) & ~(alignment - 1);
+}
+
+}  // namespace
+
+PickleArena::PickleArena()
+    : block_size_(kDefaultBlockSize),
+      current_(NULL),
+      offset_(0),
+      last_allocation_(NULL),
+      bytes_allocated_(0),
+      block_count_(0),
+      outstanding_(0) {
+}
+
+PickleArena::PickleArena(size_t block_size)
+    : block_size_(std::max(block_size, kAlignment)),
+      current_(NULL),
+      offset_(0),
+      last_allocation_(NULL),
+      bytes_allocated_(0),
+      block_count_(0),
+      outstanding_(0) {
+}
+
+PickleArena::~PickleArena() {
+  assert(outstanding_ == 0);
+  while (current_) {
+    Block* next = current_->next;
+    free(current_);
+    current_ = next;
+  }
+}
+
+void* PickleArena::Allocate(size_t size) {
+  size = AlignSize(std::max<size_t>(size, 1), kAlignment);
+  if (!current_ || current_->size - offset_ < size)
+    AddBlock(size);
+
+  char* p = block_data(current_) + offset_;
+  offset_ += size;
+  bytes_allocated_ += size;
+  last_allocation_ = p;
+  ++outstanding_;
+  return p;
+}
+
+void* PickleArena::Reallocate(void* ptr, size_t old_size, size_t new_size) {
+  old_size = AlignSize(std::max<size_t>(old_size, 1), kAlignment);
+  size_t aligned_new_size = AlignSize(new_size, kAlignment);
+
+  // The most recent allocation can usually grow in place.
+  if (ptr == last_allocation_ &&
+      current_->size - (offset_ - old_size) >= aligned_new_size) {
+    offset_ += aligned_new_size - old_size;
+    bytes_allocated_ += aligned_new_size - old_size;
+    return ptr;
+  }
+
+  void* p = Allocate(new_size);
+  memcpy(p, ptr, std::min(old_size, new_size));
+  Free(ptr, old_size);
+  return p;
+}
+
+void PickleArena::Free(void* ptr, size_t size) {
+  if (!ptr)
+    return;
+  assert(outstanding_ > 0);
+  --outstanding_;
+
+  // Only the most recent allocation can be handed back; everything else waits
+  // for Reset().
+  if (ptr == last_allocation_) {
+    size = AlignSize(std::max<size_t>(size, 1), kAlignment);
+    offset_ -= size;
+    bytes_allocated_ -= size;
+    last_allocation_ = NULL;
+  }
+}
+
+void PickleArena::Reset() {
+  assert(outstanding_ == 0);
+  if (current_) {
+    // Keep the newest block; it is at least as large as the older ones unless
+    // an oversized request forced a bigger one, in which case it is also the
+    // one worth keeping.
+    Block* old = current_->next;
+    current_->next = NULL;
+    while (old) {
+      Block* next = old->next;
+      free(old);
+      old = next;
+      --block_count_;
+    }
+  }
+  offset_ = 0;
+  last_allocation_ = NULL;
+  bytes_allocated_ = 0;
+}
+
+void PickleArena::AddBlock(size_t size) {
+  size_t usable = std::max(block_size_, size);
+  Block* block =
+      reinterpret_cast<Block*>(malloc(kBlockHeaderSize + usable));
+  //CHECK(block);
+  block->next = current_;
+  block->size = usable;
+  current_ = block;
+  offset_ = 0;
+  ++block_count_;
+}
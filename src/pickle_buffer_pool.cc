@@ -0,0 +1,243 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "base/pickle_buffer_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>  // for min() and max()
+
+#if defined(OS_WIN)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+// static
+STATIC_CONST_MEMBER_DEFINITION const size_t PickleBufferPool::kMaxPooledSize;
+
+// Creates the process-wide instance; see GetInstance().
+struct PickleBufferPoolTraits {
+  static PickleBufferPool* New() { return new PickleBufferPool; }
+};
+
+namespace {
+
+// Size classes are multiples of this.  It matches Pickle::kPayloadUnit, and
+// Pickle::Resize() rounds header plus payload to it, so a Pickle buffer is
+// always exactly one class in size.
+const size_t kSizeClassUnit = 64;
+
+const size_t kNumSizeClasses =
+    PickleBufferPool::kMaxPooledSize / kSizeClassUnit + 1;
+
+size_t SizeClass(size_t size) {
+  return (size + kSizeClassUnit - 1) / kSizeClassUnit;
+}
+
+// A cached buffer; the link is stored in the buffer itself.
+struct FreeBuffer {
+  FreeBuffer* next;
+};
+
+struct ThreadCache {
+  FreeBuffer* lists[kNumSizeClasses];
+  uint32 counts[kNumSizeClasses];
+  PickleBufferPool::Stats stats;
+};
+
+ThreadCache* NewThreadCache() {
+  ThreadCache* cache =
+      static_cast<ThreadCache*>(calloc(1, sizeof(ThreadCache)));
+  //CHECK(cache);
+  return cache;
+}
+
+void FreeCachedBuffers(ThreadCache* cache) {
+  for (size_t i = 0; i < kNumSizeClasses; ++i) {
+    while (cache->lists[i]) {
+      FreeBuffer* next = cache->lists[i]->next;
+      free(cache->lists[i]);
+      cache->lists[i] = next;
+    }
+    cache->counts[i] = 0;
+  }
+  cache->stats.cached_buffers = 0;
+  cache->stats.cached_bytes = 0;
+}
+
+PickleBufferPool* g_instance = NULL;
+
+#if defined(OS_WIN)
+
+DWORD g_tls_index = FLS_OUT_OF_INDEXES;
+INIT_ONCE g_init_once = INIT_ONCE_STATIC_INIT;
+
+void WINAPI OnThreadExit(void* data) {
+  if (!data)
+    return;
+  FreeCachedBuffers(static_cast<ThreadCache*>(data));
+  free(data);
+}
+
+BOOL CALLBACK InitializeOnce(PINIT_ONCE, PVOID, PVOID*) {
+  g_tls_index = FlsAlloc(&OnThreadExit);
+  g_instance = PickleBufferPoolTraits::New();
+  return TRUE;
+}
+
+void EnsureInitialized() {
+  InitOnceExecuteOnce(&g_init_once, &InitializeOnce, NULL, NULL);
+}
+
+ThreadCache* GetThreadCache(bool create) {
+  EnsureInitialized();
+  ThreadCache* cache = static_cast<ThreadCache*>(FlsGetValue(g_tls_index));
+  if (!cache && create) {
+    cache = NewThreadCache();
+    FlsSetValue(g_tls_index, cache);
+  }
+  return cache;
+}
+
+#else  // defined(OS_WIN)
+
+pthread_key_t g_tls_key;
+pthread_once_t g_init_once = PTHREAD_ONCE_INIT;
+
+void OnThreadExit(void* data) {
+  FreeCachedBuffers(static_cast<ThreadCache*>(data));
+  free(data);
+}
+
+void InitializeOnce() {
+  pthread_key_create(&g_tls_key, &OnThreadExit);
+  g_instance = PickleBufferPoolTraits::New();
+}
+
+void EnsureInitialized() {
+  pthread_once(&g_init_once, &InitializeOnce);
+}
+
+ThreadCache* GetThreadCache(bool create) {
+  EnsureInitialized();
+  ThreadCache* cache =
+      static_cast<ThreadCache*>(pthread_getspecific(g_tls_key));
+  if (!cache && create) {
+    cache = NewThreadCache();
+    pthread_setspecific(g_tls_key, cache);
+  }
+  return cache;
+}
+
+#endif  // defined(OS_WIN)
+
+}  // namespace
+
+PickleBufferPool::Limits::Limits()
+    : max_buffer_size(16 * 1024),
+      max_buffers_per_class(32),
+      max_cached_bytes(1024 * 1024) {
+}
+
+PickleBufferPool::Stats::Stats()
+    : hits(0),
+      misses(0),
+      unpooled(0),
+      recycled(0),
+      released(0),
+      cached_buffers(0),
+      cached_bytes(0) {
+}
+
+PickleBufferPool::PickleBufferPool() {
+}
+
+PickleBufferPool::~PickleBufferPool() {
+}
+
+// static
+PickleBufferPool* PickleBufferPool::GetInstance() {
+  EnsureInitialized();
+  return g_instance;
+}
+
+void PickleBufferPool::SetLimits(const Limits& limits) {
+  limits_ = limits;
+  limits_.max_buffer_size = std::min(limits_.max_buffer_size, kMaxPooledSize);
+}
+
+void PickleBufferPool::GetStats(Stats* stats) const {
+  ThreadCache* cache = GetThreadCache(false);
+  *stats = cache ? cache->stats : Stats();
+}
+
+void PickleBufferPool::TrimCurrentThread() {
+  ThreadCache* cache = GetThreadCache(false);
+  if (cache)
+    FreeCachedBuffers(cache);
+}
+
+void* PickleBufferPool::Allocate(size_t size) {
+  ThreadCache* cache = GetThreadCache(true);
+  if (size > kMaxPooledSize) {
+    ++cache->stats.unpooled;
+    return malloc(size);
+  }
+
+  // Everything up to kMaxPooledSize is allocated at its full class size, so
+  // it can join a free list later even if the limits change meanwhile.
+  size_t size_class = SizeClass(size);
+  FreeBuffer* buffer = cache->lists[size_class];
+  if (buffer) {
+    cache->lists[size_class] = buffer->next;
+    --cache->counts[size_class];
+    --cache->stats.cached_buffers;
+    cache->stats.cached_bytes -= size_class * kSizeClassUnit;
+    ++cache->stats.hits;
+    return buffer;
+  }
+
+  ++cache->stats.misses;
+  return malloc(std::max<size_t>(size_class, 1) * kSizeClassUnit);
+}
+
+void* PickleBufferPool::Reallocate(void* ptr, size_t old_size,
+                                   size_t new_size) {
+  if (old_size > kMaxPooledSize && new_size > kMaxPooledSize)
+    return realloc(ptr, new_size);
+  if (old_size <= kMaxPooledSize && new_size <= kMaxPooledSize &&
+      SizeClass(old_size) == SizeClass(new_size))
+    return ptr;
+
+  void* p = Allocate(new_size);
+  memcpy(p, ptr, std::min(old_size, new_size));
+  Free(ptr, old_size);
+  return p;
+}
+
+void PickleBufferPool::Free(void* ptr, size_t size) {
+  if (!ptr)
+    return;
+
+  ThreadCache* cache = GetThreadCache(true);
+  size_t size_class = SizeClass(size);
+  size_t class_bytes = size_class * kSizeClassUnit;
+  if (size > limits_.max_buffer_size || size_class == 0 ||
+      cache->counts[size_class] >= limits_.max_buffers_per_class ||
+      cache->stats.cached_bytes + class_bytes > limits_.max_cached_bytes) {
+    ++cache->stats.released;
+    free(ptr);
+    return;
+  }
+
+  FreeBuffer* buffer = static_cast<FreeBuffer*>(ptr);
+  buffer->next = cache->lists[size_class];
+  cache->lists[size_class] = buffer;
+  ++cache->counts[size_class];
+  ++cache->stats.cached_buffers;
+  cache->stats.cached_bytes += class_bytes;
+  ++cache->stats.recycled;
+}
@@ -0,0 +1,51 @@
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "base/crc32c.h"
+#include <gtest/gtest.h>
+
+TEST(Crc32cTest, KnownValues) {
+    const char kCheck[] = "123456789";
+    EXPECT_EQ(0xE3069283u, base::Crc32c(0, kCheck, 9));
+    EXPECT_EQ(0xE3069283u, base::Crc32cPortable(0, kCheck, 9));
+    EXPECT_EQ(0u, base::Crc32c(0, kCheck, 0));
+
+    // From RFC 3720, section B.4.
+    char zeros[32];
+    memset(zeros, 0, sizeof(zeros));
+    EXPECT_EQ(0x8A9136AAu, base::Crc32c(0, zeros, sizeof(zeros)));
+    char ones[32];
+    memset(ones, 0xff, sizeof(ones));
+    EXPECT_EQ(0x62A8AB43u, base::Crc32c(0, ones, sizeof(ones)));
+}
+
+TEST(Crc32cTest, MatchesPortable) {
+    // Long enough for both block sizes of the three-stream path.
+    std::vector<unsigned char> data(3 * 8192 * 2 + 1000);
+    srand(42);
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = static_cast<unsigned char>(rand());
+
+    for (int i = 0; i < 200; ++i) {
+        size_t offset = rand() % 8;
+        size_t length = rand() % (data.size() - offset);
+        if (i < 64)
+            length = i;
+        EXPECT_EQ(base::Crc32cPortable(0, &data[offset], length),
+                  base::Crc32c(0, &data[offset], length))
+            << "offset " << offset << ", length " << length;
+    }
+}
+
+TEST(Crc32cTest, Continues) {
+    std::vector<unsigned char> data(10000);
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = static_cast<unsigned char>(i * 7);
+    uint32 whole = base::Crc32c(0, &data[0], data.size());
+
+    for (size_t split = 0; split < data.size(); split += 999) {
+        uint32 crc = base::Crc32c(0, &data[0], split);
+        crc = base::Crc32c(crc, &data[split], data.size() - split);
+        EXPECT_EQ(whole, crc);
+    }
+}
@@ -0,0 +1,159 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include "base/file_descriptor_posix.h"
+#include "ipc/file_descriptor_set_posix.h"
+#include "ipc/ipc_message.h"
+#include "ipc/ipc_message_utils.h"
+#include <gtest/gtest.h>
+
+namespace {
+
+// True once every write end of the pipe that |fd| reads from is closed.
+bool AtEndOfFile(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    char c;
+    ssize_t result = read(fd, &c, 1);
+    fcntl(fd, F_SETFL, flags);
+    return result == 0;
+}
+
+}  // namespace
+
+TEST(FileDescriptorSetTest, TakenInOrder) {
+    IPC::FileDescriptorSet* set = new IPC::FileDescriptorSet;
+    EXPECT_TRUE(set->empty());
+    for (size_t i = 0; i < IPC::FileDescriptorSet::kMaxDescriptorsPerMessage;
+         ++i)
+        EXPECT_TRUE(set->Add(100 + static_cast<int>(i)));
+    EXPECT_FALSE(set->Add(99));
+    EXPECT_FALSE(set->AddAndAutoClose(99));
+    EXPECT_EQ(IPC::FileDescriptorSet::kMaxDescriptorsPerMessage, set->size());
+
+    int buffer[IPC::FileDescriptorSet::kMaxDescriptorsPerMessage];
+    set->GetDescriptors(buffer);
+    EXPECT_EQ(100, buffer[0]);
+    EXPECT_EQ(101, buffer[1]);
+
+    // Each once, in order.
+    EXPECT_EQ(-1, set->GetDescriptorAt(1));
+    EXPECT_EQ(100, set->GetDescriptorAt(0));
+    EXPECT_EQ(-1, set->GetDescriptorAt(0));
+    EXPECT_EQ(101, set->GetDescriptorAt(1));
+    EXPECT_EQ(-1, set->GetDescriptorAt(
+        IPC::FileDescriptorSet::kMaxDescriptorsPerMessage));
+
+    // None of them closes automatically.
+    set->CommitAll();
+    EXPECT_TRUE(set->empty());
+    set->Release();
+}
+
+TEST(FileDescriptorSetTest, ClosesWhatItOwns) {
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+
+    // Committing closes the auto-close descriptors.
+    IPC::FileDescriptorSet* set = new IPC::FileDescriptorSet;
+    EXPECT_TRUE(set->AddAndAutoClose(fds[1]));
+    EXPECT_TRUE(set->Add(fds[0]));
+    set->CommitAll();
+    EXPECT_TRUE(AtEndOfFile(fds[0]));
+    set->Release();
+
+    // A received set closes the descriptors nobody took.
+    ASSERT_EQ(0, close(fds[0]));
+    ASSERT_EQ(0, pipe(fds));
+    int received[2] = { dup(fds[1]), dup(fds[1]) };
+    ASSERT_EQ(0, close(fds[1]));
+    set = new IPC::FileDescriptorSet;
+    set->SetDescriptors(received, 2);
+    int taken = set->GetDescriptorAt(0);
+    EXPECT_EQ(received[0], taken);
+    set->Release();
+    EXPECT_FALSE(AtEndOfFile(fds[0]));
+    EXPECT_EQ(0, close(taken));
+    EXPECT_TRUE(AtEndOfFile(fds[0]));
+    EXPECT_EQ(0, close(fds[0]));
+}
+
+TEST(FileDescriptorSetTest, MessageParams) {
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+
+    IPC::Message* message = new IPC::Message(1, 2,
+                                             IPC::Message::PRIORITY_NORMAL);
+    EXPECT_FALSE(message->HasFileDescriptors());
+    IPC::WriteParam(message, 7);
+    IPC::WriteParam(message, base::FileDescriptor(fds[0], false));
+    IPC::WriteParam(message, base::FileDescriptor(-1, true));
+    IPC::WriteParam(message, base::FileDescriptor(fds[1], true));
+    EXPECT_TRUE(message->HasFileDescriptors());
+
+    // Copies share the descriptors; validating takes none.
+    IPC::Message copy(*message);
+    delete message;
+    PickleIterator iter(copy);
+    int value;
+    EXPECT_TRUE(IPC::ReadParam(&copy, &iter, &value));
+    EXPECT_EQ(7, value);
+    PickleIterator validate_iter(iter);
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_TRUE(IPC::ValidateParam<base::FileDescriptor>(
+            &copy, &validate_iter));
+    }
+
+    base::FileDescriptor descriptor;
+    PickleIterator read_again(iter);
+    EXPECT_TRUE(IPC::ReadParam(&copy, &iter, &descriptor));
+    EXPECT_EQ(fds[0], descriptor.fd);
+    EXPECT_TRUE(descriptor.auto_close);
+    EXPECT_TRUE(IPC::ReadParam(&copy, &iter, &descriptor));
+    EXPECT_EQ(-1, descriptor.fd);
+    EXPECT_FALSE(descriptor.auto_close);
+    // A descriptor is only handed out once.
+    EXPECT_FALSE(IPC::ReadParam(&copy, &read_again, &descriptor));
+
+    std::string log;
+    IPC::LogParam(base::FileDescriptor(3, true), &log);
+    EXPECT_EQ("FD(3 auto-close)", log);
+
+    // The write end was never read, so the message closes it.
+    EXPECT_FALSE(AtEndOfFile(fds[0]));
+    copy = IPC::Message();
+    EXPECT_FALSE(copy.HasFileDescriptors());
+    EXPECT_TRUE(AtEndOfFile(fds[0]));
+    EXPECT_EQ(0, close(fds[0]));
+}
+
+TEST(FileDescriptorSetTest, DescriptorsBeyondTheLimit) {
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+
+    IPC::Message message(1, 2, IPC::Message::PRIORITY_NORMAL);
+    for (size_t i = 0; i < IPC::FileDescriptorSet::kMaxDescriptorsPerMessage;
+         ++i)
+        IPC::WriteParam(&message, base::FileDescriptor(fds[0], false));
+    // The set is full, so this one goes out as invalid, and is closed since
+    // the message was to own it.
+    int extra = dup(fds[1]);
+    ASSERT_LE(0, extra);
+    IPC::WriteParam(&message, base::FileDescriptor(extra, true));
+    IPC::WriteParam(&message, 7);
+    EXPECT_EQ(-1, fcntl(extra, F_GETFD));
+
+    // The message still reads back field by field.
+    PickleIterator iter(message);
+    base::FileDescriptor descriptor;
+    for (size_t i = 0; i < IPC::FileDescriptorSet::kMaxDescriptorsPerMessage;
+         ++i)
+        EXPECT_TRUE(IPC::ReadParam(&message, &iter, &descriptor));
+    EXPECT_TRUE(IPC::ReadParam(&message, &iter, &descriptor));
+    EXPECT_EQ(-1, descriptor.fd);
+    int value;
+    EXPECT_TRUE(IPC::ReadParam(&message, &iter, &value));
+    EXPECT_EQ(7, value);
+
+    EXPECT_EQ(0, close(fds[0]));
+    EXPECT_EQ(0, close(fds[1]));
+}
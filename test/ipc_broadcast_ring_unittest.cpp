@@ -0,0 +1,230 @@
+#include <pthread.h>
+#include <unistd.h>
+#include <string>
+#include "ipc/ipc_broadcast_ring.h"
+#include "ipc/ipc_message.h"
+#include <gtest/gtest.h>
+
+namespace {
+
+// Expects messages numbered from zero, each with a payload of the number's
+// low byte, allowing for the ones reported lost.
+class CheckingListener : public IPC::BroadcastRing::Reader::Listener {
+public:
+    CheckingListener() : expected_(0), received_(0), lost_(0), bad_(0) {}
+
+    virtual bool OnMessageReceived(const IPC::Message& message) {
+        PickleIterator iter(message);
+        int value;
+        std::string payload;
+        if (!message.ReadInt(&iter, &value) ||
+            !message.ReadString(&iter, &payload) ||
+            value != expected_ ||
+            payload != std::string(payload.size(), static_cast<char>(value)))
+            ++bad_;
+        expected_ = value + 1;
+        ++received_;
+        return true;
+    }
+
+    virtual void OnMessagesLost(uint64 count) {
+        expected_ += static_cast<int>(count);
+        lost_ += static_cast<int>(count);
+    }
+
+    int expected_;
+    int received_;
+    int lost_;
+    int bad_;
+};
+
+IPC::Message* NewMessage(int value, size_t payload_size) {
+    IPC::Message* message = new IPC::Message(
+        1, 100, IPC::Message::PRIORITY_NORMAL);
+    message->WriteInt(value);
+    message->WriteString(std::string(payload_size, static_cast<char>(value)));
+    return message;
+}
+
+struct WriterParams {
+    IPC::BroadcastRing* ring;
+    int count;
+};
+
+// Publishes |count| messages of varying size, waiting for space if the
+// ring waits for its readers.
+void* RunWriter(void* param) {
+    WriterParams* params = static_cast<WriterParams*>(param);
+    for (int i = 0; i < params->count; ++i) {
+        IPC::Message* message = NewMessage(i, (i % 61) * 8);
+        while (!params->ring->WriteMessage(*message)) {
+            if (!params->ring->WaitForSpace(message->payload_size(), 5000))
+                break;
+        }
+        delete message;
+    }
+    return NULL;
+}
+
+struct ReaderParams {
+    IPC::BroadcastRing::Reader* reader;
+    int count;
+    CheckingListener listener;
+};
+
+// Reads until message |count| - 1 arrives or the writer goes quiet.
+void* RunReader(void* param) {
+    ReaderParams* params = static_cast<ReaderParams*>(param);
+    while (params->listener.expected_ < params->count &&
+           params->reader->WaitForMessage(200)) {
+        params->reader->DispatchMessages(&params->listener, 1000);
+    }
+    return NULL;
+}
+
+}  // namespace
+
+TEST(BroadcastRingTest, WaitsForSlowestReader) {
+    IPC::BroadcastRing* ring = IPC::BroadcastRing::Create(
+        4096, 2, IPC::BroadcastRing::BLOCK_ON_SLOW_READERS);
+    ASSERT_TRUE(ring != NULL);
+    EXPECT_EQ(4096u, ring->capacity());
+    // Nothing holds a ring without readers back.
+    for (int i = 0; i < 100; ++i)
+        EXPECT_TRUE(ring->Send(NewMessage(i, 100)));
+
+    IPC::BroadcastRing::Reader* fast =
+        IPC::BroadcastRing::Reader::Open(dup(ring->fd()));
+    IPC::BroadcastRing::Reader* slow =
+        IPC::BroadcastRing::Reader::Open(dup(ring->fd()));
+    ASSERT_TRUE(fast != NULL);
+    ASSERT_TRUE(slow != NULL);
+    EXPECT_TRUE(IPC::BroadcastRing::Reader::Open(dup(ring->fd())) == NULL);
+    EXPECT_EQ(2u, ring->reader_count());
+
+    // Readers only see what is published after they attach.
+    CheckingListener fast_listener, slow_listener;
+    fast_listener.expected_ = slow_listener.expected_ = 100;
+    EXPECT_FALSE(fast->WaitForMessage(0));
+    int sent = 100;
+    while (ring->Send(NewMessage(sent, 100))) {
+        ++sent;
+        EXPECT_EQ(1u, fast->DispatchMessages(&fast_listener, 10));
+    }
+    EXPECT_LT(100 + 10, sent);
+    EXPECT_FALSE(ring->WaitForSpace(100, 10));
+
+    // The slow reader makes room as it reads.
+    EXPECT_TRUE(slow->WaitForMessage(0));
+    EXPECT_EQ(2u, slow->DispatchMessages(&slow_listener, 2));
+    EXPECT_TRUE(ring->WaitForSpace(100, 0));
+    EXPECT_EQ(static_cast<size_t>(sent - 102),
+              slow->DispatchMessages(&slow_listener, 1000));
+    EXPECT_EQ(sent - 100, slow_listener.received_);
+    EXPECT_EQ(sent - 100, fast_listener.received_);
+
+    // And makes way for good when it leaves.
+    while (ring->Send(NewMessage(sent, 100))) {
+        ++sent;
+        EXPECT_EQ(1u, fast->DispatchMessages(&fast_listener, 10));
+    }
+    delete slow;
+    EXPECT_EQ(1u, ring->reader_count());
+    EXPECT_TRUE(ring->Send(NewMessage(sent++, 100)));
+    fast->DispatchMessages(&fast_listener, 1000);
+    EXPECT_EQ(sent, fast_listener.expected_);
+    EXPECT_EQ(0, fast_listener.lost_);
+    EXPECT_EQ(0, fast_listener.bad_ + slow_listener.bad_);
+    EXPECT_FALSE(fast->is_broken());
+
+    // Its place is free for another reader.
+    slow = IPC::BroadcastRing::Reader::Open(dup(ring->fd()));
+    EXPECT_TRUE(slow != NULL);
+    delete slow;
+    delete fast;
+    delete ring;
+}
+
+TEST(BroadcastRingTest, OverwritesSlowReaders) {
+    IPC::BroadcastRing* ring = IPC::BroadcastRing::Create(
+        4096, 4, IPC::BroadcastRing::OVERWRITE_SLOW_READERS);
+    ASSERT_TRUE(ring != NULL);
+    IPC::BroadcastRing::Reader* fast =
+        IPC::BroadcastRing::Reader::Open(dup(ring->fd()));
+    IPC::BroadcastRing::Reader* slow =
+        IPC::BroadcastRing::Reader::Open(dup(ring->fd()));
+    ASSERT_TRUE(fast != NULL);
+    ASSERT_TRUE(slow != NULL);
+
+    CheckingListener fast_listener, slow_listener;
+    for (int i = 0; i < 100; ++i) {
+        EXPECT_TRUE(ring->Send(NewMessage(i, 200)));
+        EXPECT_EQ(1u, fast->DispatchMessages(&fast_listener, 10));
+    }
+    // Lapped: the slow reader starts over at the head, and learns what it
+    // lost with the next message.
+    EXPECT_EQ(0u, slow->DispatchMessages(&slow_listener, 1000));
+    EXPECT_TRUE(ring->Send(NewMessage(100, 200)));
+    EXPECT_EQ(1u, slow->DispatchMessages(&slow_listener, 1000));
+    EXPECT_EQ(1u, fast->DispatchMessages(&fast_listener, 1000));
+    EXPECT_EQ(100u, slow->messages_lost());
+    EXPECT_EQ(100, slow_listener.lost_);
+    EXPECT_EQ(101, fast_listener.received_);
+    EXPECT_EQ(0u, fast->messages_lost());
+    EXPECT_EQ(0, fast_listener.bad_ + slow_listener.bad_);
+
+    // Too big for the ring at all.
+    EXPECT_FALSE(ring->Send(NewMessage(101, 8192)));
+    EXPECT_FALSE(ring->WaitForSpace(8192, 0));
+
+    // Only a ring opens as one.
+    EXPECT_TRUE(IPC::BroadcastRing::Reader::Open(dup(STDIN_FILENO)) == NULL);
+    delete slow;
+    delete fast;
+    delete ring;
+}
+
+TEST(BroadcastRingTest, ReaderThreads) {
+    const int kReaders = 3;
+    const IPC::BroadcastRing::OverflowPolicy kPolicies[] = {
+        IPC::BroadcastRing::BLOCK_ON_SLOW_READERS,
+        IPC::BroadcastRing::OVERWRITE_SLOW_READERS
+    };
+    for (size_t i = 0; i < arraysize(kPolicies); ++i) {
+        IPC::BroadcastRing* ring = IPC::BroadcastRing::Create(
+            16 * 1024, kReaders, kPolicies[i]);
+        ASSERT_TRUE(ring != NULL);
+        WriterParams writer = { ring, 50000 };
+        ReaderParams readers[kReaders];
+        pthread_t threads[kReaders + 1];
+        for (int j = 0; j < kReaders; ++j) {
+            readers[j].reader =
+                IPC::BroadcastRing::Reader::Open(dup(ring->fd()));
+            ASSERT_TRUE(readers[j].reader != NULL);
+            readers[j].count = writer.count;
+            ASSERT_EQ(0, pthread_create(&threads[j], NULL, &RunReader,
+                                        &readers[j]));
+        }
+        ASSERT_EQ(0, pthread_create(&threads[kReaders], NULL, &RunWriter,
+                                    &writer));
+        for (int j = 0; j <= kReaders; ++j)
+            pthread_join(threads[j], NULL);
+
+        for (int j = 0; j < kReaders; ++j) {
+            const CheckingListener& listener = readers[j].listener;
+            EXPECT_EQ(0, listener.bad_);
+            EXPECT_FALSE(readers[j].reader->is_broken());
+            if (kPolicies[i] == IPC::BroadcastRing::BLOCK_ON_SLOW_READERS) {
+                EXPECT_EQ(writer.count, listener.received_);
+                EXPECT_EQ(0, listener.lost_);
+            } else {
+                // What a lapped reader skips is only counted when the next
+                // message comes, if one does.
+                EXPECT_GE(writer.count, listener.received_ + listener.lost_);
+                EXPECT_LT(0, listener.received_);
+            }
+            delete readers[j].reader;
+        }
+        delete ring;
+    }
+}
@@ -0,0 +1,314 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string>
+#include "ipc/ipc_channel.h"
+#include "ipc/ipc_io_loop.h"
+#include "ipc/ipc_message.h"
+#include "ipc/ipc_shared_ring.h"
+#include <gtest/gtest.h>
+
+// Latency and throughput of a Channel between two threads, over a socket
+// pair, on each IOLoop backend and with and without coalescing writes, and
+// the throughput of a SharedRing for comparison.  The numbers are printed;
+// nothing is asserted about them.
+
+namespace {
+
+enum {
+    kPingType = 1,  // Echoed back.
+    kBulkType,      // Counted.
+    kFlushType      // Answered with the count so far.
+};
+
+// Runs on the server thread.
+class EchoListener : public IPC::Channel::Listener {
+public:
+    explicit EchoListener(IPC::IOLoop* loop)
+        : loop_(loop), channel_(NULL), count_(0) {}
+
+    virtual bool OnMessageReceived(const IPC::Message& message) {
+        switch (message.type()) {
+          case kPingType:
+            channel_->Send(new IPC::Message(message));
+            break;
+          case kBulkType:
+            ++count_;
+            break;
+          case kFlushType: {
+            IPC::Message* reply = new IPC::Message(
+                0, kFlushType, IPC::Message::PRIORITY_NORMAL);
+            reply->WriteInt(count_);
+            count_ = 0;
+            channel_->Send(reply);
+            break;
+          }
+        }
+        return true;
+    }
+
+    virtual void OnChannelError() {
+        loop_->Quit();
+    }
+
+    IPC::IOLoop* loop_;
+    IPC::Channel* channel_;
+    int count_;
+};
+
+struct ServerParams {
+    int fd;
+    IPC::IOLoop::Backend backend;
+};
+
+void* RunServer(void* param) {
+    ServerParams* params = static_cast<ServerParams*>(param);
+    IPC::IOLoop loop;
+    if (!loop.Init(params->backend))
+        return NULL;
+    EchoListener listener(&loop);
+    IPC::Channel channel(params->fd, &listener, &loop);
+    listener.channel_ = &channel;
+    if (channel.Connect())
+        loop.Run();
+    return NULL;
+}
+
+// Runs on the test thread.
+class ClientListener : public IPC::Channel::Listener {
+public:
+    ClientListener() : replies_(0), flushed_(-1) {}
+
+    virtual bool OnMessageReceived(const IPC::Message& message) {
+        ++replies_;
+        if (message.type() == kFlushType) {
+            PickleIterator iter(message);
+            EXPECT_TRUE(message.ReadInt(&iter, &flushed_));
+        }
+        return true;
+    }
+
+    int replies_;
+    int flushed_;
+};
+
+const IPC::IOLoop::Backend kBackends[] = {
+    IPC::IOLoop::BACKEND_EPOLL,
+    IPC::IOLoop::BACKEND_IO_URING
+};
+
+const char* BackendName(IPC::IOLoop::Backend backend) {
+    return backend == IPC::IOLoop::BACKEND_EPOLL ? "epoll" : "io_uring";
+}
+
+// Holds small messages back for up to half a millisecond.
+IPC::Channel::FlushPolicy CoalescingPolicy() {
+    IPC::Channel::FlushPolicy policy;
+    policy.max_bytes = 64 * 1024;
+    policy.max_messages = 64;
+    policy.max_delay_us = 500;
+    return policy;
+}
+
+class ChannelPerfTest : public testing::Test {
+protected:
+    ChannelPerfTest() : loop_(NULL), channel_(NULL) {}
+
+    virtual void TearDown() {
+        Disconnect();
+    }
+
+    // Starts a server thread and connects to it, both ends running on
+    // |backend|, or on epoll without io_uring.  Returns the backend.
+    IPC::IOLoop::Backend Connect(IPC::IOLoop::Backend backend,
+                                 const IPC::Channel::FlushPolicy& policy) {
+        int fd;
+        EXPECT_TRUE(IPC::Channel::SocketPair(&fd, &server_params_.fd));
+        loop_ = new IPC::IOLoop;
+        EXPECT_TRUE(loop_->Init(backend));
+        server_params_.backend = loop_->backend();
+        listener_ = ClientListener();
+        channel_ = new IPC::Channel(fd, &listener_, loop_);
+        channel_->set_flush_policy(policy);
+        EXPECT_TRUE(channel_->Connect());
+        EXPECT_EQ(0, pthread_create(&server_, NULL, &RunServer,
+                                    &server_params_));
+        return loop_->backend();
+    }
+
+    void Disconnect() {
+        if (!channel_)
+            return;
+        // Closing our end stops the server.
+        delete channel_;
+        channel_ = NULL;
+        pthread_join(server_, NULL);
+        delete loop_;
+        loop_ = NULL;
+    }
+
+    IPC::Message* NewMessage(int type, const std::string& payload,
+                             IPC::Message::PriorityValue priority =
+                                 IPC::Message::PRIORITY_NORMAL) {
+        IPC::Message* message = new IPC::Message(0, type, priority);
+        message->WriteData(payload.data(), static_cast<int>(payload.size()));
+        return message;
+    }
+
+    void RunUntilReplies(int replies) {
+        while (listener_.replies_ < replies && loop_->RunOnce(1000)) {
+        }
+    }
+
+    IPC::IOLoop* loop_;
+    ClientListener listener_;
+    IPC::Channel* channel_;
+    ServerParams server_params_;
+    pthread_t server_;
+};
+
+struct RingConsumerParams {
+    IPC::SharedRing* ring;
+    int count;
+};
+
+// Reads |count| messages off the ring, touching each payload.
+void* RunRingConsumer(void* param) {
+    RingConsumerParams* params = static_cast<RingConsumerParams*>(param);
+    int received = 0;
+    while (received < params->count && params->ring->WaitForMessage(5000)) {
+        const char* data;
+        int size;
+        while (params->ring->PeekMessage(&data, &size)) {
+            IPC::Message message(data, size);
+            PickleIterator iter(message);
+            int value;
+            if (!message.ReadInt(&iter, &value))
+                return NULL;
+            params->ring->PopMessage();
+            ++received;
+        }
+    }
+    params->count = received;
+    return NULL;
+}
+
+}  // namespace
+
+// With coalescing, the pings are high priority and so skip the wait.
+TEST_F(ChannelPerfTest, Latency) {
+    const size_t kSizes[] = { 12, 1024, 64 * 1024 };
+    const int kRoundTrips = 2000;
+    for (size_t b = 0; b < arraysize(kBackends); ++b) {
+        for (int coalesce = 0; coalesce < 2; ++coalesce) {
+            IPC::IOLoop::Backend backend = Connect(
+                kBackends[b], coalesce ? CoalescingPolicy()
+                                       : IPC::Channel::FlushPolicy());
+            if (backend != kBackends[b]) {
+                Disconnect();
+                continue;
+            }
+            IPC::Message::PriorityValue priority =
+                coalesce ? IPC::Message::PRIORITY_HIGH
+                         : IPC::Message::PRIORITY_NORMAL;
+            for (size_t i = 0; i < arraysize(kSizes); ++i) {
+                std::string payload(kSizes[i], 'p');
+                int64 start = IPC::Message::DeadlineClockNow();
+                for (int j = 0; j < kRoundTrips; ++j) {
+                    channel_->Send(NewMessage(kPingType, payload, priority));
+                    RunUntilReplies(listener_.replies_ + 1);
+                }
+                int64 elapsed = IPC::Message::DeadlineClockNow() - start;
+                ASSERT_TRUE(channel_->is_connected());
+                printf("*RESULT ipc_channel_latency_%s%s: %d_bytes= "
+                       "%.2f us/round trip\n",
+                       BackendName(backend), coalesce ? "_coalesced" : "",
+                       static_cast<int>(kSizes[i]),
+                       static_cast<double>(elapsed) / kRoundTrips);
+            }
+            Disconnect();
+        }
+    }
+}
+
+TEST_F(ChannelPerfTest, Throughput) {
+    const size_t kSizes[] = { 128, 4 * 1024, 256 * 1024 };
+    const size_t kBytesPerSize = 64 * 1024 * 1024;
+    // Keeps the outgoing queue, and so memory use, bounded.
+    const size_t kMaxPending = 64;
+    for (size_t b = 0; b < arraysize(kBackends); ++b) {
+        for (int coalesce = 0; coalesce < 2; ++coalesce) {
+            IPC::IOLoop::Backend backend = Connect(
+                kBackends[b], coalesce ? CoalescingPolicy()
+                                       : IPC::Channel::FlushPolicy());
+            if (backend != kBackends[b]) {
+                Disconnect();
+                continue;
+            }
+            for (size_t i = 0; i < arraysize(kSizes); ++i) {
+                std::string payload(kSizes[i], 't');
+                int count = static_cast<int>(kBytesPerSize / kSizes[i]);
+                int64 start = IPC::Message::DeadlineClockNow();
+                for (int j = 0; j < count; ++j) {
+                    channel_->Send(NewMessage(kBulkType, payload));
+                    while (channel_->pending_messages() > kMaxPending)
+                        loop_->RunOnce(1000);
+                }
+                channel_->Send(NewMessage(kFlushType, std::string()));
+                channel_->Flush();
+                RunUntilReplies(listener_.replies_ + 1);
+                int64 elapsed = IPC::Message::DeadlineClockNow() - start;
+                EXPECT_EQ(count, listener_.flushed_);
+                printf("*RESULT ipc_channel_throughput_%s%s: %d_bytes= "
+                       "%.1f MB/s, %.0f messages/s\n",
+                       BackendName(backend), coalesce ? "_coalesced" : "",
+                       static_cast<int>(kSizes[i]),
+                       kBytesPerSize / static_cast<double>(elapsed),
+                       count * 1e6 / elapsed);
+            }
+            Disconnect();
+        }
+    }
+}
+
+TEST(SharedRingPerfTest, Throughput) {
+    const size_t kSizes[] = { 128, 4 * 1024, 256 * 1024 };
+    const size_t kBytesPerSize = 64 * 1024 * 1024;
+    for (size_t i = 0; i < arraysize(kSizes); ++i) {
+        IPC::SharedRing* producer = IPC::SharedRing::Create(4 * 1024 * 1024);
+        ASSERT_TRUE(producer != NULL);
+        IPC::SharedRing* consumer =
+            IPC::SharedRing::Open(dup(producer->fd()));
+        ASSERT_TRUE(consumer != NULL);
+        std::string payload(kSizes[i], 't');
+        int count = static_cast<int>(kBytesPerSize / kSizes[i]);
+        RingConsumerParams params = { consumer, count };
+        pthread_t thread;
+        ASSERT_EQ(0, pthread_create(&thread, NULL, &RunRingConsumer,
+                                    &params));
+
+        int64 start = IPC::Message::DeadlineClockNow();
+        for (int j = 0; j < count; ++j) {
+            size_t payload_size = sizeof(int) + payload.size();
+            IPC::Message* message;
+            while (!(message = producer->BeginMessage(
+                         0, kBulkType, IPC::Message::PRIORITY_NORMAL,
+                         payload_size)))
+                ASSERT_TRUE(producer->WaitForSpace(payload_size, 5000));
+            message->WriteInt(j);
+            message->WriteBytes(payload.data(),
+                                static_cast<int>(payload.size()));
+            ASSERT_TRUE(producer->CommitMessage());
+        }
+        pthread_join(thread, NULL);
+        int64 elapsed = IPC::Message::DeadlineClockNow() - start;
+        EXPECT_EQ(count, params.count);
+        printf("*RESULT ipc_shared_ring_throughput: %d_bytes= %.1f MB/s, "
+               "%.0f messages/s\n",
+               static_cast<int>(kSizes[i]),
+               kBytesPerSize / static_cast<double>(elapsed),
+               count * 1e6 / elapsed);
+        delete consumer;
+        delete producer;
+    }
+}
@@ -0,0 +1,505 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "base/file_descriptor_posix.h"
+#include "ipc/ipc_channel.h"
+#include "ipc/ipc_io_loop.h"
+#include "ipc/ipc_message.h"
+#include "ipc/ipc_sync_message.h"
+#define  MESSAGES_INTERNAL_FILE "test/ipc_sync_message_unittest.h"
+#include "ipc/ipc_message_macros.h"
+#include <gtest/gtest.h>
+#include <assert.h>
+#define DCHECK assert
+
+namespace {
+
+// Keeps a copy of every message it receives.
+class RecordingListener : public IPC::Channel::Listener {
+public:
+    RecordingListener()
+        : connected_(0), errors_(0), peer_pid_(-1), channel_(NULL),
+          deserializer_(NULL) {}
+    virtual ~RecordingListener() {
+        for (size_t i = 0; i < messages_.size(); ++i)
+            delete messages_[i];
+    }
+
+    virtual bool OnMessageReceived(const IPC::Message& message) {
+        if (message.is_reply() && deserializer_) {
+            EXPECT_TRUE(deserializer_->SerializeOutputParameters(message));
+            delete deserializer_;
+            deserializer_ = NULL;
+        }
+        messages_.push_back(new IPC::Message(message));
+        return true;
+    }
+
+    virtual void OnChannelConnected(int32 peer_pid) {
+        ++connected_;
+        peer_pid_ = peer_pid;
+    }
+
+    virtual void OnChannelError() {
+        ++errors_;
+    }
+
+    // Answers synchronous messages through the channel, as any class with
+    // a message map would.
+    bool Send(IPC::Message* message) {
+        return channel_->Send(message);
+    }
+
+    void OnDouble(int in, int* out) {
+        *out = in * 2;
+    }
+
+    int connected_;
+    int errors_;
+    int32 peer_pid_;
+    IPC::Channel* channel_;
+    IPC::MessageReplyDeserializer* deserializer_;
+    std::vector<IPC::Message*> messages_;
+};
+
+// Answers SyncChannelTestMsg_Double through its message map.
+class DoublingListener : public RecordingListener {
+public:
+    virtual bool OnMessageReceived(const IPC::Message& msg) {
+        bool handled = true;
+        IPC_BEGIN_MESSAGE_MAP(DoublingListener, msg)
+            IPC_MESSAGE_HANDLER(SyncChannelTestMsg_Double, OnDouble)
+            IPC_MESSAGE_UNHANDLED(handled = false)
+        IPC_END_MESSAGE_MAP()
+        RecordingListener::OnMessageReceived(msg);
+        return handled;
+    }
+};
+
+size_t MessageCount(const RecordingListener& listener) {
+    return listener.messages_.size();
+}
+
+IPC::Message* NewMessage(int value, IPC::Message::PriorityValue priority,
+                         const std::string& str) {
+    IPC::Message* message = new IPC::Message(1, 100, priority);
+    message->WriteInt(value);
+    message->WriteString(str);
+    return message;
+}
+
+void ExpectMessage(const IPC::Message& message, int value,
+                   const std::string& str) {
+    PickleIterator iter(message);
+    int read_value;
+    std::string read_str;
+    EXPECT_TRUE(message.ReadInt(&iter, &read_value));
+    EXPECT_TRUE(message.ReadString(&iter, &read_str));
+    EXPECT_EQ(value, read_value);
+    EXPECT_TRUE(str == read_str);
+}
+
+// True once every write end of the pipe that |fd| reads from is closed.
+bool AtEndOfFile(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    char c;
+    ssize_t result = read(fd, &c, 1);
+    fcntl(fd, F_SETFL, flags);
+    return result == 0;
+}
+
+}  // namespace
+
+TEST(ChannelTest, SocketPairInPriorityOrder) {
+    IPC::IOLoop loop;
+    ASSERT_TRUE(loop.Init());
+    int fd0, fd1;
+    ASSERT_TRUE(IPC::Channel::SocketPair(&fd0, &fd1));
+    RecordingListener listener0, listener1;
+    IPC::Channel channel0(fd0, &listener0, &loop);
+    IPC::Channel channel1(fd1, &listener1, &loop);
+
+    // Queued until the channel connects, then written by priority.
+    EXPECT_TRUE(channel0.Send(
+        NewMessage(1, IPC::Message::PRIORITY_LOW, "low")));
+    EXPECT_TRUE(channel0.Send(
+        NewMessage(2, IPC::Message::PRIORITY_HIGH, "high")));
+    EXPECT_EQ(2u, channel0.pending_messages());
+    ASSERT_TRUE(channel1.Connect());
+    ASSERT_TRUE(channel0.Connect());
+    // On io_uring, the loop writes them when it next runs.
+    if (loop.backend() == IPC::IOLoop::BACKEND_EPOLL) {
+        EXPECT_EQ(0u, channel0.pending_messages());
+    }
+    EXPECT_EQ(1, listener0.connected_);
+    EXPECT_EQ(getpid(), listener0.peer_pid_);
+
+    EXPECT_TRUE(channel1.Send(
+        NewMessage(3, IPC::Message::PRIORITY_NORMAL, "back")));
+    for (int i = 0; i < 100 && (MessageCount(listener1) < 2 ||
+                                MessageCount(listener0) < 1); ++i)
+        loop.RunOnce(10);
+    ASSERT_EQ(2u, MessageCount(listener1));
+    ExpectMessage(*listener1.messages_[0], 2, "high");
+    ExpectMessage(*listener1.messages_[1], 1, "low");
+    ASSERT_EQ(1u, MessageCount(listener0));
+    ExpectMessage(*listener0.messages_[0], 3, "back");
+    EXPECT_EQ(0u, channel0.pending_messages());
+    EXPECT_EQ(0, listener0.errors_);
+}
+
+TEST(ChannelTest, AnswersSyncMessagesThroughMessageMap) {
+    IPC::IOLoop loop;
+    ASSERT_TRUE(loop.Init());
+    int fd0, fd1;
+    ASSERT_TRUE(IPC::Channel::SocketPair(&fd0, &fd1));
+    RecordingListener client;
+    DoublingListener server;
+    IPC::Channel client_channel(fd0, &client, &loop);
+    IPC::Channel server_channel(fd1, &server, &loop);
+    server.channel_ = &server_channel;
+    ASSERT_TRUE(client_channel.Connect());
+    ASSERT_TRUE(server_channel.Connect());
+
+    int result = 0;
+    SyncChannelTestMsg_Double* msg = new SyncChannelTestMsg_Double(21, &result);
+    client.deserializer_ = msg->GetReplyDeserializer();
+    EXPECT_TRUE(client_channel.Send(msg));
+    for (int i = 0; i < 200 && MessageCount(client) < 1; ++i)
+        loop.RunOnce(10);
+    ASSERT_EQ(1u, MessageCount(client));
+    EXPECT_TRUE(client.messages_[0]->is_reply());
+    EXPECT_EQ(42, result);
+}
+
+TEST(ChannelTest, LargeCompressedAndChecksummedMessages) {
+    IPC::IOLoop loop;
+    ASSERT_TRUE(loop.Init());
+    int fd0, fd1;
+    ASSERT_TRUE(IPC::Channel::SocketPair(&fd0, &fd1));
+    RecordingListener listener0, listener1;
+    IPC::Channel channel0(fd0, &listener0, &loop);
+    IPC::Channel channel1(fd1, &listener1, &loop);
+    channel0.set_compression_threshold(1024);
+    channel0.set_add_checksums(true);
+    ASSERT_TRUE(channel0.Connect());
+    ASSERT_TRUE(channel1.Connect());
+
+    // Far more than the socket buffer holds, so the writes have to wait
+    // for the reader.
+    std::string compressible;
+    while (compressible.size() < 4 * 1024 * 1024)
+        compressible += "row,column,value;";
+    std::string random(2 * 1024 * 1024, '\0');
+    for (size_t i = 0; i < random.size(); ++i)
+        random[i] = static_cast<char>(rand());
+
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_TRUE(channel0.Send(NewMessage(
+            i, IPC::Message::PRIORITY_NORMAL, i == 1 ? random : compressible)));
+    }
+    EXPECT_LT(0u, channel0.pending_messages());
+    for (int i = 0; i < 2000 && MessageCount(listener1) < 3; ++i)
+        loop.RunOnce(10);
+    ASSERT_EQ(3u, MessageCount(listener1));
+    for (int i = 0; i < 3; ++i) {
+        const IPC::Message& message = *listener1.messages_[i];
+        EXPECT_FALSE(message.is_compressed());
+        ExpectMessage(message, i, i == 1 ? random : compressible);
+    }
+    EXPECT_EQ(0, listener1.errors_);
+
+    // A message the sender checksummed itself goes out uncompressed, with
+    // its checksum intact.
+    std::string small = compressible.substr(0, 64 * 1024);
+    IPC::Message* checksummed =
+        NewMessage(3, IPC::Message::PRIORITY_NORMAL, small);
+    checksummed->AddChecksum();
+    EXPECT_TRUE(channel0.Send(checksummed));
+    for (int i = 0; i < 200 && MessageCount(listener1) < 4; ++i)
+        loop.RunOnce(10);
+    ASSERT_EQ(4u, MessageCount(listener1));
+    EXPECT_TRUE(listener1.messages_[3]->has_checksum());
+    ExpectMessage(*listener1.messages_[3], 3, small);
+    EXPECT_EQ(0, listener1.errors_);
+}
+
+TEST(ChannelTest, NamedSocketAndErrors) {
+    IPC::IOLoop loop;
+    ASSERT_TRUE(loop.Init());
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/ipc_channel_test.%d", getpid());
+
+    RecordingListener server, client;
+    IPC::Channel server_channel(path, IPC::Channel::MODE_SERVER, &server,
+                                &loop);
+    ASSERT_TRUE(server_channel.Connect());
+    EXPECT_FALSE(server_channel.is_connected());
+    IPC::Channel* client_channel =
+        new IPC::Channel(path, IPC::Channel::MODE_CLIENT, &client, &loop);
+    ASSERT_TRUE(client_channel->Connect());
+    EXPECT_TRUE(client_channel->Send(
+        NewMessage(5, IPC::Message::PRIORITY_NORMAL, "hello")));
+    for (int i = 0; i < 200 && MessageCount(server) < 1; ++i)
+        loop.RunOnce(10);
+    EXPECT_TRUE(server_channel.is_connected());
+    EXPECT_EQ(getpid(), server.peer_pid_);
+    ASSERT_EQ(1u, MessageCount(server));
+    ExpectMessage(*server.messages_[0], 5, "hello");
+    // The socket file is gone once the client is accepted.
+    EXPECT_NE(0, access(path, F_OK));
+
+    // The peer going away is an error.
+    delete client_channel;
+    for (int i = 0; i < 200 && server.errors_ < 1; ++i)
+        loop.RunOnce(10);
+    EXPECT_EQ(1, server.errors_);
+    EXPECT_FALSE(server_channel.Send(
+        NewMessage(6, IPC::Message::PRIORITY_NORMAL, "late")));
+    EXPECT_EQ(0, client.errors_);
+
+    // So is a peer that sends garbage: here, a message too large to accept.
+    int fd0, fd1;
+    ASSERT_TRUE(IPC::Channel::SocketPair(&fd0, &fd1));
+    RecordingListener victim;
+    IPC::Channel channel(fd0, &victim, &loop);
+    ASSERT_TRUE(channel.Connect());
+    char header[64];
+    memset(header, 0xff, sizeof(header));
+    EXPECT_EQ(static_cast<ssize_t>(sizeof(header)),
+              write(fd1, header, sizeof(header)));
+    for (int i = 0; i < 200 && victim.errors_ < 1; ++i)
+        loop.RunOnce(10);
+    EXPECT_EQ(1, victim.errors_);
+    EXPECT_EQ(0u, MessageCount(victim));
+    close(fd1);
+}
+
+TEST(ChannelTest, EpollAndIoUringBackends) {
+    const IPC::IOLoop::Backend kBackends[] = {
+        IPC::IOLoop::BACKEND_EPOLL,
+        IPC::IOLoop::BACKEND_IO_URING
+    };
+    for (size_t i = 0; i < arraysize(kBackends); ++i) {
+        IPC::IOLoop loop;
+        ASSERT_TRUE(loop.Init(kBackends[i]));
+        // io_uring falls back to epoll on kernels without it.
+        if (kBackends[i] == IPC::IOLoop::BACKEND_EPOLL) {
+            EXPECT_EQ(IPC::IOLoop::BACKEND_EPOLL, loop.backend());
+        }
+        int fd0, fd1;
+        ASSERT_TRUE(IPC::Channel::SocketPair(&fd0, &fd1));
+        RecordingListener listener0, listener1;
+        IPC::Channel channel0(fd0, &listener0, &loop);
+        IPC::Channel channel1(fd1, &listener1, &loop);
+        ASSERT_TRUE(channel0.Connect());
+        ASSERT_TRUE(channel1.Connect());
+
+        // Enough small messages for several batches, and large ones that
+        // span many receive buffers and fill the socket.
+        const int kCount = 1000;
+        std::string large(1024 * 1024, 'l');
+        for (int j = 0; j < kCount; ++j) {
+            EXPECT_TRUE(channel0.Send(NewMessage(
+                j, IPC::Message::PRIORITY_NORMAL,
+                j % 250 == 0 ? large : std::string(j % 64, 's'))));
+        }
+        EXPECT_TRUE(channel1.Send(
+            NewMessage(-1, IPC::Message::PRIORITY_NORMAL, "back")));
+        for (int j = 0; j < 2000 && (MessageCount(listener1) < kCount ||
+                                     MessageCount(listener0) < 1); ++j)
+            loop.RunOnce(10);
+        ASSERT_EQ(static_cast<size_t>(kCount), MessageCount(listener1));
+        for (int j = 0; j < kCount; ++j) {
+            ExpectMessage(*listener1.messages_[j], j,
+                          j % 250 == 0 ? large : std::string(j % 64, 's'));
+        }
+        ASSERT_EQ(1u, MessageCount(listener0));
+        ExpectMessage(*listener0.messages_[0], -1, "back");
+        EXPECT_EQ(0u, channel0.pending_messages());
+
+        // Closing one end breaks the other.
+        channel0.Close();
+        for (int j = 0; j < 200 && listener1.errors_ < 1; ++j)
+            loop.RunOnce(10);
+        EXPECT_EQ(1, listener1.errors_);
+        EXPECT_EQ(0, listener0.errors_);
+    }
+}
+
+TEST(ChannelTest, FlushPolicy) {
+    const IPC::IOLoop::Backend kBackends[] = {
+        IPC::IOLoop::BACKEND_EPOLL,
+        IPC::IOLoop::BACKEND_IO_URING
+    };
+    for (size_t i = 0; i < arraysize(kBackends); ++i) {
+        IPC::IOLoop loop;
+        ASSERT_TRUE(loop.Init(kBackends[i]));
+        int fd0, fd1;
+        ASSERT_TRUE(IPC::Channel::SocketPair(&fd0, &fd1));
+        RecordingListener listener0, listener1;
+        IPC::Channel channel0(fd0, &listener0, &loop);
+        IPC::Channel channel1(fd1, &listener1, &loop);
+        IPC::Channel::FlushPolicy policy;
+        policy.max_messages = 4;
+        channel0.set_flush_policy(policy);
+        ASSERT_TRUE(channel0.Connect());
+        ASSERT_TRUE(channel1.Connect());
+
+        // Held until the fourth message.
+        for (int j = 0; j < 3; ++j) {
+            EXPECT_TRUE(channel0.Send(
+                NewMessage(j, IPC::Message::PRIORITY_NORMAL, "held")));
+        }
+        for (int j = 0; j < 5; ++j)
+            loop.RunOnce(10);
+        EXPECT_EQ(0u, MessageCount(listener1));
+        EXPECT_EQ(3u, channel0.pending_messages());
+        EXPECT_TRUE(channel0.Send(
+            NewMessage(3, IPC::Message::PRIORITY_NORMAL, "fourth")));
+        for (int j = 0; j < 200 && MessageCount(listener1) < 4; ++j)
+            loop.RunOnce(10);
+        ASSERT_EQ(4u, MessageCount(listener1));
+        ExpectMessage(*listener1.messages_[3], 3, "fourth");
+
+        // A high priority message takes the waiting ones along, as does
+        // Flush() or a batch.
+        EXPECT_TRUE(channel0.Send(
+            NewMessage(4, IPC::Message::PRIORITY_NORMAL, "normal")));
+        EXPECT_TRUE(channel0.Send(
+            NewMessage(5, IPC::Message::PRIORITY_HIGH, "high")));
+        for (int j = 0; j < 200 && MessageCount(listener1) < 6; ++j)
+            loop.RunOnce(10);
+        ASSERT_EQ(6u, MessageCount(listener1));
+        ExpectMessage(*listener1.messages_[4], 5, "high");
+        EXPECT_TRUE(channel0.Send(
+            NewMessage(6, IPC::Message::PRIORITY_NORMAL, "flushed")));
+        EXPECT_TRUE(channel0.Flush());
+        std::vector<IPC::Message*> batch;
+        for (int j = 7; j < 9; ++j)
+            batch.push_back(
+                NewMessage(j, IPC::Message::PRIORITY_NORMAL, "batch"));
+        EXPECT_TRUE(channel0.SendBatch(&batch));
+        EXPECT_TRUE(batch.empty());
+        for (int j = 0; j < 200 && MessageCount(listener1) < 9; ++j)
+            loop.RunOnce(10);
+        ASSERT_EQ(9u, MessageCount(listener1));
+        ExpectMessage(*listener1.messages_[8], 8, "batch");
+
+        // Or the timer.
+        policy.max_delay_us = 2000;
+        channel0.set_flush_policy(policy);
+        EXPECT_TRUE(channel0.Send(
+            NewMessage(9, IPC::Message::PRIORITY_NORMAL, "late")));
+        EXPECT_EQ(1u, channel0.pending_messages());
+        for (int j = 0; j < 200 && MessageCount(listener1) < 10; ++j)
+            loop.RunOnce(10);
+        ASSERT_EQ(10u, MessageCount(listener1));
+        ExpectMessage(*listener1.messages_[9], 9, "late");
+        EXPECT_EQ(0u, channel0.pending_messages());
+        EXPECT_EQ(0, listener0.errors_ + listener1.errors_);
+    }
+}
+
+TEST(ChannelTest, PassesFileDescriptors) {
+    const IPC::IOLoop::Backend kBackends[] = {
+        IPC::IOLoop::BACKEND_EPOLL,
+        IPC::IOLoop::BACKEND_IO_URING
+    };
+    for (size_t i = 0; i < arraysize(kBackends); ++i) {
+        IPC::IOLoop loop;
+        ASSERT_TRUE(loop.Init(kBackends[i]));
+        int fd0, fd1;
+        ASSERT_TRUE(IPC::Channel::SocketPair(&fd0, &fd1));
+        RecordingListener listener0, listener1;
+        IPC::Channel channel0(fd0, &listener0, &loop);
+        IPC::Channel channel1(fd1, &listener1, &loop);
+        channel0.set_add_checksums(true);
+        ASSERT_TRUE(channel0.Connect());
+        ASSERT_TRUE(channel1.Connect());
+
+        // A memfd takes bulk data past the socket.
+        const size_t kBulkSize = 4 * 1024 * 1024;
+        int memfd = memfd_create("bulk", MFD_CLOEXEC);
+        ASSERT_GE(memfd, 0);
+        ASSERT_EQ(0, ftruncate(memfd, kBulkSize));
+        ASSERT_EQ(4, pwrite(memfd, "bulk", 4, kBulkSize - 4));
+        int pipe_fds[2];
+        ASSERT_EQ(0, pipe(pipe_fds));
+
+        // Messages with and without descriptors, in one batch; a write
+        // carries the descriptors of one message only.
+        std::vector<IPC::Message*> batch;
+        batch.push_back(NewMessage(0, IPC::Message::PRIORITY_NORMAL, "none"));
+        batch.push_back(new IPC::Message(1, 100,
+                                         IPC::Message::PRIORITY_NORMAL));
+        IPC::WriteParam(batch.back(), 1);
+        IPC::WriteParam(batch.back(), base::FileDescriptor(memfd, true));
+        batch.push_back(new IPC::Message(1, 100,
+                                         IPC::Message::PRIORITY_NORMAL));
+        IPC::WriteParam(batch.back(), 2);
+        IPC::WriteParam(batch.back(),
+                        base::FileDescriptor(pipe_fds[1], false));
+        IPC::WriteParam(batch.back(),
+                        base::FileDescriptor(dup(pipe_fds[1]), true));
+        batch.push_back(NewMessage(3, IPC::Message::PRIORITY_NORMAL, "none"));
+        // Nobody reads this one's descriptor.
+        batch.push_back(new IPC::Message(1, 100,
+                                         IPC::Message::PRIORITY_NORMAL));
+        IPC::WriteParam(batch.back(), 4);
+        IPC::WriteParam(batch.back(),
+                        base::FileDescriptor(dup(pipe_fds[1]), true));
+        EXPECT_TRUE(channel0.SendBatch(&batch));
+        for (int j = 0; j < 200 && MessageCount(listener1) < 5; ++j)
+            loop.RunOnce(10);
+        ASSERT_EQ(5u, MessageCount(listener1));
+        EXPECT_EQ(0u, channel0.pending_messages());
+        ExpectMessage(*listener1.messages_[0], 0, "none");
+        ExpectMessage(*listener1.messages_[3], 3, "none");
+
+        // Received descriptors are new ones, for the same files.
+        const IPC::Message& bulk = *listener1.messages_[1];
+        PickleIterator iter(bulk);
+        int value;
+        base::FileDescriptor descriptor;
+        EXPECT_TRUE(IPC::ReadParam(&bulk, &iter, &value));
+        EXPECT_EQ(1, value);
+        ASSERT_TRUE(IPC::ReadParam(&bulk, &iter, &descriptor));
+        EXPECT_TRUE(descriptor.auto_close);
+        struct stat info;
+        ASSERT_EQ(0, fstat(descriptor.fd, &info));
+        EXPECT_EQ(static_cast<off_t>(kBulkSize), info.st_size);
+        char data[4];
+        EXPECT_EQ(4, pread(descriptor.fd, data, 4, kBulkSize - 4));
+        EXPECT_EQ(0, memcmp(data, "bulk", 4));
+        EXPECT_EQ(0, close(descriptor.fd));
+
+        const IPC::Message& pipes = *listener1.messages_[2];
+        iter = PickleIterator(pipes);
+        EXPECT_TRUE(IPC::ReadParam(&pipes, &iter, &value));
+        EXPECT_EQ(2, value);
+        for (int j = 0; j < 2; ++j) {
+            ASSERT_TRUE(IPC::ReadParam(&pipes, &iter, &descriptor));
+            EXPECT_EQ(1, write(descriptor.fd, "p", 1));
+            EXPECT_EQ(1, read(pipe_fds[0], data, 1));
+            EXPECT_EQ(0, close(descriptor.fd));
+        }
+
+        // The sender closed the descriptors it was told to; the unread
+        // one closes with the last copy of its message.
+        EXPECT_EQ(0, close(pipe_fds[1]));
+        EXPECT_FALSE(AtEndOfFile(pipe_fds[0]));
+        delete listener1.messages_[4];
+        listener1.messages_.pop_back();
+        EXPECT_TRUE(AtEndOfFile(pipe_fds[0]));
+        EXPECT_EQ(0, close(pipe_fds[0]));
+        EXPECT_EQ(0, listener0.errors_ + listener1.errors_);
+    }
+}
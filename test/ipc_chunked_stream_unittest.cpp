@@ -0,0 +1,197 @@
+#include <map>
+#include <string>
+#include <vector>
+#include "ipc/ipc_chunked_stream.h"
+#include "ipc/ipc_message.h"
+#include <gtest/gtest.h>
+
+namespace {
+
+// Collects the messages sent to it.
+class CollectingSender : public IPC::Message::Sender {
+public:
+    CollectingSender() : fail_(false) {}
+    ~CollectingSender() {
+        for (size_t i = 0; i < messages_.size(); ++i)
+            delete messages_[i];
+    }
+
+    virtual bool Send(IPC::Message* msg) {
+        if (fail_) {
+            delete msg;
+            return false;
+        }
+        messages_.push_back(msg);
+        return true;
+    }
+
+    std::vector<IPC::Message*> messages_;
+    bool fail_;
+};
+
+// Records what a ChunkedStreamReader delivers, per stream id.
+class RecordingDelegate : public IPC::ChunkedStreamReader::Delegate {
+public:
+    RecordingDelegate() : data_calls_(0) {}
+
+    virtual void OnStreamData(int32 routing_id, uint16 type,
+                              uint32 stream_id, const char* data,
+                              size_t size) {
+        ++data_calls_;
+        received_[stream_id].append(data, size);
+    }
+
+    virtual void OnStreamEnd(int32 routing_id, uint16 type,
+                             uint32 stream_id, std::vector<char>* data) {
+        EXPECT_EQ(7, routing_id);
+        EXPECT_EQ(42, type);
+        if (data)
+            received_[stream_id].assign(data->begin(), data->end());
+        ended_.push_back(stream_id);
+    }
+
+    int data_calls_;
+    std::map<uint32, std::string> received_;
+    std::vector<uint32> ended_;
+};
+
+std::string MakeStream(size_t size, char seed) {
+    std::string stream(size, '\0');
+    for (size_t i = 0; i < size; ++i)
+        stream[i] = static_cast<char>(seed + i * 13);
+    return stream;
+}
+
+}  // namespace
+
+TEST(ChunkedStreamTest, ChunksAndDeliversIncrementally) {
+    CollectingSender sender;
+    std::string stream = MakeStream(10000, 1);
+    IPC::ChunkedStreamWriter writer(&sender, 7, 42, 1, 1024);
+    // Small writes are gathered, large ones go out directly.
+    writer.Write(stream.data(), 100);
+    writer.Write(stream.data() + 100, 1500);
+    writer.Write(stream.data() + 1600, 5000);
+    writer.Write(stream.data() + 6600, stream.size() - 6600);
+    EXPECT_EQ(9u, sender.messages_.size());
+    EXPECT_TRUE(writer.Close());
+    EXPECT_EQ(stream.size(), writer.bytes_written());
+    ASSERT_EQ(10u, sender.messages_.size());
+    for (size_t i = 0; i < sender.messages_.size(); ++i) {
+        EXPECT_EQ(IPC_CHUNK_ID, sender.messages_[i]->type());
+        EXPECT_GT(1100u, sender.messages_[i]->payload_size());
+    }
+
+    RecordingDelegate delegate;
+    IPC::ChunkedStreamReader reader(&delegate);
+    for (size_t i = 0; i < sender.messages_.size(); ++i) {
+        EXPECT_TRUE(reader.OnMessageReceived(*sender.messages_[i]));
+        EXPECT_EQ(i + 1 < sender.messages_.size() ? 1u : 0u,
+                  reader.open_streams());
+    }
+    EXPECT_EQ(stream, delegate.received_[1]);
+    EXPECT_EQ(10, delegate.data_calls_);
+    ASSERT_EQ(1u, delegate.ended_.size());
+}
+
+TEST(ChunkedStreamTest, ReassemblesInterleavedStreams) {
+    CollectingSender sender;
+    std::string first = MakeStream(5000, 2);
+    std::string second = MakeStream(3000, 3);
+    IPC::ChunkedStreamWriter writer1(&sender, 7, 42, 1, 512);
+    IPC::ChunkedStreamWriter writer2(&sender, 7, 42, 2, 512);
+    for (size_t i = 0; i < 5000; i += 250) {
+        writer1.Write(first.data() + i, 250);
+        if (i < 3000)
+            writer2.Write(second.data() + i, 250);
+    }
+    writer2.Close();
+    writer1.Close();
+
+    RecordingDelegate delegate;
+    IPC::ChunkedStreamReader reader(&delegate, 1 << 20);
+    for (size_t i = 0; i < sender.messages_.size(); ++i)
+        EXPECT_TRUE(reader.OnMessageReceived(*sender.messages_[i]));
+    EXPECT_EQ(0, delegate.data_calls_);
+    ASSERT_EQ(2u, delegate.ended_.size());
+    EXPECT_EQ(2u, delegate.ended_[0]);
+    EXPECT_EQ(first, delegate.received_[1]);
+    EXPECT_EQ(second, delegate.received_[2]);
+}
+
+TEST(ChunkedStreamTest, RejectsBrokenStreams) {
+    CollectingSender sender;
+    std::string stream = MakeStream(4000, 4);
+    IPC::ChunkedStreamWriter writer(&sender, 7, 42, 1, 1000);
+    writer.Write(stream.data(), stream.size());
+    writer.Close();
+    ASSERT_EQ(5u, sender.messages_.size());
+
+    RecordingDelegate delegate;
+    {
+        // A chunk missing in the middle.
+        IPC::ChunkedStreamReader reader(&delegate);
+        EXPECT_TRUE(reader.OnMessageReceived(*sender.messages_[0]));
+        EXPECT_FALSE(reader.OnMessageReceived(*sender.messages_[2]));
+        EXPECT_EQ(0u, reader.open_streams());
+        // Nor can the stream be picked up later.
+        EXPECT_FALSE(reader.OnMessageReceived(*sender.messages_[3]));
+    }
+    {
+        // Too large to reassemble.
+        IPC::ChunkedStreamReader reader(&delegate, 2500);
+        EXPECT_TRUE(reader.OnMessageReceived(*sender.messages_[0]));
+        EXPECT_TRUE(reader.OnMessageReceived(*sender.messages_[1]));
+        EXPECT_FALSE(reader.OnMessageReceived(*sender.messages_[2]));
+        EXPECT_EQ(0u, reader.open_streams());
+    }
+    {
+        IPC::ChunkedStreamReader reader(&delegate);
+        IPC::Message garbage(7, IPC_CHUNK_ID, IPC::Message::PRIORITY_NORMAL);
+        garbage.WriteInt(1);
+        EXPECT_FALSE(reader.OnMessageReceived(garbage));
+    }
+    EXPECT_TRUE(delegate.ended_.empty());
+
+    // A writer stops once sending fails.
+    sender.fail_ = true;
+    IPC::ChunkedStreamWriter failing(&sender, 7, 42, 2, 1000);
+    EXPECT_FALSE(failing.Write(stream.data(), stream.size()));
+    EXPECT_FALSE(failing.Close());
+}
+
+TEST(ChunkedStreamTest, LimitsOpenStreams) {
+    CollectingSender sender;
+    std::string stream = MakeStream(2000, 5);
+    for (uint32 id = 1; id <= 3; ++id) {
+        IPC::ChunkedStreamWriter writer(&sender, 7, 42, id, 1000);
+        writer.Write(stream.data(), stream.size());
+        writer.Close();
+    }
+    ASSERT_EQ(9u, sender.messages_.size());
+
+    RecordingDelegate delegate;
+    IPC::ChunkedStreamReader reader(&delegate, 1 << 20, 2);
+    // Streams 1 and 2 open; a third is refused while they are.
+    EXPECT_TRUE(reader.OnMessageReceived(*sender.messages_[0]));
+    EXPECT_TRUE(reader.OnMessageReceived(*sender.messages_[3]));
+    EXPECT_FALSE(reader.OnMessageReceived(*sender.messages_[6]));
+    EXPECT_EQ(2u, reader.open_streams());
+
+    // Once one ends there is room again.
+    EXPECT_TRUE(reader.OnMessageReceived(*sender.messages_[1]));
+    EXPECT_TRUE(reader.OnMessageReceived(*sender.messages_[2]));
+    EXPECT_EQ(1u, reader.open_streams());
+    EXPECT_TRUE(reader.OnMessageReceived(*sender.messages_[6]));
+    EXPECT_EQ(2u, reader.open_streams());
+
+    // A stream that ends with its first chunk is never held open.
+    IPC::ChunkedStreamWriter single(&sender, 7, 42, 4, 1000);
+    single.Write(stream.data(), 10);
+    single.Close();
+    EXPECT_TRUE(reader.OnMessageReceived(*sender.messages_.back()));
+    EXPECT_EQ(2u, reader.open_streams());
+    ASSERT_EQ(2u, delegate.ended_.size());
+    EXPECT_EQ(stream, delegate.received_[1]);
+    EXPECT_EQ(std::string(stream.data(), 10), delegate.received_[4]);
+}
@@ -0,0 +1,155 @@
+#include <string>
+#include "ipc/ipc_message.h"
+#include "ipc/ipc_message_batch.h"
+#include "ipc/ipc_message_reader.h"
+#include <gtest/gtest.h>
+
+namespace {
+
+IPC::Message MakeMessage(int value, bool compact) {
+    IPC::Message msg(value, 7, IPC::Message::PRIORITY_NORMAL);
+    if (compact)
+        msg.set_compact();
+    EXPECT_TRUE(msg.WriteInt(value));
+    EXPECT_TRUE(msg.WriteString(std::string(value % 5, 'x')));
+    return msg;
+}
+
+// Reads inner message |index| of |reader| and checks that it is
+// MakeMessage(index, ...).
+void ExpectMessage(const IPC::MessageBatch::Reader& reader, size_t index) {
+    const char* data;
+    int size;
+    ASSERT_TRUE(reader.GetMessageData(index, &data, &size));
+    IPC::Message msg(data, size);
+    EXPECT_EQ(static_cast<int32>(index), msg.routing_id());
+    EXPECT_EQ(7, msg.type());
+    PickleIterator iter(msg);
+    int value;
+    std::string str;
+    EXPECT_TRUE(msg.ReadInt(&iter, &value));
+    EXPECT_TRUE(msg.ReadString(&iter, &str));
+    EXPECT_EQ(static_cast<int>(index), value);
+    EXPECT_EQ(std::string(index % 5, 'x'), str);
+}
+
+}  // namespace
+
+TEST(MessageBatchTest, RandomAccess) {
+    IPC::MessageBatch batch;
+    for (int i = 0; i < 500; ++i)
+        batch.AddMessage(MakeMessage(i, i % 3 == 0));
+    EXPECT_EQ(500u, batch.message_count());
+    batch.Finish();
+    EXPECT_EQ(IPC_BATCH_ID, batch.type());
+    EXPECT_FALSE(batch.is_compact());
+
+    // The batch goes over the wire as one frame.
+    IPC::MessageReader stream;
+    stream.Append(static_cast<const char*>(batch.data()), batch.size());
+    const char* data;
+    int size;
+    ASSERT_EQ(IPC::MessageReader::MESSAGE_READY,
+              stream.ReadMessage(&data, &size));
+    IPC::Message received(data, size);
+
+    IPC::MessageBatch::Reader reader;
+    ASSERT_TRUE(reader.Init(received));
+    ASSERT_EQ(500u, reader.size());
+    ExpectMessage(reader, 499);
+    ExpectMessage(reader, 0);
+    ExpectMessage(reader, 250);
+    for (size_t i = 0; i < reader.size(); ++i)
+        ExpectMessage(reader, i);
+    EXPECT_FALSE(reader.GetMessageData(500, &data, &size));
+}
+
+TEST(MessageBatchTest, EmptyBatch) {
+    IPC::MessageBatch batch;
+    batch.Finish();
+    IPC::MessageBatch::Reader reader;
+    ASSERT_TRUE(reader.Init(batch));
+    EXPECT_EQ(0u, reader.size());
+}
+
+TEST(MessageBatchTest, CompactByDefault) {
+    IPC::Message::SetCompactByDefault(true);
+    IPC::MessageBatch batch;
+    IPC::Message::SetCompactByDefault(false);
+    EXPECT_FALSE(batch.is_compact());
+    batch.AddMessage(MakeMessage(0, true));
+    batch.Finish();
+    IPC::MessageBatch::Reader reader;
+    ASSERT_TRUE(reader.Init(batch));
+    ExpectMessage(reader, 0);
+}
+
+TEST(MessageBatchTest, RejectsMalformedBatches) {
+    IPC::MessageBatch::Reader reader;
+
+    // No table at all.
+    IPC::Message empty(1, IPC_BATCH_ID, IPC::Message::PRIORITY_NORMAL);
+    EXPECT_FALSE(reader.Init(empty));
+
+    // A count larger than the payload.
+    IPC::Message too_many(1, IPC_BATCH_ID, IPC::Message::PRIORITY_NORMAL);
+    too_many.WriteUInt32(0);
+    too_many.WriteUInt32(2);
+    EXPECT_FALSE(reader.Init(too_many));
+
+    // Offsets that point past the messages or are misaligned.
+    IPC::Message message = MakeMessage(1, false);
+    static const uint32 kBadOffsets[] = { 2, 4, 0xFFFFFFF0 };
+    for (size_t i = 0; i < arraysize(kBadOffsets); ++i) {
+        IPC::Message bad(1, IPC_BATCH_ID, IPC::Message::PRIORITY_NORMAL);
+        bad.WriteBytes(message.data(), static_cast<int>(message.size()));
+        bad.WriteUInt32(kBadOffsets[i]);
+        bad.WriteUInt32(1);
+        ASSERT_TRUE(reader.Init(bad));
+        const char* data;
+        int size;
+        EXPECT_FALSE(reader.GetMessageData(0, &data, &size));
+    }
+
+    // A message whose header claims more than its slot.
+    IPC::MessageBatch batch;
+    batch.AddMessage(message);
+    batch.AddMessage(message);
+    batch.Finish();
+    std::string bytes(static_cast<const char*>(batch.data()), batch.size());
+    IPC::Message original(bytes.data(), static_cast<int>(bytes.size()));
+    size_t first_message = bytes.size() - original.payload_size();
+    bytes[first_message] += 4;
+    IPC::Message corrupt(bytes.data(), static_cast<int>(bytes.size()));
+    ASSERT_TRUE(reader.Init(corrupt));
+    const char* data;
+    int size;
+    EXPECT_FALSE(reader.GetMessageData(0, &data, &size));
+    EXPECT_TRUE(reader.GetMessageData(1, &data, &size));
+}
+
+TEST(MessageBatchTest, ChecksummedInnerMessages) {
+    IPC::MessageBatch batch;
+    for (int i = 0; i < 3; ++i) {
+        IPC::Message msg = MakeMessage(i, i == 1);
+        msg.AddChecksum();
+        batch.AddMessage(msg);
+    }
+    batch.Finish();
+
+    std::string copy(static_cast<const char*>(batch.data()), batch.size());
+    IPC::Message received(copy.data(), static_cast<int>(copy.size()));
+    IPC::MessageBatch::Reader reader;
+    ASSERT_TRUE(reader.Init(received));
+    ExpectMessage(reader, 0);
+    ExpectMessage(reader, 1);
+    ExpectMessage(reader, 2);
+
+    // Flip a bit inside the second inner message.
+    const char* data;
+    int size;
+    ASSERT_TRUE(reader.GetMessageData(1, &data, &size));
+    const_cast<char*>(data)[size / 2] ^= 0x01;
+    EXPECT_FALSE(reader.GetMessageData(1, &data, &size));
+    ExpectMessage(reader, 2);
+}
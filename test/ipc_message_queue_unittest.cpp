@@ -0,0 +1,103 @@
+#include "ipc/ipc_message.h"
+#include "ipc/ipc_message_queue.h"
+#include <gtest/gtest.h>
+
+namespace {
+
+IPC::Message* NewMessage(int id, IPC::Message::PriorityValue priority) {
+    return new IPC::Message(id, 1, priority);
+}
+
+// Pops the next message and returns its routing id, or -1.
+int PopId(IPC::MessageQueue* queue) {
+    IPC::Message* message = queue->Pop();
+    if (!message)
+        return -1;
+    int id = message->routing_id();
+    delete message;
+    return id;
+}
+
+}  // namespace
+
+TEST(MessageQueueTest, HighestPriorityFirst) {
+    IPC::MessageQueue queue;
+    queue.Push(NewMessage(1, IPC::Message::PRIORITY_LOW));
+    queue.Push(NewMessage(2, IPC::Message::PRIORITY_NORMAL));
+    queue.Push(NewMessage(3, IPC::Message::PRIORITY_HIGH));
+    queue.Push(NewMessage(4, IPC::Message::PRIORITY_HIGH));
+    queue.Push(new IPC::Message());  // No priority; counts as normal.
+    EXPECT_EQ(5u, queue.size());
+    EXPECT_EQ(2u, queue.stats(IPC::Message::PRIORITY_NORMAL).depth);
+
+    EXPECT_EQ(3, PopId(&queue));
+    EXPECT_EQ(4, PopId(&queue));
+    EXPECT_EQ(2, PopId(&queue));
+    EXPECT_EQ(0, PopId(&queue));
+    EXPECT_EQ(1, PopId(&queue));
+    EXPECT_EQ(-1, PopId(&queue));
+    EXPECT_TRUE(queue.empty());
+
+    const IPC::MessageQueue::Stats& high =
+        queue.stats(IPC::Message::PRIORITY_HIGH);
+    EXPECT_EQ(0u, high.depth);
+    EXPECT_EQ(2u, high.max_depth);
+    EXPECT_EQ(2u, high.pushed);
+    EXPECT_EQ(2u, high.popped);
+}
+
+TEST(MessageQueueTest, BoundedStarvation) {
+    IPC::MessageQueue queue(3);
+    queue.Push(NewMessage(100, IPC::Message::PRIORITY_LOW));
+    for (int i = 0; i < 10; ++i)
+        queue.Push(NewMessage(i, IPC::Message::PRIORITY_HIGH));
+
+    EXPECT_EQ(0, PopId(&queue));
+    EXPECT_EQ(1, PopId(&queue));
+    EXPECT_EQ(2, PopId(&queue));
+    // Passed over three times; its turn now.
+    EXPECT_EQ(100, PopId(&queue));
+    EXPECT_EQ(3, PopId(&queue));
+    EXPECT_EQ(1u, queue.stats(IPC::Message::PRIORITY_LOW).promoted);
+    EXPECT_EQ(0u, queue.stats(IPC::Message::PRIORITY_HIGH).promoted);
+}
+
+TEST(MessageQueueTest, SetPriority) {
+    IPC::Message* message = NewMessage(1, IPC::Message::PRIORITY_NORMAL);
+    message->set_compact();
+    message->set_priority(IPC::Message::PRIORITY_HIGH);
+    EXPECT_EQ(IPC::Message::PRIORITY_HIGH, message->priority());
+    EXPECT_TRUE(message->is_compact());
+
+    IPC::MessageQueue queue;
+    queue.Push(NewMessage(2, IPC::Message::PRIORITY_NORMAL));
+    queue.Push(message);
+    EXPECT_EQ(1, PopId(&queue));
+}
+
+TEST(MessageQueueTest, DropsExpiredAsyncMessages) {
+    int64 past = IPC::Message::DeadlineClockNow() - 1;
+    IPC::MessageQueue queue;
+
+    IPC::Message* expired = NewMessage(1, IPC::Message::PRIORITY_HIGH);
+    expired->set_deadline(past);
+    queue.Push(expired);
+
+    IPC::Message* expired_sync = NewMessage(2, IPC::Message::PRIORITY_HIGH);
+    expired_sync->set_sync();
+    expired_sync->set_deadline(past);
+    queue.Push(expired_sync);
+
+    queue.Push(NewMessage(3, IPC::Message::PRIORITY_LOW));
+
+    // The synchronous one is left for the dispatcher to answer.
+    EXPECT_EQ(2, PopId(&queue));
+    EXPECT_EQ(3, PopId(&queue));
+    EXPECT_EQ(1u, queue.stats(IPC::Message::PRIORITY_HIGH).expired);
+
+    // Clear() deletes what is left.
+    queue.Push(NewMessage(4, IPC::Message::PRIORITY_LOW));
+    queue.Clear();
+    EXPECT_TRUE(queue.empty());
+    EXPECT_EQ(0u, queue.stats(IPC::Message::PRIORITY_LOW).depth);
+}
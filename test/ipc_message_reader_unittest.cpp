@@ -0,0 +1,364 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "ipc/ipc_message.h"
+#include "ipc/ipc_message_reader.h"
+#include <gtest/gtest.h>
+
+namespace {
+
+// Appends the serialized form of a message carrying |value| and |str|.
+void AppendMessage(int value, const std::string& str, bool compact,
+                   std::string* stream) {
+    IPC::Message msg(1, 2, IPC::Message::PRIORITY_NORMAL);
+    if (compact)
+        msg.set_compact();
+    EXPECT_TRUE(msg.WriteInt(value));
+    EXPECT_TRUE(msg.WriteString(str));
+    stream->append(static_cast<const char*>(msg.data()), msg.size());
+}
+
+// Reads every complete message out of |reader| into |values| and |strs|.
+void ReadMessages(IPC::MessageReader* reader, std::vector<int>* values,
+                  std::vector<std::string>* strs) {
+    const char* data;
+    int size;
+    while (reader->ReadMessage(&data, &size) ==
+           IPC::MessageReader::MESSAGE_READY) {
+        EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(data) % sizeof(uint32));
+        IPC::Message msg(data, size);
+        PickleIterator iter(msg);
+        int value;
+        std::string str;
+        EXPECT_TRUE(msg.ReadInt(&iter, &value));
+        EXPECT_TRUE(msg.ReadString(&iter, &str));
+        values->push_back(value);
+        strs->push_back(str);
+    }
+}
+
+}  // namespace
+
+TEST(MessageReaderTest, SplitAnywhere) {
+    std::string stream;
+    AppendMessage(1, "one", false, &stream);
+    AppendMessage(2, std::string(10000, 'x'), false, &stream);
+    AppendMessage(3, "three", true, &stream);
+    AppendMessage(4, "four", false, &stream);
+
+    static const size_t kChunkSizes[] = { 1, 3, 7, 64, 5000, 100000 };
+    for (size_t i = 0; i < arraysize(kChunkSizes); ++i) {
+        IPC::MessageReader reader;
+        std::vector<int> values;
+        std::vector<std::string> strs;
+        for (size_t offset = 0; offset < stream.size();
+             offset += kChunkSizes[i]) {
+            size_t size = std::min(kChunkSizes[i], stream.size() - offset);
+            reader.Append(stream.data() + offset, size);
+            ReadMessages(&reader, &values, &strs);
+        }
+        ASSERT_EQ(4u, values.size());
+        EXPECT_EQ(1, values[0]);
+        EXPECT_EQ(std::string(10000, 'x'), strs[1]);
+        EXPECT_EQ("three", strs[2]);
+        EXPECT_EQ(4, values[3]);
+        EXPECT_EQ(0u, reader.pending_bytes());
+    }
+}
+
+TEST(MessageReaderTest, ReadsInPlace) {
+    std::string stream;
+    AppendMessage(1, "one", false, &stream);
+    AppendMessage(2, "two", false, &stream);
+
+    IPC::MessageReader reader;
+    size_t size;
+    char* buffer = reader.GetWriteBuffer(&size);
+    ASSERT_LE(stream.size(), size);
+    memcpy(buffer, stream.data(), stream.size());
+    reader.DidWrite(stream.size());
+
+    const char* data;
+    int data_size;
+    ASSERT_EQ(IPC::MessageReader::MESSAGE_READY,
+              reader.ReadMessage(&data, &data_size));
+    EXPECT_EQ(buffer, data);
+    ASSERT_EQ(IPC::MessageReader::MESSAGE_READY,
+              reader.ReadMessage(&data, &data_size));
+    EXPECT_EQ(buffer + data_size, data);
+    EXPECT_EQ(IPC::MessageReader::NEED_MORE_DATA,
+              reader.ReadMessage(&data, &data_size));
+}
+
+TEST(MessageReaderTest, KeepsUnalignedMessagesHandedOut) {
+    // Two 17-byte compact messages: the second starts unaligned.
+    std::string stream;
+    IPC::Message first(1, 10, IPC::Message::PRIORITY_NORMAL);
+    first.set_compact();
+    EXPECT_TRUE(first.WriteInt(1));
+    IPC::Message second(1, 20, IPC::Message::PRIORITY_NORMAL);
+    second.set_compact();
+    EXPECT_TRUE(second.WriteInt(2));
+    ASSERT_EQ(17u, first.size());
+    ASSERT_EQ(17u, second.size());
+    stream.append(static_cast<const char*>(first.data()), first.size());
+    stream.append(static_cast<const char*>(second.data()), second.size());
+
+    for (int borrow = 0; borrow < 2; ++borrow) {
+        IPC::MessageReader reader;
+        std::vector<char> chunk(stream.begin(), stream.end());
+        if (borrow)
+            reader.Borrow(&chunk[0], chunk.size());
+        else
+            reader.Append(&chunk[0], chunk.size());
+
+        const char* data1;
+        int size1;
+        const char* data2;
+        int size2;
+        ASSERT_EQ(IPC::MessageReader::MESSAGE_READY,
+                  reader.ReadMessage(&data1, &size1));
+        ASSERT_EQ(IPC::MessageReader::MESSAGE_READY,
+                  reader.ReadMessage(&data2, &size2));
+        EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(data2) % sizeof(uint32));
+        EXPECT_EQ(IPC::MessageReader::NEED_MORE_DATA,
+                  reader.ReadMessage(&data2, &size2));
+
+        // Both messages are still intact.
+        IPC::Message msg1(data1, size1);
+        IPC::Message msg2(data2, size2);
+        EXPECT_EQ(10u, msg1.type());
+        EXPECT_EQ(20u, msg2.type());
+        PickleIterator iter1(msg1);
+        PickleIterator iter2(msg2);
+        int value;
+        EXPECT_TRUE(msg1.ReadInt(&iter1, &value));
+        EXPECT_EQ(1, value);
+        EXPECT_TRUE(msg2.ReadInt(&iter2, &value));
+        EXPECT_EQ(2, value);
+    }
+}
+
+TEST(MessageReaderTest, BorrowsWholeMessages) {
+    std::string stream;
+    AppendMessage(1, "one", false, &stream);
+    AppendMessage(2, std::string(10000, 'x'), false, &stream);
+    AppendMessage(3, "three", true, &stream);
+    AppendMessage(4, "four", false, &stream);
+    AppendMessage(5, "five", false, &stream);
+
+    static const size_t kChunkSizes[] = { 1, 3, 7, 64, 5000, 100000 };
+    for (size_t i = 0; i < arraysize(kChunkSizes); ++i) {
+        IPC::MessageReader reader;
+        std::vector<int> values;
+        std::vector<std::string> strs;
+        for (size_t offset = 0; offset < stream.size();
+             offset += kChunkSizes[i]) {
+            // Each chunk is only valid until the next.
+            size_t size = std::min(kChunkSizes[i], stream.size() - offset);
+            std::vector<char> chunk(stream.begin() + offset,
+                                    stream.begin() + offset + size);
+            reader.Borrow(&chunk[0], size);
+            ReadMessages(&reader, &values, &strs);
+            std::fill(chunk.begin(), chunk.end(), '?');
+        }
+        ASSERT_EQ(5u, values.size());
+        EXPECT_EQ(1, values[0]);
+        EXPECT_EQ(std::string(10000, 'x'), strs[1]);
+        EXPECT_EQ("three", strs[2]);
+        EXPECT_EQ(4, values[3]);
+        EXPECT_EQ("five", strs[4]);
+        EXPECT_EQ(0u, reader.pending_bytes());
+    }
+
+    // Whole messages are handed out of the borrowed bytes themselves.
+    std::string two;
+    AppendMessage(1, "one", false, &two);
+    AppendMessage(2, "two", false, &two);
+    std::vector<char> chunk(two.begin(), two.end());
+    IPC::MessageReader reader;
+    reader.Borrow(&chunk[0], chunk.size());
+    const char* data;
+    int data_size;
+    ASSERT_EQ(IPC::MessageReader::MESSAGE_READY,
+              reader.ReadMessage(&data, &data_size));
+    EXPECT_EQ(&chunk[0], data);
+    ASSERT_EQ(IPC::MessageReader::MESSAGE_READY,
+              reader.ReadMessage(&data, &data_size));
+    EXPECT_EQ(&chunk[0] + data_size, data);
+    EXPECT_EQ(IPC::MessageReader::NEED_MORE_DATA,
+              reader.ReadMessage(&data, &data_size));
+}
+
+TEST(MessageReaderTest, MakesRoomForKnownSize) {
+    std::string stream;
+    AppendMessage(1, std::string(100000, 'x'), false, &stream);
+
+    IPC::MessageReader reader;
+    reader.Append(stream.data(), 16);
+    size_t size;
+    reader.GetWriteBuffer(&size);
+    EXPECT_LE(stream.size() - 16, size);
+}
+
+TEST(MessageReaderTest, RejectsOversizedMessages) {
+    std::string stream;
+    AppendMessage(1, "small", false, &stream);
+    AppendMessage(2, std::string(1000, 'x'), false, &stream);
+
+    IPC::MessageReader reader(256);
+    std::vector<int> values;
+    std::vector<std::string> strs;
+    // Only the header of the large message has to arrive.
+    reader.Append(stream.data(), stream.size() - 1000);
+    ReadMessages(&reader, &values, &strs);
+    EXPECT_EQ(1u, values.size());
+
+    const char* data;
+    int size;
+    EXPECT_EQ(IPC::MessageReader::MESSAGE_TOO_LARGE,
+              reader.ReadMessage(&data, &size));
+    reader.Append(stream.data() + stream.size() - 1000, 1000);
+    EXPECT_EQ(IPC::MessageReader::MESSAGE_TOO_LARGE,
+              reader.ReadMessage(&data, &size));
+}
+
+TEST(MessageReaderTest, VerifiesChecksums) {
+    IPC::Message msg(1, 2, IPC::Message::PRIORITY_NORMAL);
+    EXPECT_TRUE(msg.WriteInt(7));
+    EXPECT_TRUE(msg.WriteString("checked"));
+    msg.set_deadline(1234);
+    msg.AddChecksum();
+    EXPECT_TRUE(msg.has_checksum());
+    EXPECT_TRUE(msg.VerifyChecksum());
+    EXPECT_EQ(1234, msg.deadline());
+
+    std::string stream(static_cast<const char*>(msg.data()), msg.size());
+    std::string corrupt = stream;
+    corrupt[corrupt.size() / 2] ^= 0x10;
+    stream += corrupt;
+    AppendMessage(3, "unchecked", true, &stream);
+
+    IPC::MessageReader reader;
+    reader.Append(stream.data(), stream.size());
+    const char* data;
+    int size;
+    ASSERT_EQ(IPC::MessageReader::MESSAGE_READY,
+              reader.ReadMessage(&data, &size));
+    IPC::Message received(data, size);
+    PickleIterator iter(received);
+    int value;
+    std::string str;
+    EXPECT_TRUE(received.ReadInt(&iter, &value));
+    EXPECT_TRUE(received.ReadString(&iter, &str));
+    EXPECT_EQ(7, value);
+    EXPECT_EQ("checked", str);
+    EXPECT_EQ(1234, received.deadline());
+
+    // The corrupt copy is skipped, and reading goes on after it.
+    EXPECT_EQ(IPC::MessageReader::CHECKSUM_MISMATCH,
+              reader.ReadMessage(&data, &size));
+    std::vector<int> values;
+    std::vector<std::string> strs;
+    ReadMessages(&reader, &values, &strs);
+    ASSERT_EQ(1u, values.size());
+    EXPECT_EQ(3, values[0]);
+}
+
+TEST(MessageReaderTest, RejectsMissingTrailers) {
+    // A header that announces a deadline the payload cannot hold.
+    IPC::Message msg(1, 2, IPC::Message::PRIORITY_NORMAL);
+    msg.set_deadline(1234);
+    size_t header_size = msg.size() - msg.payload_size();
+    std::string stream(static_cast<const char*>(msg.data()), msg.size());
+    uint32 payload_size = 4;
+    memcpy(&stream[0], &payload_size, sizeof(payload_size));
+    stream.resize(header_size + payload_size);
+    AppendMessage(3, "after", false, &stream);
+
+    for (int borrow = 0; borrow < 2; ++borrow) {
+        IPC::MessageReader reader;
+        std::vector<char> chunk(stream.begin(), stream.end());
+        if (borrow)
+            reader.Borrow(&chunk[0], chunk.size());
+        else
+            reader.Append(&chunk[0], chunk.size());
+        const char* data;
+        int size;
+        EXPECT_EQ(IPC::MessageReader::MALFORMED_MESSAGE,
+                  reader.ReadMessage(&data, &size));
+
+        // The malformed message is skipped, and reading goes on after it.
+        std::vector<int> values;
+        std::vector<std::string> strs;
+        ReadMessages(&reader, &values, &strs);
+        ASSERT_EQ(1u, values.size());
+        EXPECT_EQ(3, values[0]);
+    }
+}
+
+TEST(MessageReaderTest, CompressedMessages) {
+    std::string blob;
+    for (int i = 0; blob.size() < 200000; ++i)
+        blob += "key=value;" + std::string(i % 3, '#');
+
+    IPC::Message msg(1, 2, IPC::Message::PRIORITY_HIGH);
+    EXPECT_TRUE(msg.WriteInt(5));
+    EXPECT_TRUE(msg.WriteData(blob.data(), static_cast<int>(blob.size())));
+    msg.set_deadline(99);
+    size_t raw_size = msg.size();
+    EXPECT_FALSE(msg.Compress(raw_size));
+    EXPECT_TRUE(msg.Compress());
+    EXPECT_TRUE(msg.is_compressed());
+    EXPECT_GT(raw_size / 4, msg.size());
+    EXPECT_EQ(99, msg.deadline());
+    EXPECT_EQ(IPC::Message::PRIORITY_HIGH, msg.priority());
+    msg.AddChecksum();
+
+    // Small and incompressible payloads are sent as they are.
+    IPC::Message small(1, 2, IPC::Message::PRIORITY_NORMAL);
+    EXPECT_TRUE(small.WriteInt(6));
+    EXPECT_FALSE(small.Compress());
+    EXPECT_FALSE(small.Compress(0));
+
+    std::string stream(static_cast<const char*>(msg.data()), msg.size());
+    stream.append(static_cast<const char*>(small.data()), small.size());
+    IPC::MessageReader reader;
+    reader.Append(stream.data(), stream.size());
+    const char* data;
+    int size;
+    ASSERT_EQ(IPC::MessageReader::MESSAGE_READY,
+              reader.ReadMessage(&data, &size));
+
+    IPC::Message received(data, size);
+    ASSERT_TRUE(received.is_compressed());
+    ASSERT_TRUE(received.Decompress());
+    EXPECT_FALSE(received.is_compressed());
+    EXPECT_FALSE(received.has_checksum());
+    EXPECT_EQ(raw_size, received.size());
+    EXPECT_EQ(99, received.deadline());
+    PickleIterator iter(received);
+    int value;
+    const char* blob_data;
+    int blob_size;
+    EXPECT_TRUE(received.ReadInt(&iter, &value));
+    EXPECT_EQ(5, value);
+    ASSERT_TRUE(received.ReadData(&iter, &blob_data, &blob_size));
+    EXPECT_EQ(blob, std::string(blob_data, blob_size));
+
+    // Truncated compressed data is refused.
+    std::string truncated(data, size);
+    reinterpret_cast<uint32*>(&truncated[0])[0] -= 4;
+    IPC::Message shorter(truncated.data(),
+                         static_cast<int>(truncated.size() - 4));
+    EXPECT_FALSE(shorter.Decompress());
+    EXPECT_TRUE(shorter.is_compressed());
+
+    ASSERT_EQ(IPC::MessageReader::MESSAGE_READY,
+              reader.ReadMessage(&data, &size));
+    IPC::Message plain(data, size);
+    EXPECT_TRUE(plain.Decompress());
+    PickleIterator plain_iter(plain);
+    EXPECT_TRUE(plain.ReadInt(&plain_iter, &value));
+    EXPECT_EQ(6, value);
+}
@@ -0,0 +1,221 @@
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "ipc/ipc_channel.h"
+#include "ipc/ipc_message.h"
+#include "ipc/ipc_shared_ring.h"
+#include <gtest/gtest.h>
+
+namespace {
+
+// Keeps a copy of every message it receives.
+class RecordingListener : public IPC::Channel::Listener {
+public:
+    virtual ~RecordingListener() {
+        for (size_t i = 0; i < messages_.size(); ++i)
+            delete messages_[i];
+    }
+
+    virtual bool OnMessageReceived(const IPC::Message& message) {
+        messages_.push_back(new IPC::Message(message));
+        return true;
+    }
+
+    std::vector<IPC::Message*> messages_;
+};
+
+void ExpectMessage(const IPC::Message& message, int value,
+                   const std::string& str) {
+    PickleIterator iter(message);
+    int read_value;
+    std::string read_str;
+    EXPECT_TRUE(message.ReadInt(&iter, &read_value));
+    EXPECT_TRUE(message.ReadString(&iter, &read_str));
+    EXPECT_EQ(value, read_value);
+    EXPECT_TRUE(str == read_str);
+}
+
+// Writes |count| messages numbered from zero, waiting for space as needed.
+struct ProducerParams {
+    IPC::SharedRing* ring;
+    int count;
+};
+
+void* RunProducer(void* param) {
+    ProducerParams* params = static_cast<ProducerParams*>(param);
+    for (int i = 0; i < params->count; ++i) {
+        std::string filler((i % 97) * 8, static_cast<char>(i));
+        size_t payload_size = sizeof(int) + filler.size();
+        IPC::Message* message = NULL;
+        while (!(message = params->ring->BeginMessage(
+                     1, 2, IPC::Message::PRIORITY_NORMAL, payload_size))) {
+            if (!params->ring->WaitForSpace(payload_size, 5000))
+                return NULL;
+        }
+        message->WriteInt(i);
+        message->WriteBytes(filler.data(), static_cast<int>(filler.size()));
+        if (!params->ring->CommitMessage())
+            return NULL;
+    }
+    return NULL;
+}
+
+}  // namespace
+
+TEST(SharedRingTest, BuildsMessagesInPlace) {
+    IPC::SharedRing* ring = IPC::SharedRing::Create(5000);
+    ASSERT_TRUE(ring != NULL);
+    EXPECT_EQ(8192u, ring->capacity());
+
+    IPC::Message* message = ring->BeginMessage(
+        7, 100, IPC::Message::PRIORITY_HIGH, 64);
+    ASSERT_TRUE(message != NULL);
+    message->WriteInt(1);
+    message->WriteString("in place");
+    const void* slot = message->data();
+    EXPECT_TRUE(ring->CommitMessage());
+
+    IPC::Message copied(2, 100, IPC::Message::PRIORITY_NORMAL);
+    copied.WriteInt(2);
+    copied.WriteString("copied");
+    EXPECT_TRUE(ring->WriteMessage(copied));
+
+    // The consumer reads the message where the producer wrote it.
+    const char* data;
+    int size;
+    ASSERT_TRUE(ring->PeekMessage(&data, &size));
+    EXPECT_EQ(slot, data);
+    IPC::Message read(data, size);
+    EXPECT_EQ(7, read.routing_id());
+    EXPECT_EQ(100u, read.type());
+    EXPECT_EQ(IPC::Message::PRIORITY_HIGH, read.priority());
+    ExpectMessage(read, 1, "in place");
+    ring->PopMessage();
+
+    RecordingListener listener;
+    EXPECT_EQ(1u, ring->DispatchMessages(&listener, 10));
+    ASSERT_EQ(1u, listener.messages_.size());
+    ExpectMessage(*listener.messages_[0], 2, "copied");
+    EXPECT_FALSE(ring->PeekMessage(&data, &size));
+    EXPECT_FALSE(ring->is_broken());
+    delete ring;
+}
+
+TEST(SharedRingTest, WrapsAndOutgrowsSlots) {
+    IPC::SharedRing* producer = IPC::SharedRing::Create(4096);
+    ASSERT_TRUE(producer != NULL);
+    // The other side maps the same memory through its own descriptor.
+    IPC::SharedRing* consumer = IPC::SharedRing::Open(dup(producer->fd()));
+    ASSERT_TRUE(consumer != NULL);
+    EXPECT_EQ(4096u, consumer->capacity());
+
+    // Too big for the ring at all.
+    EXPECT_TRUE(producer->BeginMessage(
+        1, 1, IPC::Message::PRIORITY_NORMAL, 8192) == NULL);
+    EXPECT_FALSE(producer->WaitForSpace(8192, 0));
+
+    // Messages that do not divide the ring evenly wrap around it many times.
+    std::string payload(1000, 'w');
+    RecordingListener listener;
+    for (int i = 0; i < 20; ++i) {
+        IPC::Message message(1, 1, IPC::Message::PRIORITY_NORMAL);
+        message.WriteInt(i);
+        message.WriteString(payload);
+        EXPECT_TRUE(producer->WriteMessage(message));
+        EXPECT_TRUE(producer->WriteMessage(message));
+        // Full until the consumer catches up.
+        while (producer->WriteMessage(message)) {
+        }
+        EXPECT_FALSE(producer->WaitForSpace(message.payload_size(), 0));
+        EXPECT_LE(2u, consumer->DispatchMessages(&listener, 100));
+        EXPECT_TRUE(producer->WaitForSpace(message.payload_size(), 0));
+    }
+    ASSERT_LE(40u, listener.messages_.size());
+    for (size_t i = 1; i < listener.messages_.size(); ++i) {
+        PickleIterator iter(*listener.messages_[i]);
+        int value, previous;
+        EXPECT_TRUE(listener.messages_[i]->ReadInt(&iter, &value));
+        PickleIterator previous_iter(*listener.messages_[i - 1]);
+        EXPECT_TRUE(listener.messages_[i - 1]->ReadInt(&previous_iter,
+                                                       &previous));
+        EXPECT_TRUE(value == previous || value == previous + 1);
+    }
+    ExpectMessage(*listener.messages_.back(), 19, payload);
+
+    // A message that outgrows its slot is copied in on commit.
+    IPC::Message* message = producer->BeginMessage(
+        2, 2, IPC::Message::PRIORITY_NORMAL, 8);
+    ASSERT_TRUE(message != NULL);
+    message->WriteInt(3);
+    message->WriteString(payload);
+    EXPECT_TRUE(producer->CommitMessage());
+    const char* data;
+    int size;
+    ASSERT_TRUE(consumer->PeekMessage(&data, &size));
+    ExpectMessage(IPC::Message(data, size), 3, payload);
+    consumer->PopMessage();
+    EXPECT_FALSE(consumer->is_broken());
+
+    delete consumer;
+    delete producer;
+}
+
+TEST(SharedRingTest, DetectsBrokenProducer) {
+    IPC::SharedRing* ring = IPC::SharedRing::Create(4096);
+    ASSERT_TRUE(ring != NULL);
+    IPC::Message message(1, 1, IPC::Message::PRIORITY_NORMAL);
+    message.WriteInt(1);
+    ASSERT_TRUE(ring->WriteMessage(message));
+
+    // Rewrites the payload size of the published message through a second
+    // mapping, as a misbehaving producer could.
+    IPC::SharedRing* other = IPC::SharedRing::Open(dup(ring->fd()));
+    ASSERT_TRUE(other != NULL);
+    const char* data;
+    int size;
+    ASSERT_TRUE(other->PeekMessage(&data, &size));
+    uint32 huge = 1u << 20;
+    memcpy(const_cast<char*>(data), &huge, sizeof(huge));
+    delete other;
+
+    EXPECT_FALSE(ring->PeekMessage(&data, &size));
+    EXPECT_TRUE(ring->is_broken());
+    delete ring;
+
+    // Only a ring opens as one.
+    EXPECT_TRUE(IPC::SharedRing::Open(dup(STDIN_FILENO)) == NULL);
+}
+
+TEST(SharedRingTest, ProducerAndConsumerThreads) {
+    IPC::SharedRing* producer = IPC::SharedRing::Create(16 * 1024);
+    ASSERT_TRUE(producer != NULL);
+    IPC::SharedRing* consumer = IPC::SharedRing::Open(dup(producer->fd()));
+    ASSERT_TRUE(consumer != NULL);
+
+    ProducerParams params = { producer, 100000 };
+    pthread_t thread;
+    ASSERT_EQ(0, pthread_create(&thread, NULL, &RunProducer, &params));
+
+    int expected = 0;
+    while (expected < params.count && consumer->WaitForMessage(5000)) {
+        const char* data;
+        int size;
+        while (consumer->PeekMessage(&data, &size)) {
+            IPC::Message message(data, size);
+            PickleIterator iter(message);
+            int value;
+            ASSERT_TRUE(message.ReadInt(&iter, &value));
+            ASSERT_EQ(expected, value);
+            ASSERT_EQ(sizeof(int) + (value % 97) * 8, message.payload_size());
+            consumer->PopMessage();
+            ++expected;
+        }
+    }
+    pthread_join(thread, NULL);
+    EXPECT_EQ(params.count, expected);
+    EXPECT_FALSE(consumer->is_broken());
+    delete consumer;
+    delete producer;
+}
@@ -9,7 +9,9 @@
 #include "ipc/ipc_message_macros.h"
 #include <gtest/gtest.h>
 #include <assert.h>
+#include <map>
 #include <string>
+#include <vector>
 using namespace base;
 using namespace std;
 using namespace IPC;
@@ -91,6 +93,13 @@ public:
         *out3 = false;
     }
 
+    void On_Views(const base::StringPiece& key,
+                  const IPC::ArrayView<char>& bytes, bool* out1) {
+        DCHECK(key == "key");
+        DCHECK(std::string(bytes.begin(), bytes.end()) == "bytes");
+        *out1 = !bytes.owns_data();
+    }
+
     bool Send(IPC::Message* message) {
         // gets the reply message, stash in global
         DCHECK(g_reply == NULL);
@@ -124,6 +133,7 @@ public:
             IPC_MESSAGE_HANDLER(Msg_R_3_1, On_3_1)
             IPC_MESSAGE_HANDLER(Msg_R_3_2, On_3_2)
             IPC_MESSAGE_HANDLER(Msg_R_3_3, On_3_3)
+            IPC_MESSAGE_HANDLER(Msg_C_Views, On_Views)
             IPC_END_MESSAGE_MAP()
             //չΪ
             /*
@@ -261,3 +271,605 @@ TEST(IPCSyncMessageTest, Main) {
     DCHECK(string1 == "3_3" && int1 == 33 && !bool1);
 }
 
+
+TEST(IPCSyncMessageTest, MoveAndAdopt) {
+    SyncMessage msg(0, SyncChannelTestMsg_NoArgs::ID,
+                    Message::PRIORITY_NORMAL, NULL);
+    EXPECT_TRUE(msg.WriteString(std::string(Pickle::kInlineCapacity, 'x')));
+    int id = SyncMessage::GetMessageId(msg);
+
+    SyncMessage moved(std::move(msg));
+    EXPECT_TRUE(moved.is_sync());
+    EXPECT_EQ(id, SyncMessage::GetMessageId(moved));
+    EXPECT_FALSE(msg.is_sync());
+
+    // Hand the bytes to a "transport" and rebuild the message on the other
+    // side without copying them.
+    Pickle::Buffer buffer = moved.ReleaseBuffer();
+    Message received(buffer);
+    EXPECT_EQ(buffer.data, received.data());
+    EXPECT_TRUE(received.is_sync());
+    EXPECT_EQ(static_cast<uint32>(SyncChannelTestMsg_NoArgs::ID),
+              received.type());
+    EXPECT_EQ(id, SyncMessage::GetMessageId(received));
+
+    Message assigned;
+    assigned = std::move(received);
+    EXPECT_EQ(buffer.data, assigned.data());
+    EXPECT_EQ(0u, received.payload_size());
+}
+
+TEST(IPCSyncMessageTest, SharedFanOut) {
+    Message original(1, 2, Message::PRIORITY_NORMAL);
+    EXPECT_TRUE(original.WriteString(std::string(Pickle::kInlineCapacity, 'x')));
+
+    // A received message only references the receive buffer.
+    std::vector<char> receive_buffer(
+        static_cast<const char*>(original.data()),
+        static_cast<const char*>(original.data()) + original.size());
+    Message received(&receive_buffer[0],
+                     static_cast<int>(receive_buffer.size()));
+    received.MakeShared();
+    receive_buffer.clear();
+
+    std::vector<Message> queues(3, received);
+    for (size_t i = 0; i < queues.size(); ++i) {
+        EXPECT_EQ(received.data(), queues[i].data());
+        EXPECT_EQ(1, queues[i].routing_id());
+    }
+
+    // A listener that modifies its copy gets a private one.
+    queues[0].set_routing_id(7);
+    EXPECT_NE(received.data(), queues[0].data());
+    EXPECT_EQ(7, queues[0].routing_id());
+    EXPECT_EQ(1, queues[1].routing_id());
+
+    PickleIterator iter(queues[2]);
+    std::string str;
+    EXPECT_TRUE(queues[2].ReadString(&iter, &str));
+    EXPECT_EQ(std::string(Pickle::kInlineCapacity, 'x'), str);
+}
+
+TEST(IPCSyncMessageTest, SharedCompact) {
+    Message msg(1, 2, Message::PRIORITY_NORMAL);
+    msg.set_compact();
+    EXPECT_TRUE(msg.WriteInt(300));
+    EXPECT_TRUE(msg.WriteBool(true));
+    EXPECT_TRUE(msg.WriteString(std::string(Pickle::kInlineCapacity, 'x')));
+    msg.MakeShared();
+    EXPECT_TRUE(msg.compact());
+    EXPECT_TRUE(msg.is_compact());
+
+    Message copy(msg);
+    EXPECT_EQ(msg.data(), copy.data());
+    PickleIterator iter(copy);
+    int outint;
+    bool outbool;
+    std::string outstr;
+    EXPECT_TRUE(copy.ReadInt(&iter, &outint));
+    EXPECT_EQ(300, outint);
+    EXPECT_TRUE(copy.ReadBool(&iter, &outbool));
+    EXPECT_TRUE(outbool);
+    EXPECT_TRUE(copy.ReadString(&iter, &outstr));
+    EXPECT_EQ(std::string(Pickle::kInlineCapacity, 'x'), outstr);
+}
+
+TEST(IPCSyncMessageTest, CompactParamTraits) {
+    std::vector<int> ints;
+    ints.push_back(1);
+    ints.push_back(-300);
+    ints.push_back(kint32max);
+    std::map<std::string, int> map;
+    map["one"] = 1;
+    map["two"] = 2;
+
+    Message msg(1, 2, Message::PRIORITY_NORMAL);
+    msg.set_compact();
+    IPC::WriteParam(&msg, true);
+    IPC::WriteParam(&msg, 42u);
+    IPC::WriteParam(&msg, kuint32max);
+    IPC::WriteParam(&msg, -5L);
+    IPC::WriteParam(&msg, -(1LL << 40));
+    IPC::WriteParam(&msg, 2.5);
+    IPC::WriteParam(&msg, std::wstring(L"wide"));
+    IPC::WriteParam(&msg, ints);
+    IPC::WriteParam(&msg, map);
+
+    // The receiver learns the encoding from the header.
+    Message received(static_cast<const char*>(msg.data()),
+                     static_cast<int>(msg.size()));
+    EXPECT_TRUE(received.is_compact());
+
+    PickleIterator iter(received);
+    bool b;
+    unsigned int u1, u2;
+    long l;
+    long long ll;
+    double d;
+    std::wstring ws;
+    std::vector<int> out_ints;
+    std::map<std::string, int> out_map;
+    EXPECT_TRUE(IPC::ReadParam(&received, &iter, &b));
+    EXPECT_TRUE(b);
+    EXPECT_TRUE(IPC::ReadParam(&received, &iter, &u1));
+    EXPECT_EQ(42u, u1);
+    EXPECT_TRUE(IPC::ReadParam(&received, &iter, &u2));
+    EXPECT_EQ(kuint32max, u2);
+    EXPECT_TRUE(IPC::ReadParam(&received, &iter, &l));
+    EXPECT_EQ(-5L, l);
+    EXPECT_TRUE(IPC::ReadParam(&received, &iter, &ll));
+    EXPECT_EQ(-(1LL << 40), ll);
+    EXPECT_TRUE(IPC::ReadParam(&received, &iter, &d));
+    EXPECT_EQ(2.5, d);
+    EXPECT_TRUE(IPC::ReadParam(&received, &iter, &ws));
+    EXPECT_EQ(L"wide", ws);
+    EXPECT_TRUE(IPC::ReadParam(&received, &iter, &out_ints));
+    EXPECT_EQ(ints, out_ints);
+    EXPECT_TRUE(IPC::ReadParam(&received, &iter, &out_map));
+    EXPECT_EQ(map, out_map);
+}
+
+TEST(IPCSyncMessageTest, CompactByDefault) {
+    Message::SetCompactByDefault(true);
+
+    bool bool1 = false;
+    int int1 = 0;
+    std::string string1;
+    IPC::SyncMessage* msg = new Msg_C_3_3(3, "3_3", true, &string1, &int1,
+                                          &bool1);
+    EXPECT_TRUE(msg->is_compact());
+    Send(msg);
+    EXPECT_EQ("3_3", string1);
+    EXPECT_EQ(33, int1);
+    EXPECT_FALSE(bool1);
+
+    Message::SetCompactByDefault(false);
+}
+
+namespace {
+
+// A type whose ParamTraits predate GetSize().
+struct Unsized {
+    int value;
+};
+
+}  // namespace
+
+namespace IPC {
+
+template <>
+struct ParamTraits<Unsized> {
+    typedef Unsized param_type;
+    static void Write(Message* m, const param_type& p) {
+        m->WriteInt(p.value);
+    }
+    static bool Read(const Message* m, PickleIterator* iter, param_type* r) {
+        return m->ReadInt(iter, &r->value);
+    }
+    static void Log(const param_type& p, std::string* l) {
+    }
+};
+
+}  // namespace IPC
+
+TEST(IPCSyncMessageTest, GetParamSize) {
+    DictionaryValue dict;
+    dict.SetInteger("int", -7);
+    dict.SetString("string", "value");
+    dict.SetBoolean("bool", true);
+    ListValue* list = new ListValue;
+    list->AppendDouble(1.5);
+    list->Append(Value::CreateNullValue());
+    list->Append(BinaryValue::CreateWithCopiedBuffer("\x01\x02\x03", 3));
+    dict.Set("list", list);
+
+    std::vector<std::string> strings;
+    strings.push_back("a");
+    strings.push_back("bcdef");
+    std::map<int, std::wstring> map;
+    map[1] = L"one";
+    map[300] = L"three hundred";
+    std::vector<bool> bools(11, true);
+    std::vector<char> bytes(5, 'x');
+    unsigned short us = 65000;
+
+    for (int compact = 0; compact < 2; ++compact) {
+        Message msg(1, 2, Message::PRIORITY_NORMAL);
+        if (compact)
+            msg.set_compact();
+        Tuple5<const DictionaryValue&, const std::vector<std::string>&,
+               const std::map<int, std::wstring>&, const std::vector<bool>&,
+               const std::vector<char>&> params(dict, strings, map, bools,
+                                                bytes);
+
+        PickleSizer sizer(msg.compact());
+        IPC::GetParamSize(&sizer, params);
+        IPC::GetParamSize(&sizer, us);
+        IPC::GetParamSize(&sizer, msg);
+        EXPECT_TRUE(sizer.known());
+
+        Message nested(msg);
+        IPC::WriteParam(&msg, params);
+        IPC::WriteParam(&msg, us);
+        IPC::WriteParam(&msg, nested);
+        EXPECT_EQ(msg.payload_size(), sizer.payload_size());
+    }
+
+    // Traits without GetSize() still serialize, the size is just unknown.
+    Unsized unsized = { 5 };
+    PickleSizer sizer(false);
+    IPC::GetParamSize(&sizer, 1);
+    IPC::GetParamSize(&sizer, unsized);
+    EXPECT_FALSE(sizer.known());
+    Message msg(1, 2, Message::PRIORITY_NORMAL);
+    IPC::ReserveParam(&msg, unsized);
+    IPC::WriteParam(&msg, unsized);
+    PickleIterator iter(msg);
+    Unsized out;
+    EXPECT_TRUE(IPC::ReadParam(&msg, &iter, &out));
+    EXPECT_EQ(5, out.value);
+}
+
+TEST(IPCSyncMessageTest, ArithmeticVectors) {
+    std::vector<double> doubles;
+    std::vector<int> ints;
+    std::vector<unsigned short> shorts;
+    for (int i = 0; i < 1000; ++i) {
+        doubles.push_back(i * 0.5);
+        ints.push_back(i * (i % 2 ? -7 : 7));
+        shorts.push_back(static_cast<unsigned short>(i * 61));
+    }
+
+    for (int compact = 0; compact < 2; ++compact) {
+        Message msg(1, 2, Message::PRIORITY_NORMAL);
+        if (compact)
+            msg.set_compact();
+        IPC::WriteParam(&msg, doubles);
+        IPC::WriteParam(&msg, ints);
+        IPC::WriteParam(&msg, shorts);
+
+        PickleSizer sizer(msg.compact());
+        IPC::GetParamSize(&sizer, doubles);
+        IPC::GetParamSize(&sizer, ints);
+        IPC::GetParamSize(&sizer, shorts);
+        EXPECT_EQ(msg.payload_size(), sizer.payload_size());
+
+        PickleIterator iter(msg);
+        std::vector<double> out_doubles;
+        std::vector<int> out_ints;
+        std::vector<unsigned short> out_shorts;
+        EXPECT_TRUE(IPC::ReadParam(&msg, &iter, &out_doubles));
+        EXPECT_TRUE(IPC::ReadParam(&msg, &iter, &out_ints));
+        EXPECT_TRUE(IPC::ReadParam(&msg, &iter, &out_shorts));
+        EXPECT_EQ(doubles, out_doubles);
+        EXPECT_EQ(ints, out_ints);
+        EXPECT_EQ(shorts, out_shorts);
+
+        // A truncated block is rejected as a whole.
+        Message truncated(1, 2, Message::PRIORITY_NORMAL);
+        if (compact)
+            truncated.set_compact();
+        truncated.WriteInt(static_cast<int>(doubles.size()));
+        truncated.WriteBytes(&doubles.front(), 100 * sizeof(double));
+        PickleIterator truncated_iter(truncated);
+        EXPECT_FALSE(IPC::ReadParam(&truncated, &truncated_iter,
+                                    &out_doubles));
+    }
+
+    // Outside compact mode 4- and 8-byte elements keep the layout of
+    // element-by-element writes.
+    Message block(1, 2, Message::PRIORITY_NORMAL);
+    IPC::WriteParam(&block, ints);
+    IPC::WriteParam(&block, doubles);
+    Message elements(1, 2, Message::PRIORITY_NORMAL);
+    elements.WriteInt(static_cast<int>(ints.size()));
+    for (size_t i = 0; i < ints.size(); ++i)
+        elements.WriteInt(ints[i]);
+    elements.WriteInt(static_cast<int>(doubles.size()));
+    for (size_t i = 0; i < doubles.size(); ++i)
+        IPC::WriteParam(&elements, doubles[i]);
+    ASSERT_EQ(elements.payload_size(), block.payload_size());
+    EXPECT_EQ(0, memcmp(elements.payload(), block.payload(),
+                        block.payload_size()));
+}
+
+TEST(IPCSyncMessageTest, ArrayView) {
+    double raw[] = { 1.0, 2.5, -3.25, 1e100 };
+    std::vector<int> ints(50, -9);
+
+    Message msg(1, 2, Message::PRIORITY_NORMAL);
+    IPC::WriteParam(&msg, IPC::ArrayView<double>(raw, arraysize(raw)));
+    IPC::WriteParam(&msg, IPC::ArrayView<int>(ints));
+
+    PickleIterator iter(msg);
+    std::vector<double> doubles;
+    IPC::ArrayView<int> int_view;
+    EXPECT_TRUE(IPC::ReadParam(&msg, &iter, &doubles));
+    EXPECT_EQ(std::vector<double>(raw, raw + arraysize(raw)), doubles);
+    EXPECT_TRUE(IPC::ReadParam(&msg, &iter, &int_view));
+    ASSERT_EQ(ints.size(), int_view.size());
+    EXPECT_TRUE(std::equal(int_view.begin(), int_view.end(), ints.begin()));
+    // Ints are always aligned, so the view reads the message in place.
+    EXPECT_FALSE(int_view.owns_data());
+    EXPECT_TRUE(reinterpret_cast<const char*>(int_view.data()) >
+                    msg.payload() &&
+                reinterpret_cast<const char*>(int_view.end()) <=
+                    msg.end_of_payload());
+
+    // Views of elements that are not stored as a block, or not aligned,
+    // hold their own copy.
+    Message compact(1, 2, Message::PRIORITY_NORMAL);
+    compact.set_compact();
+    IPC::WriteParam(&compact, true);
+    IPC::WriteParam(&compact, ints);
+    IPC::WriteParam(&compact, doubles);
+    PickleIterator compact_iter(compact);
+    bool b;
+    IPC::ArrayView<double> double_view;
+    EXPECT_TRUE(IPC::ReadParam(&compact, &compact_iter, &b));
+    EXPECT_TRUE(IPC::ReadParam(&compact, &compact_iter, &int_view));
+    EXPECT_TRUE(int_view.owns_data());
+    EXPECT_TRUE(std::equal(int_view.begin(), int_view.end(), ints.begin()));
+    EXPECT_TRUE(IPC::ReadParam(&compact, &compact_iter, &double_view));
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(double_view.data()) %
+                  ALIGNOF(double));
+    EXPECT_TRUE(std::equal(double_view.begin(), double_view.end(),
+                           doubles.begin()));
+
+    IPC::ArrayView<double> copy(double_view);
+    EXPECT_EQ(double_view.owns_data(), copy.owns_data());
+    EXPECT_TRUE(std::equal(copy.begin(), copy.end(), doubles.begin()));
+}
+
+TEST(IPCSyncMessageTest, StringPieceAndByteViews) {
+    Message msg(1, 2, Message::PRIORITY_NORMAL);
+    IPC::WriteParam(&msg, std::string("stored"));
+    IPC::WriteParam(&msg, base::StringPiece("piece"));
+    IPC::WriteParam(&msg, std::vector<char>(3, 'v'));
+    IPC::WriteParam(&msg, IPC::ArrayView<char>("span", 4));
+
+    PickleSizer sizer(false);
+    IPC::GetParamSize(&sizer, base::StringPiece("stored"));
+    IPC::GetParamSize(&sizer, std::string("piece"));
+    IPC::GetParamSize(&sizer, IPC::ArrayView<char>("vvv", 3));
+    IPC::GetParamSize(&sizer, std::vector<char>(4, 's'));
+    EXPECT_EQ(msg.payload_size(), sizer.payload_size());
+
+    // The two string types and the two byte types read each other's data.
+    PickleIterator iter(msg);
+    base::StringPiece piece;
+    std::string str;
+    IPC::ArrayView<char> span;
+    std::vector<char> bytes;
+    EXPECT_TRUE(IPC::ReadParam(&msg, &iter, &piece));
+    EXPECT_EQ("stored", piece.as_string());
+    EXPECT_TRUE(piece.data() > msg.payload() &&
+                piece.end() < msg.end_of_payload());
+    EXPECT_TRUE(IPC::ReadParam(&msg, &iter, &str));
+    EXPECT_EQ("piece", str);
+    EXPECT_TRUE(IPC::ReadParam(&msg, &iter, &span));
+    EXPECT_EQ("vvv", std::string(span.begin(), span.end()));
+    EXPECT_FALSE(span.owns_data());
+    EXPECT_TRUE(IPC::ReadParam(&msg, &iter, &bytes));
+    EXPECT_EQ("span", std::string(bytes.begin(), bytes.end()));
+
+    // Truncated strings are rejected.
+    Message truncated(1, 2, Message::PRIORITY_NORMAL);
+    truncated.WriteInt(100);
+    truncated.WriteInt(0);
+    PickleIterator truncated_iter(truncated);
+    EXPECT_FALSE(IPC::ReadParam(&truncated, &truncated_iter, &piece));
+
+    // Handlers can take views; they see the message's own bytes.
+    bool in_place = false;
+    IPC::SyncMessage* views = new Msg_C_Views(std::string("key"),
+                                              IPC::ArrayView<char>("bytes", 5),
+                                              &in_place);
+    Send(views);
+    EXPECT_TRUE(in_place);
+}
+
+TEST(IPCSyncMessageTest, ValidateThenReadUnchecked) {
+    typedef Tuple5<std::string, std::vector<double>, std::map<int, std::wstring>,
+                   std::vector<std::string>, Unsized> Params;
+    std::map<int, std::wstring> map;
+    map[1] = L"one";
+    map[-2] = L"minus two";
+    std::vector<std::string> strings(3, "str");
+    Unsized unsized = { 7 };
+    Params params("hello", std::vector<double>(5, 0.25), map, strings,
+                  unsized);
+
+    for (int compact = 0; compact < 2; ++compact) {
+        Message msg(1, 2, Message::PRIORITY_NORMAL);
+        if (compact)
+            msg.set_compact();
+        IPC::WriteParam(&msg, params);
+
+        PickleIterator iter(msg);
+        EXPECT_TRUE(IPC::ValidateParam<Params>(&msg, &iter));
+        EXPECT_FALSE(iter.SkipBytes(1));
+
+        PickleIterator unchecked(msg);
+        unchecked.set_checked(false);
+        Params out;
+        EXPECT_TRUE(IPC::ReadParam(&msg, &unchecked, &out));
+        EXPECT_EQ(params.a, out.a);
+        EXPECT_EQ(params.b, out.b);
+        EXPECT_EQ(params.c, out.c);
+        EXPECT_EQ(params.d, out.d);
+        EXPECT_EQ(7, out.e.value);
+
+        // Validation fails exactly where a checked read does.
+        for (size_t length = 0; length < msg.payload_size(); ++length) {
+            Message truncated(1, 2, Message::PRIORITY_NORMAL);
+            if (compact)
+                truncated.set_compact();
+            truncated.WriteBytes(msg.payload(), static_cast<int>(length));
+            PickleIterator validate_iter(truncated);
+            PickleIterator read_iter(truncated);
+            Params ignored;
+            EXPECT_EQ(IPC::ReadParam(&truncated, &read_iter, &ignored),
+                      IPC::ValidateParam<Params>(&truncated, &validate_iter));
+        }
+    }
+
+    // Negative lengths are rejected without reading further.
+    Message negative(1, 2, Message::PRIORITY_NORMAL);
+    negative.WriteInt(-1);
+    PickleIterator negative_iter(negative);
+    EXPECT_FALSE(IPC::ValidateParam<std::vector<int> >(&negative,
+                                                       &negative_iter));
+}
+
+TEST(IPCSyncMessageTest, DispatchValidated) {
+    bool in_place = false;
+    IPC::SyncMessage* msg = new Msg_C_Views(std::string("key"),
+                                            IPC::ArrayView<char>("bytes", 5),
+                                            &in_place);
+    EXPECT_TRUE(Msg_C_Views::Validate(msg));
+    IPC::MessageReplyDeserializer* deserializer = msg->GetReplyDeserializer();
+
+    TestMessageReceiver receiver;
+    EXPECT_TRUE(Msg_C_Views::DispatchValidated(msg, &receiver,
+                                               &TestMessageReceiver::On_Views));
+    ASSERT_TRUE(g_reply != NULL);
+    EXPECT_TRUE(deserializer->SerializeOutputParameters(*g_reply));
+    EXPECT_TRUE(in_place);
+    delete g_reply;
+    g_reply = NULL;
+    delete deserializer;
+
+    // A message cut short does not validate.
+    Message truncated(msg->routing_id(), msg->type(),
+                      Message::PRIORITY_NORMAL);
+    truncated.SetHeaderValues(msg->routing_id(), msg->type(), msg->flags());
+    truncated.WriteBytes(msg->payload(),
+                         static_cast<int>(msg->payload_size()) - 8);
+    delete msg;
+    EXPECT_FALSE(Msg_C_Views::Validate(&truncated));
+}
+
+TEST(IPCSyncMessageTest, FixedLayoutTuples) {
+    typedef Tuple5<int, bool, double, unsigned short, long long> Params;
+    // Copied to locals; gtest takes its arguments by reference.
+    bool fixed = IPC::FixedLayoutTraits<Params>::kFixed;
+    size_t size = IPC::FixedLayoutTraits<Params>::kSize;
+    EXPECT_TRUE(fixed);
+    EXPECT_EQ(4u + 4u + 8u + 4u + 8u, size);
+    fixed = IPC::FixedLayoutTraits<Tuple2<int, std::string> >::kFixed;
+    EXPECT_FALSE(fixed);
+    fixed = IPC::FixedLayoutTraits<Tuple2<const int&, bool&> >::kFixed;
+    EXPECT_TRUE(fixed);
+
+    Params params(-7, true, 2.5, 65535, -(1LL << 40));
+    Message msg(1, 2, Message::PRIORITY_NORMAL);
+    IPC::WriteParam(&msg, params);
+
+    // Same bytes as writing the fields one at a time.
+    Message fieldwise(1, 2, Message::PRIORITY_NORMAL);
+    IPC::WriteParam(&fieldwise, params.a);
+    IPC::WriteParam(&fieldwise, params.b);
+    IPC::WriteParam(&fieldwise, params.c);
+    IPC::WriteParam(&fieldwise, params.d);
+    IPC::WriteParam(&fieldwise, params.e);
+    ASSERT_EQ(fieldwise.payload_size(), msg.payload_size());
+    EXPECT_EQ(0, memcmp(fieldwise.payload(), msg.payload(),
+                        msg.payload_size()));
+
+    PickleSizer sizer(false);
+    IPC::GetParamSize(&sizer, params);
+    EXPECT_EQ(msg.payload_size(), sizer.payload_size());
+
+    PickleIterator iter(fieldwise);
+    Params out;
+    EXPECT_TRUE(IPC::ReadParam(&fieldwise, &iter, &out));
+    EXPECT_EQ(params.a, out.a);
+    EXPECT_EQ(params.b, out.b);
+    EXPECT_EQ(params.c, out.c);
+    EXPECT_EQ(params.d, out.d);
+    EXPECT_EQ(params.e, out.e);
+
+    Message truncated(1, 2, Message::PRIORITY_NORMAL);
+    truncated.WriteBytes(msg.payload(),
+                         static_cast<int>(msg.payload_size()) - 4);
+    PickleIterator read_iter(truncated);
+    PickleIterator validate_iter(truncated);
+    EXPECT_FALSE(IPC::ReadParam(&truncated, &read_iter, &out));
+    EXPECT_FALSE(IPC::ValidateParam<Params>(&truncated, &validate_iter));
+
+    // Compact messages keep the per-field encoding.
+    Message compact(1, 2, Message::PRIORITY_NORMAL);
+    compact.set_compact();
+    IPC::WriteParam(&compact, params);
+    EXPECT_LT(compact.payload_size(), msg.payload_size());
+    PickleIterator compact_iter(compact);
+    Params compact_out;
+    EXPECT_TRUE(IPC::ReadParam(&compact, &compact_iter, &compact_out));
+    EXPECT_EQ(params.c, compact_out.c);
+    EXPECT_EQ(params.e, compact_out.e);
+}
+
+namespace {
+
+class DeadlineReceiver {
+public:
+    DeadlineReceiver() : value(0) {}
+    void OnValue(int in) {
+        value = in;
+    }
+    int value;
+};
+
+}  // namespace
+
+TEST(IPCSyncMessageTest, Deadlines) {
+    typedef IPC::MessageWithTuple<Tuple1<int> > AsyncMsg;
+    int64 now = Message::DeadlineClockNow();
+
+    for (int compact = 0; compact < 2; ++compact) {
+        Message::SetCompactByDefault(compact != 0);
+        AsyncMsg fresh(MSG_ROUTING_CONTROL, 1, AsyncMsg::RefParam(5));
+        AsyncMsg stale(MSG_ROUTING_CONTROL, 1, AsyncMsg::RefParam(6));
+        Message::SetCompactByDefault(false);
+        EXPECT_FALSE(fresh.has_deadline());
+        EXPECT_FALSE(fresh.IsExpired());
+        fresh.set_deadline(now + 60 * 1000000LL);
+        stale.set_deadline(now - 1);
+        EXPECT_EQ(now + 60 * 1000000LL, fresh.deadline());
+        EXPECT_TRUE(stale.IsExpired());
+        EXPECT_FALSE(fresh.IsExpired());
+        EXPECT_TRUE(fresh.IsExpired(fresh.deadline()));
+
+#ifdef IPC_MESSAGE_LOG_ENABLED
+        fresh.set_sent_time(1234);
+        EXPECT_EQ(1234, fresh.sent_time());
+        EXPECT_EQ(now + 60 * 1000000LL, fresh.deadline());
+#endif
+
+        // The trailer does not disturb the parameters.
+        DeadlineReceiver receiver;
+        EXPECT_TRUE(AsyncMsg::Dispatch(&fresh, &receiver,
+                                       &DeadlineReceiver::OnValue));
+        EXPECT_EQ(5, receiver.value);
+        EXPECT_TRUE(AsyncMsg::Dispatch(&stale, &receiver,
+                                       &DeadlineReceiver::OnValue));
+        EXPECT_EQ(5, receiver.value);
+    }
+
+    // An expired synchronous message is answered with an error, without
+    // running the handler (which would check its input).
+    bool out = false;
+    IPC::SyncMessage* msg = new Msg_C_1_1(7, &out);
+    msg->set_deadline(now - 1);
+    delete msg->GetReplyDeserializer();
+    TestMessageReceiver receiver;
+    receiver.OnMessageReceived(*msg);
+    ASSERT_TRUE(g_reply != NULL);
+    EXPECT_TRUE(g_reply->is_reply_error());
+    EXPECT_TRUE(IPC::SyncMessage::IsMessageReplyTo(*g_reply,
+        IPC::SyncMessage::GetMessageId(*msg)));
+    delete g_reply;
+    g_reply = NULL;
+    delete msg;
+}
@@ -150,4 +150,9 @@ IPC_SYNC_MESSAGE_ROUTED3_2(Msg_R_3_2, std::string, bool, int, bool, int)
 IPC_SYNC_MESSAGE_ROUTED3_3(Msg_R_3_3, int, std::string, bool, std::string,
 int, bool)
 
+// in1 must be "key", in2 must be "bytes", out1 is true if both were read in
+// place.  The handler borrows its inputs from the message.
+IPC_SYNC_MESSAGE_CONTROL2_1(Msg_C_Views, base::StringPiece,
+IPC::ArrayView<char>, bool)
+
 IPC_END_MESSAGES(TestMsg)
@@ -0,0 +1,85 @@
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "base/lz_codec.h"
+#include <gtest/gtest.h>
+
+namespace {
+
+// Compresses |input|, checks that it decompresses back and returns the
+// compressed size.
+size_t RoundTrip(const std::string& input) {
+    std::vector<char> compressed(base::LzCompressBound(input.size()));
+    size_t size = base::LzCompress(input.data(), input.size(),
+                                   &compressed[0], compressed.size());
+    EXPECT_LT(0u, size);
+    std::string output(input.size(), '\0');
+    EXPECT_TRUE(base::LzDecompress(&compressed[0], size,
+                                   &output[0], output.size()));
+    EXPECT_EQ(input, output);
+    return size;
+}
+
+std::string RandomBytes(size_t length) {
+    std::string bytes(length, '\0');
+    for (size_t i = 0; i < length; ++i)
+        bytes[i] = static_cast<char>(rand());
+    return bytes;
+}
+
+}  // namespace
+
+TEST(LzCodecTest, RoundTrips) {
+    srand(7);
+    RoundTrip("");
+    RoundTrip("a");
+    RoundTrip("abcdefghijklm");
+    RoundTrip(std::string(100000, 'z'));
+    RoundTrip(RandomBytes(70000));
+    for (size_t length = 0; length < 300; ++length)
+        RoundTrip(RandomBytes(length % 7) + std::string(length, 'q'));
+
+    // Structured, repetitive data shrinks several times.
+    std::string records;
+    for (int i = 0; records.size() < 300000; ++i) {
+        records += "{\"id\": " + std::string(1, 'a' + i % 26) +
+                   ", \"name\": \"record\", \"enabled\": true}";
+    }
+    EXPECT_GT(records.size() / 5, RoundTrip(records));
+}
+
+TEST(LzCodecTest, GivesUpWhenOutputDoesNotFit) {
+    std::string random = RandomBytes(4096);
+    std::vector<char> output(random.size());
+    EXPECT_EQ(0u, base::LzCompress(random.data(), random.size(),
+                                   &output[0], output.size() - 1));
+}
+
+TEST(LzCodecTest, RejectsCorruptInput) {
+    std::string input;
+    for (int i = 0; i < 1000; ++i)
+        input += "pattern " + std::string(i % 10, '!');
+    std::vector<char> compressed(base::LzCompressBound(input.size()));
+    size_t size = base::LzCompress(input.data(), input.size(),
+                                   &compressed[0], compressed.size());
+    ASSERT_LT(0u, size);
+
+    std::string output(input.size(), '\0');
+    // Wrong sizes either way.
+    EXPECT_FALSE(base::LzDecompress(&compressed[0], size,
+                                    &output[0], output.size() - 1));
+    std::string longer(input.size() + 1, '\0');
+    EXPECT_FALSE(base::LzDecompress(&compressed[0], size,
+                                    &longer[0], longer.size()));
+    EXPECT_FALSE(base::LzDecompress(&compressed[0], size - 1,
+                                    &output[0], output.size()));
+
+    // Random damage must be caught or decode to something, never crash.
+    srand(11);
+    for (int i = 0; i < 2000; ++i) {
+        std::vector<char> damaged(compressed.begin(),
+                                  compressed.begin() + size);
+        damaged[rand() % size] ^= static_cast<char>(1 << (rand() % 8));
+        base::LzDecompress(&damaged[0], size, &output[0], output.size());
+    }
+}
@@ -0,0 +1,112 @@
+#include <string>
+#include "base/pickle.h"
+#include "base/pickle_allocator.h"
+#include "ipc/ipc_message.h"
+#include <gtest/gtest.h>
+
+namespace {
+
+// Counts the calls made through it and forwards to malloc().
+class CountingAllocator : public PickleAllocator {
+public:
+    CountingAllocator() : allocs(0), reallocs(0), frees(0) {}
+
+    virtual void* Allocate(size_t size) OVERRIDE {
+        ++allocs;
+        return malloc(size);
+    }
+    virtual void* Reallocate(void* ptr, size_t old_size,
+                             size_t new_size) OVERRIDE {
+        ++reallocs;
+        return realloc(ptr, new_size);
+    }
+    virtual void Free(void* ptr, size_t size) OVERRIDE {
+        ++frees;
+        free(ptr);
+    }
+
+    int allocs;
+    int reallocs;
+    int frees;
+};
+
+}  // namespace
+
+TEST(PickleAllocatorTest, CustomAllocatorIsUsedAfterSpill) {
+    CountingAllocator allocator;
+    {
+        Pickle pickle(sizeof(Pickle::Header), &allocator);
+        EXPECT_EQ(&allocator, pickle.allocator());
+        EXPECT_TRUE(pickle.WriteInt(1));
+        // Still inline.
+        EXPECT_EQ(0, allocator.allocs);
+
+        std::string big(Pickle::kInlineCapacity * 2, 'x');
+        EXPECT_TRUE(pickle.WriteString(big));
+        EXPECT_EQ(1, allocator.allocs);
+        EXPECT_TRUE(pickle.WriteString(big));
+        EXPECT_TRUE(pickle.WriteString(big));
+        EXPECT_LE(1, allocator.reallocs);
+
+        // Copies go to the default heap.
+        Pickle copy(pickle);
+        EXPECT_EQ(NULL, copy.allocator());
+        EXPECT_EQ(1, allocator.allocs);
+    }
+    EXPECT_EQ(1, allocator.frees);
+}
+
+TEST(PickleAllocatorTest, ArenaAllocatesAndResets) {
+    PickleArena arena(1024);
+    void* a = arena.Allocate(10);
+    void* b = arena.Allocate(20);
+    EXPECT_NE(a, b);
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(a) % 16);
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(b) % 16);
+    EXPECT_EQ(1u, arena.block_count());
+
+    // Growing the latest allocation happens in place.
+    memset(b, 'b', 20);
+    void* c = arena.Reallocate(b, 20, 200);
+    EXPECT_EQ(b, c);
+    EXPECT_EQ('b', static_cast<char*>(c)[19]);
+
+    // Growing an older one moves it and keeps its contents.
+    memset(a, 'a', 10);
+    void* d = arena.Reallocate(a, 10, 100);
+    EXPECT_NE(a, d);
+    EXPECT_EQ('a', static_cast<char*>(d)[9]);
+
+    // Oversized requests get their own block.
+    void* e = arena.Allocate(4096);
+    EXPECT_EQ(2u, arena.block_count());
+
+    arena.Free(c, 200);
+    arena.Free(d, 100);
+    arena.Free(e, 4096);
+    arena.Reset();
+    EXPECT_EQ(0u, arena.bytes_allocated());
+    EXPECT_EQ(1u, arena.block_count());
+}
+
+TEST(PickleAllocatorTest, MessagesFromArena) {
+    PickleArena arena;
+    std::string big(Pickle::kInlineCapacity * 4, 'x');
+    for (int batch = 0; batch < 3; ++batch) {
+        for (int i = 0; i < 10; ++i) {
+            IPC::Message msg(1, 2, IPC::Message::PRIORITY_NORMAL, &arena);
+            EXPECT_TRUE(msg.WriteInt(i));
+            EXPECT_TRUE(msg.WriteString(big));
+
+            PickleIterator iter(msg);
+            int value;
+            std::string str;
+            EXPECT_TRUE(msg.ReadInt(&iter, &value));
+            EXPECT_EQ(i, value);
+            EXPECT_TRUE(msg.ReadString(&iter, &str));
+            EXPECT_EQ(big, str);
+        }
+        arena.Reset();
+        EXPECT_EQ(1u, arena.block_count());
+    }
+}
@@ -0,0 +1,149 @@
+#include <string>
+#include <vector>
+#include "base/pickle.h"
+#include "base/pickle_buffer_pool.h"
+#include "ipc/ipc_message.h"
+#include <gtest/gtest.h>
+
+namespace {
+
+class PickleBufferPoolTest : public testing::Test {
+protected:
+    virtual void SetUp() {
+        pool_ = PickleBufferPool::GetInstance();
+        saved_limits_ = pool_->limits();
+        pool_->TrimCurrentThread();
+        pool_->GetStats(&start_);
+    }
+
+    virtual void TearDown() {
+        pool_->SetLimits(saved_limits_);
+        pool_->TrimCurrentThread();
+        Pickle::SetDefaultAllocator(NULL);
+    }
+
+    // Counters accumulated since SetUp().
+    PickleBufferPool::Stats Delta() {
+        PickleBufferPool::Stats now;
+        pool_->GetStats(&now);
+        now.hits -= start_.hits;
+        now.misses -= start_.misses;
+        now.unpooled -= start_.unpooled;
+        now.recycled -= start_.recycled;
+        now.released -= start_.released;
+        return now;
+    }
+
+    PickleBufferPool* pool_;
+    PickleBufferPool::Limits saved_limits_;
+    PickleBufferPool::Stats start_;
+};
+
+// Forwards to |pool| and remembers every size asked for.
+class RecordingAllocator : public PickleAllocator {
+public:
+    explicit RecordingAllocator(PickleAllocator* pool) : pool_(pool) {}
+
+    virtual void* Allocate(size_t size) OVERRIDE {
+        sizes.push_back(size);
+        return pool_->Allocate(size);
+    }
+    virtual void* Reallocate(void* ptr, size_t old_size,
+                             size_t new_size) OVERRIDE {
+        sizes.push_back(new_size);
+        return pool_->Reallocate(ptr, old_size, new_size);
+    }
+    virtual void Free(void* ptr, size_t size) OVERRIDE {
+        sizes.push_back(size);
+        pool_->Free(ptr, size);
+    }
+
+    std::vector<size_t> sizes;
+
+private:
+    PickleAllocator* pool_;
+};
+
+}  // namespace
+
+TEST_F(PickleBufferPoolTest, RecyclesSameSizeClass) {
+    void* a = pool_->Allocate(100);
+    pool_->Free(a, 100);
+    // 100 and 128 bytes share a size class.
+    void* b = pool_->Allocate(128);
+    EXPECT_EQ(a, b);
+    pool_->Free(b, 128);
+
+    PickleBufferPool::Stats stats = Delta();
+    EXPECT_EQ(1u, stats.misses);
+    EXPECT_EQ(1u, stats.hits);
+    EXPECT_EQ(2u, stats.recycled);
+    EXPECT_EQ(1u, stats.cached_buffers);
+    EXPECT_EQ(128u, stats.cached_bytes);
+}
+
+TEST_F(PickleBufferPoolTest, HonorsLimits) {
+    PickleBufferPool::Limits limits;
+    limits.max_buffer_size = 1024;
+    limits.max_buffers_per_class = 2;
+    pool_->SetLimits(limits);
+
+    void* big = pool_->Allocate(4096);
+    pool_->Free(big, 4096);
+
+    void* small[3];
+    for (int i = 0; i < 3; ++i)
+        small[i] = pool_->Allocate(64);
+    for (int i = 0; i < 3; ++i)
+        pool_->Free(small[i], 64);
+
+    PickleBufferPool::Stats stats = Delta();
+    EXPECT_EQ(2u, stats.released);
+    EXPECT_EQ(2u, stats.recycled);
+    EXPECT_EQ(2u, stats.cached_buffers);
+
+    // Buffers beyond kMaxPooledSize bypass the free lists entirely.
+    void* huge = pool_->Allocate(PickleBufferPool::kMaxPooledSize + 1);
+    pool_->Free(huge, PickleBufferPool::kMaxPooledSize + 1);
+    EXPECT_EQ(1u, Delta().unpooled);
+}
+
+TEST_F(PickleBufferPoolTest, ReallocatePreservesContents) {
+    char* p = static_cast<char*>(pool_->Allocate(64));
+    memset(p, 'p', 64);
+    // Same class: stays in place.
+    EXPECT_EQ(p, pool_->Reallocate(p, 64, 60));
+    char* q = static_cast<char*>(pool_->Reallocate(p, 64, 1000));
+    EXPECT_EQ('p', q[0]);
+    EXPECT_EQ('p', q[63]);
+    pool_->Free(q, 1000);
+}
+
+TEST_F(PickleBufferPoolTest, MessagesReuseBuffers) {
+    Pickle::SetDefaultAllocator(pool_);
+    std::string payload(1000, 'x');
+    for (int i = 0; i < 100; ++i) {
+        IPC::Message msg(1, 2, IPC::Message::PRIORITY_NORMAL);
+        EXPECT_EQ(pool_, msg.allocator());
+        EXPECT_TRUE(msg.WriteString(payload));
+    }
+
+    // Every message after the first one is built from recycled buffers.
+    PickleBufferPool::Stats stats = Delta();
+    EXPECT_GE(stats.hits, 99u);
+    EXPECT_LE(stats.misses, 2u);
+}
+
+TEST_F(PickleBufferPoolTest, PickleBuffersFillWholeClasses) {
+    // Header plus payload is rounded as a whole, so no request leaves most
+    // of a class unused.
+    RecordingAllocator allocator(pool_);
+    {
+        IPC::Message msg(1, 2, IPC::Message::PRIORITY_NORMAL, &allocator);
+        for (int i = 0; i < 20; ++i)
+            EXPECT_TRUE(msg.WriteString(std::string(100, 'x')));
+    }
+    ASSERT_LT(2u, allocator.sizes.size());
+    for (size_t i = 0; i < allocator.sizes.size(); ++i)
+        EXPECT_EQ(0u, allocator.sizes[i] % 64) << allocator.sizes[i];
+}
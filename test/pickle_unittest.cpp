@@ -0,0 +1,558 @@
+#include <stdlib.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include "base/pickle.h"
+#include <gtest/gtest.h>
+
+namespace {
+
+const int testint = 2093847192;
+const std::string teststr("Hello world");  // note non-aligned string length
+const char testdata[] = "AAA\0BBB\0";
+const int testdatalen = arraysize(testdata) - 1;
+const bool testbool1 = false;
+const bool testbool2 = true;
+const uint16 testuint16 = 32123;
+const float testfloat = 3.1415926935f;
+const double testdouble = 2.71828182845904523;
+
+// Returns true if |pickle| keeps its header and payload inside the object.
+bool IsInline(const Pickle& pickle) {
+    const char* data = static_cast<const char*>(pickle.data());
+    const char* object = reinterpret_cast<const char*>(&pickle);
+    return data >= object && data < object + sizeof(pickle);
+}
+
+// checks that the result
+void VerifyResult(const Pickle& pickle) {
+    PickleIterator iter(pickle);
+
+    int outint;
+    EXPECT_TRUE(pickle.ReadInt(&iter, &outint));
+    EXPECT_EQ(testint, outint);
+
+    std::string outstr;
+    EXPECT_TRUE(pickle.ReadString(&iter, &outstr));
+    EXPECT_EQ(teststr, outstr);
+
+    bool outbool;
+    EXPECT_TRUE(pickle.ReadBool(&iter, &outbool));
+    EXPECT_FALSE(outbool);
+    EXPECT_TRUE(pickle.ReadBool(&iter, &outbool));
+    EXPECT_TRUE(outbool);
+
+    uint16 outuint16;
+    EXPECT_TRUE(pickle.ReadUInt16(&iter, &outuint16));
+    EXPECT_EQ(testuint16, outuint16);
+
+    float outfloat;
+    EXPECT_TRUE(pickle.ReadFloat(&iter, &outfloat));
+    EXPECT_EQ(testfloat, outfloat);
+
+    double outdouble;
+    EXPECT_TRUE(pickle.ReadDouble(&iter, &outdouble));
+    EXPECT_EQ(testdouble, outdouble);
+
+    const char* outdata;
+    int outdatalen;
+    EXPECT_TRUE(pickle.ReadData(&iter, &outdata, &outdatalen));
+    EXPECT_EQ(testdatalen, outdatalen);
+    EXPECT_EQ(memcmp(testdata, outdata, outdatalen), 0);
+
+    // reads past the end should fail
+    EXPECT_FALSE(pickle.ReadInt(&iter, &outint));
+}
+
+void WriteTestValues(Pickle* pickle) {
+    EXPECT_TRUE(pickle->WriteInt(testint));
+    EXPECT_TRUE(pickle->WriteString(teststr));
+    EXPECT_TRUE(pickle->WriteBool(testbool1));
+    EXPECT_TRUE(pickle->WriteBool(testbool2));
+    EXPECT_TRUE(pickle->WriteUInt16(testuint16));
+    EXPECT_TRUE(pickle->WriteFloat(testfloat));
+    EXPECT_TRUE(pickle->WriteDouble(testdouble));
+    EXPECT_TRUE(pickle->WriteData(testdata, testdatalen));
+}
+
+}  // namespace
+
+TEST(PickleTest, EncodeDecode) {
+    Pickle pickle;
+    WriteTestValues(&pickle);
+    VerifyResult(pickle);
+
+    // test copy constructor
+    Pickle pickle2(pickle);
+    VerifyResult(pickle2);
+
+    // test operator=
+    Pickle pickle3;
+    pickle3 = pickle;
+    VerifyResult(pickle3);
+
+    // test a read-only view of the data
+    Pickle pickle4(static_cast<const char*>(pickle.data()),
+                   static_cast<int>(pickle.size()));
+    VerifyResult(pickle4);
+}
+
+TEST(PickleTest, SmallPickleStaysInline) {
+    Pickle pickle;
+    EXPECT_TRUE(IsInline(pickle));
+    WriteTestValues(&pickle);
+    ASSERT_LE(pickle.size(), Pickle::kInlineCapacity);
+    EXPECT_TRUE(IsInline(pickle));
+
+    Pickle copy(pickle);
+    EXPECT_TRUE(IsInline(copy));
+    VerifyResult(copy);
+}
+
+TEST(PickleTest, LargePickleSpillsToHeap) {
+    Pickle pickle;
+    WriteTestValues(&pickle);
+
+    std::string big(Pickle::kInlineCapacity * 3, 'x');
+    EXPECT_TRUE(pickle.WriteString(big));
+    EXPECT_FALSE(IsInline(pickle));
+
+    // The values written before the spill must have been carried over.
+    PickleIterator iter(pickle);
+    int outint;
+    EXPECT_TRUE(pickle.ReadInt(&iter, &outint));
+    EXPECT_EQ(testint, outint);
+
+    Pickle copy(pickle);
+    EXPECT_FALSE(IsInline(copy));
+    EXPECT_EQ(pickle.size(), copy.size());
+    EXPECT_EQ(0, memcmp(pickle.data(), copy.data(), pickle.size()));
+
+    // Assigning a small pickle over a spilled one keeps working.
+    Pickle small;
+    WriteTestValues(&small);
+    copy = small;
+    VerifyResult(copy);
+}
+
+TEST(PickleTest, LargeHeaderSize) {
+    // A header that leaves no room for payload in the inline buffer must go
+    // straight to the heap.
+    Pickle pickle(static_cast<int>(Pickle::kInlineCapacity));
+    EXPECT_FALSE(IsInline(pickle));
+    WriteTestValues(&pickle);
+    VerifyResult(pickle);
+}
+
+TEST(PickleTest, Reserve) {
+    Pickle pickle;
+    pickle.Reserve(Pickle::kInlineCapacity * 4);
+    EXPECT_FALSE(IsInline(pickle));
+    WriteTestValues(&pickle);
+    VerifyResult(pickle);
+}
+
+namespace {
+
+// A BufferDeleter that counts its calls in |context| and frees |data|.
+void CountingDeleter(void* data, void* context) {
+    ++*static_cast<int*>(context);
+    free(data);
+}
+
+}  // namespace
+
+TEST(PickleTest, MoveConstructAndAssign) {
+    // Inline pickle.
+    Pickle small;
+    WriteTestValues(&small);
+    Pickle moved_small(std::move(small));
+    EXPECT_TRUE(IsInline(moved_small));
+    VerifyResult(moved_small);
+    EXPECT_EQ(0u, small.payload_size());
+
+    // Heap pickle: the buffer changes hands without a copy.
+    Pickle big;
+    WriteTestValues(&big);
+    EXPECT_TRUE(big.WriteString(std::string(Pickle::kInlineCapacity * 2, 'x')));
+    const void* data = big.data();
+    Pickle moved_big(std::move(big));
+    EXPECT_EQ(data, moved_big.data());
+    EXPECT_EQ(0u, big.payload_size());
+
+    // The moved-from pickles are still usable.
+    WriteTestValues(&big);
+    VerifyResult(big);
+
+    Pickle assigned;
+    assigned = std::move(moved_big);
+    EXPECT_EQ(data, assigned.data());
+    assigned = std::move(moved_small);
+    VerifyResult(assigned);
+
+    Pickle other;
+    other.Swap(&assigned);
+    VerifyResult(other);
+    EXPECT_EQ(0u, assigned.payload_size());
+}
+
+TEST(PickleTest, ReleaseAndAdoptBuffer) {
+    Pickle pickle;
+    pickle.Reserve(Pickle::kInlineCapacity * 2);
+    WriteTestValues(&pickle);
+    const void* data = pickle.data();
+    size_t size = pickle.size();
+
+    Pickle::Buffer buffer = pickle.ReleaseBuffer();
+    EXPECT_EQ(data, buffer.data);
+    EXPECT_EQ(size, buffer.size);
+    EXPECT_LE(size, buffer.capacity);
+    EXPECT_EQ(0u, pickle.payload_size());
+
+    Pickle adopted(buffer);
+    EXPECT_EQ(data, adopted.data());
+    VerifyResult(adopted);
+
+    // An inline pickle hands out a copy.
+    Pickle small;
+    WriteTestValues(&small);
+    buffer = small.ReleaseBuffer();
+    EXPECT_NE(small.data(), buffer.data);
+    Pickle small_adopted(buffer);
+    VerifyResult(small_adopted);
+
+    // Garbage is refused, and the buffer is disposed of.
+    int deletes = 0;
+    buffer = Pickle::Buffer();
+    buffer.data = static_cast<char*>(malloc(3));
+    buffer.size = buffer.capacity = 3;
+    buffer.deleter = &CountingDeleter;
+    buffer.deleter_context = &deletes;
+    Pickle invalid(buffer);
+    EXPECT_EQ(1, deletes);
+    EXPECT_EQ(NULL, invalid.data());
+}
+
+TEST(PickleTest, AdoptBufferWithDeleter) {
+    Pickle source;
+    WriteTestValues(&source);
+
+    int deletes = 0;
+    Pickle::Buffer buffer;
+    buffer.size = source.size();
+    buffer.capacity = source.size() + 16;
+    buffer.data = static_cast<char*>(malloc(buffer.capacity));
+    memcpy(buffer.data, source.data(), source.size());
+    buffer.deleter = &CountingDeleter;
+    buffer.deleter_context = &deletes;
+
+    {
+        Pickle pickle(buffer);
+        VerifyResult(pickle);
+
+        // Small appends stay in the adopted buffer.
+        EXPECT_TRUE(pickle.WriteInt(1));
+        EXPECT_EQ(buffer.data, pickle.data());
+
+        // Outgrowing it moves the data and disposes of the buffer.
+        EXPECT_TRUE(pickle.WriteString(std::string(256, 'x')));
+        EXPECT_NE(buffer.data, pickle.data());
+        EXPECT_EQ(1, deletes);
+
+        PickleIterator iter(pickle);
+        int outint;
+        EXPECT_TRUE(pickle.ReadInt(&iter, &outint));
+        EXPECT_EQ(testint, outint);
+    }
+    EXPECT_EQ(1, deletes);
+
+    // Without growth the deleter runs on destruction, or travels on with
+    // ReleaseBuffer().
+    buffer.data = static_cast<char*>(malloc(buffer.capacity));
+    memcpy(buffer.data, source.data(), source.size());
+    {
+        Pickle pickle(buffer);
+        Pickle::Buffer released = pickle.ReleaseBuffer();
+        EXPECT_EQ(buffer.data, released.data);
+        EXPECT_EQ(&CountingDeleter, released.deleter);
+        Pickle::FreeBuffer(released);
+    }
+    EXPECT_EQ(2, deletes);
+}
+
+TEST(PickleTest, SharedCopyOnWrite) {
+    Pickle pickle;
+    pickle.Reserve(Pickle::kInlineCapacity * 2);
+    WriteTestValues(&pickle);
+    const void* data = pickle.data();
+
+    // A heap buffer is shared as is.
+    pickle.MakeShared();
+    EXPECT_TRUE(pickle.is_shared());
+    EXPECT_EQ(data, pickle.data());
+    VerifyResult(pickle);
+
+    Pickle copy1(pickle);
+    Pickle copy2;
+    copy2 = pickle;
+    EXPECT_TRUE(copy1.is_shared());
+    EXPECT_EQ(data, copy1.data());
+    EXPECT_EQ(data, copy2.data());
+
+    // Writing to one copy leaves the others alone.
+    EXPECT_TRUE(copy1.WriteInt(1));
+    EXPECT_FALSE(copy1.is_shared());
+    EXPECT_NE(data, copy1.data());
+    EXPECT_EQ(pickle.size() + sizeof(int), copy1.size());
+    VerifyResult(pickle);
+    VerifyResult(copy2);
+
+    // The last reference takes the buffer back without copying.
+    copy2 = Pickle();
+    EXPECT_TRUE(pickle.WriteInt(2));
+    EXPECT_FALSE(pickle.is_shared());
+    EXPECT_EQ(data, pickle.data());
+
+    // A read-only view is copied once, then shared.
+    Pickle view(static_cast<const char*>(copy1.data()),
+                static_cast<int>(copy1.size()));
+    view.MakeShared();
+    EXPECT_NE(copy1.data(), view.data());
+    Pickle view_copy(view);
+    EXPECT_EQ(view.data(), view_copy.data());
+    EXPECT_EQ(copy1.size(), view_copy.size());
+}
+
+TEST(PickleTest, ScatterGather) {
+    std::string blob1(1001, 'a');  // note non-aligned length
+    std::string blob2(4096, 'b');
+
+    Pickle pickle;
+    pickle.EnableScatterGather(1000);
+    EXPECT_TRUE(pickle.WriteInt(testint));
+    EXPECT_TRUE(pickle.WriteData(blob1.data(), static_cast<int>(blob1.size())));
+    EXPECT_TRUE(pickle.WriteData(testdata, testdatalen));
+    EXPECT_TRUE(pickle.WriteData(blob2.data(), static_cast<int>(blob2.size())));
+    EXPECT_TRUE(pickle.WriteString(teststr));
+    EXPECT_TRUE(pickle.has_references());
+
+    std::vector<Pickle::Segment> segments;
+    pickle.GetSegments(&segments);
+    EXPECT_EQ(6u, segments.size());
+    // Only the small fields went into the (inline) buffer.
+    const char* object = reinterpret_cast<const char*>(&pickle);
+    EXPECT_TRUE(segments[0].data >= object &&
+                segments[0].data < object + sizeof(pickle));
+    EXPECT_EQ(blob1.data(), segments[1].data);
+    EXPECT_EQ(3u, segments[2].size);  // padding
+    EXPECT_EQ(blob2.data(), segments[4].data);
+    std::string gathered;
+    for (size_t i = 0; i < segments.size(); ++i)
+        gathered.append(segments[i].data, segments[i].size);
+    EXPECT_EQ(pickle.size(), gathered.size());
+
+    // Reading flattens the pickle into the same bytes.
+    PickleIterator iter(pickle);
+    EXPECT_FALSE(pickle.has_references());
+    EXPECT_EQ(gathered, std::string(static_cast<const char*>(pickle.data()),
+                                    pickle.size()));
+
+    int outint;
+    const char* outdata;
+    int outdatalen;
+    std::string outstr;
+    EXPECT_TRUE(pickle.ReadInt(&iter, &outint));
+    EXPECT_EQ(testint, outint);
+    EXPECT_TRUE(pickle.ReadData(&iter, &outdata, &outdatalen));
+    EXPECT_EQ(blob1, std::string(outdata, outdatalen));
+    EXPECT_TRUE(pickle.ReadData(&iter, &outdata, &outdatalen));
+    EXPECT_EQ(testdatalen, outdatalen);
+    EXPECT_TRUE(pickle.ReadData(&iter, &outdata, &outdatalen));
+    EXPECT_EQ(blob2, std::string(outdata, outdatalen));
+    EXPECT_TRUE(pickle.ReadString(&iter, &outstr));
+    EXPECT_EQ(teststr, outstr);
+
+    // Copies are contiguous.
+    Pickle referencing;
+    referencing.EnableScatterGather(1000);
+    EXPECT_TRUE(referencing.WriteData(blob2.data(),
+                                      static_cast<int>(blob2.size())));
+    Pickle copy(referencing);
+    PickleIterator copy_iter(copy);
+    EXPECT_TRUE(copy.ReadData(&copy_iter, &outdata, &outdatalen));
+    EXPECT_EQ(blob2, std::string(outdata, outdatalen));
+}
+
+TEST(PickleTest, ScatterGatherCopyAppends) {
+    std::string blob(4096, 'b');
+
+    Pickle referencing;
+    referencing.EnableScatterGather(1000);
+    EXPECT_TRUE(referencing.WriteInt(testint));
+    EXPECT_TRUE(referencing.WriteData(blob.data(),
+                                      static_cast<int>(blob.size())));
+    EXPECT_TRUE(referencing.has_references());
+
+    // The copy's write offset must cover the flattened blob, so further
+    // writes land after it rather than on top of it.
+    Pickle copy(referencing);
+    EXPECT_EQ(referencing.size(), copy.size());
+    EXPECT_TRUE(copy.WriteString(teststr));
+
+    PickleIterator iter(copy);
+    int outint;
+    const char* outdata;
+    int outdatalen;
+    std::string outstr;
+    EXPECT_TRUE(copy.ReadInt(&iter, &outint));
+    EXPECT_EQ(testint, outint);
+    EXPECT_TRUE(copy.ReadData(&iter, &outdata, &outdatalen));
+    EXPECT_EQ(blob, std::string(outdata, outdatalen));
+    EXPECT_TRUE(copy.ReadString(&iter, &outstr));
+    EXPECT_EQ(teststr, outstr);
+}
+
+TEST(PickleTest, CompactEncoding) {
+    Pickle pickle;
+    pickle.set_compact(true);
+    WriteTestValues(&pickle);
+    VerifyResult(pickle);
+
+    Pickle fixed;
+    WriteTestValues(&fixed);
+    EXPECT_LT(pickle.payload_size(), fixed.payload_size());
+
+    // Extremes of every integer type survive the round trip.
+    Pickle ints;
+    ints.set_compact(true);
+    EXPECT_TRUE(ints.WriteInt(kint32min));
+    EXPECT_TRUE(ints.WriteInt(kint32max));
+    EXPECT_TRUE(ints.WriteUInt16(kuint16max));
+    EXPECT_TRUE(ints.WriteUInt32(kuint32max));
+    EXPECT_TRUE(ints.WriteInt64(kint64min));
+    EXPECT_TRUE(ints.WriteUInt64(kuint64max));
+    EXPECT_TRUE(ints.WriteInt(-100000));
+
+    // A reader of the raw bytes has to be told about the encoding.
+    Pickle view(static_cast<const char*>(ints.data()),
+                static_cast<int>(ints.size()));
+    view.set_compact(true);
+    PickleIterator iter(view);
+    int outint;
+    uint16 outuint16;
+    uint32 outuint32;
+    int64 outint64;
+    uint64 outuint64;
+    EXPECT_TRUE(iter.ReadInt(&outint));
+    EXPECT_EQ(kint32min, outint);
+    EXPECT_TRUE(iter.ReadInt(&outint));
+    EXPECT_EQ(kint32max, outint);
+    EXPECT_TRUE(iter.ReadUInt16(&outuint16));
+    EXPECT_EQ(kuint16max, outuint16);
+    EXPECT_TRUE(iter.ReadUInt32(&outuint32));
+    EXPECT_EQ(kuint32max, outuint32);
+    EXPECT_TRUE(iter.ReadInt64(&outint64));
+    EXPECT_EQ(kint64min, outint64);
+    EXPECT_TRUE(iter.ReadUInt64(&outuint64));
+    EXPECT_EQ(kuint64max, outuint64);
+    // A value that does not fit the requested type is an error.
+    EXPECT_FALSE(iter.ReadUInt16(&outuint16));
+}
+
+TEST(PickleTest, CompactBoolsArePacked) {
+    Pickle pickle;
+    pickle.set_compact(true);
+    for (int i = 0; i < 20; ++i) {
+        EXPECT_TRUE(pickle.WriteBool(i % 3 == 0));
+        EXPECT_TRUE(pickle.WriteInt(i));
+    }
+    // 3 bytes of packed booleans plus 20 one-byte ints.
+    EXPECT_EQ(23u, pickle.payload_size());
+
+    PickleIterator iter(pickle);
+    for (int i = 0; i < 20; ++i) {
+        bool outbool;
+        int outint;
+        EXPECT_TRUE(iter.ReadBool(&outbool));
+        EXPECT_EQ(i % 3 == 0, outbool);
+        EXPECT_TRUE(iter.ReadInt(&outint));
+        EXPECT_EQ(i, outint);
+    }
+
+    // Packing carries on correctly past referenced blobs.
+    std::string blob(64, 'x');
+    Pickle segmented;
+    segmented.set_compact(true);
+    segmented.EnableScatterGather(32);
+    EXPECT_TRUE(segmented.WriteBool(false));
+    EXPECT_TRUE(segmented.WriteData(blob.data(),
+                                    static_cast<int>(blob.size())));
+    segmented.Flatten();
+    EXPECT_TRUE(segmented.WriteBool(true));
+    PickleIterator segmented_iter(segmented);
+    bool outbool;
+    const char* outdata;
+    int outdatalen;
+    EXPECT_TRUE(segmented_iter.ReadBool(&outbool));
+    EXPECT_FALSE(outbool);
+    EXPECT_TRUE(segmented_iter.ReadData(&outdata, &outdatalen));
+    EXPECT_EQ(blob, std::string(outdata, outdatalen));
+    EXPECT_TRUE(segmented_iter.ReadBool(&outbool));
+    EXPECT_TRUE(outbool);
+}
+
+TEST(PickleTest, SizerMatchesWrites) {
+    std::wstring wide(L"wide");
+    for (int compact = 0; compact < 2; ++compact) {
+        Pickle pickle;
+        pickle.set_compact(!!compact);
+        PickleSizer sizer(!!compact);
+        for (int i = 0; i < 10; ++i) {
+            EXPECT_TRUE(pickle.WriteBool(i % 2 == 0));
+            sizer.AddBool(i % 2 == 0);
+        }
+        EXPECT_TRUE(pickle.WriteInt(-testint));
+        sizer.AddInt(-testint);
+        EXPECT_TRUE(pickle.WriteLongUsingDangerousNonPortableLessPersistableForm(
+            1L << 20));
+        sizer.AddLongUsingDangerousNonPortableLessPersistableForm(1L << 20);
+        EXPECT_TRUE(pickle.WriteUInt16(testuint16));
+        sizer.AddUInt16(testuint16);
+        EXPECT_TRUE(pickle.WriteUInt32(kuint32max));
+        sizer.AddUInt32(kuint32max);
+        EXPECT_TRUE(pickle.WriteInt64(kint64min));
+        sizer.AddInt64(kint64min);
+        EXPECT_TRUE(pickle.WriteUInt64(127));
+        sizer.AddUInt64(127);
+        EXPECT_TRUE(pickle.WriteFloat(testfloat));
+        sizer.AddFloat(testfloat);
+        EXPECT_TRUE(pickle.WriteDouble(testdouble));
+        sizer.AddDouble(testdouble);
+        EXPECT_TRUE(pickle.WriteString(teststr));
+        sizer.AddString(teststr);
+        EXPECT_TRUE(pickle.WriteWString(wide));
+        sizer.AddWString(wide);
+        EXPECT_TRUE(pickle.WriteData(testdata, testdatalen));
+        sizer.AddData(testdatalen);
+        EXPECT_TRUE(pickle.WriteBytes(testdata, 3));
+        sizer.AddBytes(3);
+
+        EXPECT_TRUE(sizer.known());
+        EXPECT_EQ(pickle.payload_size(), sizer.payload_size());
+    }
+}
+
+TEST(PickleTest, ReserveExact) {
+    std::string big(Pickle::kInlineCapacity * 3, 'x');
+    PickleSizer sizer(false);
+    sizer.AddString(big);
+    sizer.AddInt(testint);
+
+    Pickle pickle;
+    pickle.ReserveExact(sizer.payload_size());
+    const void* buffer = pickle.data();
+    EXPECT_TRUE(pickle.WriteString(big));
+    EXPECT_TRUE(pickle.WriteInt(testint));
+    EXPECT_EQ(buffer, pickle.data());
+    EXPECT_EQ(sizer.payload_size(), pickle.payload_size());
+}